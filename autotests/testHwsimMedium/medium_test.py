@@ -0,0 +1,148 @@
+#!/usr/bin/python3
+
+import unittest
+import sys
+import time
+import dbus
+
+sys.path.append('../util')
+import iwd
+from iwd import IWD
+
+HWSIM_SERVICE = 'net.connman.hwsim'
+HWSIM_RADIO_INTERFACE = 'net.connman.hwsim.Radio'
+HWSIM_RULE_INTERFACE = 'net.connman.hwsim.Rule'
+HWSIM_RULE_MANAGER_INTERFACE = 'net.connman.hwsim.RuleManager'
+
+class Radio(object):
+    '''
+        Drives the medium model methods of a net.connman.hwsim.Radio
+        object directly over D-Bus.
+    '''
+    _bus = dbus.SystemBus()
+
+    def __init__(self, name):
+        manager = dbus.Interface(self._bus.get_object(HWSIM_SERVICE, '/'),
+                                    'org.freedesktop.DBus.ObjectManager')
+
+        for path, interfaces in manager.GetManagedObjects().items():
+            props = interfaces.get(HWSIM_RADIO_INTERFACE)
+            if props and str(props['Name']) == name:
+                break
+        else:
+            raise Exception('Radio %s not found' % name)
+
+        proxy = self._bus.get_object(HWSIM_SERVICE, path)
+        self._iface = dbus.Interface(proxy, HWSIM_RADIO_INTERFACE)
+        self._props = dbus.Interface(proxy, iwd.DBUS_PROPERTIES)
+        self.address = str(props['Addresses'][0])
+
+    def set_position(self, x, y, duration=0):
+        self._iface.SetPosition(dbus.Double(x), dbus.Double(y),
+                                    dbus.UInt32(duration))
+
+    def set_path(self, waypoints):
+        self._iface.SetPath(dbus.Array([ dbus.Struct((dbus.Double(x),
+                                    dbus.Double(y), dbus.UInt32(duration)))
+                                    for x, y, duration in waypoints ],
+                                    signature='(ddu)'))
+
+    @property
+    def position(self):
+        x, y = self._props.Get(HWSIM_RADIO_INTERFACE, 'Position')
+        return (float(x), float(y))
+
+class Test(unittest.TestCase):
+
+    def add_path_loss_rule(self, source):
+        bus = dbus.SystemBus()
+        manager = dbus.Interface(bus.get_object(HWSIM_SERVICE, '/'),
+                                    HWSIM_RULE_MANAGER_INTERFACE)
+        path = manager.AddRule()
+        props = dbus.Interface(bus.get_object(HWSIM_SERVICE, path),
+                                    iwd.DBUS_PROPERTIES)
+
+        props.Set(HWSIM_RULE_INTERFACE, 'Source', source)
+        props.Set(HWSIM_RULE_INTERFACE, 'Bidirectional', dbus.Boolean(True))
+        props.Set(HWSIM_RULE_INTERFACE, 'PathLoss', dbus.Boolean(True))
+
+        return dbus.Interface(bus.get_object(HWSIM_SERVICE, path),
+                                    HWSIM_RULE_INTERFACE)
+
+    def scan_signal(self, wd, device):
+        condition = 'not obj.scanning'
+        wd.wait_for_object_condition(device, condition)
+
+        device.scan()
+
+        condition = 'obj.scanning'
+        wd.wait_for_object_condition(device, condition)
+        condition = 'not obj.scanning'
+        wd.wait_for_object_condition(device, condition)
+
+        return device.get_ordered_network('ssidOpen').signal_strength
+
+    def test_waypoints(self):
+        radio = Radio('rad1')
+
+        with self.assertRaises(dbus.DBusException):
+            radio.set_path([])
+
+        radio.set_path([ (0, 0, 0), (10, 0, 1000), (10, 10, 1000) ])
+
+        # Still on the first leg, which starts at the first point
+        x, y = radio.position
+        self.assertLess(x, 10)
+        self.assertAlmostEqual(y, 0)
+
+        # Half way through the second leg
+        time.sleep(1.5)
+        x, y = radio.position
+        self.assertAlmostEqual(x, 10)
+        self.assertGreater(y, 0)
+        self.assertLess(y, 10)
+
+        time.sleep(1)
+        self.assertEqual(radio.position, (10, 10))
+
+        # SetPosition replaces whatever is left of a path
+        radio.set_path([ (20, 10, 60000) ])
+        radio.set_position(-5, 0)
+        self.assertEqual(radio.position, (-5, 0))
+
+    def test_path_loss(self):
+        wd = IWD()
+
+        devices = wd.list_devices(1)
+        device = devices[0]
+
+        ap = Radio('rad0')
+        sta = Radio('rad1')
+        rule = self.add_path_loss_rule(ap.address)
+
+        ap.set_position(0, 0)
+        sta.set_position(1, 0)
+
+        near = self.scan_signal(wd, device)
+
+        # Walk away and stay there for the rest of the test
+        sta.set_path([ (50, 0, 500), (50, 0, 600000) ])
+        time.sleep(1)
+
+        far = self.scan_signal(wd, device)
+
+        # 1m vs 50m is about 50dB with a path loss exponent of 3
+        self.assertLess(far, near - 3000)
+
+        rule.Remove()
+
+    @classmethod
+    def setUpClass(cls):
+        pass
+
+    @classmethod
+    def tearDownClass(cls):
+        IWD.clear_storage()
+
+if __name__ == '__main__':
+    unittest.main(exit=True)
@@ -0,0 +1,248 @@
+#!/usr/bin/python3
+
+import unittest
+import sys
+import os
+import time
+import json
+
+sys.path.append('../util')
+import iwd
+from iwd import IWD
+from iwd import IWD_STATION_INTERFACE
+from iwd import DBUS_PROPERTIES
+from iwd import NetworkType
+
+from hostapd import HostapdCLI
+from hwsim import Hwsim
+
+# Number of times each operation is measured, results report every sample
+iterations = int(os.environ.get('IWD_BENCHMARK_ITERATIONS', '5'))
+
+class StateRecorder(object):
+    '''
+        Timestamps the Station State changes of a device as they arrive
+        so that short lived states like 'roaming' are not missed.
+    '''
+    def __init__(self, device):
+        self.transitions = []
+        self._match = IWD._bus.add_signal_receiver(self._changed,
+                                        signal_name='PropertiesChanged',
+                                        dbus_interface=DBUS_PROPERTIES,
+                                        path=device.device_path)
+
+    def _changed(self, interface, changed, invalidated):
+        if interface != IWD_STATION_INTERFACE or 'State' not in changed:
+            return
+
+        self.transitions.append((str(changed['State']), time.monotonic()))
+
+    def reset(self):
+        self.transitions = []
+
+    def first(self, state, after=0):
+        for name, timestamp in self.transitions:
+            if name == state and timestamp >= after:
+                return timestamp
+
+        return None
+
+    @property
+    def roamed(self):
+        start = self.first('roaming')
+        return start is not None and \
+                self.first('connected', start) is not None
+
+    def remove(self):
+        self._match.remove()
+
+class Test(unittest.TestCase):
+    results = {}
+
+    def record(self, name, seconds):
+        Test.results.setdefault(name, []).append(round(seconds * 1000, 3))
+
+    def get_hostapd(self, config):
+        return HostapdCLI(config=config)
+
+    def start(self):
+        wd = IWD(True)
+
+        devices = wd.list_devices(1)
+        device = devices[0]
+
+        condition = 'not obj.scanning'
+        wd.wait_for_object_condition(device, condition)
+
+        return (wd, device)
+
+    def disconnect(self, wd, device, network):
+        device.disconnect()
+
+        condition = 'not obj.connected'
+        wd.wait_for_object_condition(network, condition)
+
+    def connect_timed(self, wd, device, ssid, name):
+        ordered_network = device.get_ordered_network(ssid, scan_if_needed=True)
+        network = ordered_network.network_object
+
+        condition = 'not obj.connected'
+        wd.wait_for_object_condition(network, condition)
+
+        start = time.monotonic()
+        network.connect()
+
+        condition = 'obj.connected'
+        wd.wait_for_object_condition(network, condition)
+
+        self.record(name, time.monotonic() - start)
+
+        return network
+
+    def connect_repeat(self, ssid, name):
+        wd, device = self.start()
+
+        for i in range(iterations):
+            network = self.connect_timed(wd, device, ssid, name)
+            self.disconnect(wd, device, network)
+
+    # aps lists (hostapd config, radio) pairs as set up in hw.conf
+    def roam_repeat(self, ssid, aps, name):
+        hwsim = Hwsim()
+
+        hostapds = [ self.get_hostapd(config) for config, radio in aps ]
+        radios = [ hwsim.get_radio(radio) for config, radio in aps ]
+        rules = []
+
+        for radio in radios:
+            rule = hwsim.rules.create()
+            rule.source = radio.addresses[0]
+            rule.bidirectional = True
+            rules.append(rule)
+
+        # Start out with a clear preference for the first AP
+        rules[0].signal = -2000
+        rules[1].signal = -8500
+
+        wd, device = self.start()
+        recorder = StateRecorder(device)
+
+        network = self.connect_timed(wd, device, ssid, name + '-connect')
+        self.assertIn(device.address, hostapds[0].list_sta())
+
+        current = 0
+
+        for i in range(iterations):
+            target = 1 - current
+
+            # Make sure the target AP is known with its new signal strength
+            rules[target].signal = -2000
+            device.scan()
+
+            condition = 'not obj.scanning'
+            wd.wait_for_object_condition(device, condition)
+
+            recorder.reset()
+            trigger = time.monotonic()
+            rules[current].signal = -8500
+
+            condition = 'obj.roamed'
+            wd.wait_for_object_condition(recorder, condition, 30)
+
+            start = recorder.first('roaming')
+            end = recorder.first('connected', start)
+
+            self.assertIn(device.address, hostapds[target].list_sta())
+
+            self.record(name + '-trigger', start - trigger)
+            self.record(name, end - start)
+
+            current = target
+
+        recorder.remove()
+        self.disconnect(wd, device, network)
+
+    def test_connect_psk(self):
+        self.connect_repeat('TestRoam', 'connect-psk')
+
+    def test_connect_sae(self):
+        self.connect_repeat('ssidSAE', 'connect-sae')
+
+    def test_connect_eap(self):
+        self.connect_repeat('ssidEAP-PEAP', 'connect-eap-peap')
+
+    def test_roam_ft(self):
+        self.roam_repeat('TestFT', [('ft-psk-ccmp-1.conf', 'rad0'),
+                                    ('ft-psk-ccmp-2.conf', 'rad1')],
+                                    'roam-ft-psk')
+
+    def test_roam_reassociation(self):
+        self.roam_repeat('TestRoam', [('psk-ccmp-1.conf', 'rad2'),
+                                      ('psk-ccmp-2.conf', 'rad3')],
+                                      'roam-psk')
+
+    def test_autoconnect(self):
+        IWD.create_in_storage('TestRoam.psk',
+                        '[Security]\nPassphrase=EasilyGuessedPassword\n')
+
+        try:
+            self.autoconnect_repeat()
+        finally:
+            # Put back the AutoConnect=false profile the other tests use
+            IWD.copy_to_storage('TestRoam.psk')
+
+    def autoconnect_repeat(self):
+        # Both APs serve TestRoam, take down whichever we are connected to
+        hostapds = [ self.get_hostapd(config) for config in
+                                ['psk-ccmp-1.conf', 'psk-ccmp-2.conf'] ]
+        wd, device = self.start()
+
+        condition = 'obj.state == DeviceState.connected'
+        wd.wait_for_object_condition(device, condition, 30)
+
+        for i in range(iterations):
+            recorder = StateRecorder(device)
+
+            # Kick the station off without disabling autoconnect
+            start = time.monotonic()
+
+            for hostapd in hostapds:
+                hostapd.reload()
+
+            condition = 'obj.first("disconnected") is not None'
+            wd.wait_for_object_condition(recorder, condition)
+
+            condition = 'obj.first("connected") is not None'
+            wd.wait_for_object_condition(recorder, condition, 30)
+
+            self.record('autoconnect',
+                        recorder.first('connected') -
+                        recorder.first('disconnected'))
+            self.record('autoconnect-total',
+                        recorder.first('connected') - start)
+
+            recorder.remove()
+
+    @classmethod
+    def setUpClass(cls):
+        IWD.copy_to_storage('TestFT.psk')
+        IWD.copy_to_storage('TestRoam.psk')
+        IWD.copy_to_storage('ssidSAE.psk')
+        IWD.copy_to_storage('ssidEAP-PEAP.8021x')
+
+    @classmethod
+    def tearDownClass(cls):
+        IWD.clear_storage()
+
+        # One JSON object per run: operation -> list of samples in ms
+        print('BENCHMARK ' + json.dumps({
+                'iterations': iterations,
+                'results': cls.results }, sort_keys=True))
+
+        path = os.environ.get('IWD_BENCHMARK_RESULTS', None)
+        if path:
+            with open(path, 'w') as f:
+                json.dump(cls.results, f, sort_keys=True, indent=4)
+
+if __name__ == '__main__':
+    unittest.main(exit=True)
@@ -30,6 +30,7 @@
 #include <ctype.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <net/ethernet.h>
@@ -82,6 +83,15 @@
 #define BSS_CAPABILITY_APSD		(1<<11)
 #define BSS_CAPABILITY_DSSS_OFDM	(1<<13)
 
+/*
+ * TPACKET_V3 receive ring geometry.  Blocks are handed over to user space
+ * when full or after NLMON_RING_BLOCK_TIMEOUT ms, whichever comes first.
+ */
+#define NLMON_RING_BLOCK_SIZE		(1 << 20)
+#define NLMON_RING_BLOCK_COUNT		16
+#define NLMON_RING_FRAME_SIZE		(1 << 11)
+#define NLMON_RING_BLOCK_TIMEOUT	20
+
 enum msg_type {
 	MSG_REQUEST,
 	MSG_RESPONSE,
@@ -90,12 +100,92 @@ enum msg_type {
 	MSG_EVENT,
 };
 
+struct nlmon_ring {
+	uint8_t *map;
+	size_t map_size;
+	unsigned int block_idx;
+	uint64_t last_drop_check;
+	uint64_t drops;
+};
+
+struct nlmon_filter {
+	int cmd;		/* nl80211 command, -1 for any */
+	uint32_t ifindex;	/* 0 for any */
+	uint64_t wdev;		/* 0 for any */
+	uint8_t addr[6];
+	bool match_addr : 1;
+};
+
+struct nlmon_cmd_stats {
+	uint32_t requests;
+	uint32_t results;
+	uint32_t events;
+	uint32_t errors;
+	uint32_t latency_count;
+	uint64_t latency_total;	/* usec */
+	uint64_t latency_max;	/* usec */
+};
+
+enum nlmon_phase {
+	NLMON_PHASE_SCAN,
+	NLMON_PHASE_AUTH,
+	NLMON_PHASE_ASSOC,
+	NLMON_PHASE_EAP,
+	NLMON_PHASE_4WAY,
+	NLMON_PHASE_KEY,
+	NLMON_PHASE_TOTAL,
+	__NLMON_PHASE_MAX,
+};
+
+static const char *nlmon_phase_names[__NLMON_PHASE_MAX] = {
+	[NLMON_PHASE_SCAN]	= "Scan",
+	[NLMON_PHASE_AUTH]	= "Authenticate",
+	[NLMON_PHASE_ASSOC]	= "Associate",
+	[NLMON_PHASE_EAP]	= "EAP",
+	[NLMON_PHASE_4WAY]	= "4-Way Handshake",
+	[NLMON_PHASE_KEY]	= "Key Install",
+	[NLMON_PHASE_TOTAL]	= "Total",
+};
+
+/*
+ * Keys installed later than this after the last EAPoL-Key frame of the
+ * 4-Way Handshake belong to a rekey, not to the connection being set up.
+ */
+#define NLMON_KEY_INSTALL_WINDOW	1000000
+
+/* A connection or roam attempt being reconstructed, times in usec */
+struct nlmon_conn {
+	uint32_t ifindex;
+	bool roam;
+	unsigned int num_key_frames;
+	uint64_t start[__NLMON_PHASE_MAX];
+	uint64_t end[__NLMON_PHASE_MAX];
+};
+
+struct nlmon_samples {
+	uint64_t *values;
+	unsigned int count;
+	unsigned int alloc;
+};
+
 struct nlmon {
 	uint16_t id;
 	struct l_io *io;
 	struct l_io *pae_io;
+	struct nlmon_ring *ring;
+	struct nlmon_ring *pae_ring;
 	struct l_queue *req_list;
 	struct pcap *pcap;
+	uint32_t pcap_iface;
+	uint32_t pcap_pae_iface;
+	struct nlmon_filter filter;
+	struct nlmon_cmd_stats *cmd_stats;	/* Indexed by nl80211 command */
+	uint32_t num_filtered;
+	struct l_queue *conns;
+	/* Completed phase latencies, for connections [0] and roams [1] */
+	struct nlmon_samples phase_samples[2][__NLMON_PHASE_MAX];
+	bool timeline;
+	bool summary;
 	bool nortnl;
 	bool nowiphy;
 	bool noscan;
@@ -107,6 +197,9 @@ struct nlmon_req {
 	uint16_t flags;
 	uint8_t cmd;
 	uint8_t version;
+	struct timeval time;
+	uint32_t ifindex;
+	bool match;
 };
 
 typedef void (*attr_func_t) (unsigned int level, const char *label,
@@ -144,6 +237,70 @@ struct attr_entry {
 static void print_attributes(int indent, const struct attr_entry *table,
 						const void *buf, uint32_t len);
 
+/*
+ * Attribute tables are sorted for humans, not for lookups.  Each table is
+ * turned into an array indexed by attribute type the first time it is
+ * used, so that resolving an attribute does not depend on the table size.
+ */
+struct attr_index {
+	uint16_t max_attr;
+	const struct attr_entry **entries;
+};
+
+static struct l_hashmap *attr_indexes;
+
+static void attr_index_free(void *data)
+{
+	struct attr_index *index = data;
+
+	l_free(index->entries);
+	l_free(index);
+}
+
+static const struct attr_index *attr_table_index(
+					const struct attr_entry *table)
+{
+	struct attr_index *index;
+	unsigned int i;
+
+	if (!table)
+		return NULL;
+
+	if (!attr_indexes)
+		attr_indexes = l_hashmap_new();
+
+	index = l_hashmap_lookup(attr_indexes, table);
+	if (index)
+		return index;
+
+	index = l_new(struct attr_index, 1);
+
+	for (i = 0; table[i].str; i++)
+		if (table[i].attr > index->max_attr)
+			index->max_attr = table[i].attr;
+
+	index->entries = l_new(const struct attr_entry *, index->max_attr + 1);
+
+	/* Keep the first entry for duplicates, as a linear search */
+	for (i = 0; table[i].str; i++)
+		if (!index->entries[table[i].attr])
+			index->entries[table[i].attr] = &table[i];
+
+	l_hashmap_insert(attr_indexes, table, index);
+
+	return index;
+}
+
+static const struct attr_entry *attr_index_lookup(
+					const struct attr_index *index,
+					uint16_t attr)
+{
+	if (!index || attr > index->max_attr)
+		return NULL;
+
+	return index->entries[attr];
+}
+
 struct flag_names {
 	uint16_t flag;
 	const char *name;
@@ -5978,9 +6135,9 @@ static void print_array(int indent, enum attr_type type,
 static void print_attributes(int indent, const struct attr_entry *table,
 						const void *buf, uint32_t len)
 {
+	const struct attr_index *index = attr_table_index(table);
 	const struct nlattr *nla;
 	const char *str;
-	int i;
 
 	for (nla = buf ; NLA_OK(nla, len); nla = NLA_NEXT(nla, len)) {
 		uint16_t nla_type = nla->nla_type & NLA_TYPE_MASK;
@@ -5996,23 +6153,20 @@ static void print_attributes(int indent, const struct attr_entry *table,
 		int32_t val_s32;
 		int64_t val_s64;
 		uint8_t *ptr;
+		const struct attr_entry *entry;
 
 		str = "Reserved";
 		type = ATTR_UNSPEC;
 		array_type = ATTR_UNSPEC;
 		nested = NULL;
 
-		if (table) {
-			for (i = 0; table[i].str; i++) {
-				if (nla_type == table[i].attr) {
-					str = table[i].str;
-					type = table[i].type;
-					nested = table[i].nested;
-					array_type = table[i].array_type;
-					function = table[i].function;
-					break;
-				}
-			}
+		entry = attr_index_lookup(index, nla_type);
+		if (entry) {
+			str = entry->str;
+			type = entry->type;
+			nested = entry->nested;
+			array_type = entry->array_type;
+			function = entry->function;
 		}
 
 		switch (type) {
@@ -6296,6 +6450,433 @@ static void print_message(struct nlmon *nlmon, const struct timeval *tv,
 	}
 }
 
+/*
+ * Check the command and the top level interface attributes against the
+ * filter without decoding anything else, so that messages not of interest
+ * cost next to nothing when going through a large capture.
+ */
+static bool nlmon_filter_match(struct nlmon *nlmon, uint8_t cmd,
+					const void *data, uint32_t len)
+{
+	const struct nlmon_filter *filter = &nlmon->filter;
+	const struct nlattr *nla;
+	bool ifindex_ok = !filter->ifindex;
+	bool wdev_ok = !filter->wdev;
+	bool addr_ok = !filter->match_addr;
+	int attrlen = len;
+
+	if (filter->cmd >= 0 && filter->cmd != cmd)
+		return false;
+
+	if (ifindex_ok && wdev_ok && addr_ok)
+		return true;
+
+	for (nla = data; NLA_OK(nla, attrlen); nla = NLA_NEXT(nla, attrlen)) {
+		const void *value = NLA_DATA(nla);
+
+		switch (nla->nla_type & NLA_TYPE_MASK) {
+		case NL80211_ATTR_IFINDEX:
+			if (NLA_PAYLOAD(nla) == 4 &&
+					l_get_u32(value) == filter->ifindex)
+				ifindex_ok = true;
+			break;
+		case NL80211_ATTR_WDEV:
+			if (NLA_PAYLOAD(nla) == 8 &&
+					l_get_u64(value) == filter->wdev)
+				wdev_ok = true;
+			break;
+		case NL80211_ATTR_MAC:
+			if (NLA_PAYLOAD(nla) == 6 &&
+					!memcmp(value, filter->addr, 6))
+				addr_ok = true;
+			break;
+		}
+	}
+
+	return ifindex_ok && wdev_ok && addr_ok;
+}
+
+static struct nlmon_cmd_stats *nlmon_stats(struct nlmon *nlmon, uint8_t cmd)
+{
+	if (!nlmon->cmd_stats)
+		nlmon->cmd_stats = l_new(struct nlmon_cmd_stats, 256);
+
+	return &nlmon->cmd_stats[cmd];
+}
+
+static void nlmon_req_done(struct nlmon *nlmon, const struct nlmon_req *req,
+					const struct timeval *tv, bool error)
+{
+	struct nlmon_cmd_stats *stats;
+	uint64_t latency;
+
+	if (!req->match)
+		return;
+
+	stats = nlmon_stats(nlmon, req->cmd);
+
+	if (error)
+		stats->errors += 1;
+
+	if (!tv || !req->time.tv_sec)
+		return;
+
+	latency = (tv->tv_sec - req->time.tv_sec) * 1000000LL +
+					tv->tv_usec - req->time.tv_usec;
+
+	stats->latency_count += 1;
+	stats->latency_total += latency;
+
+	if (latency > stats->latency_max)
+		stats->latency_max = latency;
+}
+
+static uint64_t timeval_to_usec(const struct timeval *tv)
+{
+	return (uint64_t) tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+static void nlmon_samples_add(struct nlmon_samples *samples, uint64_t value)
+{
+	if (samples->count == samples->alloc) {
+		samples->alloc = samples->alloc ? samples->alloc * 2 : 64;
+		samples->values = l_realloc(samples->values,
+				samples->alloc * sizeof(uint64_t));
+	}
+
+	samples->values[samples->count++] = value;
+}
+
+static bool nlmon_conn_match_ifindex(const void *a, const void *b)
+{
+	const struct nlmon_conn *conn = a;
+
+	return conn->ifindex == L_PTR_TO_UINT(b);
+}
+
+static void nlmon_conn_mark(struct nlmon_conn *conn, enum nlmon_phase phase,
+						bool start, uint64_t ts)
+{
+	if (start) {
+		if (!conn->start[phase])
+			conn->start[phase] = ts;
+	} else if (conn->start[phase])
+		conn->end[phase] = ts;
+}
+
+/*
+ * Record the latencies of a finished attempt.  Only attempts that got as
+ * far as a completed association are counted, others are reported as
+ * failed so that they do not skew the statistics.
+ */
+static void nlmon_conn_finish(struct nlmon *nlmon, struct nlmon_conn *conn)
+{
+	struct nlmon_samples *samples = nlmon->phase_samples[conn->roam];
+	const char *label = conn->roam ? "Roam" : "Connection";
+	uint64_t first = 0, last = 0;
+	char str[64];
+	unsigned int i;
+
+	l_queue_remove(nlmon->conns, conn);
+
+	if (!conn->end[NLMON_PHASE_ASSOC]) {
+		if (!nlmon->summary && conn->start[NLMON_PHASE_ASSOC]) {
+			snprintf(str, sizeof(str), "ifindex %u", conn->ifindex);
+			print_packet(NULL, '*', COLOR_RED, label, "failed", str);
+		}
+
+		l_free(conn);
+		return;
+	}
+
+	for (i = 0; i < NLMON_PHASE_TOTAL; i++) {
+		if (!conn->start[i] || !conn->end[i])
+			continue;
+
+		if (!first || conn->start[i] < first)
+			first = conn->start[i];
+
+		if (conn->end[i] > last)
+			last = conn->end[i];
+	}
+
+	conn->start[NLMON_PHASE_TOTAL] = first;
+	conn->end[NLMON_PHASE_TOTAL] = last;
+
+	if (!nlmon->summary) {
+		snprintf(str, sizeof(str), "ifindex %u", conn->ifindex);
+		print_packet(NULL, '*', COLOR_GREEN, label, "timeline", str);
+	}
+
+	for (i = 0; i < __NLMON_PHASE_MAX; i++) {
+		uint64_t latency;
+
+		if (!conn->start[i] || !conn->end[i])
+			continue;
+
+		latency = conn->end[i] - conn->start[i];
+		nlmon_samples_add(&samples[i], latency);
+
+		if (!nlmon->summary)
+			print_attr(0, "%s: %" PRIu64 ".%03" PRIu64 " ms",
+					nlmon_phase_names[i], latency / 1000,
+					latency % 1000);
+	}
+
+	l_free(conn);
+}
+
+static struct nlmon_conn *nlmon_conn_get(struct nlmon *nlmon,
+						uint32_t ifindex, uint64_t ts)
+{
+	struct nlmon_conn *conn;
+
+	if (!nlmon->conns)
+		nlmon->conns = l_queue_new();
+
+	conn = l_queue_find(nlmon->conns, nlmon_conn_match_ifindex,
+						L_UINT_TO_PTR(ifindex));
+
+	/* Anything well after the handshake is no longer part of it */
+	if (conn && conn->num_key_frames >= 4 &&
+			ts > conn->end[NLMON_PHASE_4WAY] +
+						NLMON_KEY_INSTALL_WINDOW) {
+		nlmon_conn_finish(nlmon, conn);
+		conn = NULL;
+	}
+
+	if (conn)
+		return conn;
+
+	conn = l_new(struct nlmon_conn, 1);
+	conn->ifindex = ifindex;
+	l_queue_push_tail(nlmon->conns, conn);
+
+	return conn;
+}
+
+/* A new attempt starts, finish the previous one if it got anywhere */
+static struct nlmon_conn *nlmon_conn_restart(struct nlmon *nlmon,
+						struct nlmon_conn *conn,
+						uint64_t ts)
+{
+	uint32_t ifindex = conn->ifindex;
+
+	if (!conn->start[NLMON_PHASE_ASSOC])
+		return conn;
+
+	nlmon_conn_finish(nlmon, conn);
+
+	return nlmon_conn_get(nlmon, ifindex, ts);
+}
+
+static void nlmon_timeline_genl(struct nlmon *nlmon, const struct timeval *tv,
+					enum msg_type type, uint8_t cmd,
+					uint32_t ifindex, bool prev_bssid)
+{
+	struct nlmon_conn *conn;
+	uint64_t ts;
+
+	if (!nlmon->timeline || !tv || !ifindex)
+		return;
+
+	switch (cmd) {
+	case NL80211_CMD_TRIGGER_SCAN:
+	case NL80211_CMD_NEW_SCAN_RESULTS:
+	case NL80211_CMD_SCAN_ABORTED:
+	case NL80211_CMD_AUTHENTICATE:
+	case NL80211_CMD_ASSOCIATE:
+	case NL80211_CMD_CONNECT:
+	case NL80211_CMD_ROAM:
+	case NL80211_CMD_NEW_KEY:
+	case NL80211_CMD_SET_KEY:
+	case NL80211_CMD_SET_STATION:
+		break;
+	default:
+		return;
+	}
+
+	ts = timeval_to_usec(tv);
+	conn = nlmon_conn_get(nlmon, ifindex, ts);
+
+	switch (cmd) {
+	case NL80211_CMD_TRIGGER_SCAN:
+		/*
+		 * Requests are often addressed by wdev only, so use the
+		 * kernel's scan started event which carries the ifindex.
+		 */
+		if (type != MSG_EVENT)
+			break;
+
+		conn = nlmon_conn_restart(nlmon, conn, ts);
+
+		/* Only the scan right before connecting is of interest */
+		conn->start[NLMON_PHASE_SCAN] = ts;
+		conn->end[NLMON_PHASE_SCAN] = 0;
+		break;
+	case NL80211_CMD_NEW_SCAN_RESULTS:
+		if (type == MSG_EVENT && !conn->end[NLMON_PHASE_SCAN])
+			nlmon_conn_mark(conn, NLMON_PHASE_SCAN, false, ts);
+		break;
+	case NL80211_CMD_SCAN_ABORTED:
+		conn->start[NLMON_PHASE_SCAN] = 0;
+		break;
+	case NL80211_CMD_AUTHENTICATE:
+		if (type == MSG_REQUEST) {
+			conn = nlmon_conn_restart(nlmon, conn, ts);
+			nlmon_conn_mark(conn, NLMON_PHASE_AUTH, true, ts);
+		} else if (type == MSG_EVENT)
+			nlmon_conn_mark(conn, NLMON_PHASE_AUTH, false, ts);
+		break;
+	case NL80211_CMD_ASSOCIATE:
+	case NL80211_CMD_CONNECT:
+		if (type == MSG_REQUEST) {
+			if (cmd == NL80211_CMD_CONNECT)
+				conn = nlmon_conn_restart(nlmon, conn, ts);
+
+			nlmon_conn_mark(conn, NLMON_PHASE_ASSOC, true, ts);
+			conn->roam = prev_bssid;
+		} else if (type == MSG_EVENT)
+			nlmon_conn_mark(conn, NLMON_PHASE_ASSOC, false, ts);
+		break;
+	case NL80211_CMD_ROAM:
+		/* Roamed by the driver, only the completion is visible */
+		conn = nlmon_conn_restart(nlmon, conn, ts);
+		conn->roam = true;
+		conn->start[NLMON_PHASE_ASSOC] = ts;
+		conn->end[NLMON_PHASE_ASSOC] = ts;
+		break;
+	case NL80211_CMD_NEW_KEY:
+	case NL80211_CMD_SET_KEY:
+	case NL80211_CMD_SET_STATION:
+		if (!conn->end[NLMON_PHASE_ASSOC])
+			break;
+
+		if (type == MSG_REQUEST && cmd == NL80211_CMD_NEW_KEY)
+			nlmon_conn_mark(conn, NLMON_PHASE_KEY, true, ts);
+		else if (type == MSG_RESPONSE)
+			nlmon_conn_mark(conn, NLMON_PHASE_KEY, false, ts);
+		break;
+	}
+}
+
+static void nlmon_timeline_pae(struct nlmon *nlmon, const struct timeval *tv,
+					int ifindex, const uint8_t *data,
+					uint32_t size)
+{
+	struct nlmon_conn *conn;
+	uint64_t ts;
+
+	if (!nlmon->timeline || !tv || ifindex <= 0 || size < 4)
+		return;
+
+	ts = timeval_to_usec(tv);
+	conn = nlmon_conn_get(nlmon, ifindex, ts);
+
+	if (!conn->end[NLMON_PHASE_ASSOC])
+		return;
+
+	switch (data[1]) {
+	case 0:		/* EAP-Packet */
+		if (conn->start[NLMON_PHASE_4WAY])
+			break;
+
+		nlmon_conn_mark(conn, NLMON_PHASE_EAP, true, ts);
+		nlmon_conn_mark(conn, NLMON_PHASE_EAP, false, ts);
+		break;
+	case 3:		/* EAPoL-Key */
+		if (conn->num_key_frames >= 4)
+			break;
+
+		conn->num_key_frames += 1;
+		nlmon_conn_mark(conn, NLMON_PHASE_4WAY, true, ts);
+		nlmon_conn_mark(conn, NLMON_PHASE_4WAY, false, ts);
+		break;
+	}
+}
+
+static void nlmon_get_conn_attrs(const void *data, uint32_t len,
+					uint32_t *ifindex, bool *prev_bssid)
+{
+	const struct nlattr *nla;
+	int attrlen = len;
+
+	*ifindex = 0;
+	*prev_bssid = false;
+
+	for (nla = data; NLA_OK(nla, attrlen); nla = NLA_NEXT(nla, attrlen)) {
+		switch (nla->nla_type & NLA_TYPE_MASK) {
+		case NL80211_ATTR_IFINDEX:
+			if (NLA_PAYLOAD(nla) == 4)
+				*ifindex = l_get_u32(NLA_DATA(nla));
+			break;
+		case NL80211_ATTR_PREV_BSSID:
+			*prev_bssid = true;
+			break;
+		}
+	}
+}
+
+static int nlmon_samples_compare(const void *a, const void *b)
+{
+	uint64_t v1 = *(const uint64_t *) a;
+	uint64_t v2 = *(const uint64_t *) b;
+
+	return v1 < v2 ? -1 : v1 > v2;
+}
+
+static void nlmon_print_timeline_summary(struct nlmon *nlmon)
+{
+	struct nlmon_conn *conn;
+	unsigned int kind, i;
+
+	while ((conn = l_queue_peek_head(nlmon->conns)))
+		nlmon_conn_finish(nlmon, conn);
+
+	for (kind = 0; kind < 2; kind++) {
+		struct nlmon_samples *samples = nlmon->phase_samples[kind];
+
+		if (!samples[NLMON_PHASE_TOTAL].count)
+			continue;
+
+		printf("%s latencies (%u samples, ms)\n",
+				kind ? "Roam" : "Connection",
+				samples[NLMON_PHASE_TOTAL].count);
+		printf("%-16s %8s %10s %10s %10s %10s\n", "Phase", "Count",
+				"p50", "p90", "p99", "Max");
+
+		for (i = 0; i < __NLMON_PHASE_MAX; i++) {
+			struct nlmon_samples *s = &samples[i];
+			unsigned int n = s->count;
+
+			if (!n)
+				continue;
+
+			qsort(s->values, n, sizeof(uint64_t),
+						nlmon_samples_compare);
+
+			printf("%-16s %8u %10.3f %10.3f %10.3f %10.3f\n",
+				nlmon_phase_names[i], n,
+				s->values[(n - 1) * 50 / 100] / 1000.0,
+				s->values[(n - 1) * 90 / 100] / 1000.0,
+				s->values[(n - 1) * 99 / 100] / 1000.0,
+				s->values[n - 1] / 1000.0);
+		}
+	}
+}
+
+static void nlmon_timeline_free(struct nlmon *nlmon)
+{
+	unsigned int kind, i;
+
+	l_queue_destroy(nlmon->conns, l_free);
+	nlmon->conns = NULL;
+
+	for (kind = 0; kind < 2; kind++)
+		for (i = 0; i < __NLMON_PHASE_MAX; i++)
+			l_free(nlmon->phase_samples[kind][i].values);
+}
+
 struct nlmon_req_match {
 	uint32_t seq;
 	uint32_t pid;
@@ -6310,7 +6891,7 @@ static bool nlmon_req_match(const void *a, const void *b)
 }
 
 static void store_packet(struct nlmon *nlmon, const struct timeval *tv,
-					uint16_t pkt_type,
+					uint32_t iface, uint16_t pkt_type,
 					uint16_t arphrd_type,
 					uint16_t proto_type,
 					const void *data, uint32_t size)
@@ -6326,15 +6907,16 @@ static void store_packet(struct nlmon *nlmon, const struct timeval *tv,
 	l_put_be16(arphrd_type, buf + 2);
 	l_put_be16(proto_type, buf + 14);
 
-	pcap_write(nlmon->pcap, tv, &sll_hdr, sizeof(sll_hdr), data, size);
+	pcap_write_iface(nlmon->pcap, iface, tv, &sll_hdr, sizeof(sll_hdr),
+								data, size);
 }
 
 static void store_netlink(struct nlmon *nlmon, const struct timeval *tv,
 					uint16_t proto_type,
 					const struct nlmsghdr *nlmsg)
 {
-	store_packet(nlmon, tv, PACKET_HOST, ARPHRD_NETLINK, proto_type,
-						nlmsg, nlmsg->nlmsg_len);
+	store_packet(nlmon, tv, nlmon->pcap_iface, PACKET_HOST, ARPHRD_NETLINK,
+					proto_type, nlmsg, nlmsg->nlmsg_len);
 }
 
 static void store_message(struct nlmon *nlmon, const struct timeval *tv,
@@ -6377,9 +6959,19 @@ static void nlmon_message(struct nlmon *nlmon, const struct timeval *tv,
 			}
 
 			store_message(nlmon, tv, nlmsg);
-			print_message(nlmon, tv, type, nlmsg->nlmsg_flags, status,
+			nlmon_req_done(nlmon, req, tv, status != 0 &&
+						type == MSG_RESPONSE);
+
+			if (type == MSG_RESPONSE && !status)
+				nlmon_timeline_genl(nlmon, tv, type, req->cmd,
+							req->ifindex, false);
+
+			if (req->match && !nlmon->summary)
+				print_message(nlmon, tv, type,
+						nlmsg->nlmsg_flags, status,
 						req->cmd, req->version,
 						NULL, sizeof(status));
+
 			nlmon_req_free(req);
 		}
 		return;
@@ -6402,17 +6994,44 @@ static void nlmon_message(struct nlmon *nlmon, const struct timeval *tv,
 		req->flags = nlmsg->nlmsg_flags;
 		req->cmd = genlmsg->cmd;
 		req->version = genlmsg->version;
+		req->match = nlmon_filter_match(nlmon, genlmsg->cmd,
+					NLMSG_DATA(nlmsg) + GENL_HDRLEN,
+					NLMSG_PAYLOAD(nlmsg, GENL_HDRLEN));
+
+		if (tv)
+			req->time = *tv;
 
 		l_queue_push_tail(nlmon->req_list, req);
 
 		store_message(nlmon, tv, nlmsg);
-		print_message(nlmon, tv, MSG_REQUEST, flags, 0,
+
+		if (nlmon->timeline) {
+			bool prev_bssid;
+
+			nlmon_get_conn_attrs(NLMSG_DATA(nlmsg) + GENL_HDRLEN,
+					NLMSG_PAYLOAD(nlmsg, GENL_HDRLEN),
+					&req->ifindex, &prev_bssid);
+			nlmon_timeline_genl(nlmon, tv, MSG_REQUEST, req->cmd,
+						req->ifindex, prev_bssid);
+		}
+
+		if (!req->match) {
+			nlmon->num_filtered += 1;
+			return;
+		}
+
+		nlmon_stats(nlmon, req->cmd)->requests += 1;
+
+		if (!nlmon->summary)
+			print_message(nlmon, tv, MSG_REQUEST, flags, 0,
 					req->cmd, req->version,
 					NLMSG_DATA(nlmsg) + GENL_HDRLEN,
 					NLMSG_PAYLOAD(nlmsg, GENL_HDRLEN));
 	} else {
 		const struct genlmsghdr *genlmsg = NLMSG_DATA(nlmsg);
 		enum msg_type type = MSG_EVENT;
+		struct nlmon_cmd_stats *stats;
+		bool req_match = false;
 
 		struct nlmon_req_match match = {
 			.seq = nlmsg->nlmsg_seq,
@@ -6421,7 +7040,10 @@ static void nlmon_message(struct nlmon *nlmon, const struct timeval *tv,
 
 		req = l_queue_find(nlmon->req_list, nlmon_req_match, &match);
 		if (req) {
+			req_match = req->match;
+
 			if (!(req->flags & NLM_F_ACK)) {
+				nlmon_req_done(nlmon, req, tv, false);
 				l_queue_remove(nlmon->req_list, req);
 				nlmon_req_free(req);
 			}
@@ -6429,14 +7051,71 @@ static void nlmon_message(struct nlmon *nlmon, const struct timeval *tv,
 		}
 
 		store_message(nlmon, tv, nlmsg);
-		print_message(nlmon, tv, type, nlmsg->nlmsg_flags, 0,
+
+		if (nlmon->timeline) {
+			uint32_t ifindex;
+			bool prev_bssid;
+
+			nlmon_get_conn_attrs(NLMSG_DATA(nlmsg) + GENL_HDRLEN,
+					NLMSG_PAYLOAD(nlmsg, GENL_HDRLEN),
+					&ifindex, &prev_bssid);
+			nlmon_timeline_genl(nlmon, tv, type, genlmsg->cmd,
+						ifindex, prev_bssid);
+		}
+
+		/* Results are shown along with the request they answer */
+		if (type == MSG_RESULT ? !req_match :
+				!nlmon_filter_match(nlmon, genlmsg->cmd,
+					NLMSG_DATA(nlmsg) + GENL_HDRLEN,
+					NLMSG_PAYLOAD(nlmsg, GENL_HDRLEN))) {
+			nlmon->num_filtered += 1;
+			return;
+		}
+
+		stats = nlmon_stats(nlmon, genlmsg->cmd);
+
+		if (type == MSG_RESULT)
+			stats->results += 1;
+		else
+			stats->events += 1;
+
+		if (!nlmon->summary)
+			print_message(nlmon, tv, type, nlmsg->nlmsg_flags, 0,
 					genlmsg->cmd, genlmsg->version,
 					NLMSG_DATA(nlmsg) + GENL_HDRLEN,
 					NLMSG_PAYLOAD(nlmsg, GENL_HDRLEN));
 	}
 }
 
-struct nlmon *nlmon_create(uint16_t id)
+/*
+ * Only show nl80211 messages for the command (0 for any) that carry the
+ * interface index, wireless device id or MAC address (0 or NULL for any)
+ * given in @config.  Messages are matched before being decoded.
+ */
+static void nlmon_set_config(struct nlmon *nlmon,
+				const struct nlmon_config *config)
+{
+	nlmon->filter.cmd = config->filter_cmd ? config->filter_cmd : -1;
+	nlmon->filter.ifindex = config->filter_ifindex;
+	nlmon->filter.wdev = config->filter_wdev;
+	nlmon->filter.match_addr = config->filter_addr != NULL;
+
+	if (config->filter_addr)
+		memcpy(nlmon->filter.addr, config->filter_addr, 6);
+
+	/* Collect statistics only instead of printing every message */
+	nlmon->summary = config->summary;
+	/*
+	 * Reconstruct connection and roam attempts per interface and report
+	 * how long each phase took.
+	 */
+	nlmon->timeline = config->timeline;
+	nlmon->nortnl = config->nortnl;
+	nlmon->nowiphy = config->nowiphy;
+	nlmon->noscan = config->noscan;
+}
+
+struct nlmon *nlmon_create(uint16_t id, const struct nlmon_config *config)
 {
 	struct nlmon *nlmon;
 
@@ -6444,16 +7123,65 @@ struct nlmon *nlmon_create(uint16_t id)
 
 	nlmon->id = id;
 	nlmon->req_list = l_queue_new();
+	nlmon_set_config(nlmon, config);
 
 	return nlmon;
 }
 
+static void nlmon_print_summary(struct nlmon *nlmon)
+{
+	unsigned int i;
+
+	printf("%-32s %8s %8s %8s %8s %12s %12s\n", "Command", "Requests",
+			"Results", "Events", "Errors", "Avg latency",
+			"Max latency");
+
+	for (i = 0; nlmon->cmd_stats && i < 256; i++) {
+		const struct nlmon_cmd_stats *stats = &nlmon->cmd_stats[i];
+		const char *str;
+		char avg[32] = "-";
+		char max[32] = "-";
+
+		if (!stats->requests && !stats->results && !stats->events)
+			continue;
+
+		if (stats->latency_count) {
+			snprintf(avg, sizeof(avg), "%" PRIu64 " us",
+					stats->latency_total /
+					stats->latency_count);
+			snprintf(max, sizeof(max), "%" PRIu64 " us",
+					stats->latency_max);
+		}
+
+		str = nl80211cmd_to_string(i);
+
+		printf("%-32s %8u %8u %8u %8u %12s %12s\n",
+				str ? str : "Unknown", stats->requests,
+				stats->results, stats->events, stats->errors,
+				avg, max);
+	}
+
+	printf("%u messages did not match the filter\n",
+						nlmon->num_filtered);
+}
+
 void nlmon_destroy(struct nlmon *nlmon)
 {
 	if (!nlmon)
 		return;
 
+	if (nlmon->summary)
+		nlmon_print_summary(nlmon);
+
+	if (nlmon->timeline)
+		nlmon_print_timeline_summary(nlmon);
+
 	l_queue_destroy(nlmon->req_list, nlmon_req_free);
+	l_free(nlmon->cmd_stats);
+	nlmon_timeline_free(nlmon);
+
+	l_hashmap_destroy(attr_indexes, attr_index_free);
+	attr_indexes = NULL;
 
 	l_free(nlmon);
 }
@@ -6647,11 +7375,14 @@ static struct attr_entry route_entry[] = {
 static void print_rtnl_attributes(int indent, const struct attr_entry *table,
 						struct rtattr *rt_attr, int len)
 {
+	const struct attr_index *index;
 	struct rtattr *attr;
 
 	if (!table || !rt_attr)
 		return;
 
+	index = attr_table_index(table);
+
 	for (attr = rt_attr; RTA_OK(attr, len); attr = RTA_NEXT(attr, len)) {
 		uint16_t rta_type = attr->rta_type;
 		enum attr_type type = ATTR_UNSPEC;
@@ -6664,19 +7395,18 @@ static void print_rtnl_attributes(int indent, const struct attr_entry *table,
 		int8_t val_s8;
 		int32_t val_s32;
 		int64_t val_s64;
+		const struct attr_entry *entry;
 		const char *str;
-		int i, payload;
+		int payload;
 
 		str = "Reserved";
 
-		for (i = 0; table[i].str; i++) {
-			if (rta_type == table[i].attr) {
-				str = table[i].str;
-				type = table[i].type;
-				function = table[i].function;
-				nested = table[i].nested;
-				break;
-			}
+		entry = attr_index_lookup(index, rta_type);
+		if (entry) {
+			str = entry->str;
+			type = entry->type;
+			function = entry->function;
+			nested = entry->nested;
 		}
 
 		payload = RTA_PAYLOAD(attr);
@@ -7178,10 +7908,175 @@ void nlmon_print_genl(struct nlmon *nlmon, const struct timeval *tv,
 	}
 }
 
+typedef void (*nlmon_packet_func_t)(struct nlmon *nlmon,
+					const struct timeval *tv,
+					const struct tpacket_auxdata *tp,
+					const struct sockaddr_ll *sll,
+					const void *data, uint32_t size);
+
+static struct nlmon_ring *nlmon_ring_setup(int fd)
+{
+	struct nlmon_ring *ring;
+	struct tpacket_req3 req;
+	int version = TPACKET_V3;
+	size_t map_size;
+	void *map;
+
+	if (setsockopt(fd, SOL_PACKET, PACKET_VERSION,
+					&version, sizeof(version)) < 0)
+		return NULL;
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = NLMON_RING_BLOCK_SIZE;
+	req.tp_block_nr = NLMON_RING_BLOCK_COUNT;
+	req.tp_frame_size = NLMON_RING_FRAME_SIZE;
+	req.tp_frame_nr = NLMON_RING_BLOCK_SIZE / NLMON_RING_FRAME_SIZE *
+						NLMON_RING_BLOCK_COUNT;
+	req.tp_retire_blk_tov = NLMON_RING_BLOCK_TIMEOUT;
+
+	if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0)
+		goto reset_version;
+
+	map_size = (size_t) req.tp_block_size * req.tp_block_nr;
+	map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		memset(&req, 0, sizeof(req));
+		setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req));
+		goto reset_version;
+	}
+
+	ring = l_new(struct nlmon_ring, 1);
+	ring->map = map;
+	ring->map_size = map_size;
+
+	return ring;
+
+reset_version:
+	version = TPACKET_V1;
+	setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version));
+
+	return NULL;
+}
+
+static void nlmon_ring_free(struct nlmon_ring *ring)
+{
+	if (!ring)
+		return;
+
+	munmap(ring->map, ring->map_size);
+	l_free(ring);
+}
+
+/*
+ * Frames lost by the kernel are reported at most once a second so that
+ * checking does not add a system call to every wakeup.
+ */
+static void nlmon_check_drops(struct nlmon_ring *ring, int fd,
+						const char *label)
+{
+	struct tpacket_stats_v3 stats;
+	socklen_t len = sizeof(stats);
+	uint64_t now = l_time_now();
+	char str[64];
+
+	if (ring->last_drop_check &&
+			l_time_diff(ring->last_drop_check, now) < L_USEC_PER_SEC)
+		return;
+
+	ring->last_drop_check = now;
+
+	memset(&stats, 0, sizeof(stats));
+
+	if (getsockopt(fd, SOL_PACKET, PACKET_STATISTICS, &stats, &len) < 0)
+		return;
+
+	if (!stats.tp_drops)
+		return;
+
+	ring->drops += stats.tp_drops;
+
+	snprintf(str, sizeof(str), "%u frames (%" PRIu64 " total)",
+						stats.tp_drops, ring->drops);
+	print_packet(NULL, '!', COLOR_RED, "Dropped", label, str);
+}
+
+/*
+ * Process every block the kernel has handed over, then give the blocks
+ * back.  A single wakeup drains everything queued since the last one.
+ */
+static void nlmon_ring_drain(struct nlmon *nlmon, struct nlmon_ring *ring,
+						nlmon_packet_func_t func)
+{
+	while (true) {
+		struct tpacket_block_desc *bd = (void *) (ring->map +
+				ring->block_idx * NLMON_RING_BLOCK_SIZE);
+		struct tpacket3_hdr *hdr;
+		uint32_t i;
+
+		if (!(__atomic_load_n(&bd->hdr.bh1.block_status,
+					__ATOMIC_ACQUIRE) & TP_STATUS_USER))
+			break;
+
+		hdr = (void *) ((uint8_t *) bd +
+					bd->hdr.bh1.offset_to_first_pkt);
+
+		for (i = 0; i < bd->hdr.bh1.num_pkts; i++) {
+			const struct sockaddr_ll *sll = (void *) ((uint8_t *)
+				hdr + TPACKET_ALIGN(sizeof(*hdr)));
+			struct timeval tv;
+
+			tv.tv_sec = hdr->tp_sec;
+			tv.tv_usec = hdr->tp_nsec / 1000;
+
+			func(nlmon, &tv, NULL, sll, (uint8_t *) hdr + hdr->tp_mac,
+							hdr->tp_snaplen);
+
+			hdr = (void *) ((uint8_t *) hdr + hdr->tp_next_offset);
+		}
+
+		__atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL,
+							__ATOMIC_RELEASE);
+
+		ring->block_idx = (ring->block_idx + 1) % NLMON_RING_BLOCK_COUNT;
+	}
+}
+
+static void nlmon_packet(struct nlmon *nlmon, const struct timeval *tv,
+					const struct tpacket_auxdata *tp,
+					const struct sockaddr_ll *sll,
+					const void *data, uint32_t size)
+{
+	const struct nlmsghdr *nlmsg;
+	uint16_t proto_type;
+	int nlmsg_len;
+
+	if (sll->sll_hatype != ARPHRD_NETLINK)
+		return;
+
+	proto_type = ntohs(sll->sll_protocol);
+
+	nlmsg_len = size;
+
+	for (nlmsg = data; NLMSG_OK(nlmsg, nlmsg_len);
+				nlmsg = NLMSG_NEXT(nlmsg, nlmsg_len)) {
+		switch (proto_type) {
+		case NETLINK_ROUTE:
+			store_netlink(nlmon, tv, proto_type, nlmsg);
+
+			if (!nlmon->nortnl)
+				nlmon_print_rtnl(nlmon, tv, nlmsg,
+							nlmsg->nlmsg_len);
+			break;
+		case NETLINK_GENERIC:
+			nlmon_message(nlmon, tv, tp, nlmsg);
+			break;
+		}
+	}
+}
+
 static bool nlmon_receive(struct l_io *io, void *user_data)
 {
 	struct nlmon *nlmon = user_data;
-	struct nlmsghdr *nlmsg;
 	struct msghdr msg;
 	struct sockaddr_ll sll;
 	struct iovec iov;
@@ -7190,17 +8085,21 @@ static bool nlmon_receive(struct l_io *io, void *user_data)
 	struct tpacket_auxdata copy_tp;
 	const struct timeval *tv = NULL;
 	const struct tpacket_auxdata *tp = NULL;
-	uint16_t proto_type;
 	unsigned char buf[8192];
 	unsigned char control[32];
 	ssize_t bytes_read;
-	int nlmsg_len;
 	int fd;
 
 	fd = l_io_get_fd(io);
 	if (fd < 0)
 		return false;
 
+	if (nlmon->ring) {
+		nlmon_ring_drain(nlmon, nlmon->ring, nlmon_packet);
+		nlmon_check_drops(nlmon->ring, fd, "Netlink");
+		return true;
+	}
+
 	memset(&sll, 0, sizeof(sll));
 
 	memset(&iov, 0, sizeof(iov));
@@ -7223,11 +8122,6 @@ static bool nlmon_receive(struct l_io *io, void *user_data)
 		return true;
 	}
 
-	if (sll.sll_hatype != ARPHRD_NETLINK)
-		return true;
-
-	proto_type = ntohs(sll.sll_protocol);
-
 	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg;
 				cmsg = CMSG_NXTHDR(&msg, cmsg)) {
 		if (cmsg->cmsg_level == SOL_SOCKET &&
@@ -7243,23 +8137,7 @@ static bool nlmon_receive(struct l_io *io, void *user_data)
 		}
 	}
 
-	nlmsg_len = bytes_read;
-
-	for (nlmsg = iov.iov_base; NLMSG_OK(nlmsg, nlmsg_len);
-				nlmsg = NLMSG_NEXT(nlmsg, nlmsg_len)) {
-		switch (proto_type) {
-		case NETLINK_ROUTE:
-			store_netlink(nlmon, tv, proto_type, nlmsg);
-
-			if (!nlmon->nortnl)
-				nlmon_print_rtnl(nlmon, tv, nlmsg,
-							nlmsg->nlmsg_len);
-			break;
-		case NETLINK_GENERIC:
-			nlmon_message(nlmon, tv, tp, nlmsg);
-			break;
-		}
-	}
+	nlmon_packet(nlmon, tv, tp, &sll, buf, bytes_read);
 
 	return true;
 }
@@ -7281,7 +8159,7 @@ static struct sock_filter mon_filter[] = {
 
 static const struct sock_fprog mon_fprog = { .len = 7, .filter = mon_filter };
 
-static struct l_io *open_packet(const char *name)
+static struct l_io *open_packet(const char *name, struct nlmon_ring **ring)
 {
 	struct l_io *io;
 	struct sockaddr_ll sll;
@@ -7338,6 +8216,9 @@ static struct l_io *open_packet(const char *name)
 		return NULL;
 	}
 
+	/* Fall back to reading one frame at a time if there is no ring */
+	*ring = nlmon_ring_setup(fd);
+
 	io = l_io_new(fd);
 
 	l_io_set_close_on_destroy(io, true);
@@ -7361,6 +8242,23 @@ void nlmon_print_pae(struct nlmon *nlmon, const struct timeval *tv,
 		print_attr(0, "Interface Index: %u", index);
 
 	print_eapol(0, "EAPoL", data, size);
+
+	nlmon_timeline_pae(nlmon, tv, index, data, size);
+}
+
+static void pae_packet(struct nlmon *nlmon, const struct timeval *tv,
+					const struct tpacket_auxdata *tp,
+					const struct sockaddr_ll *sll,
+					const void *data, uint32_t size)
+{
+	if (sll->sll_hatype != ARPHRD_ETHER)
+		return;
+
+	store_packet(nlmon, tv, nlmon->pcap_pae_iface, sll->sll_pkttype,
+			ARPHRD_ETHER, ntohs(sll->sll_protocol), data, size);
+
+	nlmon_print_pae(nlmon, tv, sll->sll_pkttype, sll->sll_ifindex,
+							data, size);
 }
 
 static bool pae_receive(struct l_io *io, void *user_data)
@@ -7381,6 +8279,12 @@ static bool pae_receive(struct l_io *io, void *user_data)
 	if (fd < 0)
 		return false;
 
+	if (nlmon->pae_ring) {
+		nlmon_ring_drain(nlmon, nlmon->pae_ring, pae_packet);
+		nlmon_check_drops(nlmon->pae_ring, fd, "PAE");
+		return true;
+	}
+
 	memset(&sll, 0, sizeof(sll));
 
 	memset(&iov, 0, sizeof(iov));
@@ -7403,9 +8307,6 @@ static bool pae_receive(struct l_io *io, void *user_data)
 		return true;
 	}
 
-	if (sll.sll_hatype != ARPHRD_ETHER)
-		return true;
-
 	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg;
 				cmsg = CMSG_NXTHDR(&msg, cmsg)) {
 		if (cmsg->cmsg_level == SOL_SOCKET &&
@@ -7415,11 +8316,7 @@ static bool pae_receive(struct l_io *io, void *user_data)
 		}
 	}
 
-	store_packet(nlmon, tv, sll.sll_pkttype, ARPHRD_ETHER,
-				ntohs(sll.sll_protocol), buf, bytes_read);
-
-	nlmon_print_pae(nlmon, tv, sll.sll_pkttype, sll.sll_ifindex,
-							buf, bytes_read);
+	pae_packet(nlmon, tv, NULL, &sll, buf, bytes_read);
 
 	return true;
 }
@@ -7440,7 +8337,7 @@ static struct sock_filter pae_filter[] = {
 
 static const struct sock_fprog pae_fprog = { .len = 7, .filter = pae_filter };
 
-static struct l_io *open_pae(void)
+static struct l_io *open_pae(struct nlmon_ring **ring)
 {
 	struct l_io *io;
 	int fd, opt = 1;
@@ -7465,6 +8362,8 @@ static struct l_io *open_pae(void)
 		return NULL;
 	}
 
+	*ring = nlmon_ring_setup(fd);
+
 	io = l_io_new(fd);
 
 	l_io_set_close_on_destroy(io, true);
@@ -7477,14 +8376,16 @@ struct nlmon *nlmon_open(const char *ifname, uint16_t id, const char *pathname,
 {
 	struct nlmon *nlmon;
 	struct l_io *io, *pae_io;
+	struct nlmon_ring *ring, *pae_ring;
 	struct pcap *pcap;
 
-	io = open_packet(ifname);
+	io = open_packet(ifname, &ring);
 	if (!io)
 		return NULL;
 
-	pae_io = open_pae();
+	pae_io = open_pae(&pae_ring);
 	if (!pae_io) {
+		nlmon_ring_free(ring);
 		l_io_destroy(io);
 		return NULL;
 	}
@@ -7492,10 +8393,15 @@ struct nlmon *nlmon_open(const char *ifname, uint16_t id, const char *pathname,
 	if (pathname) {
 		pcap = pcap_create(pathname);
 		if (!pcap) {
+			nlmon_ring_free(pae_ring);
 			l_io_destroy(pae_io);
+			nlmon_ring_free(ring);
 			l_io_destroy(io);
 			return NULL;
 		}
+
+		pcap_set_rotation(pcap, config->rotate_size,
+						config->rotate_interval);
 	} else
 		pcap = NULL;
 
@@ -7504,11 +8410,13 @@ struct nlmon *nlmon_open(const char *ifname, uint16_t id, const char *pathname,
 	nlmon->id = id;
 	nlmon->io = io;
 	nlmon->pae_io = pae_io;
+	nlmon->ring = ring;
+	nlmon->pae_ring = pae_ring;
 	nlmon->req_list = l_queue_new();
 	nlmon->pcap = pcap;
-	nlmon->nortnl = config->nortnl;
-	nlmon->nowiphy = config->nowiphy;
-	nlmon->noscan = config->noscan;
+	nlmon->pcap_iface = pcap_add_interface(pcap, ifname);
+	nlmon->pcap_pae_iface = pcap_add_interface(pcap, "pae");
+	nlmon_set_config(nlmon, config);
 
 	l_io_set_read_handler(nlmon->io, nlmon_receive, nlmon, NULL);
 	l_io_set_read_handler(nlmon->pae_io, pae_receive, nlmon, NULL);
@@ -7525,7 +8433,8 @@ void nlmon_close(struct nlmon *nlmon)
 
 	l_io_destroy(nlmon->io);
 	l_io_destroy(nlmon->pae_io);
-	l_queue_destroy(nlmon->req_list, nlmon_req_free);
+	nlmon_ring_free(nlmon->ring);
+	nlmon_ring_free(nlmon->pae_ring);
 
 	l_hashmap_destroy(wlan_iface_list, wlan_iface_list_free);
 	wlan_iface_list = NULL;
@@ -7533,5 +8442,6 @@ void nlmon_close(struct nlmon *nlmon)
 	if (nlmon->pcap)
 		pcap_close(nlmon->pcap);
 
-	l_free(nlmon);
+	/* The rest is shared with the monitors that only decode captures */
+	nlmon_destroy(nlmon);
 }
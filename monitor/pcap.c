@@ -29,6 +29,8 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/uio.h>
 #include <sys/types.h>
@@ -55,13 +57,106 @@ struct pcap_pkt {
 } __attribute__ ((packed));
 #define PCAP_PKT_SIZE (sizeof(struct pcap_pkt))
 
+#define PCAPNG_BLOCK_SHB	0x0a0d0d0a
+#define PCAPNG_BLOCK_IDB	0x00000001
+#define PCAPNG_BLOCK_EPB	0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC	0x1a2b3c4d
+#define PCAPNG_OPT_ENDOFOPT	0
+#define PCAPNG_OPT_IF_NAME	2
+
+struct pcapng_block_hdr {
+	uint32_t type;
+	uint32_t total_len;
+} __attribute__ ((packed));
+
+struct pcapng_shb {
+	struct pcapng_block_hdr hdr;
+	uint32_t byte_order_magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int64_t section_len;
+} __attribute__ ((packed));
+
+struct pcapng_idb {
+	struct pcapng_block_hdr hdr;
+	uint16_t link_type;
+	uint16_t reserved;
+	uint32_t snaplen;
+} __attribute__ ((packed));
+
+struct pcapng_opt {
+	uint16_t code;
+	uint16_t len;
+} __attribute__ ((packed));
+
+struct pcapng_epb {
+	struct pcapng_block_hdr hdr;
+	uint32_t interface_id;
+	uint32_t ts_high;
+	uint32_t ts_low;
+	uint32_t captured_len;
+	uint32_t orig_len;
+} __attribute__ ((packed));
+
+#define PCAPNG_ALIGN(len) (((len) + 3) & ~3)
+
+/*
+ * Captured packets are collected in a page aligned buffer and written out
+ * in batches of PCAP_BUFFER_SIZE, or after PCAP_FLUSH_INTERVAL seconds if
+ * the capture is slow, so that capturing does not wait on the disk for
+ * every packet.
+ */
+#define PCAP_BUFFER_SIZE	(256 * 1024)
+#define PCAP_FLUSH_INTERVAL	1
+
 struct pcap {
 	int fd;
 	bool closed;
+	bool pcapng;
 	uint32_t type;
 	uint32_t snaplen;
+	char *pathname;
+	uint8_t *buf;
+	size_t buf_len;
+	struct l_timeout *flush_timeout;
+	char **ifaces;			/* pcapng interface names by id */
+	unsigned int num_ifaces;
+	uint64_t file_size;
+	uint64_t file_start;
+	unsigned int file_index;
+	uint64_t rotate_size;
+	unsigned int rotate_interval;
+	/* Read side, capture files are memory mapped when possible */
+	const uint8_t *map;
+	size_t map_size;
+	size_t map_offset;
 };
 
+/*
+ * Map the whole capture so that reading a packet is a bounds check and a
+ * copy instead of two read() calls.  Files that cannot be mapped, e.g.
+ * pipes, are still read the traditional way.
+ */
+static void pcap_map(struct pcap *pcap)
+{
+	struct stat st;
+	void *map;
+
+	if (fstat(pcap->fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+			(size_t) st.st_size <= PCAP_HDR_SIZE)
+		return;
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, pcap->fd, 0);
+	if (map == MAP_FAILED)
+		return;
+
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	pcap->map = map;
+	pcap->map_size = st.st_size;
+	pcap->map_offset = PCAP_HDR_SIZE;
+}
+
 struct pcap *pcap_open(const char *pathname)
 {
 	struct pcap *pcap;
@@ -102,6 +197,8 @@ struct pcap *pcap_open(const char *pathname)
 	pcap->snaplen = hdr.snaplen;
 	pcap->type = hdr.network;
 
+	pcap_map(pcap);
+
 	return pcap;
 
 failed:
@@ -112,63 +209,352 @@ failed:
 }
 
 
-struct pcap *pcap_create(const char *pathname)
+static bool pcap_write_all(int fd, const void *data, size_t size)
 {
-	struct pcap *pcap;
-	struct pcap_hdr hdr;
-	ssize_t len;
+	while (size) {
+		ssize_t written = write(fd, data, size);
 
-	pcap = l_new(struct pcap, 1);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return false;
+		}
+
+		data += written;
+		size -= written;
+	}
+
+	return true;
+}
+
+static bool pcap_flush(struct pcap *pcap)
+{
+	if (!pcap->buf_len)
+		return true;
+
+	if (!pcap_write_all(pcap->fd, pcap->buf, pcap->buf_len)) {
+		perror("Failed to write PCAP file");
+		pcap->closed = true;
+		return false;
+	}
+
+	pcap->buf_len = 0;
+
+	return true;
+}
+
+static void pcap_flush_timeout(struct l_timeout *timeout, void *user_data)
+{
+	struct pcap *pcap = user_data;
+
+	l_timeout_remove(pcap->flush_timeout);
+	pcap->flush_timeout = NULL;
+
+	pcap_flush(pcap);
+}
+
+/*
+ * Queue @iovcnt buffers as a single record.  Records larger than the
+ * buffer bypass it after the buffer contents have been written out.
+ */
+static bool pcap_append(struct pcap *pcap, const struct iovec *iov,
+							int iovcnt)
+{
+	size_t total = 0;
+	int i;
+
+	for (i = 0; i < iovcnt; i++)
+		total += iov[i].iov_len;
+
+	if (pcap->buf_len + total > PCAP_BUFFER_SIZE && !pcap_flush(pcap))
+		return false;
+
+	pcap->file_size += total;
+
+	if (total > PCAP_BUFFER_SIZE) {
+		for (i = 0; i < iovcnt; i++)
+			if (!pcap_write_all(pcap->fd, iov[i].iov_base,
+							iov[i].iov_len)) {
+				pcap->closed = true;
+				return false;
+			}
+
+		return true;
+	}
+
+	for (i = 0; i < iovcnt; i++) {
+		memcpy(pcap->buf + pcap->buf_len, iov[i].iov_base,
+							iov[i].iov_len);
+		pcap->buf_len += iov[i].iov_len;
+	}
+
+	if (pcap->buf_len == PCAP_BUFFER_SIZE)
+		return pcap_flush(pcap);
+
+	if (!pcap->flush_timeout)
+		pcap->flush_timeout = l_timeout_create(PCAP_FLUSH_INTERVAL,
+							pcap_flush_timeout,
+							pcap, NULL);
+
+	return true;
+}
+
+static bool pcapng_write_idb(struct pcap *pcap, const char *name)
+{
+	static const uint8_t padding[4];
+	struct pcapng_idb idb;
+	struct pcapng_opt opt;
+	struct pcapng_opt opt_end = { .code = PCAPNG_OPT_ENDOFOPT };
+	uint16_t name_len = strlen(name);
+	uint32_t total_len;
+	struct iovec iov[6];
+
+	total_len = sizeof(idb) + sizeof(opt) + PCAPNG_ALIGN(name_len) +
+				sizeof(opt_end) + sizeof(total_len);
+
+	memset(&idb, 0, sizeof(idb));
+	idb.hdr.type = PCAPNG_BLOCK_IDB;
+	idb.hdr.total_len = total_len;
+	idb.link_type = pcap->type;
+	idb.snaplen = pcap->snaplen;
+
+	opt.code = PCAPNG_OPT_IF_NAME;
+	opt.len = name_len;
+
+	iov[0].iov_base = &idb;
+	iov[0].iov_len = sizeof(idb);
+	iov[1].iov_base = &opt;
+	iov[1].iov_len = sizeof(opt);
+	iov[2].iov_base = (void *) name;
+	iov[2].iov_len = name_len;
+	iov[3].iov_base = (void *) padding;
+	iov[3].iov_len = PCAPNG_ALIGN(name_len) - name_len;
+	iov[4].iov_base = &opt_end;
+	iov[4].iov_len = sizeof(opt_end);
+	iov[5].iov_base = &total_len;
+	iov[5].iov_len = sizeof(total_len);
+
+	return pcap_append(pcap, iov, 6);
+}
+
+static bool pcap_write_header(struct pcap *pcap)
+{
+	struct iovec iov[2];
+	unsigned int i;
+
+	if (pcap->pcapng) {
+		struct pcapng_shb shb;
+		uint32_t total_len = sizeof(shb) + sizeof(total_len);
+
+		memset(&shb, 0, sizeof(shb));
+		shb.hdr.type = PCAPNG_BLOCK_SHB;
+		shb.hdr.total_len = total_len;
+		shb.byte_order_magic = PCAPNG_BYTE_ORDER_MAGIC;
+		shb.version_major = 1;
+		shb.version_minor = 0;
+		shb.section_len = -1;
+
+		iov[0].iov_base = &shb;
+		iov[0].iov_len = sizeof(shb);
+		iov[1].iov_base = &total_len;
+		iov[1].iov_len = sizeof(total_len);
+
+		if (!pcap_append(pcap, iov, 2))
+			return false;
+
+		/* Every file after a rotation repeats the interface list */
+		for (i = 0; i < pcap->num_ifaces; i++)
+			if (!pcapng_write_idb(pcap, pcap->ifaces[i]))
+				return false;
+	} else {
+		struct pcap_hdr hdr;
+
+		memset(&hdr, 0, sizeof(hdr));
+		hdr.magic_number = 0xa1b2c3d4;
+		hdr.version_major = 0x0002;
+		hdr.version_minor = 0x0004;
+		hdr.thiszone = 0;
+		hdr.sigfigs = 0;
+		hdr.snaplen = pcap->snaplen;
+		hdr.network = pcap->type;
+
+		iov[0].iov_base = &hdr;
+		iov[0].iov_len = PCAP_HDR_SIZE;
+
+		if (!pcap_append(pcap, iov, 1))
+			return false;
+	}
+
+	return pcap_flush(pcap);
+}
+
+static bool pcap_open_output(struct pcap *pcap)
+{
+	char *pathname;
+
+	if (pcap->file_index)
+		pathname = l_strdup_printf("%s.%u", pcap->pathname,
+							pcap->file_index);
+	else
+		pathname = l_strdup(pcap->pathname);
 
 	pcap->fd = open(pathname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
 					S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	l_free(pathname);
+
 	if (pcap->fd < 0) {
 		perror("Failed to create PCAP file");
-		l_free(pcap);
-		return NULL;
+		return false;
+	}
+
+	pcap->file_size = 0;
+	pcap->file_start = l_time_now();
+
+	if (!pcap_write_header(pcap)) {
+		perror("Failed to write PCAP header");
+		close(pcap->fd);
+		pcap->fd = -1;
+		return false;
+	}
+
+	return true;
+}
+
+static bool pcap_rotate(struct pcap *pcap)
+{
+	if (!pcap_flush(pcap))
+		return false;
+
+	close(pcap->fd);
+	pcap->fd = -1;
+	pcap->file_index += 1;
+
+	if (!pcap_open_output(pcap)) {
+		pcap->closed = true;
+		return false;
 	}
 
+	return true;
+}
+
+static bool pcap_needs_rotation(struct pcap *pcap)
+{
+	if (pcap->rotate_size && pcap->file_size >= pcap->rotate_size)
+		return true;
+
+	if (pcap->rotate_interval &&
+			l_time_diff(pcap->file_start, l_time_now()) >=
+			pcap->rotate_interval * L_USEC_PER_SEC)
+		return true;
+
+	return false;
+}
+
+/*
+ * Register a capture interface and return its id for pcap_write_iface().
+ * Classic PCAP files have no notion of interfaces, so there all packets end
+ * up in the same stream regardless of the id.
+ */
+uint32_t pcap_add_interface(struct pcap *pcap, const char *name)
+{
+	uint32_t id;
+
+	if (!pcap || !pcap->pcapng)
+		return 0;
+
+	id = pcap->num_ifaces++;
+	pcap->ifaces = l_realloc(pcap->ifaces,
+				pcap->num_ifaces * sizeof(char *));
+	pcap->ifaces[id] = l_strdup(name);
+
+	/* Still being created, the IDB will be written with the header */
+	if (pcap->fd < 0)
+		return id;
+
+	if (!pcapng_write_idb(pcap, name))
+		pcap->closed = true;
+
+	return id;
+}
+
+/*
+ * Create a new capture file.  Files ending in .pcapng are written in the
+ * pcapng format, anything else as a classic PCAP file.
+ */
+struct pcap *pcap_create(const char *pathname)
+{
+	struct pcap *pcap;
+
+	pcap = l_new(struct pcap, 1);
+
+	pcap->fd = -1;
 	pcap->closed = false;
 	pcap->snaplen = 0x0000ffff;
 	pcap->type = 0x00000071;
+	pcap->pathname = l_strdup(pathname);
+	pcap->pcapng = l_str_has_suffix(pathname, ".pcapng");
 
-	memset(&hdr, 0, sizeof(hdr));
-	hdr.magic_number = 0xa1b2c3d4;
-	hdr.version_major = 0x0002;
-	hdr.version_minor = 0x0004;
-	hdr.thiszone = 0;
-	hdr.sigfigs = 0;
-	hdr.snaplen = pcap->snaplen;
-	hdr.network = pcap->type;
-
-	len = write(pcap->fd, &hdr, PCAP_HDR_SIZE);
-	if (len < 0) {
-		perror("Failed to write PCAP header");
+	if (posix_memalign((void **) &pcap->buf, 4096, PCAP_BUFFER_SIZE)) {
+		fprintf(stderr, "Failed to allocate PCAP buffer\n");
 		goto failed;
 	}
 
-	if (len != PCAP_HDR_SIZE) {
-		fprintf(stderr, "Written PCAP header size mismatch\n");
+	/* Interface 0 is used by pcap_write() */
+	if (pcap->pcapng)
+		pcap_add_interface(pcap, "any");
+
+	if (!pcap_open_output(pcap))
 		goto failed;
-	}
 
 	return pcap;
 
 failed:
-	close(pcap->fd);
-	l_free(pcap);
+	pcap_close(pcap);
 
 	return NULL;
 }
 
+/*
+ * Start a new file, named after the original one with an increasing
+ * numerical suffix, once the current one reaches @max_size bytes or is
+ * @max_seconds old.  Zero disables the respective limit.
+ */
+void pcap_set_rotation(struct pcap *pcap, uint64_t max_size,
+						unsigned int max_seconds)
+{
+	if (!pcap)
+		return;
+
+	pcap->rotate_size = max_size;
+	pcap->rotate_interval = max_seconds;
+}
+
 void pcap_close(struct pcap *pcap)
 {
+	unsigned int i;
+
 	if (!pcap)
 		return;
 
-	if (pcap->fd >= 0)
+	l_timeout_remove(pcap->flush_timeout);
+
+	if (pcap->fd >= 0) {
+		if (!pcap->closed && pcap->pathname)
+			pcap_flush(pcap);
+
 		close(pcap->fd);
+	}
+
+	if (pcap->map)
+		munmap((void *) pcap->map, pcap->map_size);
 
+	for (i = 0; i < pcap->num_ifaces; i++)
+		l_free(pcap->ifaces[i]);
+
+	l_free(pcap->ifaces);
+	free(pcap->buf);
+	l_free(pcap->pathname);
 	l_free(pcap);
 }
 
@@ -188,6 +574,51 @@ uint32_t pcap_get_snaplen(struct pcap *pcap)
 	return pcap->snaplen;
 }
 
+/*
+ * Return a pointer to the next packet in a memory mapped capture without
+ * copying it.  The data stays valid until pcap_close().
+ */
+static bool pcap_read_ptr(struct pcap *pcap, struct timeval *tv,
+					const void **data, uint32_t *len,
+					uint32_t *real_len)
+{
+	struct pcap_pkt pkt;
+	size_t avail;
+
+	if (!pcap || !pcap->map || pcap->closed)
+		return false;
+
+	avail = pcap->map_size - pcap->map_offset;
+	if (avail < PCAP_PKT_SIZE) {
+		pcap->closed = true;
+		return false;
+	}
+
+	memcpy(&pkt, pcap->map + pcap->map_offset, PCAP_PKT_SIZE);
+	pcap->map_offset += PCAP_PKT_SIZE;
+	avail -= PCAP_PKT_SIZE;
+
+	/* The last packet of an interrupted capture may be cut short */
+	if (pkt.incl_len > avail)
+		pkt.incl_len = avail;
+
+	*data = pcap->map + pcap->map_offset;
+	pcap->map_offset += pkt.incl_len;
+
+	if (tv) {
+		tv->tv_sec = pkt.ts_sec;
+		tv->tv_usec = pkt.ts_usec;
+	}
+
+	if (len)
+		*len = pkt.incl_len;
+
+	if (real_len)
+		*real_len = pkt.incl_len;
+
+	return true;
+}
+
 bool pcap_read(struct pcap *pcap, struct timeval *tv,
 		void *data, uint32_t size, uint32_t *len, uint32_t *real_len)
 {
@@ -201,6 +632,23 @@ bool pcap_read(struct pcap *pcap, struct timeval *tv,
 	if (pcap->closed)
 		return false;
 
+	if (pcap->map) {
+		const void *ptr;
+
+		if (!pcap_read_ptr(pcap, tv, &ptr, &toread, real_len))
+			return false;
+
+		if (toread > size)
+			toread = size;
+
+		memcpy(data, ptr, toread);
+
+		if (len)
+			*len = toread;
+
+		return true;
+	}
+
 	bytes_read = read(pcap->fd, &pkt, PCAP_PKT_SIZE);
 	if (bytes_read != PCAP_PKT_SIZE) {
 		pcap->closed = true;
@@ -239,13 +687,13 @@ bool pcap_read(struct pcap *pcap, struct timeval *tv,
 	return true;
 }
 
-bool pcap_write(struct pcap *pcap, const struct timeval *tv,
+bool pcap_write_iface(struct pcap *pcap, uint32_t iface,
+					const struct timeval *tv,
 					const void *phdr, uint32_t plen,
 					const void *data, uint32_t size)
 {
-	struct iovec iov[3];
-	struct pcap_pkt pkt;
-	ssize_t written;
+	static const uint8_t padding[4];
+	struct iovec iov[5];
 
 	if (!pcap)
 		return false;
@@ -253,31 +701,65 @@ bool pcap_write(struct pcap *pcap, const struct timeval *tv,
 	if (pcap->closed)
 		return false;
 
-	memset(&pkt, 0, sizeof(pkt));
-	if (tv) {
-		pkt.ts_sec = tv->tv_sec;
-		pkt.ts_usec = tv->tv_usec;
-	}
-	pkt.incl_len = plen + size;
-	pkt.orig_len = plen + size;
-
-	iov[0].iov_base = &pkt;
-	iov[0].iov_len = PCAP_PKT_SIZE;
-	iov[1].iov_base = (void *) phdr;
-	iov[1].iov_len = plen;
-	iov[2].iov_base = (void *) data;
-	iov[2].iov_len = size;
-
-	written = writev(pcap->fd, iov, 3);
-	if (written < 0) {
-		pcap->closed = true;
+	if (pcap_needs_rotation(pcap) && !pcap_rotate(pcap))
 		return false;
-	}
 
-	if (written < (ssize_t) (PCAP_PKT_SIZE + plen + size)) {
-		pcap->closed = true;
-		return false;
+	if (pcap->pcapng) {
+		struct pcapng_epb epb;
+		uint32_t len = plen + size;
+		uint32_t total_len = sizeof(epb) + PCAPNG_ALIGN(len) +
+							sizeof(total_len);
+		uint64_t ts = 0;
+
+		if (tv)
+			ts = (uint64_t) tv->tv_sec * 1000000 + tv->tv_usec;
+
+		memset(&epb, 0, sizeof(epb));
+		epb.hdr.type = PCAPNG_BLOCK_EPB;
+		epb.hdr.total_len = total_len;
+		epb.interface_id = iface < pcap->num_ifaces ? iface : 0;
+		epb.ts_high = ts >> 32;
+		epb.ts_low = ts;
+		epb.captured_len = len;
+		epb.orig_len = len;
+
+		iov[0].iov_base = &epb;
+		iov[0].iov_len = sizeof(epb);
+		iov[1].iov_base = (void *) phdr;
+		iov[1].iov_len = plen;
+		iov[2].iov_base = (void *) data;
+		iov[2].iov_len = size;
+		iov[3].iov_base = (void *) padding;
+		iov[3].iov_len = PCAPNG_ALIGN(len) - len;
+		iov[4].iov_base = &total_len;
+		iov[4].iov_len = sizeof(total_len);
+
+		return pcap_append(pcap, iov, 5);
+	} else {
+		struct pcap_pkt pkt;
+
+		memset(&pkt, 0, sizeof(pkt));
+		if (tv) {
+			pkt.ts_sec = tv->tv_sec;
+			pkt.ts_usec = tv->tv_usec;
+		}
+		pkt.incl_len = plen + size;
+		pkt.orig_len = plen + size;
+
+		iov[0].iov_base = &pkt;
+		iov[0].iov_len = PCAP_PKT_SIZE;
+		iov[1].iov_base = (void *) phdr;
+		iov[1].iov_len = plen;
+		iov[2].iov_base = (void *) data;
+		iov[2].iov_len = size;
+
+		return pcap_append(pcap, iov, 3);
 	}
+}
 
-	return true;
+bool pcap_write(struct pcap *pcap, const struct timeval *tv,
+					const void *phdr, uint32_t plen,
+					const void *data, uint32_t size)
+{
+	return pcap_write_iface(pcap, 0, tv, phdr, plen, data, size);
 }
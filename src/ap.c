@@ -31,6 +31,7 @@
 
 #include "linux/nl80211.h"
 
+#include "src/missing.h"
 #include "src/iwd.h"
 #include "src/module.h"
 #include "src/scan.h"
@@ -63,12 +64,21 @@ struct ap_state {
 	uint8_t gtk[CRYPTO_MAX_GTK_LEN];
 	uint8_t gtk_index;
 
+	/* Group key rotation, see ap_gtk_rekey_start() */
+	struct l_timeout *gtk_rekey_timeout;
+	struct l_timeout *gtk_rekey_pace_timeout;
+	struct l_queue *gtk_rekey_queue;
+	unsigned int gtk_rekey_pending;
+	uint8_t next_gtk[CRYPTO_MAX_GTK_LEN];
+	uint8_t next_gtk_index;
+
 	uint16_t last_aid;
 	struct l_queue *sta_states;
 
 	bool pending;
 	bool started : 1;
 	bool gtk_set : 1;
+	bool gtk_rekey_active : 1;
 };
 
 struct sta_state {
@@ -85,11 +95,28 @@ struct sta_state {
 	struct eapol_sm *sm;
 	struct handshake_state *hs;
 	uint32_t gtk_query_cmd_id;
+	bool gtk_rekey_pending : 1;
+	bool gtk_rekey_deferred : 1;
 };
 
 static uint32_t netdev_watch;
 
+/*
+ * Periodic GTK rotation interval in seconds, 0 disables it.  During a
+ * rotation the Group Key Handshake is started with at most
+ * AP_GTK_REKEY_BURST stations every AP_GTK_REKEY_PACE_MS.  The new key is
+ * used for transmission once all stations have acknowledged it, or after
+ * AP_GTK_REKEY_TIMEOUT seconds at the latest.
+ */
+static uint32_t gtk_rekey_interval;
+
+#define AP_GTK_REKEY_BURST 8
+#define AP_GTK_REKEY_PACE_MS 20
+#define AP_GTK_REKEY_TIMEOUT 10
+
 #ifdef HAVE_DBUS
+static void ap_gtk_rekey_sta_drop(struct sta_state *sta);
+
 static void ap_sta_free(void *data)
 {
 	struct sta_state *sta = data;
@@ -104,6 +131,8 @@ static void ap_sta_free(void *data)
 	if (sta->gtk_query_cmd_id)
 		l_genl_family_cancel(ap->nl80211, sta->gtk_query_cmd_id);
 
+	ap_gtk_rekey_sta_drop(sta);
+
 	if (sta->sm)
 		eapol_sm_free(sta->sm);
 
@@ -113,6 +142,22 @@ static void ap_sta_free(void *data)
 	l_free(sta);
 }
 
+static void ap_gtk_rekey_stop(struct ap_state *ap)
+{
+	l_timeout_remove(ap->gtk_rekey_timeout);
+	ap->gtk_rekey_timeout = NULL;
+
+	l_timeout_remove(ap->gtk_rekey_pace_timeout);
+	ap->gtk_rekey_pace_timeout = NULL;
+
+	l_queue_destroy(ap->gtk_rekey_queue, NULL);
+	ap->gtk_rekey_queue = NULL;
+	ap->gtk_rekey_pending = 0;
+	ap->gtk_rekey_active = false;
+
+	explicit_bzero(ap->next_gtk, sizeof(ap->next_gtk));
+}
+
 static void ap_reset(struct ap_state *ap)
 {
 	struct netdev *netdev = ap->netdev;
@@ -128,6 +173,8 @@ static void ap_reset(struct ap_state *ap)
 
 	memset(ap->pmk, 0, sizeof(ap->pmk));
 
+	ap_gtk_rekey_stop(ap);
+
 	frame_watch_wdev_remove(netdev_get_wdev_id(netdev));
 
 	if (ap->start_stop_cmd_id)
@@ -167,6 +214,8 @@ static void ap_del_station(struct sta_state *sta, uint16_t reason,
 		sta->gtk_query_cmd_id = 0;
 	}
 
+	ap_gtk_rekey_sta_drop(sta);
+
 	if (sta->sm)
 		eapol_sm_free(sta->sm);
 
@@ -206,11 +255,290 @@ static void ap_del_key_cb(struct l_genl_msg *msg, void *user_data)
 		l_debug("DEL_KEY failed: %i", l_genl_msg_get_error(msg));
 }
 
+static void ap_gtk_op_cb(struct l_genl_msg *msg, void *user_data)
+{
+	if (l_genl_msg_get_error(msg) < 0) {
+		uint8_t cmd = l_genl_msg_get_command(msg);
+		const char *cmd_name =
+			cmd == NL80211_CMD_NEW_KEY ? "NEW_KEY" :
+			cmd == NL80211_CMD_SET_KEY ? "SET_KEY" :
+			"DEL_KEY";
+
+		l_error("%s failed for the GTK: %i",
+			cmd_name, l_genl_msg_get_error(msg));
+	}
+}
+
+static struct l_genl_msg *ap_build_cmd_del_key(struct ap_state *ap,
+							uint8_t key_index)
+{
+	uint32_t ifindex = netdev_get_ifindex(ap->netdev);
+	struct l_genl_msg *msg;
+
+	msg = l_genl_msg_new_sized(NL80211_CMD_DEL_KEY, 128);
+
+	l_genl_msg_append_attr(msg, NL80211_ATTR_IFINDEX, 4, &ifindex);
+	l_genl_msg_enter_nested(msg, NL80211_ATTR_KEY);
+	l_genl_msg_append_attr(msg, NL80211_KEY_IDX, 1, &key_index);
+	l_genl_msg_leave_nested(msg);
+
+	return msg;
+}
+
+static void ap_gtk_rekey_finish(struct ap_state *ap)
+{
+	enum crypto_cipher group_cipher =
+			ie_rsn_cipher_suite_to_cipher(ap->group_cipher);
+	int gtk_len = crypto_cipher_key_len(group_cipher);
+	uint32_t ifindex = netdev_get_ifindex(ap->netdev);
+	uint8_t old_index = ap->gtk_index;
+	const struct l_queue_entry *entry;
+	struct l_genl_msg *msg;
+
+	l_timeout_remove(ap->gtk_rekey_pace_timeout);
+	ap->gtk_rekey_pace_timeout = NULL;
+
+	l_queue_destroy(ap->gtk_rekey_queue, NULL);
+	ap->gtk_rekey_queue = NULL;
+	ap->gtk_rekey_pending = 0;
+	ap->gtk_rekey_active = false;
+
+	/*
+	 * Any station that hasn't acknowledged the new GTK by now would stop
+	 * receiving group addressed traffic, so drop it.
+	 */
+	for (entry = l_queue_get_entries(ap->sta_states); entry;
+						entry = entry->next) {
+		struct sta_state *sta = entry->data;
+
+		if (!sta->gtk_rekey_pending)
+			continue;
+
+		l_debug("STA "MAC" did not complete the Group Key Handshake",
+							MAC_STR(sta->addr));
+		ap_del_station(sta,
+				MMPDU_REASON_CODE_GROUP_KEY_HANDSHAKE_TIMEOUT,
+				true);
+	}
+
+	memcpy(ap->gtk, ap->next_gtk, gtk_len);
+	ap->gtk_index = ap->next_gtk_index;
+	explicit_bzero(ap->next_gtk, sizeof(ap->next_gtk));
+
+	msg = nl80211_build_new_key_group(ifindex, group_cipher,
+						ap->gtk_index, ap->gtk,
+						gtk_len, NULL, 0, NULL);
+	if (!l_genl_family_send(ap->nl80211, msg, ap_gtk_op_cb, NULL, NULL)) {
+		l_genl_msg_unref(msg);
+		l_error("Issuing NEW_KEY failed");
+	}
+
+	msg = nl80211_build_set_key(ifindex, ap->gtk_index);
+	if (!l_genl_family_send(ap->nl80211, msg, ap_gtk_op_cb, NULL, NULL)) {
+		l_genl_msg_unref(msg);
+		l_error("Issuing SET_KEY failed");
+	}
+
+	msg = ap_build_cmd_del_key(ap, old_index);
+	if (!l_genl_family_send(ap->nl80211, msg, ap_gtk_op_cb, NULL, NULL)) {
+		l_genl_msg_unref(msg);
+		l_error("Issuing DEL_KEY failed");
+	}
+
+	l_debug("GTK rotated to key index %u", ap->gtk_index);
+
+	l_timeout_modify(ap->gtk_rekey_timeout, gtk_rekey_interval);
+}
+
+static void ap_gtk_rekey_check(struct ap_state *ap)
+{
+	if (!ap->gtk_rekey_active || ap->gtk_rekey_pending ||
+			!l_queue_isempty(ap->gtk_rekey_queue))
+		return;
+
+	ap_gtk_rekey_finish(ap);
+}
+
+static void ap_gtk_rekey_pace(struct l_timeout *timeout, void *user_data)
+{
+	static const uint8_t zero_rsc[6];
+	struct ap_state *ap = user_data;
+	struct sta_state *sta;
+	unsigned int sent = 0;
+
+	while (sent < AP_GTK_REKEY_BURST &&
+			(sta = l_queue_pop_head(ap->gtk_rekey_queue))) {
+		/*
+		 * The new key hasn't been used for transmission yet so the
+		 * Tx PN starts from zero.
+		 */
+		handshake_state_set_gtk(sta->hs, ap->next_gtk,
+					ap->next_gtk_index, zero_rsc);
+
+		if (!eapol_sm_rekey_gtk(sta->sm)) {
+			/*
+			 * The catch-up Group Key Handshake started from
+			 * ap_new_rsna is still running.  Keep the station
+			 * pending and requeue it once that handshake
+			 * completes, see ap_handshake_event.
+			 */
+			sta->gtk_rekey_deferred = true;
+			ap->gtk_rekey_pending++;
+			continue;
+		}
+
+		ap->gtk_rekey_pending++;
+		sent++;
+	}
+
+	if (l_queue_isempty(ap->gtk_rekey_queue)) {
+		l_timeout_remove(ap->gtk_rekey_pace_timeout);
+		ap->gtk_rekey_pace_timeout = NULL;
+	} else if (ap->gtk_rekey_pace_timeout)
+		l_timeout_modify_ms(ap->gtk_rekey_pace_timeout,
+						AP_GTK_REKEY_PACE_MS);
+	else
+		ap->gtk_rekey_pace_timeout =
+			l_timeout_create_ms(AP_GTK_REKEY_PACE_MS,
+						ap_gtk_rekey_pace, ap, NULL);
+
+	ap_gtk_rekey_check(ap);
+}
+
+static void ap_gtk_rekey_sta_queue(struct sta_state *sta)
+{
+	struct ap_state *ap = sta->ap;
+
+	sta->gtk_rekey_pending = true;
+	l_queue_push_tail(ap->gtk_rekey_queue, sta);
+
+	if (!ap->gtk_rekey_pace_timeout)
+		ap->gtk_rekey_pace_timeout =
+			l_timeout_create_ms(AP_GTK_REKEY_PACE_MS,
+						ap_gtk_rekey_pace, ap, NULL);
+}
+
+static void ap_gtk_rekey_sta_drop(struct sta_state *sta)
+{
+	struct ap_state *ap = sta->ap;
+
+	if (!sta->gtk_rekey_pending)
+		return;
+
+	sta->gtk_rekey_pending = false;
+	sta->gtk_rekey_deferred = false;
+
+	if (!ap->gtk_rekey_active)
+		return;
+
+	if (!l_queue_remove(ap->gtk_rekey_queue, sta))
+		ap->gtk_rekey_pending--;
+
+	ap_gtk_rekey_check(ap);
+}
+
+/*
+ * Generates the next GTK once and distributes it with the Group Key
+ * Handshake to every station that has completed its 4-Way Handshake.  The
+ * key is only installed for transmission by ap_gtk_rekey_finish().
+ */
+static void ap_gtk_rekey_start(struct ap_state *ap)
+{
+	enum crypto_cipher group_cipher =
+			ie_rsn_cipher_suite_to_cipher(ap->group_cipher);
+	const struct l_queue_entry *entry;
+
+	/* No station has associated yet so there is no GTK to rotate */
+	if (!ap->gtk_set) {
+		l_timeout_modify(ap->gtk_rekey_timeout, gtk_rekey_interval);
+		return;
+	}
+
+	l_getrandom(ap->next_gtk, crypto_cipher_key_len(group_cipher));
+	ap->next_gtk_index = ap->gtk_index == 1 ? 2 : 1;
+	ap->gtk_rekey_queue = l_queue_new();
+	ap->gtk_rekey_active = true;
+
+	for (entry = l_queue_get_entries(ap->sta_states); entry;
+						entry = entry->next) {
+		struct sta_state *sta = entry->data;
+
+		if (!sta->rsna || !sta->sm)
+			continue;
+
+		sta->gtk_rekey_pending = true;
+		l_queue_push_tail(ap->gtk_rekey_queue, sta);
+	}
+
+	l_debug("Rotating GTK for %u stations",
+				l_queue_length(ap->gtk_rekey_queue));
+
+	l_timeout_modify(ap->gtk_rekey_timeout, AP_GTK_REKEY_TIMEOUT);
+
+	ap_gtk_rekey_pace(NULL, ap);
+}
+
+static void ap_gtk_rekey_timeout(struct l_timeout *timeout, void *user_data)
+{
+	struct ap_state *ap = user_data;
+
+	if (!ap->gtk_rekey_active) {
+		ap_gtk_rekey_start(ap);
+		return;
+	}
+
+	l_debug("GTK rotation timed out with %u stations pending",
+			ap->gtk_rekey_pending +
+			l_queue_length(ap->gtk_rekey_queue));
+
+	ap_gtk_rekey_finish(ap);
+}
+
+static void ap_gtk_catch_up_query_cb(struct l_genl_msg *msg, void *user_data)
+{
+	struct sta_state *sta = user_data;
+	struct ap_state *ap = sta->ap;
+	const void *gtk_rsc;
+
+	sta->gtk_query_cmd_id = 0;
+
+	gtk_rsc = nl80211_parse_get_key_seq(msg);
+	if (!gtk_rsc || !sta->sm)
+		return;
+
+	handshake_state_set_gtk(sta->hs, ap->gtk, ap->gtk_index, gtk_rsc);
+	eapol_sm_rekey_gtk(sta->sm);
+}
+
 static void ap_new_rsna(struct sta_state *sta)
 {
+	struct ap_state *ap = sta->ap;
+	struct l_genl_msg *msg;
+
 	l_debug("STA "MAC" authenticated", MAC_STR(sta->addr));
 
 	sta->rsna = true;
+
+	/*
+	 * The GTK may have been rotated, or a rotation started, while this
+	 * station was going through the 4-Way Handshake.  Bring it up to date
+	 * with a Group Key Handshake.
+	 */
+	if (ap->gtk_rekey_active) {
+		if (sta->hs->gtk_index != ap->next_gtk_index)
+			ap_gtk_rekey_sta_queue(sta);
+	} else if (ap->gtk_set && sta->hs->gtk_index != ap->gtk_index) {
+		msg = nl80211_build_get_key(netdev_get_ifindex(ap->netdev),
+						ap->gtk_index);
+		sta->gtk_query_cmd_id = l_genl_family_send(ap->nl80211, msg,
+						ap_gtk_catch_up_query_cb,
+						sta, NULL);
+		if (!sta->gtk_query_cmd_id) {
+			l_genl_msg_unref(msg);
+			l_error("Issuing GET_KEY failed");
+		}
+	}
+
 	/*
 	 * TODO: Once new AP interface is implemented this is where a
 	 * new "ConnectedPeer" property will be added.
@@ -245,6 +573,8 @@ static void ap_drop_rsna(struct sta_state *sta)
 		l_error("Issuing DEL_KEY failed");
 	}
 
+	ap_gtk_rekey_sta_drop(sta);
+
 	if (sta->sm)
 		eapol_sm_free(sta->sm);
 
@@ -388,6 +718,22 @@ static void ap_handshake_event(struct handshake_state *hs,
 	case HANDSHAKE_EVENT_COMPLETE:
 		ap_new_rsna(sta);
 		break;
+	case HANDSHAKE_EVENT_REKEY_COMPLETE:
+		if (!sta->gtk_rekey_pending)
+			break;
+
+		sta->ap->gtk_rekey_pending--;
+
+		/* This was the catch-up handshake, now send the new GTK */
+		if (sta->gtk_rekey_deferred) {
+			sta->gtk_rekey_deferred = false;
+			ap_gtk_rekey_sta_queue(sta);
+			break;
+		}
+
+		sta->gtk_rekey_pending = false;
+		ap_gtk_rekey_check(sta->ap);
+		break;
 	case HANDSHAKE_EVENT_FAILED:
 		netdev_handshake_failed(hs, va_arg(args, int));
 		/* fall through */
@@ -471,21 +817,6 @@ error:
 	ap_del_station(sta, MMPDU_REASON_CODE_UNSPECIFIED, true);
 }
 
-static struct l_genl_msg *ap_build_cmd_del_key(struct ap_state *ap)
-{
-	uint32_t ifindex = netdev_get_ifindex(ap->netdev);
-	struct l_genl_msg *msg;
-
-	msg = l_genl_msg_new_sized(NL80211_CMD_DEL_KEY, 128);
-
-	l_genl_msg_append_attr(msg, NL80211_ATTR_IFINDEX, 4, &ifindex);
-	l_genl_msg_enter_nested(msg, NL80211_ATTR_KEY);
-	l_genl_msg_append_attr(msg, NL80211_KEY_IDX, 1, &ap->gtk_index);
-	l_genl_msg_leave_nested(msg);
-
-	return msg;
-}
-
 static struct l_genl_msg *ap_build_cmd_new_station(struct sta_state *sta)
 {
 	struct l_genl_msg *msg;
@@ -512,20 +843,6 @@ static struct l_genl_msg *ap_build_cmd_new_station(struct sta_state *sta)
 	return msg;
 }
 
-static void ap_gtk_op_cb(struct l_genl_msg *msg, void *user_data)
-{
-	if (l_genl_msg_get_error(msg) < 0) {
-		uint8_t cmd = l_genl_msg_get_command(msg);
-		const char *cmd_name =
-			cmd == NL80211_CMD_NEW_KEY ? "NEW_KEY" :
-			cmd == NL80211_CMD_SET_KEY ? "SET_KEY" :
-			"DEL_KEY";
-
-		l_error("%s failed for the GTK: %i",
-			cmd_name, l_genl_msg_get_error(msg));
-	}
-}
-
 static void ap_associate_sta_cb(struct l_genl_msg *msg, void *user_data)
 {
 	struct sta_state *sta = user_data;
@@ -1326,6 +1643,12 @@ static void ap_start_cb(struct l_genl_msg *msg, void *user_data)
 
 	ap->started = true;
 
+	if (gtk_rekey_interval && ap->group_cipher !=
+				IE_RSN_CIPHER_SUITE_NO_GROUP_TRAFFIC)
+		ap->gtk_rekey_timeout = l_timeout_create(gtk_rekey_interval,
+							ap_gtk_rekey_timeout,
+							ap, NULL);
+
 	l_dbus_property_changed(dbus_get_bus(), netdev_get_path(ap->netdev),
 						IWD_AP_INTERFACE, "Started");
 }
@@ -1558,7 +1881,7 @@ static int ap_stop(struct ap_state *ap, struct l_dbus_message *message)
 
 		ap->gtk_set = false;
 
-		msg = ap_build_cmd_del_key(ap);
+		msg = ap_build_cmd_del_key(ap, ap->gtk_index);
 		if (!l_genl_family_send(ap->nl80211, msg, ap_gtk_op_cb, NULL,
 					NULL)) {
 			l_genl_msg_unref(msg);
@@ -1689,6 +2012,11 @@ static void ap_netdev_watch(struct netdev *netdev,
 
 static int ap_init(void)
 {
+	if (!l_settings_get_uint(iwd_get_config(), "General",
+					"GroupRekeyInterval",
+					&gtk_rekey_interval))
+		gtk_rekey_interval = 0;
+
 	netdev_watch = netdev_watch_add(ap_netdev_watch, NULL, NULL);
 
 #ifdef HAVE_DBUS
@@ -65,9 +65,29 @@ enum state {
 	STATE_FINISHED,
 };
 
+#define EAP_WSC_DH_POOL_SIZE 2
+#define EAP_WSC_DH_POOL_LIFETIME 120
+
 static struct l_key *dh5_generator;
 static struct l_key *dh5_prime;
 
+/*
+ * Generating the 1536-bit DH keypair is by far the most expensive part of
+ * building M1.  Keep a small pool of precomputed keypairs, filled one at a
+ * time from an idle callback, so that the exchange itself does not have to
+ * stall on the modular exponentiation.  The pool is only refilled when a
+ * session is about to start and keypairs still unused after
+ * EAP_WSC_DH_POOL_LIFETIME seconds are discarded.
+ */
+struct eap_wsc_dh_keypair {
+	struct l_key *private;
+	uint8_t public_key[192];
+};
+
+static struct l_queue *dh_pool;
+static struct l_idle *dh_pool_idle;
+static struct l_timeout *dh_pool_expire;
+
 struct eap_wsc_state {
 	struct wsc_m1 *m1;
 	struct wsc_m2 *m2;
@@ -274,6 +294,110 @@ static bool encrypted_settings_encrypt(struct eap_wsc_state *wsc,
 	return true;
 }
 
+static void eap_wsc_dh_keypair_free(void *data)
+{
+	struct eap_wsc_dh_keypair *keypair = data;
+
+	l_key_free(keypair->private);
+	l_free(keypair);
+}
+
+static struct eap_wsc_dh_keypair *eap_wsc_dh_keypair_generate(void)
+{
+	struct eap_wsc_dh_keypair *keypair;
+	size_t len = sizeof(keypair->public_key);
+
+	keypair = l_new(struct eap_wsc_dh_keypair, 1);
+
+	keypair->private = l_key_generate_dh_private(crypto_dh5_prime,
+							crypto_dh5_prime_size);
+	if (!keypair->private)
+		goto fail;
+
+	if (!l_key_compute_dh_public(dh5_generator, keypair->private,
+					dh5_prime, keypair->public_key, &len))
+		goto fail;
+
+	if (len != sizeof(keypair->public_key))
+		goto fail;
+
+	return keypair;
+
+fail:
+	eap_wsc_dh_keypair_free(keypair);
+	return NULL;
+}
+
+static void eap_wsc_dh_pool_idle_destroy(void *user_data)
+{
+	dh_pool_idle = NULL;
+}
+
+static void eap_wsc_dh_pool_fill(struct l_idle *idle, void *user_data)
+{
+	struct eap_wsc_dh_keypair *keypair;
+
+	/* Generate a single keypair per iteration to keep latency bounded */
+	if (l_queue_length(dh_pool) < EAP_WSC_DH_POOL_SIZE) {
+		keypair = eap_wsc_dh_keypair_generate();
+		if (keypair)
+			l_queue_push_tail(dh_pool, keypair);
+		else
+			l_error("Unable to precompute WSC DH keypair");
+
+		if (keypair && l_queue_length(dh_pool) < EAP_WSC_DH_POOL_SIZE)
+			return;
+	}
+
+	l_idle_remove(idle);
+}
+
+static void eap_wsc_dh_pool_flush(struct l_timeout *timeout,
+							void *user_data)
+{
+	l_debug("Discarding %u unused DH keypairs", l_queue_length(dh_pool));
+
+	l_timeout_remove(dh_pool_expire);
+	dh_pool_expire = NULL;
+
+	l_idle_remove(dh_pool_idle);
+	l_queue_clear(dh_pool, eap_wsc_dh_keypair_free);
+}
+
+void eap_wsc_dh_pool_prepare(void)
+{
+	if (!dh_pool)
+		return;
+
+	if (dh_pool_expire)
+		l_timeout_modify(dh_pool_expire, EAP_WSC_DH_POOL_LIFETIME);
+	else
+		dh_pool_expire = l_timeout_create(EAP_WSC_DH_POOL_LIFETIME,
+						eap_wsc_dh_pool_flush,
+						NULL, NULL);
+
+	if (dh_pool_idle)
+		return;
+
+	if (l_queue_length(dh_pool) >= EAP_WSC_DH_POOL_SIZE)
+		return;
+
+	dh_pool_idle = l_idle_create(eap_wsc_dh_pool_fill, NULL,
+					eap_wsc_dh_pool_idle_destroy);
+}
+
+static struct eap_wsc_dh_keypair *eap_wsc_dh_pool_take(void)
+{
+	struct eap_wsc_dh_keypair *keypair = l_queue_pop_head(dh_pool);
+
+	if (keypair) {
+		l_debug("Using precomputed DH keypair");
+		return keypair;
+	}
+
+	return eap_wsc_dh_keypair_generate();
+}
+
 static void eap_wsc_free(struct eap_state *eap)
 {
 	struct eap_wsc_state *wsc = eap_get_data(eap);
@@ -1202,6 +1326,7 @@ static bool eap_wsc_load_settings(struct eap_state *eap,
 	struct eap_wsc_state *wsc;
 	const char *v;
 	uint8_t private_key[192];
+	struct eap_wsc_dh_keypair *keypair;
 	size_t len;
 	unsigned int u32;
 
@@ -1234,20 +1359,28 @@ static bool eap_wsc_load_settings(struct eap_state *eap,
 
 		wsc->private = l_key_new(L_KEY_RAW, private_key, 192);
 		explicit_bzero(private_key, 192);
-	} else
-		wsc->private = l_key_generate_dh_private(crypto_dh5_prime,
-							crypto_dh5_prime_size);
 
-	if (!wsc->private)
-		goto err;
+		if (!wsc->private)
+			goto err;
 
-	len = sizeof(wsc->m1->public_key);
-	if (!l_key_compute_dh_public(dh5_generator, wsc->private, dh5_prime,
-						wsc->m1->public_key, &len))
-		goto err;
+		len = sizeof(wsc->m1->public_key);
+		if (!l_key_compute_dh_public(dh5_generator, wsc->private,
+						dh5_prime, wsc->m1->public_key,
+						&len))
+			goto err;
 
-	if (len != sizeof(wsc->m1->public_key))
-		goto err;
+		if (len != sizeof(wsc->m1->public_key))
+			goto err;
+	} else {
+		keypair = eap_wsc_dh_pool_take();
+		if (!keypair)
+			goto err;
+
+		wsc->private = keypair->private;
+		memcpy(wsc->m1->public_key, keypair->public_key,
+					sizeof(wsc->m1->public_key));
+		l_free(keypair);
+	}
 
 	wsc->m1->auth_type_flags = WSC_AUTHENTICATION_TYPE_WPA2_PERSONAL |
 					WSC_AUTHENTICATION_TYPE_WPA_PERSONAL |
@@ -1406,8 +1539,10 @@ static int eap_wsc_init(void)
 		goto fail_prime;
 
 	r = eap_register_method(&eap_wsc);
-	if (!r)
+	if (!r) {
+		dh_pool = l_queue_new();
 		return 0;
+	}
 
 	l_key_free(dh5_prime);
 	dh5_prime = NULL;
@@ -1425,6 +1560,13 @@ static void eap_wsc_exit(void)
 
 	eap_unregister_method(&eap_wsc);
 
+	l_timeout_remove(dh_pool_expire);
+	dh_pool_expire = NULL;
+
+	l_idle_remove(dh_pool_idle);
+	l_queue_destroy(dh_pool, eap_wsc_dh_keypair_free);
+	dh_pool = NULL;
+
 	l_key_free(dh5_prime);
 	l_key_free(dh5_generator);
 }
@@ -23,3 +23,5 @@
 enum EAP_WSC_EVENT {
 	EAP_WSC_EVENT_CREDENTIAL_OBTAINED	= 0x0050f200,
 };
+
+void eap_wsc_dh_pool_prepare(void);
@@ -48,6 +48,26 @@ static struct l_queue *preauths;
 static struct watchlist frame_watches;
 static uint32_t eapol_4way_handshake_time = 2;
 
+/*
+ * Authenticator state machines, indexed by (ifindex, supplicant address) so
+ * that received frames are handed straight to the right station instead of
+ * being offered to every station on the interface.
+ */
+static struct l_hashmap *authenticators;
+
+/*
+ * At most EAPOL_AUTH_START_BURST authenticator handshakes are kicked off
+ * every EAPOL_AUTH_START_INTERVAL_MS.  Any further stations wait in
+ * auth_start_queue, so a burst of associations (e.g. after the AP is power
+ * cycled) can't monopolize the event loop.
+ */
+#define EAPOL_AUTH_START_BURST 8
+#define EAPOL_AUTH_START_INTERVAL_MS 20
+
+static struct l_queue *auth_start_queue;
+static struct l_timeout *auth_start_timeout;
+static unsigned int auth_start_count;
+
 static eapol_rekey_offload_func_t rekey_offload = NULL;
 
 static eapol_tx_packet_func_t tx_packet = NULL;
@@ -820,8 +840,14 @@ static bool eapol_frame_watch_remove(uint32_t id)
 	return watchlist_remove(&frame_watches, id);
 }
 
+struct eapol_auth_key {
+	uint32_t ifindex;
+	uint8_t spa[6];
+};
+
 struct eapol_sm {
 	struct handshake_state *handshake;
+	struct eapol_auth_key auth_key;
 	enum eapol_protocol_version protocol_version;
 	uint64_t replay_counter;
 	void *user_data;
@@ -844,8 +870,29 @@ struct eapol_sm {
 	uint8_t installed_igtk_len;
 	uint8_t installed_igtk[CRYPTO_MAX_IGTK_LEN];
 	unsigned int mic_len;
+	uint8_t pmkid[16];
+	bool have_pmkid:1;
 };
 
+static unsigned int eapol_auth_key_hash(const void *p)
+{
+	const struct eapol_auth_key *key = p;
+
+	/* The OUI is often shared between clients, use the NIC part */
+	return l_get_u32(key->spa + 2) ^ key->ifindex;
+}
+
+static int eapol_auth_key_compare(const void *a, const void *b)
+{
+	const struct eapol_auth_key *key_a = a;
+	const struct eapol_auth_key *key_b = b;
+
+	if (key_a->ifindex != key_b->ifindex)
+		return key_a->ifindex < key_b->ifindex ? -1 : 1;
+
+	return memcmp(key_a->spa, key_b->spa, sizeof(key_a->spa));
+}
+
 static void eapol_sm_destroy(void *value)
 {
 	struct eapol_sm *sm = value;
@@ -888,6 +935,13 @@ void eapol_sm_free(struct eapol_sm *sm)
 {
 	l_queue_remove(state_machines, sm);
 
+	if (sm->handshake->authenticator) {
+		if (l_hashmap_lookup(authenticators, &sm->auth_key) == sm)
+			l_hashmap_remove(authenticators, &sm->auth_key);
+
+		l_queue_remove(auth_start_queue, sm);
+	}
+
 	eapol_sm_destroy(sm);
 }
 
@@ -1030,7 +1084,6 @@ static void eapol_send_ptk_1_of_4(struct eapol_sm *sm)
 	struct eapol_key *ek = (struct eapol_key *) frame_buf;
 	enum crypto_cipher cipher = ie_rsn_cipher_suite_to_cipher(
 				sm->handshake->pairwise_cipher);
-	uint8_t pmkid[16];
 
 	handshake_state_new_anonce(sm->handshake);
 
@@ -1050,11 +1103,18 @@ static void eapol_send_ptk_1_of_4(struct eapol_sm *sm)
 	ek->key_replay_counter = L_CPU_TO_BE64(sm->replay_counter);
 	memcpy(ek->key_nonce, sm->handshake->anonce, sizeof(ek->key_nonce));
 
-	/* Write the PMKID KDE into Key Data field unencrypted */
-	crypto_derive_pmkid(sm->handshake->pmk, sm->handshake->spa, aa,
-			pmkid, false);
+	/*
+	 * Write the PMKID KDE into Key Data field unencrypted.  The PMK can't
+	 * change over the life of the state machine so only derive it once.
+	 */
+	if (!sm->have_pmkid) {
+		crypto_derive_pmkid(sm->handshake->pmk, sm->handshake->spa, aa,
+					sm->pmkid, false);
+		sm->have_pmkid = true;
+	}
 
-	eapol_key_data_append(ek, sm->mic_len, HANDSHAKE_KDE_PMKID, pmkid, 16);
+	eapol_key_data_append(ek, sm->mic_len, HANDSHAKE_KDE_PMKID,
+				sm->pmkid, 16);
 
 	ek->header.packet_len = L_CPU_TO_BE16(EAPOL_FRAME_LEN(sm->mic_len) +
 				EAPOL_KEY_DATA_LEN(ek, sm->mic_len) - 4);
@@ -1367,6 +1427,103 @@ static void eapol_ptk_3_of_4_retry(struct l_timeout *timeout,
 	l_debug("attempt %i", sm->frame_retry);
 }
 
+#define EAPOL_GROUP_UPDATE_COUNT 3
+
+/* 802.11-2016 Section 12.7.7.2 */
+static void eapol_send_gtk_1_of_2(struct eapol_sm *sm)
+{
+	uint32_t ifindex = sm->handshake->ifindex;
+	uint8_t frame_buf[512];
+	uint8_t key_data_buf[128];
+	struct eapol_key *ek = (struct eapol_key *) frame_buf;
+	int key_data_len;
+	enum crypto_cipher group_cipher = ie_rsn_cipher_suite_to_cipher(
+				sm->handshake->group_cipher);
+	const uint8_t *kck;
+	const uint8_t *kek;
+
+	sm->replay_counter++;
+
+	memset(ek, 0, EAPOL_FRAME_LEN(sm->mic_len));
+	ek->header.protocol_version = sm->protocol_version;
+	ek->header.packet_type = 0x3;
+	ek->descriptor_type = EAPOL_DESCRIPTOR_TYPE_80211;
+	/* Must be HMAC-SHA1-128 + AES when using CCMP with PSK or 8021X */
+	ek->key_descriptor_version = EAPOL_KEY_DESCRIPTOR_VERSION_HMAC_SHA1_AES;
+	ek->key_ack = true;
+	ek->key_mic = true;
+	ek->secure = true;
+	ek->encrypted_key_data = true;
+	ek->key_replay_counter = L_CPU_TO_BE64(sm->replay_counter);
+	memcpy(ek->key_rsc, sm->handshake->gtk_rsc, 6);
+
+	handshake_util_build_gtk_kde(group_cipher, sm->handshake->gtk,
+					sm->handshake->gtk_index, key_data_buf);
+	key_data_len = key_data_buf[1] + 2;
+
+	kek = handshake_state_get_kek(sm->handshake);
+	key_data_len = eapol_encrypt_key_data(kek, key_data_buf,
+						key_data_len, ek, sm->mic_len);
+	explicit_bzero(key_data_buf, sizeof(key_data_buf));
+
+	if (key_data_len < 0)
+		return;
+
+	ek->header.packet_len = L_CPU_TO_BE16(EAPOL_FRAME_LEN(sm->mic_len) +
+				key_data_len - 4);
+
+	kck = handshake_state_get_kck(sm->handshake);
+
+	if (!eapol_calculate_mic(sm->handshake->akm_suite, kck, ek,
+			EAPOL_KEY_MIC(ek), sm->mic_len))
+		return;
+
+	l_debug("STA: "MAC" retries=%u", MAC_STR(sm->handshake->spa),
+			sm->frame_retry);
+
+	__eapol_tx_packet(ifindex, sm->handshake->spa, ETH_P_PAE,
+				(struct eapol_frame *) ek, false);
+}
+
+static void eapol_gtk_1_of_2_retry(struct l_timeout *timeout,
+						void *user_data)
+{
+	struct eapol_sm *sm = user_data;
+
+	if (sm->frame_retry >= EAPOL_GROUP_UPDATE_COUNT) {
+		handshake_failed(sm,
+			MMPDU_REASON_CODE_GROUP_KEY_HANDSHAKE_TIMEOUT);
+		return;
+	}
+
+	eapol_send_gtk_1_of_2(sm);
+
+	eapol_set_key_timeout(sm, eapol_gtk_1_of_2_retry);
+
+	l_debug("attempt %i", sm->frame_retry);
+}
+
+/*
+ * Starts a Group Key Handshake distributing the GTK currently set in the
+ * handshake_state.  HANDSHAKE_EVENT_REKEY_COMPLETE is emitted once the
+ * supplicant acknowledges it.  Only valid for authenticators, after the
+ * 4-Way Handshake has completed.
+ */
+bool eapol_sm_rekey_gtk(struct eapol_sm *sm)
+{
+	if (!sm->handshake->authenticator || !sm->handshake->ptk_complete)
+		return false;
+
+	/* 4-Way or Group Key Handshake still in progress */
+	if (sm->timeout)
+		return false;
+
+	sm->frame_retry = 0;
+	eapol_gtk_1_of_2_retry(NULL, sm);
+
+	return true;
+}
+
 static const uint8_t *eapol_find_rsne(const uint8_t *data, size_t data_len,
 				const uint8_t **optional)
 {
@@ -1785,6 +1942,36 @@ static void eapol_handle_ptk_4_of_4(struct eapol_sm *sm,
 	handshake_state_install_ptk(sm->handshake);
 }
 
+/* 802.11-2016 Section 12.7.7.3 */
+static void eapol_handle_gtk_2_of_2(struct eapol_sm *sm,
+					const struct eapol_key *ek)
+{
+	const uint8_t *kck;
+
+	l_debug("ifindex=%u", sm->handshake->ifindex);
+
+	if (!sm->timeout)
+		return; /* No Group Key Handshake in progress */
+
+	if (!eapol_verify_gtk_2_of_2(ek, false))
+		return;
+
+	if (L_BE64_TO_CPU(ek->key_replay_counter) != sm->replay_counter)
+		return;
+
+	kck = handshake_state_get_kck(sm->handshake);
+
+	if (!eapol_verify_mic(sm->handshake->akm_suite, kck, ek,
+				sm->mic_len))
+		return;
+
+	l_timeout_remove(sm->timeout);
+	sm->timeout = NULL;
+	sm->frame_retry = 0;
+
+	handshake_event(sm->handshake, HANDSHAKE_EVENT_REKEY_COMPLETE);
+}
+
 static void eapol_handle_gtk_1_of_2(struct eapol_sm *sm,
 					const struct eapol_key *ek,
 					const uint8_t *decrypted_key_data,
@@ -2199,6 +2386,11 @@ static void eapol_auth_key_handle(struct eapol_sm *sm,
 	if (!sm->handshake->have_anonce)
 		return; /* Not expecting an EAPoL-Key yet */
 
+	if (!ek->key_type) {
+		eapol_handle_gtk_2_of_2(sm, ek);
+		return;
+	}
+
 	if (!sm->handshake->ptk_complete)
 		eapol_handle_ptk_2_of_4(sm, ek);
 	else
@@ -2342,13 +2534,56 @@ void __eapol_set_rekey_offload_func(eapol_rekey_offload_func_t func)
 	rekey_offload = func;
 }
 
+static void eapol_auth_start_timeout(struct l_timeout *timeout,
+							void *user_data)
+{
+	struct eapol_sm *sm;
+
+	auth_start_count = 0;
+
+	while (auth_start_count < EAPOL_AUTH_START_BURST &&
+			(sm = l_queue_pop_head(auth_start_queue))) {
+		auth_start_count++;
+		eapol_ptk_1_of_4_retry(NULL, sm);
+	}
+
+	if (auth_start_count) {
+		l_timeout_modify_ms(timeout, EAPOL_AUTH_START_INTERVAL_MS);
+		return;
+	}
+
+	l_timeout_remove(auth_start_timeout);
+	auth_start_timeout = NULL;
+}
+
+static void eapol_auth_start(struct eapol_sm *sm)
+{
+	if (auth_start_count >= EAPOL_AUTH_START_BURST) {
+		l_debug("Deferring handshake with "MAC", %u pending",
+				MAC_STR(sm->handshake->spa),
+				l_queue_length(auth_start_queue));
+		l_queue_push_tail(auth_start_queue, sm);
+		return;
+	}
+
+	if (!auth_start_timeout)
+		auth_start_timeout = l_timeout_create_ms(
+						EAPOL_AUTH_START_INTERVAL_MS,
+						eapol_auth_start_timeout,
+						NULL, NULL);
+
+	auth_start_count++;
+	eapol_ptk_1_of_4_retry(NULL, sm);
+}
+
 void eapol_register(struct eapol_sm *sm)
 {
 	l_queue_push_head(state_machines, sm);
 
 	if (sm->handshake->authenticator) {
-		sm->watch_id = eapol_frame_watch_add(sm->handshake->ifindex,
-						eapol_rx_auth_packet, sm);
+		sm->auth_key.ifindex = sm->handshake->ifindex;
+		memcpy(sm->auth_key.spa, sm->handshake->spa, ETH_ALEN);
+		l_hashmap_replace(authenticators, &sm->auth_key, sm, NULL);
 
 		if (!sm->handshake->proto_version)
 			sm->protocol_version = EAPOL_PROTOCOL_VERSION_2004;
@@ -2360,7 +2595,7 @@ void eapol_register(struct eapol_sm *sm)
 		sm->mic_len = 16;
 
 		/* kick off handshake */
-		eapol_ptk_1_of_4_retry(NULL, sm);
+		eapol_auth_start(sm);
 	} else {
 		sm->watch_id = eapol_frame_watch_add(sm->handshake->ifindex,
 						eapol_rx_packet, sm);
@@ -2680,6 +2915,19 @@ void __eapol_rx_packet(uint32_t ifindex, const uint8_t *src, uint16_t proto,
 	if (len < sizeof(struct eapol_header) + L_BE16_TO_CPU(eh->packet_len))
 		return;
 
+	if (!l_hashmap_isempty(authenticators)) {
+		struct eapol_auth_key key = { .ifindex = ifindex };
+		struct eapol_sm *sm;
+
+		memcpy(key.spa, src, ETH_ALEN);
+
+		sm = l_hashmap_lookup(authenticators, &key);
+		if (sm)
+			eapol_rx_auth_packet(proto, src,
+					(const struct eapol_frame *) eh,
+					noencrypt, sm);
+	}
+
 	WATCHLIST_NOTIFY_MATCHES(&frame_watches,
 					eapol_frame_watch_match_ifindex,
 					L_UINT_TO_PTR(ifindex),
@@ -2708,6 +2956,12 @@ int eapol_init(void)
 {
 	state_machines = l_queue_new();
 	preauths = l_queue_new();
+
+	authenticators = l_hashmap_new();
+	l_hashmap_set_hash_function(authenticators, eapol_auth_key_hash);
+	l_hashmap_set_compare_function(authenticators, eapol_auth_key_compare);
+
+	auth_start_queue = l_queue_new();
 	watchlist_init(&frame_watches, &eapol_frame_watch_ops);
 
 	return 0;
@@ -2720,6 +2974,15 @@ void eapol_exit(void)
 
 	l_queue_destroy(state_machines, eapol_sm_destroy);
 
+	l_hashmap_destroy(authenticators, NULL);
+	authenticators = NULL;
+
+	l_queue_destroy(auth_start_queue, NULL);
+	auth_start_queue = NULL;
+	l_timeout_remove(auth_start_timeout);
+	auth_start_timeout = NULL;
+	auth_start_count = 0;
+
 	if (!l_queue_isempty(preauths))
 		l_warn("stale preauth state machines found");
 
@@ -27,6 +27,8 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <errno.h>
+#include <time.h>
+#include <sys/uio.h>
 
 #include <ell/ell.h>
 
@@ -37,8 +39,11 @@
 #include "src/erp.h"
 #include "src/crypto.h"
 #include "src/util.h"
+#include "src/storage.h"
 
 #define ERP_DEFAULT_KEY_LIFETIME_US 86400000000
+#define ERP_CACHE_KEY_LEN 32
+#define ERP_CACHE_MAX_ENTRIES 32
 
 struct erp_cache_entry {
 	char *id;
@@ -100,6 +105,8 @@ struct erp_tlv_iter {
 };
 
 static struct l_queue *key_cache;
+static uint8_t erp_cache_key[ERP_CACHE_KEY_LEN];
+static bool erp_cache_key_valid;
 
 static void erp_tlv_iter_init(struct erp_tlv_iter *iter,
 				const unsigned char *tlv, unsigned int len)
@@ -150,6 +157,7 @@ static void erp_cache_entry_destroy(void *data)
 		l_error("ERP entry still has a reference on cleanup!");
 
 	l_free(entry->id);
+	explicit_bzero(entry->emsk, entry->emsk_len);
 	l_free(entry->emsk);
 	l_free(entry->session_id);
 	l_free(entry->ssid);
@@ -157,6 +165,234 @@ static void erp_cache_entry_destroy(void *data)
 	l_free(entry);
 }
 
+/*
+ * Entries are persisted with an absolute (wall clock) expiration time since
+ * l_time_now() is only meaningful within a single boot.  Each entry carries
+ * an HMAC-SHA256 over all of its fields so that corrupted or tampered
+ * entries are dropped on load rather than used for re-authentication.
+ */
+static bool erp_cache_entry_checksum(const char *id, const char *ssid,
+					const void *session_id,
+					size_t session_len,
+					const void *emsk, size_t emsk_len,
+					uint64_t expire_secs,
+					uint8_t out[static 32])
+{
+	struct l_checksum *hmac;
+	struct iovec iov[5];
+	uint8_t expire_buf[8];
+
+	hmac = l_checksum_new_hmac(L_CHECKSUM_SHA256, erp_cache_key,
+					sizeof(erp_cache_key));
+	if (!hmac)
+		return false;
+
+	l_put_be64(expire_secs, expire_buf);
+
+	iov[0].iov_base = (void *) id;
+	iov[0].iov_len = strlen(id) + 1;
+	iov[1].iov_base = (void *) ssid;
+	iov[1].iov_len = strlen(ssid) + 1;
+	iov[2].iov_base = (void *) session_id;
+	iov[2].iov_len = session_len;
+	iov[3].iov_base = (void *) emsk;
+	iov[3].iov_len = emsk_len;
+	iov[4].iov_base = expire_buf;
+	iov[4].iov_len = sizeof(expire_buf);
+
+	l_checksum_updatev(hmac, iov, 5);
+	l_checksum_get_digest(hmac, out, 32);
+	l_checksum_free(hmac);
+
+	return true;
+}
+
+static uint64_t erp_cache_entry_expire_secs(struct erp_cache_entry *entry,
+						uint64_t now, time_t wall_now)
+{
+	if (l_time_after(now, entry->expire_time))
+		return 0;
+
+	return wall_now + l_time_to_secs(l_time_diff(now, entry->expire_time));
+}
+
+static void erp_cache_sync(void)
+{
+	const struct l_queue_entry *e;
+	struct l_settings *settings;
+	uint64_t now = l_time_now();
+	time_t wall_now = time(NULL);
+	unsigned int n = 0;
+
+	if (!erp_cache_key_valid)
+		return;
+
+	settings = l_settings_new();
+
+	for (e = l_queue_get_entries(key_cache); e; e = e->next) {
+		struct erp_cache_entry *entry = e->data;
+		uint64_t expire_secs;
+		uint8_t checksum[32];
+		char group[16];
+		char *hex;
+
+		if (entry->invalid)
+			continue;
+
+		expire_secs = erp_cache_entry_expire_secs(entry, now,
+								wall_now);
+		if (!expire_secs)
+			continue;
+
+		if (!erp_cache_entry_checksum(entry->id, entry->ssid,
+						entry->session_id,
+						entry->session_len,
+						entry->emsk, entry->emsk_len,
+						expire_secs, checksum))
+			continue;
+
+		snprintf(group, sizeof(group), "Entry%u", n++);
+
+		l_settings_set_string(settings, group, "Identity", entry->id);
+		l_settings_set_string(settings, group, "SSID", entry->ssid);
+
+		hex = l_util_hexstring(entry->session_id, entry->session_len);
+		l_settings_set_string(settings, group, "SessionId", hex);
+		l_free(hex);
+
+		hex = l_util_hexstring(entry->emsk, entry->emsk_len);
+		l_settings_set_string(settings, group, "EMSK", hex);
+		explicit_bzero(hex, strlen(hex));
+		l_free(hex);
+
+		l_settings_set_uint64(settings, group, "ExpireTime",
+					expire_secs);
+
+		hex = l_util_hexstring(checksum, sizeof(checksum));
+		l_settings_set_string(settings, group, "Checksum", hex);
+		l_free(hex);
+
+		if (n == ERP_CACHE_MAX_ENTRIES)
+			break;
+	}
+
+	storage_erp_cache_sync(settings);
+	l_settings_free(settings);
+}
+
+static void erp_cache_load_entry(struct l_settings *settings,
+					const char *group, uint64_t now,
+					time_t wall_now)
+{
+	struct erp_cache_entry *entry = NULL;
+	char *id = NULL;
+	char *ssid = NULL;
+	char *hex = NULL;
+	uint8_t *session_id = NULL;
+	uint8_t *emsk = NULL;
+	uint8_t *checksum = NULL;
+	size_t session_len;
+	size_t emsk_len = 0;
+	size_t checksum_len;
+	uint8_t expected[32];
+	uint64_t expire_secs;
+
+	id = l_settings_get_string(settings, group, "Identity");
+	ssid = l_settings_get_string(settings, group, "SSID");
+	if (!id || !ssid)
+		goto done;
+
+	if (!l_settings_get_uint64(settings, group, "ExpireTime",
+					&expire_secs))
+		goto done;
+
+	if (expire_secs <= (uint64_t) wall_now) {
+		l_debug("Dropping expired ERP cache entry for %s", id);
+		goto done;
+	}
+
+	hex = l_settings_get_string(settings, group, "SessionId");
+	if (!hex || !(session_id = l_util_from_hexstring(hex, &session_len)))
+		goto done;
+
+	l_free(hex);
+
+	hex = l_settings_get_string(settings, group, "EMSK");
+	if (!hex || !(emsk = l_util_from_hexstring(hex, &emsk_len)))
+		goto done;
+
+	explicit_bzero(hex, strlen(hex));
+	l_free(hex);
+
+	hex = l_settings_get_string(settings, group, "Checksum");
+	if (!hex || !(checksum = l_util_from_hexstring(hex, &checksum_len)))
+		goto done;
+
+	if (checksum_len != sizeof(expected) ||
+			!erp_cache_entry_checksum(id, ssid, session_id,
+						session_len, emsk, emsk_len,
+						expire_secs, expected) ||
+			memcmp(checksum, expected, sizeof(expected))) {
+		l_warn("ERP cache entry for %s failed integrity check", id);
+		goto done;
+	}
+
+	entry = l_new(struct erp_cache_entry, 1);
+
+	entry->id = id;
+	entry->emsk = l_memdup(emsk, emsk_len);
+	entry->emsk_len = emsk_len;
+	entry->session_id = session_id;
+	entry->session_len = session_len;
+	entry->ssid = ssid;
+	entry->expire_time = l_time_offset(now,
+				(expire_secs - wall_now) * L_USEC_PER_SEC);
+
+	l_queue_push_tail(key_cache, entry);
+
+	id = NULL;
+	ssid = NULL;
+	session_id = NULL;
+
+done:
+	if (emsk) {
+		explicit_bzero(emsk, emsk_len);
+		l_free(emsk);
+	}
+
+	l_free(checksum);
+	l_free(session_id);
+	l_free(hex);
+	l_free(ssid);
+	l_free(id);
+}
+
+static void erp_cache_load(void)
+{
+	struct l_settings *settings;
+	char **groups;
+	unsigned int i;
+	uint64_t now = l_time_now();
+	time_t wall_now = time(NULL);
+
+	if (!erp_cache_key_valid)
+		return;
+
+	settings = storage_erp_cache_load();
+	if (!settings)
+		return;
+
+	groups = l_settings_get_groups(settings);
+
+	for (i = 0; groups[i]; i++)
+		erp_cache_load_entry(settings, groups[i], now, wall_now);
+
+	l_strv_free(groups);
+	l_settings_free(settings);
+
+	l_debug("Loaded %u ERP cache entries", l_queue_length(key_cache));
+}
+
 void erp_cache_add(const char *id, const void *session_id,
 			size_t session_len, const void *emsk, size_t emsk_len,
 			const char *ssid)
@@ -178,6 +414,8 @@ void erp_cache_add(const char *id, const void *session_id,
 					ERP_DEFAULT_KEY_LIFETIME_US);
 
 	l_queue_push_head(key_cache, entry);
+
+	erp_cache_sync();
 }
 
 static struct erp_cache_entry *find_keycache(const char *id, const char *ssid)
@@ -223,12 +461,15 @@ void erp_cache_remove(const char *id)
 
 	if (entry->ref) {
 		entry->invalid = true;
+		erp_cache_sync();
 		return;
 	}
 
 	l_queue_remove(key_cache, entry);
 
 	erp_cache_entry_destroy(entry);
+
+	erp_cache_sync();
 }
 
 struct erp_cache_entry *erp_cache_get(const char *ssid)
@@ -532,12 +773,24 @@ static int erp_init(void)
 {
 	key_cache = l_queue_new();
 
+	erp_cache_key_valid = storage_erp_cache_get_key(erp_cache_key,
+							sizeof(erp_cache_key));
+	if (!erp_cache_key_valid)
+		l_warn("Unable to obtain ERP cache key, not persisting cache");
+
+	erp_cache_load();
+
 	return 0;
 }
 
 static void erp_exit(void)
 {
+	erp_cache_sync();
+
 	l_queue_destroy(key_cache, erp_cache_entry_destroy);
+
+	explicit_bzero(erp_cache_key, sizeof(erp_cache_key));
+	erp_cache_key_valid = false;
 }
 
 IWD_MODULE(erp, erp_init, erp_exit)
@@ -2425,6 +2425,142 @@ int ie_parse_neighbor_report(struct ie_tlv_iter *iter,
 	return 0;
 }
 
+static bool ie_rnr_entry_parse(const uint8_t *data, size_t len,
+				size_t *entry_len, uint8_t *out_type,
+				uint8_t *out_count, uint8_t *out_info_len)
+{
+	uint16_t header;
+	uint8_t count;
+	uint8_t info_len;
+
+	/* TBTT Information Header, Operating Class and Channel Number */
+	if (len < 4)
+		return false;
+
+	header = l_get_le16(data);
+	count = util_bit_field(header, 4, 4) + 1;
+	info_len = header >> 8;
+
+	if (!info_len || len - 4 < (size_t) count * info_len)
+		return false;
+
+	*entry_len = 4 + count * info_len;
+	*out_type = util_bit_field(header, 0, 2);
+	*out_count = count;
+	*out_info_len = info_len;
+
+	return true;
+}
+
+/*
+ * 802.11-2020, 9.4.2.170.2: the TBTT Information field layout is implied by
+ * its length.  All layouts start with the 1-octet Neighbor AP
+ * TBTT Offset, optional BSSID, Short-SSID and BSS Parameters follow in that
+ * order.  Lengths beyond 13 are reserved for future extensions of the 13
+ * octet layout.
+ */
+static void ie_rnr_tbtt_info_parse(const uint8_t *data, uint8_t len,
+					struct ie_rnr_info *info)
+{
+	switch (len) {
+	case 2:
+		info->bss_params = data[1];
+		info->bss_params_present = true;
+		break;
+	case 5:
+	case 6:
+		info->short_ssid = l_get_le32(data + 1);
+		info->short_ssid_present = true;
+
+		if (len == 6) {
+			info->bss_params = data[5];
+			info->bss_params_present = true;
+		}
+
+		break;
+	case 7:
+	case 8:
+	case 9:
+	case 10:
+		memcpy(info->addr, data + 1, 6);
+		info->addr_present = true;
+
+		if (len >= 8) {
+			info->bss_params = data[7];
+			info->bss_params_present = true;
+		}
+
+		break;
+	default:
+		if (len < 11)
+			break;
+
+		memcpy(info->addr, data + 1, 6);
+		info->addr_present = true;
+		info->short_ssid = l_get_le32(data + 7);
+		info->short_ssid_present = true;
+
+		if (len >= 12) {
+			info->bss_params = data[11];
+			info->bss_params_present = true;
+		}
+
+		break;
+	}
+}
+
+/*
+ * Calls @func for each TBTT Information field in the Reduced Neighbor Report
+ * element.  The whole element is validated first so that nothing is
+ * reported for a truncated element.
+ */
+int ie_parse_reduced_neighbor_report(struct ie_tlv_iter *iter,
+					ie_rnr_func_t func, void *user_data)
+{
+	unsigned int len = ie_tlv_iter_get_length(iter);
+	const uint8_t *data = ie_tlv_iter_get_data(iter);
+	const uint8_t *pos;
+	size_t left;
+	size_t entry_len;
+	uint8_t type;
+	uint8_t count;
+	uint8_t info_len;
+
+	if (!len)
+		return -EINVAL;
+
+	for (pos = data, left = len; left; pos += entry_len, left -= entry_len)
+		if (!ie_rnr_entry_parse(pos, left, &entry_len, &type, &count,
+					&info_len))
+			return -EINVAL;
+
+	for (pos = data, left = len; left; pos += entry_len,
+						left -= entry_len) {
+		const uint8_t *tbtt_info;
+		unsigned int i;
+
+		ie_rnr_entry_parse(pos, left, &entry_len, &type, &count,
+					&info_len);
+
+		/* Only the Neighbor AP TBTT Offset type (0) is defined */
+		if (type != 0)
+			continue;
+
+		for (i = 0, tbtt_info = pos + 4; i < count;
+						i++, tbtt_info += info_len) {
+			struct ie_rnr_info info;
+
+			memset(&info, 0, sizeof(info));
+			info.oper_class = pos[2];
+			info.channel_num = pos[3];
+			ie_rnr_tbtt_info_parse(tbtt_info, info_len, &info);
+
+			func(&info, user_data);
+		}
+	}
+
+	return 0;
+}
 
 int ie_parse_roaming_consortium(struct ie_tlv_iter *iter, size_t *num_anqp_out,
 				const uint8_t **oi1_out, size_t *oi1_len_out,
@@ -395,6 +395,32 @@ struct ie_neighbor_report_info {
 	bool bss_transition_pref_present : 1;
 };
 
+/* 802.11-2020, 9.4.2.170.2: BSS Parameters subfield */
+enum ie_rnr_bss_param {
+	IE_RNR_BSS_PARAM_OCT_RECOMMENDED	= 0x01,
+	IE_RNR_BSS_PARAM_SAME_SSID		= 0x02,
+	IE_RNR_BSS_PARAM_MULTIPLE_BSSID		= 0x04,
+	IE_RNR_BSS_PARAM_TRANSMITTED_BSSID	= 0x08,
+	IE_RNR_BSS_PARAM_MEMBER_ESS_COLOC	= 0x10,
+	IE_RNR_BSS_PARAM_UNSOLICITED_PROBE_RESP	= 0x20,
+	IE_RNR_BSS_PARAM_COLOCATED_AP		= 0x40,
+};
+
+/* One TBTT Information field of a Reduced Neighbor Report element */
+struct ie_rnr_info {
+	uint8_t oper_class;
+	uint8_t channel_num;
+	uint8_t addr[6];
+	uint32_t short_ssid;
+	uint8_t bss_params;
+	bool addr_present : 1;
+	bool short_ssid_present : 1;
+	bool bss_params_present : 1;
+};
+
+typedef void (*ie_rnr_func_t)(const struct ie_rnr_info *info,
+				void *user_data);
+
 extern const unsigned char ieee_oui[3];
 extern const unsigned char microsoft_oui[3];
 extern const unsigned char wifi_alliance_oui[3];
@@ -501,6 +527,8 @@ bool ie_build_fast_bss_transition(const struct ie_ft_info *info,
 
 int ie_parse_neighbor_report(struct ie_tlv_iter *iter,
 				struct ie_neighbor_report_info *info);
+int ie_parse_reduced_neighbor_report(struct ie_tlv_iter *iter,
+					ie_rnr_func_t func, void *user_data);
 
 int ie_parse_osen_from_data(const uint8_t *data, size_t len,
 				struct ie_rsn_info *info);
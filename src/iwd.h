@@ -32,6 +32,16 @@
 struct l_genl;
 struct l_genl_family;
 
+enum iwd_startup_phase {
+	IWD_STARTUP_PHASE_WIPHY_DUMP,
+	IWD_STARTUP_PHASE_INTERFACE_SETUP,
+	IWD_STARTUP_PHASE_STATION_CREATED,
+	IWD_STARTUP_PHASE_FIRST_SCAN,
+	IWD_STARTUP_PHASE_CONNECTED,
+};
+
+void iwd_startup_phase_done(enum iwd_startup_phase phase);
+
 const struct l_settings *iwd_get_config(void);
 struct l_genl *iwd_get_genl(void);
 struct l_netlink *iwd_get_rtnl(void);
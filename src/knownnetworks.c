@@ -827,7 +827,7 @@ static struct l_queue *known_frequencies_from_string(char *freq_set_str)
 
 		t = strtoul(freq_set_str, &freq_set_str, 10);
 
-		if (unlikely(errno == ERANGE || !t || t > 6000))
+		if (unlikely(errno == ERANGE || !t || t > 7125))
 			goto error;
 
 		known_freq = l_new(struct known_frequency, 1);
@@ -27,6 +27,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <getopt.h>
 #include <signal.h>
 #include <dirent.h>
@@ -62,6 +63,9 @@ static const char *noplugins;
 static const char *debugopt;
 static bool terminating;
 static bool nl80211_complete;
+static uint64_t startup_time;
+static uint64_t startup_last_phase_time;
+static uint32_t startup_phases_done;
 
 static void main_loop_quit(struct l_timeout *timeout, void *user_data)
 {
@@ -176,6 +180,46 @@ const char *iwd_get_phy_blacklist(void)
 	return nophys;
 }
 
+static const char *startup_phase_to_string(enum iwd_startup_phase phase)
+{
+	switch (phase) {
+	case IWD_STARTUP_PHASE_WIPHY_DUMP:
+		return "wiphy dump";
+	case IWD_STARTUP_PHASE_INTERFACE_SETUP:
+		return "interface setup";
+	case IWD_STARTUP_PHASE_STATION_CREATED:
+		return "station creation";
+	case IWD_STARTUP_PHASE_FIRST_SCAN:
+		return "first scan";
+	case IWD_STARTUP_PHASE_CONNECTED:
+		return "connected";
+	}
+
+	return "unknown";
+}
+
+/*
+ * Records the startup timeline.  Only the first occurrence of each phase is
+ * logged, later ones (e.g. hotplugged wiphys, subsequent scans) are ignored.
+ */
+void iwd_startup_phase_done(enum iwd_startup_phase phase)
+{
+	uint64_t now;
+
+	if (startup_phases_done & (1U << phase))
+		return;
+
+	startup_phases_done |= 1U << phase;
+	now = l_time_now();
+
+	l_info("Startup: %s done after %" PRIu64 " ms (+%" PRIu64 " ms)",
+		startup_phase_to_string(phase),
+		l_time_diff(startup_time, now) / 1000,
+		l_time_diff(startup_last_phase_time, now) / 1000);
+
+	startup_last_phase_time = now;
+}
+
 static void usage(void)
 {
 	printf("iwd - Wireless daemon\n"
@@ -433,6 +477,9 @@ int main(int argc, char *argv[])
 	char **config_dirs;
     int i;
 
+	startup_time = l_time_now();
+	startup_last_phase_time = startup_time;
+
 	for (;;) {
 		int opt;
 
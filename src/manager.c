@@ -29,6 +29,7 @@
 #include <errno.h>
 #include <linux/if_ether.h>
 #include <fnmatch.h>
+#include <dirent.h>
 
 #include <ell/ell.h>
 
@@ -43,12 +44,14 @@
 #include "src/common.h"
 #include "src/nl80211cmd.h"
 #include "src/p2p.h"
+#include "src/storage.h"
 
 static struct l_genl_family *nl80211 = NULL;
 static char **whitelist_filter;
 static char **blacklist_filter;
 static bool randomize;
 static bool use_default;
+static bool reuse_interface;
 
 struct wiphy_setup_state {
 	uint32_t id;
@@ -56,6 +59,8 @@ struct wiphy_setup_state {
 	unsigned int pending_cmd_count;
 	bool aborted;
 	bool retry;
+	bool complete;
+	bool interfaces_dumped;
 
 	/*
 	 * Data we may need if the driver does not seem to support interface
@@ -64,6 +69,12 @@ struct wiphy_setup_state {
 	 */
 	bool use_default;
 	struct l_genl_msg *default_if_msg;
+
+	/*
+	 * A compatible station interface found during the interface dump
+	 * that we take over as is instead of deleting and recreating it.
+	 */
+	struct l_genl_msg *reuse_if_msg;
 };
 
 static struct l_queue *pending_wiphys;
@@ -93,14 +104,24 @@ static void wiphy_setup_state_free(void *data)
 	if (state->default_if_msg)
 		l_genl_msg_unref(state->default_if_msg);
 
+	if (state->reuse_if_msg)
+		l_genl_msg_unref(state->reuse_if_msg);
+
 	L_WARN_ON(state->pending_cmd_count);
 	l_free(state);
 }
 
+static void manager_check_setup_complete(void)
+{
+	if (l_queue_isempty(pending_wiphys))
+		iwd_startup_phase_done(IWD_STARTUP_PHASE_INTERFACE_SETUP);
+}
+
 static void wiphy_setup_state_destroy(struct wiphy_setup_state *state)
 {
 	l_queue_remove(pending_wiphys, state);
 	wiphy_setup_state_free(state);
+	manager_check_setup_complete();
 }
 
 static bool manager_use_default(struct wiphy_setup_state *state)
@@ -126,6 +147,21 @@ static bool manager_use_default(struct wiphy_setup_state *state)
 	return true;
 }
 
+static void manager_reuse_interface(struct wiphy_setup_state *state)
+{
+	uint8_t addr_buf[6];
+	uint8_t *addr = NULL;
+
+	l_debug("");
+
+	if (randomize) {
+		wiphy_generate_random_address(state->wiphy, addr_buf);
+		addr = addr_buf;
+	}
+
+	netdev_create_from_genl(state->reuse_if_msg, addr);
+}
+
 static void manager_new_station_interface_cb(struct l_genl_msg *msg,
 						void *user_data)
 {
@@ -222,6 +258,11 @@ static void manager_create_interfaces(struct wiphy_setup_state *state)
 		goto try_create_p2p;
 	}
 
+	if (state->reuse_if_msg) {
+		manager_reuse_interface(state);
+		goto try_create_p2p;
+	}
+
 	/*
 	 * Current policy: we maintain one netdev per wiphy for station,
 	 * AP and Ad-Hoc modes, one optional p2p-device and zero or more
@@ -342,6 +383,36 @@ static void manager_del_interface_cb(struct l_genl_msg *msg, void *user_data)
 	}
 }
 
+/*
+ * An existing interface can be taken over in place if it is already a plain
+ * (non-4addr) station interface.  This saves a DEL_INTERFACE/NEW_INTERFACE
+ * round trip and the associated driver reinitialization at startup, at the
+ * cost of the interface not being tied to our netlink socket.
+ */
+static bool manager_interface_is_reusable(struct l_genl_msg *msg,
+						uint32_t iftype)
+{
+	struct l_genl_attr attr;
+	uint16_t type, len;
+	const void *data;
+
+	if (iftype != NL80211_IFTYPE_STATION)
+		return false;
+
+	if (!l_genl_attr_init(&attr, msg))
+		return false;
+
+	while (l_genl_attr_next(&attr, &type, &len, &data)) {
+		if (type != NL80211_ATTR_4ADDR)
+			continue;
+
+		if (len != 1 || l_get_u8(data))
+			return false;
+	}
+
+	return true;
+}
+
 static void manager_get_interface_cb(struct l_genl_msg *msg, void *user_data)
 {
 	struct wiphy_setup_state *state = user_data;
@@ -411,6 +482,13 @@ static void manager_get_interface_cb(struct l_genl_msg *msg, void *user_data)
 			!blacklisted)
 		state->default_if_msg = l_genl_msg_ref(msg);
 
+	if (reuse_interface && !state->use_default && !state->reuse_if_msg &&
+			manager_interface_is_reusable(msg, iftype)) {
+		l_debug("Reusing interface %s (%u)", ifname, ifindex);
+		state->reuse_if_msg = l_genl_msg_ref(msg);
+		return;
+	}
+
 delete_interface:
 	if (state->use_default)
 		return;
@@ -487,7 +565,7 @@ static void manager_interface_dump_callback(struct l_genl_msg *msg,
 	l_debug("");
 
 	state = manager_find_pending(manager_parse_wiphy_id(msg));
-	if (!state)
+	if (!state || !state->complete || state->interfaces_dumped)
 		return;
 
 	manager_get_interface_cb(msg, state);
@@ -497,6 +575,16 @@ static bool manager_check_create_interfaces(void *data, void *user_data)
 {
 	struct wiphy_setup_state *state = data;
 
+	/*
+	 * Wiphys brought up from a capability snapshot have their
+	 * interfaces dumped before the GET_WIPHY dump, don't process
+	 * them twice and don't touch wiphys not yet fully dumped.
+	 */
+	if (!state->complete || state->interfaces_dumped)
+		return false;
+
+	state->interfaces_dumped = true;
+
 	if (!manager_wiphy_check_setup_done(state))
 		return false;
 
@@ -509,6 +597,7 @@ static void manager_interface_dump_done(void *user_data)
 {
 	l_queue_foreach_remove(pending_wiphys,
 				manager_check_create_interfaces, NULL);
+	manager_check_setup_complete();
 }
 
 /* We are dumping multiple wiphys for the very first time */
@@ -558,39 +647,50 @@ static void manager_wiphy_filtered_dump_callback(struct l_genl_msg *msg,
 	wiphy_update_from_genl(state->wiphy, msg);
 }
 
-static void manager_wiphy_dump_done(void *user_data)
+static void manager_wiphy_setup_complete(struct wiphy_setup_state *state)
 {
-	const struct l_queue_entry *e;
+	wiphy_create_complete(state->wiphy);
+	state->complete = true;
+	state->use_default = use_default;
+
+	/* If whitelist/blacklist were given only try to use existing
+	 * interfaces same as when the driver does not support
+	 * NEW_INTERFACE or DEL_INTERFACE, otherwise the interface
+	 * names will become meaningless after we've created our own
+	 * interface(s).  Optimally phy name white/blacklists should
+	 * be used.
+	 */
+	if (whitelist_filter || blacklist_filter)
+		state->use_default = true;
 
-	for (e = l_queue_get_entries(pending_wiphys); e; e = e->next) {
-		struct wiphy_setup_state *state = e->data;
+	if (!state->use_default) {
+		const char *driver = wiphy_get_driver(state->wiphy);
+		const char **e;
+
+		for (e = default_if_driver_list; *e; e++)
+			if (fnmatch(*e, driver, 0) == 0)
+				state->use_default = true;
+	}
 
-		wiphy_create_complete(state->wiphy);
-		state->use_default = use_default;
+	if (state->use_default)
+		l_info("Wiphy %s will only use the default interface",
+			wiphy_get_name(state->wiphy));
+}
 
-		/* If whitelist/blacklist were given only try to use existing
-		 * interfaces same as when the driver does not support
-		 * NEW_INTERFACE or DEL_INTERFACE, otherwise the interface
-		 * names will become meaningless after we've created our own
-		 * interface(s).  Optimally phy name white/blacklists should
-		 * be used.
-		 */
-		if (whitelist_filter || blacklist_filter)
-			state->use_default = true;
+static void manager_wiphy_dump_done(void *user_data)
+{
+	const struct l_queue_entry *e;
 
-		if (!state->use_default) {
-			const char *driver = wiphy_get_driver(state->wiphy);
-			const char **e;
+	iwd_startup_phase_done(IWD_STARTUP_PHASE_WIPHY_DUMP);
 
-			for (e = default_if_driver_list; *e; e++)
-				if (fnmatch(*e, driver, 0) == 0)
-					state->use_default = true;
-		}
+	for (e = l_queue_get_entries(pending_wiphys); e; e = e->next) {
+		struct wiphy_setup_state *state = e->data;
 
-		if (state->use_default)
-			l_info("Wiphy %s will only use the default interface",
-				wiphy_get_name(state->wiphy));
+		if (!state->complete)
+			manager_wiphy_setup_complete(state);
 	}
+
+	wiphy_validate_snapshots();
 }
 
 static int manager_wiphy_filtered_dump(uint32_t wiphy_id,
@@ -781,6 +881,64 @@ static void manager_config_notify(struct l_genl_msg *msg, void *user_data)
 	}
 }
 
+/*
+ * Create the wiphys for which we have a capability snapshot straight from
+ * sysfs so that their interfaces can be set up without waiting for the
+ * full GET_WIPHY dump, which then only serves to validate the snapshots.
+ */
+static bool manager_create_from_snapshots(void)
+{
+	DIR *dir;
+	struct dirent *dirent;
+	bool found = false;
+
+	dir = opendir("/sys/class/ieee80211");
+	if (!dir)
+		return false;
+
+	while ((dirent = readdir(dir))) {
+		struct wiphy_setup_state *state;
+		struct wiphy *wiphy;
+		char buf[16];
+		char *end;
+		ssize_t len;
+		unsigned long id;
+
+		if (dirent->d_name[0] == '.')
+			continue;
+
+		len = read_file(buf, sizeof(buf) - 1,
+				"/sys/class/ieee80211/%s/index",
+				dirent->d_name);
+		if (len <= 0)
+			continue;
+
+		buf[len] = '\0';
+		errno = 0;
+		id = strtoul(buf, &end, 10);
+		if (errno || end == buf || id > UINT32_MAX)
+			continue;
+
+		wiphy = wiphy_create_from_snapshot(id, dirent->d_name);
+		if (!wiphy)
+			continue;
+
+		state = l_new(struct wiphy_setup_state, 1);
+		state->id = id;
+		state->wiphy = wiphy;
+
+		l_debug("New wiphy %s added from snapshot (%lu)",
+			dirent->d_name, id);
+
+		l_queue_push_tail(pending_wiphys, state);
+		manager_wiphy_setup_complete(state);
+		found = true;
+	}
+
+	closedir(dir);
+	return found;
+}
+
 static int manager_init(void)
 {
 	struct l_genl *genl = iwd_get_genl();
@@ -800,6 +958,29 @@ static int manager_init(void)
 	if (if_blacklist)
 		blacklist_filter = l_strsplit(if_blacklist, ',');
 
+	randomize_str = l_settings_get_value(config, "General",
+							"AddressRandomization");
+	if (randomize_str) {
+		if (!strcmp(randomize_str, "once"))
+			randomize = true;
+		else if (!strcmp(randomize_str, "disabled"))
+			randomize = false;
+	}
+
+	if (!l_settings_get_bool(config, "General",
+				"UseDefaultInterface", &use_default)) {
+		if (!l_settings_get_bool(config, "General",
+					"use_default_interface", &use_default))
+			use_default = false;
+		else
+			l_warn("[General].use_default_interface is deprecated"
+					", please use UseDefaultInterface");
+	}
+
+	if (!l_settings_get_bool(config, "General", "ReuseStationInterface",
+					&reuse_interface))
+		reuse_interface = false;
+
 	pending_wiphys = l_queue_new();
 
 	if (!l_genl_family_register(nl80211, "config", manager_config_notify,
@@ -808,6 +989,21 @@ static int manager_init(void)
 		goto error;
 	}
 
+	/*
+	 * Dump the interfaces of the snapshot wiphys first, the requests
+	 * are handled in order so this goes ahead of the wiphy dump.
+	 */
+	if (manager_create_from_snapshots()) {
+		msg = l_genl_msg_new(NL80211_CMD_GET_INTERFACE);
+
+		if (!l_genl_family_dump(nl80211, msg,
+					manager_interface_dump_callback,
+					NULL, manager_interface_dump_done)) {
+			l_error("Snapshot interface information dump failed");
+			l_genl_msg_unref(msg);
+		}
+	}
+
 	msg = l_genl_msg_new_sized(NL80211_CMD_GET_WIPHY, 128);
 	l_genl_msg_append_attr(msg, NL80211_ATTR_SPLIT_WIPHY_DUMP, 0, NULL);
 	wiphy_dump = l_genl_family_dump(nl80211, msg,
@@ -832,29 +1028,10 @@ static int manager_init(void)
 		goto error;
 	}
 
-	randomize_str = l_settings_get_value(config, "General",
-							"AddressRandomization");
-	if (randomize_str) {
-		if (!strcmp(randomize_str, "once"))
-			randomize = true;
-		else if (!strcmp(randomize_str, "disabled"))
-			randomize = false;
-	}
-
-	if (!l_settings_get_bool(config, "General",
-				"UseDefaultInterface", &use_default)) {
-		if (!l_settings_get_bool(config, "General",
-					"use_default_interface", &use_default))
-			use_default = false;
-		else
-			l_warn("[General].use_default_interface is deprecated"
-					", please use UseDefaultInterface");
-	}
-
 	return 0;
 
 error:
-	l_queue_destroy(pending_wiphys, NULL);
+	l_queue_destroy(pending_wiphys, wiphy_setup_state_free);
 	pending_wiphys = NULL;
 
 	l_genl_family_free(nl80211);
@@ -874,6 +1051,8 @@ static void manager_exit(void)
 	l_genl_family_free(nl80211);
 	nl80211 = NULL;
 	randomize = false;
+	reuse_interface = false;
 }
 
 IWD_MODULE(manager, manager_init, manager_exit);
+IWD_MODULE_DEPENDS(manager, wiphy);
@@ -25,10 +25,15 @@
 #endif
 
 #include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
 #include <arpa/inet.h>
+#include <net/if.h>
 #include <net/if_arp.h>
 #include <netinet/if_ether.h>
 #include <netinet/in.h>
+#include <linux/if_packet.h>
 #include <linux/rtnetlink.h>
 
 #include <ell/ell.h>
@@ -40,6 +45,8 @@
 #include "src/common.h"
 #include "src/network.h"
 #include "src/resolve.h"
+#include "src/storage.h"
+#include "src/util.h"
 #include "src/netconfig.h"
 
 struct netconfig {
@@ -51,10 +58,40 @@ struct netconfig {
 
 	const struct l_settings *active_settings;
 
+	char *lease_key;
+	uint8_t lease_bssid[ETH_ALEN];
+	struct netconfig_lease *cached_lease;
+	uint64_t dhcp_start_time;
+
+	uint8_t mac_address[ETH_ALEN];
+	struct l_io *dna_io;
+	struct l_timeout *dna_timeout;
+	struct l_idle *dna_idle;
+	unsigned int dna_attempts;
+	struct in_addr dna_address;
+	struct in_addr dna_gateway;
+	uint8_t dna_gateway_mac[ETH_ALEN];
+
 	netconfig_notify_func_t notify;
 	void *user_data;
 };
 
+/*
+ * A DHCPv4 lease remembered from a previous connection to the same network.
+ * It is applied right away on reconnect while the DHCP client confirms or
+ * replaces it in the background.  Since the same profile may be used for
+ * unrelated networks, the lease is only reused when connecting through one
+ * of the BSSes it has been obtained on.
+ */
+struct netconfig_lease {
+	char *address;
+	char *netmask;
+	char *broadcast;
+	char *gateway;
+	char **dns;
+	char *domain_name;
+};
+
 struct netconfig_ifaddr {
 	uint8_t family;
 	uint8_t prefix_len;
@@ -64,6 +101,14 @@ struct netconfig_ifaddr {
 
 static struct l_netlink *rtnl;
 static struct l_queue *netconfig_list;
+static struct l_settings *lease_cache;
+
+/*
+ * Detecting Network Attachment (RFC 4436) after a roam: the gateway is
+ * probed every DNA_PROBE_INTERVAL_MS, up to DNA_PROBE_ATTEMPTS times.
+ */
+#define DNA_PROBE_INTERVAL_MS 100
+#define DNA_PROBE_ATTEMPTS 3
 
 /*
  * Routing priority offset, configurable in main.conf. The route with lower
@@ -88,12 +133,44 @@ static void netconfig_ifaddr_destroy(void *data)
 	l_free(ifaddr);
 }
 
+static void netconfig_lease_free(struct netconfig_lease *lease)
+{
+	if (!lease)
+		return;
+
+	l_free(lease->address);
+	l_free(lease->netmask);
+	l_free(lease->broadcast);
+	l_free(lease->gateway);
+	l_strv_free(lease->dns);
+	l_free(lease->domain_name);
+
+	l_free(lease);
+}
+
+static void netconfig_dna_stop(struct netconfig *netconfig)
+{
+	l_timeout_remove(netconfig->dna_timeout);
+	netconfig->dna_timeout = NULL;
+
+	l_idle_remove(netconfig->dna_idle);
+	netconfig->dna_idle = NULL;
+
+	l_io_destroy(netconfig->dna_io);
+	netconfig->dna_io = NULL;
+}
+
 static void netconfig_free(void *data)
 {
 	struct netconfig *netconfig = data;
 
+	netconfig_dna_stop(netconfig);
+
 	l_dhcp_client_destroy(netconfig->dhcp_client);
 
+	netconfig_lease_free(netconfig->cached_lease);
+	l_free(netconfig->lease_key);
+
 	l_queue_destroy(netconfig->ifaddr_list, netconfig_ifaddr_destroy);
 
 	l_free(netconfig);
@@ -116,6 +193,30 @@ static struct netconfig *netconfig_find(uint32_t ifindex)
 	return NULL;
 }
 
+static struct netconfig_ifaddr *netconfig_lease_get_ifaddr(
+					const struct netconfig_lease *lease)
+{
+	struct netconfig_ifaddr *ifaddr;
+	struct in_addr in_addr;
+
+	if (!lease)
+		return NULL;
+
+	ifaddr = l_new(struct netconfig_ifaddr, 1);
+	ifaddr->ip = l_strdup(lease->address);
+
+	if (lease->netmask && inet_pton(AF_INET, lease->netmask, &in_addr) > 0)
+		ifaddr->prefix_len = __builtin_popcountl(
+						L_BE32_TO_CPU(in_addr.s_addr));
+	else
+		ifaddr->prefix_len = 24;
+
+	ifaddr->broadcast = l_strdup(lease->broadcast);
+	ifaddr->family = AF_INET;
+
+	return ifaddr;
+}
+
 static struct netconfig_ifaddr *netconfig_ipv4_get_ifaddr(
 						struct netconfig *netconfig,
 						uint8_t proto)
@@ -172,7 +273,8 @@ static struct netconfig_ifaddr *netconfig_ipv4_get_ifaddr(
 	case RTPROT_DHCP:
 		lease = l_dhcp_client_get_lease(netconfig->dhcp_client);
 		if (!lease)
-			return NULL;
+			return netconfig_lease_get_ifaddr(
+						netconfig->cached_lease);
 
 		ip = l_dhcp_lease_get_address(lease);
 		if (!ip)
@@ -218,10 +320,13 @@ static char *netconfig_ipv4_get_gateway(struct netconfig *netconfig)
 
 	case RTPROT_DHCP:
 		lease = l_dhcp_client_get_lease(netconfig->dhcp_client);
-		if (!lease)
-			return NULL;
+		if (lease)
+			return l_dhcp_lease_get_gateway(lease);
 
-		return l_dhcp_lease_get_gateway(lease);
+		if (netconfig->cached_lease)
+			return l_strdup(netconfig->cached_lease->gateway);
+
+		return NULL;
 	}
 
 	return NULL;
@@ -268,10 +373,13 @@ static char **netconfig_ipv4_get_dns(struct netconfig *netconfig, uint8_t proto)
 
 	if (proto == RTPROT_DHCP) {
 		lease = l_dhcp_client_get_lease(netconfig->dhcp_client);
-		if (!lease)
-			return NULL;
+		if (lease)
+			return l_dhcp_lease_get_dns(lease);
+
+		if (netconfig->cached_lease)
+			return l_strv_copy(netconfig->cached_lease->dns);
 
-		return l_dhcp_lease_get_dns(lease);
+		return NULL;
 	}
 
 	return NULL;
@@ -293,10 +401,13 @@ static char *netconfig_ipv4_get_domain_name(struct netconfig *netconfig,
 		return NULL;
 
 	lease = l_dhcp_client_get_lease(netconfig->dhcp_client);
-	if (!lease)
-		return NULL;
+	if (lease)
+		return l_dhcp_lease_get_domain_name(lease);
 
-	return l_dhcp_lease_get_domain_name(lease);
+	if (netconfig->cached_lease)
+		return l_strdup(netconfig->cached_lease->domain_name);
+
+	return NULL;
 }
 
 static struct netconfig_ifaddr *netconfig_ipv6_get_ifaddr(
@@ -673,6 +784,14 @@ static void netconfig_route_add_cmd_cb(int error, uint16_t type,
 	if (!netconfig->notify)
 		return;
 
+	if (netconfig->rtm_protocol == RTPROT_DHCP && netconfig->dhcp_start_time)
+		l_info("netconfig: IPv4 configured on interface %u in %" PRIu64
+			" ms using %s", netconfig->ifindex,
+			l_time_to_msecs(l_time_diff(netconfig->dhcp_start_time,
+							l_time_now())),
+			netconfig->cached_lease ? "cached lease" : "DHCPv4");
+
+	netconfig->dhcp_start_time = 0;
 	netconfig->notify(NETCONFIG_EVENT_CONNECTED, netconfig->user_data);
 	netconfig->notify = NULL;
 }
@@ -741,14 +860,36 @@ static bool netconfig_ipv4_routes_install(struct netconfig *netconfig,
 	return true;
 }
 
+static void netconfig_ipv4_dns_install(struct netconfig *netconfig)
+{
+	char **dns;
+	char *domain_name;
+
+	dns = netconfig_ipv4_get_dns(netconfig, netconfig->rtm_protocol);
+	if (!dns) {
+		l_error("netconfig: Failed to obtain DNS addresses.");
+		goto domain_name;
+	}
+
+	resolve_add_dns(netconfig->ifindex, AF_INET, dns);
+	l_strv_free(dns);
+
+domain_name:
+	domain_name = netconfig_ipv4_get_domain_name(netconfig,
+						netconfig->rtm_protocol);
+	if (!domain_name)
+		return;
+
+	resolve_add_domain_name(netconfig->ifindex, domain_name);
+	l_free(domain_name);
+}
+
 static void netconfig_ipv4_ifaddr_add_cmd_cb(int error, uint16_t type,
 						const void *data, uint32_t len,
 						void *user_data)
 {
 	struct netconfig *netconfig = user_data;
 	struct netconfig_ifaddr *ifaddr;
-	char **dns;
-	char *domain_name;
 
 	if (error && error != -EEXIST) {
 		l_error("netconfig: Failed to add IP address. "
@@ -764,31 +905,11 @@ static void netconfig_ipv4_ifaddr_add_cmd_cb(int error, uint16_t type,
 		return;
 	}
 
-	if (!netconfig_ipv4_routes_install(netconfig, ifaddr)) {
+	if (!netconfig_ipv4_routes_install(netconfig, ifaddr))
 		l_error("netconfig: Failed to install IPv4 routes.");
+	else
+		netconfig_ipv4_dns_install(netconfig);
 
-		goto done;
-	}
-
-	dns = netconfig_ipv4_get_dns(netconfig, netconfig->rtm_protocol);
-	if (!dns) {
-		l_error("netconfig: Failed to obtain DNS addresses.");
-		goto domain_name;
-	}
-
-	resolve_add_dns(netconfig->ifindex, ifaddr->family, dns);
-	l_strv_free(dns);
-
-domain_name:
-	domain_name = netconfig_ipv4_get_domain_name(netconfig,
-						netconfig->rtm_protocol);
-	if (!domain_name)
-		goto done;
-
-	resolve_add_domain_name(netconfig->ifindex, domain_name);
-	l_free(domain_name);
-
-done:
 	netconfig_ifaddr_destroy(ifaddr);
 }
 
@@ -942,6 +1063,561 @@ static void netconfig_uninstall_address(struct netconfig *netconfig,
 	}
 }
 
+static bool netconfig_lease_has_bssid(struct netconfig *netconfig)
+{
+	char **bssids;
+	unsigned int i;
+	uint8_t addr[ETH_ALEN];
+	bool found = false;
+
+	bssids = l_settings_get_string_list(lease_cache, netconfig->lease_key,
+							"BSSIDs", ' ');
+	if (!bssids)
+		return false;
+
+	for (i = 0; bssids[i] && !found; i++)
+		found = util_string_to_address(bssids[i], addr) &&
+			!memcmp(addr, netconfig->lease_bssid, ETH_ALEN);
+
+	l_strv_free(bssids);
+
+	return found;
+}
+
+static struct netconfig_lease *netconfig_lease_load(
+						struct netconfig *netconfig)
+{
+	struct netconfig_lease *lease;
+	uint64_t renew_time;
+
+	if (!lease_cache || !netconfig->lease_key)
+		return NULL;
+
+	if (!l_settings_get_uint64(lease_cache, netconfig->lease_key,
+					"RenewTime", &renew_time))
+		return NULL;
+
+	if (!netconfig_lease_has_bssid(netconfig)) {
+		l_debug("Cached lease not obtained through %s",
+				util_address_to_string(netconfig->lease_bssid));
+		return NULL;
+	}
+
+	/*
+	 * Only reuse the lease while the server still considers it bound to
+	 * us, i.e. before it would be due for renewal (T1).
+	 */
+	if (renew_time <= (uint64_t) time(NULL))
+		return NULL;
+
+	lease = l_new(struct netconfig_lease, 1);
+	lease->address = l_settings_get_string(lease_cache,
+						netconfig->lease_key,
+						"Address");
+	lease->gateway = l_settings_get_string(lease_cache,
+						netconfig->lease_key,
+						"Gateway");
+
+	if (!lease->address || !lease->gateway) {
+		netconfig_lease_free(lease);
+		return NULL;
+	}
+
+	lease->netmask = l_settings_get_string(lease_cache,
+						netconfig->lease_key,
+						"Netmask");
+	lease->broadcast = l_settings_get_string(lease_cache,
+						netconfig->lease_key,
+						"Broadcast");
+	lease->dns = l_settings_get_string_list(lease_cache,
+						netconfig->lease_key,
+						"DNS", ' ');
+	lease->domain_name = l_settings_get_string(lease_cache,
+						netconfig->lease_key,
+						"DomainName");
+
+	return lease;
+}
+
+static void netconfig_lease_store(struct netconfig *netconfig,
+					const struct l_dhcp_lease *lease)
+{
+	L_AUTO_FREE_VAR(char *, address) = NULL;
+	L_AUTO_FREE_VAR(char *, gateway) = NULL;
+	L_AUTO_FREE_VAR(char *, prev_address) = NULL;
+	L_AUTO_FREE_VAR(char *, bssids) = NULL;
+	const char *bssid = util_address_to_string(netconfig->lease_bssid);
+	char *value;
+	char **dns;
+	uint32_t lifetime;
+	time_t now = time(NULL);
+
+	if (!lease_cache || !netconfig->lease_key)
+		return;
+
+	address = l_dhcp_lease_get_address(lease);
+	gateway = l_dhcp_lease_get_gateway(lease);
+	lifetime = l_dhcp_lease_get_lifetime(lease);
+
+	/* Keep the BSSes the same lease was handed out through before */
+	prev_address = l_settings_get_string(lease_cache, netconfig->lease_key,
+								"Address");
+	if (address && prev_address && !strcmp(address, prev_address))
+		bssids = l_settings_get_string(lease_cache,
+						netconfig->lease_key,
+						"BSSIDs");
+
+	if (!bssids)
+		bssids = l_strdup(bssid);
+	else if (!netconfig_lease_has_bssid(netconfig)) {
+		value = bssids;
+		bssids = l_strdup_printf("%s %s", value, bssid);
+		l_free(value);
+	}
+
+	l_settings_remove_group(lease_cache, netconfig->lease_key);
+
+	if (!address || !gateway || !lifetime)
+		goto sync;
+
+	l_settings_set_string(lease_cache, netconfig->lease_key, "Address",
+								address);
+	l_settings_set_string(lease_cache, netconfig->lease_key, "Gateway",
+								gateway);
+	l_settings_set_string(lease_cache, netconfig->lease_key, "BSSIDs",
+								bssids);
+
+	value = l_dhcp_lease_get_netmask(lease);
+	if (value)
+		l_settings_set_string(lease_cache, netconfig->lease_key,
+							"Netmask", value);
+	l_free(value);
+
+	value = l_dhcp_lease_get_broadcast(lease);
+	if (value)
+		l_settings_set_string(lease_cache, netconfig->lease_key,
+							"Broadcast", value);
+	l_free(value);
+
+	dns = l_dhcp_lease_get_dns(lease);
+	if (dns && *dns) {
+		value = l_strjoinv(dns, ' ');
+		l_settings_set_string(lease_cache, netconfig->lease_key,
+							"DNS", value);
+		l_free(value);
+	}
+	l_strv_free(dns);
+
+	value = l_dhcp_lease_get_domain_name(lease);
+	if (value)
+		l_settings_set_string(lease_cache, netconfig->lease_key,
+							"DomainName", value);
+	l_free(value);
+
+	l_settings_set_uint64(lease_cache, netconfig->lease_key, "RenewTime",
+					(uint64_t) now + lifetime / 2);
+	l_settings_set_uint64(lease_cache, netconfig->lease_key, "ExpireTime",
+					(uint64_t) now + lifetime);
+
+sync:
+	storage_dhcp_lease_cache_sync(lease_cache);
+}
+
+/* The cached lease has been confirmed to be valid through lease_bssid */
+static void netconfig_lease_add_bssid(struct netconfig *netconfig)
+{
+	L_AUTO_FREE_VAR(char *, bssids) = NULL;
+	char *value;
+
+	if (!lease_cache || !netconfig->lease_key)
+		return;
+
+	bssids = l_settings_get_string(lease_cache, netconfig->lease_key,
+								"BSSIDs");
+	if (!bssids || netconfig_lease_has_bssid(netconfig))
+		return;
+
+	value = l_strdup_printf("%s %s", bssids,
+				util_address_to_string(netconfig->lease_bssid));
+	l_settings_set_string(lease_cache, netconfig->lease_key, "BSSIDs",
+								value);
+	l_free(value);
+
+	storage_dhcp_lease_cache_sync(lease_cache);
+}
+
+static void netconfig_lease_forget(struct netconfig *netconfig)
+{
+	if (!lease_cache || !netconfig->lease_key)
+		return;
+
+	if (!l_settings_remove_group(lease_cache, netconfig->lease_key))
+		return;
+
+	storage_dhcp_lease_cache_sync(lease_cache);
+}
+
+static void netconfig_lease_cache_load(void)
+{
+	char **groups;
+	unsigned int i;
+	uint64_t expire_time;
+	time_t now = time(NULL);
+
+	lease_cache = storage_dhcp_lease_cache_load();
+	if (!lease_cache) {
+		lease_cache = l_settings_new();
+		return;
+	}
+
+	groups = l_settings_get_groups(lease_cache);
+
+	for (i = 0; groups[i]; i++) {
+		if (l_settings_get_uint64(lease_cache, groups[i], "ExpireTime",
+						&expire_time) &&
+				expire_time > (uint64_t) now)
+			continue;
+
+		l_settings_remove_group(lease_cache, groups[i]);
+	}
+
+	l_strv_free(groups);
+}
+
+static void netconfig_ipv4_ifaddr_readd_cmd_cb(int error, uint16_t type,
+						const void *data, uint32_t len,
+						void *user_data)
+{
+	struct netconfig *netconfig = user_data;
+	struct netconfig_ifaddr *ifaddr;
+
+	if (error)
+		l_error("netconfig: Failed to delete IP address. "
+				"Error %d: %s", error, strerror(-error));
+
+	ifaddr = netconfig_ipv4_get_ifaddr(netconfig, RTPROT_DHCP);
+	if (!ifaddr)
+		return;
+
+	/* Not through netconfig_install_address, ifaddr_list may lag */
+	if (!l_rtnl_ifaddr4_add(rtnl, netconfig->ifindex, ifaddr->prefix_len,
+					ifaddr->ip, ifaddr->broadcast,
+					netconfig_ipv4_ifaddr_add_cmd_cb,
+					netconfig, NULL))
+		l_error("netconfig: Failed to set IP %s/%u.", ifaddr->ip,
+							ifaddr->prefix_len);
+
+	netconfig_ifaddr_destroy(ifaddr);
+}
+
+/*
+ * DHCP confirmed the address of the cached lease, but the routes and DNS
+ * settings installed along with it still come from the cache.  Redo them
+ * from the actual lease.
+ */
+static void netconfig_ipv4_lease_confirmed(struct netconfig *netconfig,
+					const struct netconfig_lease *cached)
+{
+	L_AUTO_FREE_VAR(char *, gateway) = NULL;
+	struct netconfig_ifaddr *cached_ifaddr;
+	struct netconfig_ifaddr *ifaddr;
+	bool same_routes;
+
+	ifaddr = netconfig_ipv4_get_ifaddr(netconfig, RTPROT_DHCP);
+	if (!ifaddr)
+		return;
+
+	cached_ifaddr = netconfig_lease_get_ifaddr(cached);
+	gateway = netconfig_ipv4_get_gateway(netconfig);
+	same_routes = gateway && !strcmp(gateway, cached->gateway) &&
+			ifaddr->prefix_len == cached_ifaddr->prefix_len;
+
+	resolve_remove(netconfig->ifindex);
+
+	if (same_routes) {
+		netconfig_ipv4_dns_install(netconfig);
+		goto done;
+	}
+
+	/*
+	 * The kernel drops the routes along with the address, so re-adding
+	 * the address installs the new routes and DNS settings.
+	 */
+	l_debug("Cached lease routes outdated for interface %u",
+							netconfig->ifindex);
+
+	if (!l_rtnl_ifaddr4_delete(rtnl, netconfig->ifindex,
+					cached_ifaddr->prefix_len,
+					cached_ifaddr->ip,
+					cached_ifaddr->broadcast,
+					netconfig_ipv4_ifaddr_readd_cmd_cb,
+					netconfig, NULL))
+		l_error("netconfig: Failed to delete IP %s/%u.",
+				cached_ifaddr->ip, cached_ifaddr->prefix_len);
+
+done:
+	netconfig_ifaddr_destroy(cached_ifaddr);
+	netconfig_ifaddr_destroy(ifaddr);
+}
+
+/*
+ * Drops the cached lease applied at connect time.  If the address it
+ * installed does not match the one DHCP ended up with, it is removed along
+ * with its routes, otherwise the routes and DNS settings are refreshed from
+ * the DHCP lease.
+ */
+static void netconfig_lease_release(struct netconfig *netconfig,
+						const char *dhcp_address)
+{
+	struct netconfig_lease *cached = netconfig->cached_lease;
+	struct netconfig_ifaddr *ifaddr;
+
+	if (!cached)
+		return;
+
+	if (dhcp_address && !strcmp(cached->address, dhcp_address)) {
+		netconfig->cached_lease = NULL;
+		netconfig_ipv4_lease_confirmed(netconfig, cached);
+		netconfig_lease_free(cached);
+		return;
+	}
+
+	l_debug("Cached lease address %s rejected for interface %u",
+					cached->address, netconfig->ifindex);
+
+	ifaddr = netconfig_lease_get_ifaddr(cached);
+
+	netconfig_lease_free(cached);
+	netconfig->cached_lease = NULL;
+
+	netconfig_uninstall_address(netconfig, ifaddr);
+	netconfig_ifaddr_destroy(ifaddr);
+	resolve_remove(netconfig->ifindex);
+}
+
+/*
+ * The current address could not be confirmed on the new link, most likely
+ * because we roamed into a different subnet.  Drop it and restart DHCP.
+ */
+static void netconfig_ipv4_dhcp_restart(struct netconfig *netconfig)
+{
+	struct netconfig_ifaddr *ifaddr;
+
+	ifaddr = netconfig_ipv4_get_ifaddr(netconfig, RTPROT_DHCP);
+	if (ifaddr) {
+		netconfig_uninstall_address(netconfig, ifaddr);
+		netconfig_ifaddr_destroy(ifaddr);
+	}
+
+	netconfig_lease_free(netconfig->cached_lease);
+	netconfig->cached_lease = NULL;
+	netconfig_lease_forget(netconfig);
+
+	l_dhcp_client_stop(netconfig->dhcp_client);
+
+	netconfig->dhcp_start_time = l_time_now();
+
+	if (!l_dhcp_client_start(netconfig->dhcp_client))
+		l_error("netconfig: Failed to re-start DHCPv4 client "
+					"for interface %u", netconfig->ifindex);
+}
+
+static bool netconfig_dna_send_probe(struct netconfig *netconfig)
+{
+	static const uint8_t broadcast[ETH_ALEN] = {
+		0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+	};
+	struct ether_arp arp;
+	struct sockaddr_ll sll;
+
+	memset(&arp, 0, sizeof(arp));
+	arp.arp_hrd = htons(ARPHRD_ETHER);
+	arp.arp_pro = htons(ETH_P_IP);
+	arp.arp_hln = ETH_ALEN;
+	arp.arp_pln = 4;
+	arp.arp_op = htons(ARPOP_REQUEST);
+	memcpy(arp.arp_sha, netconfig->mac_address, ETH_ALEN);
+	memcpy(arp.arp_spa, &netconfig->dna_address, 4);
+	memcpy(arp.arp_tpa, &netconfig->dna_gateway, 4);
+
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_ifindex = netconfig->ifindex;
+	sll.sll_protocol = htons(ETH_P_ARP);
+	sll.sll_halen = ETH_ALEN;
+
+	/*
+	 * RFC 4436 probes the gateway with a unicast request to the link
+	 * layer address it had on the previous link.  Fall back to broadcast
+	 * if the neighbor entry is gone.
+	 */
+	if (!util_mem_is_zero(netconfig->dna_gateway_mac, ETH_ALEN))
+		memcpy(sll.sll_addr, netconfig->dna_gateway_mac, ETH_ALEN);
+	else
+		memcpy(sll.sll_addr, broadcast, ETH_ALEN);
+
+	if (sendto(l_io_get_fd(netconfig->dna_io), &arp, sizeof(arp), 0,
+				(struct sockaddr *) &sll, sizeof(sll)) < 0) {
+		l_error("netconfig: Failed to send DNA probe: %s",
+							strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+static void netconfig_dna_done(struct l_idle *idle, void *user_data)
+{
+	struct netconfig *netconfig = user_data;
+
+	netconfig_dna_stop(netconfig);
+}
+
+static bool netconfig_dna_read(struct l_io *io, void *user_data)
+{
+	struct netconfig *netconfig = user_data;
+	struct ether_arp arp;
+	ssize_t len;
+
+	len = recv(l_io_get_fd(io), &arp, sizeof(arp), 0);
+	if (len < (ssize_t) sizeof(arp))
+		return true;
+
+	if (arp.arp_op != htons(ARPOP_REPLY) ||
+			memcmp(arp.arp_spa, &netconfig->dna_gateway, 4) ||
+			memcmp(arp.arp_tpa, &netconfig->dna_address, 4))
+		return true;
+
+	/*
+	 * A different router answering for the same gateway address means
+	 * we are on a different link, see RFC 4436 Section 4.6.
+	 */
+	if (!util_mem_is_zero(netconfig->dna_gateway_mac, ETH_ALEN) &&
+			memcmp(arp.arp_sha, netconfig->dna_gateway_mac,
+								ETH_ALEN)) {
+		l_debug("Gateway answered from a different address, "
+						"restarting DHCPv4");
+		netconfig_ipv4_dhcp_restart(netconfig);
+	} else {
+		l_debug("Network attachment confirmed for interface %u",
+							netconfig->ifindex);
+		netconfig_lease_add_bssid(netconfig);
+	}
+
+	l_timeout_remove(netconfig->dna_timeout);
+	netconfig->dna_timeout = NULL;
+
+	/* Close the socket once we're out of its read handler */
+	if (!netconfig->dna_idle)
+		netconfig->dna_idle = l_idle_create(netconfig_dna_done,
+							netconfig, NULL);
+
+	return false;
+}
+
+static void netconfig_dna_timeout(struct l_timeout *timeout, void *user_data)
+{
+	struct netconfig *netconfig = user_data;
+
+	if (++netconfig->dna_attempts < DNA_PROBE_ATTEMPTS &&
+			netconfig_dna_send_probe(netconfig)) {
+		l_timeout_modify_ms(timeout, DNA_PROBE_INTERVAL_MS);
+		return;
+	}
+
+	l_debug("No DNA response from gateway, restarting DHCPv4");
+
+	netconfig_dna_stop(netconfig);
+	netconfig_ipv4_dhcp_restart(netconfig);
+}
+
+static void netconfig_dna_lookup_gateway_mac(struct netconfig *netconfig)
+{
+	struct arpreq req;
+	struct sockaddr_in *sin = (struct sockaddr_in *) &req.arp_pa;
+	int fd;
+
+	memset(netconfig->dna_gateway_mac, 0, ETH_ALEN);
+	memset(&req, 0, sizeof(req));
+
+	if (!if_indextoname(netconfig->ifindex, req.arp_dev))
+		return;
+
+	sin->sin_family = AF_INET;
+	sin->sin_addr = netconfig->dna_gateway;
+
+	fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return;
+
+	if (ioctl(fd, SIOCGARP, &req) == 0 && (req.arp_flags & ATF_COM))
+		memcpy(netconfig->dna_gateway_mac, req.arp_ha.sa_data,
+								ETH_ALEN);
+
+	close(fd);
+}
+
+static bool netconfig_dna_start(struct netconfig *netconfig)
+{
+	L_AUTO_FREE_VAR(char *, gateway) = NULL;
+	struct netconfig_ifaddr *ifaddr;
+	struct sockaddr_ll sll;
+	bool ok;
+	int fd;
+
+	netconfig_dna_stop(netconfig);
+
+	ifaddr = netconfig_ipv4_get_ifaddr(netconfig, RTPROT_DHCP);
+	if (!ifaddr)
+		return false;
+
+	gateway = netconfig_ipv4_get_gateway(netconfig);
+
+	ok = gateway && inet_pton(AF_INET, ifaddr->ip,
+					&netconfig->dna_address) == 1 &&
+			inet_pton(AF_INET, gateway,
+					&netconfig->dna_gateway) == 1;
+	netconfig_ifaddr_destroy(ifaddr);
+
+	if (!ok)
+		return false;
+
+	netconfig_dna_lookup_gateway_mac(netconfig);
+
+	fd = socket(AF_PACKET, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+							htons(ETH_P_ARP));
+	if (fd < 0)
+		return false;
+
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_ARP);
+	sll.sll_ifindex = netconfig->ifindex;
+
+	if (bind(fd, (struct sockaddr *) &sll, sizeof(sll)) < 0) {
+		close(fd);
+		return false;
+	}
+
+	netconfig->dna_io = l_io_new(fd);
+	l_io_set_close_on_destroy(netconfig->dna_io, true);
+	l_io_set_read_handler(netconfig->dna_io, netconfig_dna_read,
+							netconfig, NULL);
+
+	netconfig->dna_attempts = 0;
+
+	if (!netconfig_dna_send_probe(netconfig)) {
+		netconfig_dna_stop(netconfig);
+		return false;
+	}
+
+	netconfig->dna_timeout = l_timeout_create_ms(DNA_PROBE_INTERVAL_MS,
+						netconfig_dna_timeout,
+						netconfig, NULL);
+
+	return true;
+}
+
 static void netconfig_ipv4_dhcp_event_handler(struct l_dhcp_client *client,
 						enum l_dhcp_client_event event,
 						void *userdata)
@@ -962,6 +1638,10 @@ static void netconfig_ipv4_dhcp_event_handler(struct l_dhcp_client *client,
 			return;
 		}
 
+		netconfig_lease_release(netconfig, ifaddr->ip);
+		netconfig_lease_store(netconfig,
+				l_dhcp_client_get_lease(netconfig->dhcp_client));
+
 		netconfig_install_address(netconfig, ifaddr);
 
 		netconfig_ifaddr_destroy(ifaddr);
@@ -981,6 +1661,13 @@ static void netconfig_ipv4_dhcp_event_handler(struct l_dhcp_client *client,
 
 		/* Fall through. */
 	case L_DHCP_CLIENT_EVENT_NO_LEASE:
+		/*
+		 * The cached address, if one was in use, can't be confirmed
+		 * either.  Drop it so we don't try it again next time.
+		 */
+		netconfig_lease_release(netconfig, NULL);
+		netconfig_lease_forget(netconfig);
+
 		/*
 		 * The requested address is no longer available, try to restart
 		 * the client.
@@ -1025,12 +1712,33 @@ static void netconfig_ipv4_select_and_install(struct netconfig *netconfig)
 	}
 
 	netconfig->rtm_protocol = RTPROT_DHCP;
+	netconfig->dhcp_start_time = l_time_now();
 
-	if (l_dhcp_client_start(netconfig->dhcp_client))
+	if (!l_dhcp_client_start(netconfig->dhcp_client)) {
+		l_error("netconfig: Failed to start DHCPv4 client for "
+					"interface %u", netconfig->ifindex);
 		return;
+	}
 
-	l_error("netconfig: Failed to start DHCPv4 client for interface %u",
-							netconfig->ifindex);
+	/*
+	 * If we hold an unexpired lease for this network, use it right away
+	 * rather than wait for the full DHCP exchange to complete.  The DHCP
+	 * client keeps running and either confirms the address or replaces
+	 * it once a lease is obtained.
+	 */
+	netconfig->cached_lease = netconfig_lease_load(netconfig);
+	if (!netconfig->cached_lease)
+		return;
+
+	l_debug("Using cached lease %s for interface %u",
+			netconfig->cached_lease->address, netconfig->ifindex);
+
+	ifaddr = netconfig_ipv4_get_ifaddr(netconfig, RTPROT_DHCP);
+	if (!ifaddr)
+		return;
+
+	netconfig_install_address(netconfig, ifaddr);
+	netconfig_ifaddr_destroy(ifaddr);
 }
 
 static void netconfig_ipv4_select_and_uninstall(struct netconfig *netconfig)
@@ -1043,7 +1751,13 @@ static void netconfig_ipv4_select_and_uninstall(struct netconfig *netconfig)
 		netconfig_ifaddr_destroy(ifaddr);
 	}
 
+	netconfig_dna_stop(netconfig);
+
 	l_dhcp_client_stop(netconfig->dhcp_client);
+
+	netconfig_lease_free(netconfig->cached_lease);
+	netconfig->cached_lease = NULL;
+	netconfig->dhcp_start_time = 0;
 }
 
 static void netconfig_ipv6_select_and_install(struct netconfig *netconfig)
@@ -1112,6 +1826,7 @@ bool netconfig_configure(struct netconfig *netconfig,
 	netconfig->active_settings = active_settings;
 	netconfig->notify = notify;
 	netconfig->user_data = user_data;
+	memcpy(netconfig->mac_address, mac_address, ETH_ALEN);
 
 	l_dhcp_client_set_address(netconfig->dhcp_client, ARPHRD_ETHER,
 							mac_address, ETH_ALEN);
@@ -1123,10 +1838,56 @@ bool netconfig_configure(struct netconfig *netconfig,
 	return true;
 }
 
+/*
+ * Identifies the network being configured, and the BSS it is reached
+ * through, so that DHCPv4 leases obtained on it can be remembered and reused
+ * on the next connection.
+ */
+void netconfig_set_lease_key(struct netconfig *netconfig,
+				enum security security, const char *ssid,
+				const uint8_t *bssid)
+{
+	char *path;
+	const char *name;
+
+	l_free(netconfig->lease_key);
+	netconfig->lease_key = NULL;
+
+	if (!ssid || !bssid)
+		return;
+
+	memcpy(netconfig->lease_bssid, bssid, ETH_ALEN);
+
+	path = storage_get_network_file_path(security, ssid);
+	if (!path)
+		return;
+
+	name = strrchr(path, '/');
+	netconfig->lease_key = l_strdup(name ? name + 1 : path);
+	l_free(path);
+}
+
+/*
+ * The network is now reached through a different BSS, e.g. after a roam.
+ * The lease stays keyed by the network, but it is validated against and
+ * recorded for the new BSS from now on.
+ */
+void netconfig_set_lease_bssid(struct netconfig *netconfig,
+				const uint8_t *bssid)
+{
+	memcpy(netconfig->lease_bssid, bssid, ETH_ALEN);
+}
+
 bool netconfig_reconfigure(struct netconfig *netconfig)
 {
 	if (netconfig->rtm_protocol == RTPROT_DHCP) {
-		/* TODO l_dhcp_client sending a DHCP inform request */
+		/*
+		 * After a roam check that the gateway is still reachable
+		 * before trusting the current address.  If it can't even be
+		 * probed, fall back to obtaining a new lease.
+		 */
+		if (!netconfig_dna_start(netconfig))
+			netconfig_ipv4_dhcp_restart(netconfig);
 	}
 
 	if (netconfig->rtm_v6_protocol == RTPROT_DHCP) {
@@ -1146,6 +1907,9 @@ bool netconfig_reset(struct netconfig *netconfig)
 
 	resolve_remove(netconfig->ifindex);
 
+	l_free(netconfig->lease_key);
+	netconfig->lease_key = NULL;
+
 	return true;
 }
 
@@ -1235,6 +1999,8 @@ static int netconfig_init(void)
 							&ROUTE_PRIORITY_OFFSET))
 		ROUTE_PRIORITY_OFFSET = 300;
 
+	netconfig_lease_cache_load();
+
 	netconfig_list = l_queue_new();
 
 	return 0;
@@ -1253,6 +2019,9 @@ static void netconfig_exit(void)
 	rtnl = NULL;
 
 	l_queue_destroy(netconfig_list, netconfig_free);
+
+	l_settings_free(lease_cache);
+	lease_cache = NULL;
 }
 
 IWD_MODULE(netconfig, netconfig_init, netconfig_exit)
@@ -21,6 +21,7 @@
  */
 
 struct netconfig;
+enum security;
 
 enum netconfig_event {
 	NETCONFIG_EVENT_CONNECTED,
@@ -34,6 +35,11 @@ bool netconfig_configure(struct netconfig *netconfig,
 				const uint8_t *mac_address,
 				netconfig_notify_func_t notify,
 				void *user_data);
+void netconfig_set_lease_key(struct netconfig *netconfig,
+				enum security security, const char *ssid,
+				const uint8_t *bssid);
+void netconfig_set_lease_bssid(struct netconfig *netconfig,
+				const uint8_t *bssid);
 bool netconfig_reconfigure(struct netconfig *netconfig);
 bool netconfig_reset(struct netconfig *netconfig);
 
@@ -125,6 +125,8 @@ struct netdev {
 	int8_t cur_rssi;
 	struct l_timeout *rssi_poll_timeout;
 	uint32_t rssi_poll_cmd_id;
+	struct netdev_link_stats link_stats;
+	unsigned int link_stats_interval;
 	uint8_t set_mac_once[6];
 
 	uint32_t set_powered_cmd_id;
@@ -147,6 +149,8 @@ struct netdev {
 	bool expect_connect_failure : 1;
 	bool aborting : 1;
 	bool events_ready : 1;
+	bool link_stats_enabled : 1;
+	bool link_stats_valid : 1;
 };
 
 struct netdev_preauth_state {
@@ -371,14 +375,132 @@ static void netdev_set_rssi_level_idx(struct netdev *netdev)
 	netdev->cur_rssi_level_idx = new_level;
 }
 
+#define NETDEV_RSSI_POLL_INTERVAL 6
+#define NETDEV_LINK_STATS_MIN_INTERVAL 2
+#define NETDEV_LINK_STATS_MAX_INTERVAL 16
+
+static bool netdev_rssi_polling_needed(struct netdev *netdev)
+{
+	if (wiphy_has_ext_feature(netdev->wiphy,
+					NL80211_EXT_FEATURE_CQM_RSSI_LIST))
+		return false;
+
+	return netdev->rssi_levels_num > 0;
+}
+
+static uint32_t netdev_parse_bitrate(struct l_genl_attr *attr)
+{
+	uint16_t type, len;
+	const void *data;
+	uint32_t bitrate = 0;
+	uint32_t bitrate32 = 0;
+
+	while (l_genl_attr_next(attr, &type, &len, &data)) {
+		switch (type) {
+		case NL80211_RATE_INFO_BITRATE:
+			if (len == 2)
+				bitrate = l_get_u16(data);
+
+			break;
+		case NL80211_RATE_INFO_BITRATE32:
+			if (len == 4)
+				bitrate32 = l_get_u32(data);
+
+			break;
+		}
+	}
+
+	return bitrate32 ?: bitrate;
+}
+
+static bool netdev_parse_sta_info(struct l_genl_attr *attr,
+					struct netdev_link_stats *info)
+{
+	struct l_genl_attr nested;
+	uint16_t type, len;
+	const void *data;
+	bool have_signal = false;
+
+	while (l_genl_attr_next(attr, &type, &len, &data)) {
+		switch (type) {
+		case NL80211_STA_INFO_SIGNAL_AVG:
+			if (len != 1)
+				break;
+
+			info->rssi = *(const int8_t *) data;
+			have_signal = true;
+			break;
+		case NL80211_STA_INFO_TX_BITRATE:
+			if (l_genl_attr_recurse(attr, &nested))
+				info->tx_bitrate = netdev_parse_bitrate(&nested);
+
+			break;
+		case NL80211_STA_INFO_RX_BITRATE:
+			if (l_genl_attr_recurse(attr, &nested))
+				info->rx_bitrate = netdev_parse_bitrate(&nested);
+
+			break;
+		case NL80211_STA_INFO_EXPECTED_THROUGHPUT:
+			if (len == 4)
+				info->expected_throughput = l_get_u32(data);
+
+			break;
+		case NL80211_STA_INFO_TX_PACKETS:
+			if (len == 4)
+				info->tx_packets = l_get_u32(data);
+
+			break;
+		case NL80211_STA_INFO_TX_RETRIES:
+			if (len == 4)
+				info->tx_retries = l_get_u32(data);
+
+			break;
+		case NL80211_STA_INFO_TX_FAILED:
+			if (len == 4)
+				info->tx_failed = l_get_u32(data);
+
+			break;
+		}
+	}
+
+	return have_signal;
+}
+
+/*
+ * The link is considered unsettled if the TX bitrate moved by a quarter or
+ * more, more than a fifth of the transmissions needed retries or any frame
+ * could not be delivered at all.  Such conditions usually precede a drop
+ * in throughput so the statistics are then polled more often.
+ */
+static bool netdev_link_stats_unsettled(const struct netdev_link_stats *old,
+					const struct netdev_link_stats *new)
+{
+	uint32_t attempts = new->tx_packets_delta + new->tx_retries_delta;
+	uint32_t diff;
+
+	if (new->tx_failed_delta)
+		return true;
+
+	if (attempts && new->tx_retries_delta * 5 > attempts)
+		return true;
+
+	diff = new->tx_bitrate > old->tx_bitrate ?
+			new->tx_bitrate - old->tx_bitrate :
+			old->tx_bitrate - new->tx_bitrate;
+
+	return diff * 4 >= old->tx_bitrate && diff;
+}
+
 static void netdev_rssi_poll_cb(struct l_genl_msg *msg, void *user_data)
 {
 	struct netdev *netdev = user_data;
+	struct netdev_link_stats info;
 	struct l_genl_attr attr, nested;
 	uint16_t type, len;
 	const void *data;
 	bool found;
 	uint8_t prev_rssi_level_idx = netdev->cur_rssi_level_idx;
+	unsigned int interval = NETDEV_RSSI_POLL_INTERVAL;
 
 	netdev->rssi_poll_cmd_id = 0;
 
@@ -397,37 +519,60 @@ static void netdev_rssi_poll_cb(struct l_genl_msg *msg, void *user_data)
 	if (!found || !l_genl_attr_recurse(&attr, &nested))
 		goto done;
 
-	found = false;
-	while (l_genl_attr_next(&nested, &type, &len, &data)) {
-		if (type != NL80211_STA_INFO_SIGNAL_AVG)
-			continue;
-
-		if (len != 1)
-			continue;
-
-		found = true;
-		netdev->cur_rssi = *(const int8_t *) data;
-		break;
-	}
+	memset(&info, 0, sizeof(info));
 
-	if (!found)
+	if (!netdev_parse_sta_info(&nested, &info))
 		goto done;
 
+	netdev->cur_rssi = info.rssi;
+
 	/*
 	 * Note we don't have to handle LOW_SIGNAL_THRESHOLD here.  The
 	 * CQM single threshold RSSI monitoring should work even if the
 	 * kernel driver doesn't support multiple thresholds.  So the
 	 * polling only handles the client-supplied threshold list.
 	 */
-	netdev_set_rssi_level_idx(netdev);
-	if (netdev->cur_rssi_level_idx != prev_rssi_level_idx)
-		netdev->event_filter(netdev, NETDEV_EVENT_RSSI_LEVEL_NOTIFY,
+	if (netdev_rssi_polling_needed(netdev)) {
+		netdev_set_rssi_level_idx(netdev);
+		if (netdev->cur_rssi_level_idx != prev_rssi_level_idx)
+			netdev->event_filter(netdev,
+					NETDEV_EVENT_RSSI_LEVEL_NOTIFY,
 					&netdev->cur_rssi_level_idx,
 					netdev->user_data);
+	}
+
+	if (!netdev->link_stats_enabled)
+		goto done;
+
+	if (netdev->link_stats_valid) {
+		const struct netdev_link_stats *prev = &netdev->link_stats;
+
+		info.tx_packets_delta = info.tx_packets - prev->tx_packets;
+		info.tx_retries_delta = info.tx_retries - prev->tx_retries;
+		info.tx_failed_delta = info.tx_failed - prev->tx_failed;
+	}
+
+	if (!netdev->link_stats_valid ||
+			netdev_link_stats_unsettled(&netdev->link_stats, &info))
+		netdev->link_stats_interval = NETDEV_LINK_STATS_MIN_INTERVAL;
+	else if (netdev->link_stats_interval < NETDEV_LINK_STATS_MAX_INTERVAL)
+		netdev->link_stats_interval *= 2;
+
+	memcpy(&netdev->link_stats, &info, sizeof(info));
+	netdev->link_stats_valid = true;
+
+	interval = netdev->link_stats_interval;
+
+	if (netdev_rssi_polling_needed(netdev))
+		interval = minsize(interval, NETDEV_RSSI_POLL_INTERVAL);
+
+	if (netdev->event_filter)
+		netdev->event_filter(netdev, NETDEV_EVENT_LINK_STATS,
+					&info, netdev->user_data);
 
 done:
 	/* Rearm timer */
-	l_timeout_modify(netdev->rssi_poll_timeout, 6);
+	l_timeout_modify(netdev->rssi_poll_timeout, interval);
 }
 
 static void netdev_rssi_poll(struct l_timeout *timeout, void *user_data)
@@ -445,17 +590,19 @@ static void netdev_rssi_poll(struct l_timeout *timeout, void *user_data)
 							netdev, NULL);
 }
 
-/* To be called whenever operational or rssi_levels_num are updated */
+/*
+ * To be called whenever operational, rssi_levels_num or link_stats_enabled
+ * are updated
+ */
 static void netdev_rssi_polling_update(struct netdev *netdev)
 {
-	if (wiphy_has_ext_feature(netdev->wiphy,
-					NL80211_EXT_FEATURE_CQM_RSSI_LIST))
-		return;
-
-	if (netdev->operational && netdev->rssi_levels_num > 0) {
+	if (netdev->operational && (netdev->link_stats_enabled ||
+					netdev_rssi_polling_needed(netdev))) {
 		if (netdev->rssi_poll_timeout)
 			return;
 
+		netdev->link_stats_valid = false;
+		netdev->link_stats_interval = NETDEV_LINK_STATS_MIN_INTERVAL;
 		netdev->rssi_poll_timeout =
 			l_timeout_create(1, netdev_rssi_poll, netdev, NULL);
 	} else {
@@ -3947,6 +4094,15 @@ done:
 	return 0;
 }
 
+void netdev_set_link_stats_reporting(struct netdev *netdev, bool enabled)
+{
+	if (netdev->link_stats_enabled == enabled)
+		return;
+
+	netdev->link_stats_enabled = enabled;
+	netdev_rssi_polling_update(netdev);
+}
+
 static int netdev_cqm_rssi_update(struct netdev *netdev)
 {
 	struct l_genl_msg *msg;
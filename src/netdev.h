@@ -46,6 +46,7 @@ enum netdev_event {
 	NETDEV_EVENT_RSSI_THRESHOLD_LOW,
 	NETDEV_EVENT_RSSI_THRESHOLD_HIGH,
 	NETDEV_EVENT_RSSI_LEVEL_NOTIFY,
+	NETDEV_EVENT_LINK_STATS,
 };
 
 enum netdev_watch_event {
@@ -65,6 +66,20 @@ enum netdev_iftype {
 	NETDEV_IFTYPE_P2P_GO,
 };
 
+struct netdev_link_stats {
+	int8_t rssi;			/* Average signal, dBm */
+	uint32_t tx_bitrate;		/* 100 kbit/s, 0 if unknown */
+	uint32_t rx_bitrate;		/* 100 kbit/s, 0 if unknown */
+	uint32_t expected_throughput;	/* kbit/s, 0 if unknown */
+	uint32_t tx_packets;
+	uint32_t tx_retries;
+	uint32_t tx_failed;
+	/* Counter increments since the previous report */
+	uint32_t tx_packets_delta;
+	uint32_t tx_retries_delta;
+	uint32_t tx_failed_delta;
+};
+
 typedef void (*netdev_command_cb_t)(struct netdev *netdev, int result,
 						void *user_data);
 /*
@@ -95,6 +110,7 @@ typedef void (*netdev_connect_cb_t)(struct netdev *netdev,
  * NETDEV_EVENT_RSSI_THRESHOLD_LOW - unused
  * NETDEV_EVENT_RSSI_THRESHOLD_HIGH - unused
  * NETDEV_EVENT_RSSI_LEVEL_NOTIFY - rssi level index (uint8_t)
+ * NETDEV_EVENT_LINK_STATS - link statistics (struct netdev_link_stats *)
  */
 typedef void (*netdev_event_func_t)(struct netdev *netdev,
 					enum netdev_event event,
@@ -175,6 +191,7 @@ int netdev_neighbor_report_req(struct netdev *netdev,
 
 int netdev_set_rssi_report_levels(struct netdev *netdev, const int8_t *levels,
 					size_t levels_num);
+void netdev_set_link_stats_reporting(struct netdev *netdev, bool enabled);
 
 void netdev_handshake_failed(struct handshake_state *hs, uint16_t reason_code);
 
@@ -400,6 +400,10 @@ static bool rrm_scan_results(int err, struct l_queue *bss_list, void *userdata)
 	l_debug("RRM scan results for %u APs", l_queue_length(bss_list));
 
 	rrm_report_beacon_results(rrm, bss_list);
+
+	/* Let station keep any roam candidates the measurement turned up */
+	station_roam_candidates_update(rrm->station, bss_list);
+
 	/* We aren't saving this BSS list */
 	return false;
 }
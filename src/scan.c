@@ -42,6 +42,7 @@
 #include "src/ie.h"
 #include "src/common.h"
 #include "src/network.h"
+#include "src/netdev.h"
 #include "src/knownnetworks.h"
 #include "src/nl80211cmd.h"
 #include "src/nl80211util.h"
@@ -53,8 +54,37 @@
 #define SCAN_MAX_INTERVAL 320
 #define SCAN_INIT_INTERVAL 10
 
+/*
+ * Environment churn thresholds (in percent) used by the adaptive periodic
+ * scan.  Below SCAN_CHURN_LOW the environment is considered static and the
+ * interval is doubled, at or above SCAN_CHURN_HIGH it is halved.
+ */
+#define SCAN_CHURN_LOW 5
+#define SCAN_CHURN_HIGH 25
+/* Number of best ranked BSSes whose order is compared between scans */
+#define SCAN_CHURN_RANK_DEPTH 3
+
+/*
+ * Seconds for which a hidden BSS isn't probed for our hidden SSIDs again
+ * after it answered to none of them, or to one of them.  The latter stays
+ * below the kernel's 30 second BSS expiry so the probe response needed to
+ * connect is still around.
+ */
+#define SCAN_HIDDEN_UNRESOLVED_TIMEOUT 300
+#define SCAN_HIDDEN_RESOLVED_TIMEOUT 20
+
 static struct l_queue *scan_contexts;
 
+/* Budgets for sliced (background) scans, see scan_cmds_add_sliced */
+static unsigned int slice_max_channels;
+static unsigned int slice_interval_ms;
+static unsigned int periodic_max_airtime;
+
+/* Scheduled (firmware offloaded) scan settings, see scan_sched_start */
+static bool sched_scan_disabled;
+static int sched_scan_rssi_threshold;
+static uint32_t known_networks_watch;
+
 static struct l_genl_family *nl80211;
 static uint32_t next_scan_request_id;
 
@@ -67,6 +97,20 @@ struct scan_periodic {
 	bool retry:1;
 	uint32_t id;
 	bool needs_active_scan:1;
+	uint64_t trigger_time;
+	/* Time spent in the last periodic scan, for the airtime budget */
+	uint64_t last_airtime_ms;
+	/* Addresses seen by the previous periodic scan, in rank order */
+	uint8_t *last_addrs;
+	unsigned int last_addrs_count;
+	bool have_last_addrs:1;
+	struct scan_periodic_stats stats;
+	/* Non-zero while START_SCHED_SCAN is still running */
+	unsigned int sched_cmd_id;
+	/* The firmware is scanning on our behalf, no timer is armed */
+	bool sched_scan:1;
+	/* Scheduled scan was refused or stopped, use the timer instead */
+	bool sched_scan_failed:1;
 };
 
 struct scan_request {
@@ -76,6 +120,14 @@ struct scan_request {
 	void *userdata;
 	scan_destroy_func_t destroy;
 	bool passive:1; /* Active or Passive scan? */
+	bool sliced:1; /* Pause between cmds to return to the operating channel */
+	/* Probe the 6 GHz channels learned from RNR elements once done */
+	bool rnr_6ghz:1;
+	/* Probe the channels of unresolved hidden BSSes once done */
+	bool hidden_follow_up:1;
+	bool randomize_mac_addr_hint:1;
+	/* Channels on which all hidden known networks have been probed for */
+	struct scan_freq_set *hidden_freqs;
 	struct l_queue *cmds;
 	/* The time the current scan was started. Reported in TRIGGER_SCAN */
 	uint64_t start_time_tsf;
@@ -108,6 +160,19 @@ struct scan_context {
 	bool started:1;
 	bool suspended:1;
 	struct wiphy *wiphy;
+	/* Non-NULL while waiting on-channel between slices of a sliced scan */
+	struct l_timeout *slice_timeout;
+	/* struct scan_hidden_bss for each hidden BSS seen recently */
+	struct l_queue *hidden_bsses;
+	/* Some hidden BSS from the last results may be a known network */
+	bool hidden_pending:1;
+};
+
+struct scan_hidden_bss {
+	uint8_t addr[6];
+	char ssid[33];		/* SSID it answered to, empty if none */
+	uint64_t last_probed;	/* Zero if never probed for our SSIDs */
+	uint64_t last_seen;
 };
 
 struct scan_results {
@@ -120,6 +185,8 @@ struct scan_results {
 
 static bool start_next_scan_request(struct scan_context *sc);
 static void scan_periodic_rearm(struct scan_context *sc);
+static bool scan_periodic_queue(struct scan_context *sc);
+static void scan_freq_set_constrain_6ghz(struct scan_freq_set *set, bool psc);
 
 static bool scan_context_match(const void *a, const void *b)
 {
@@ -146,6 +213,9 @@ static void scan_request_free(void *data)
 
 	l_queue_destroy(sr->cmds, (l_queue_destroy_func_t) l_genl_msg_unref);
 
+	if (sr->hidden_freqs)
+		scan_freq_set_free(sr->hidden_freqs);
+
 	l_free(sr);
 }
 
@@ -176,6 +246,7 @@ static struct scan_context *scan_context_new(uint64_t wdev_id)
 	sc->wiphy = wiphy;
 	sc->state = SCAN_STATE_NOT_RUNNING;
 	sc->requests = l_queue_new();
+	sc->hidden_bsses = l_queue_new();
 
 	return sc;
 }
@@ -189,12 +260,19 @@ static void scan_context_free(struct scan_context *sc)
 	if (sc->sp.timeout)
 		l_timeout_remove(sc->sp.timeout);
 
+	l_timeout_remove(sc->slice_timeout);
+	l_free(sc->sp.last_addrs);
+	l_queue_destroy(sc->hidden_bsses, l_free);
+
 	if (sc->start_cmd_id && nl80211)
 		l_genl_family_cancel(nl80211, sc->start_cmd_id);
 
 	if (sc->get_scan_cmd_id && nl80211)
 		l_genl_family_cancel(nl80211, sc->get_scan_cmd_id);
 
+	if (sc->sp.sched_cmd_id && nl80211)
+		l_genl_family_cancel(nl80211, sc->sp.sched_cmd_id);
+
 	l_free(sc);
 }
 
@@ -340,6 +418,10 @@ static struct l_genl_msg *scan_build_cmd(struct scan_context *sc,
 	if (params->freqs)
 		scan_build_attr_scan_frequencies(msg, params->freqs);
 
+	if (params->bssid && !is_passive)
+		l_genl_msg_append_attr(msg, NL80211_ATTR_BSSID, 6,
+					params->bssid);
+
 	if (params->flush && !ignore_flush_flag)
 		flags |= NL80211_SCAN_FLAG_FLUSH;
 
@@ -424,16 +506,34 @@ struct scan_cmds_add_data {
 	uint8_t num_ssids_can_append;
 };
 
-static bool scan_cmds_add_hidden(const struct network_info *network,
+static bool scan_hidden_network_collect(const struct network_info *network,
 					void *user_data)
 {
-	struct scan_cmds_add_data *data = user_data;
+	struct l_queue *ssids = user_data;
 
-	if (!network->is_hidden)
-		return true;
+	if (network->is_hidden)
+		l_queue_push_tail(ssids, (void *) network->ssid);
+
+	return true;
+}
+
+/* SSIDs of the hidden known networks, most recently connected first */
+static struct l_queue *scan_get_hidden_ssids(void)
+{
+	struct l_queue *ssids = l_queue_new();
+
+	known_networks_foreach(scan_hidden_network_collect, ssids);
+
+	return ssids;
+}
+
+static void scan_cmds_add_ssid(void *ssid_data, void *user_data)
+{
+	const char *ssid = ssid_data;
+	struct scan_cmds_add_data *data = user_data;
 
 	l_genl_msg_append_attr(*data->cmd, NL80211_ATTR_SSID,
-				strlen(network->ssid), network->ssid);
+				strlen(ssid), ssid);
 	data->num_ssids_can_append--;
 
 	if (!data->num_ssids_can_append) {
@@ -451,13 +551,15 @@ static bool scan_cmds_add_hidden(const struct network_info *network,
 								data->params);
 		l_genl_msg_enter_nested(*data->cmd, NL80211_ATTR_SCAN_SSIDS);
 	}
-
-	return true;
 }
 
-static void scan_cmds_add(struct l_queue *cmds, struct scan_context *sc,
-				bool passive,
-				const struct scan_parameters *params)
+/*
+ * Build the directed probe commands for @ssids, as many per command as
+ * the hardware allows.  None of them flushes the kernel's BSS table.
+ */
+static void scan_cmds_add_ssids(struct l_queue *cmds, struct scan_context *sc,
+				const struct scan_parameters *params,
+				struct l_queue *ssids)
 {
 	struct l_genl_msg *cmd;
 	struct scan_cmds_add_data data = {
@@ -468,7 +570,33 @@ static void scan_cmds_add(struct l_queue *cmds, struct scan_context *sc,
 		wiphy_get_max_num_ssids_per_scan(sc->wiphy),
 	};
 
-	cmd = scan_build_cmd(sc, false, passive, params);
+	data.num_ssids_can_append = data.max_ssids_per_scan;
+
+	cmd = scan_build_cmd(sc, true, false, params);
+	l_genl_msg_enter_nested(cmd, NL80211_ATTR_SCAN_SSIDS);
+
+	l_queue_foreach(ssids, scan_cmds_add_ssid, &data);
+
+	/* The last command is left empty if the SSIDs filled all others */
+	if (data.num_ssids_can_append == data.max_ssids_per_scan) {
+		l_genl_msg_unref(cmd);
+		return;
+	}
+
+	l_genl_msg_leave_nested(cmd);
+	l_queue_push_tail(cmds, cmd);
+}
+
+static void scan_cmds_add(struct l_queue *cmds, struct scan_context *sc,
+				bool passive, bool ignore_flush,
+				const struct scan_parameters *params)
+{
+	struct l_genl_msg *cmd;
+	unsigned int max_ssids = wiphy_get_max_num_ssids_per_scan(sc->wiphy);
+	struct l_queue *ssids;
+	const struct l_queue_entry *entry;
+
+	cmd = scan_build_cmd(sc, ignore_flush, passive, params);
 
 	if (passive) {
 		/* passive scan */
@@ -488,14 +616,94 @@ static void scan_cmds_add(struct l_queue *cmds, struct scan_context *sc,
 		return;
 	}
 
-	data.num_ssids_can_append = data.max_ssids_per_scan;
-	known_networks_foreach(scan_cmds_add_hidden, &data);
+	/*
+	 * Probe for the most recently used hidden networks alongside the
+	 * wildcard SSID, within a single command.  The others are only
+	 * probed for on the channels where hidden BSSes were seen, see
+	 * scan_hidden_follow_up.
+	 */
+	ssids = scan_get_hidden_ssids();
+
+	for (entry = l_queue_get_entries(ssids); entry && max_ssids > 1;
+			entry = entry->next, max_ssids--) {
+		const char *ssid = entry->data;
+
+		l_genl_msg_append_attr(cmd, NL80211_ATTR_SSID,
+					strlen(ssid), ssid);
+	}
+
+	l_queue_destroy(ssids, NULL);
 
 	l_genl_msg_append_attr(cmd, NL80211_ATTR_SSID, 0, NULL);
 	l_genl_msg_leave_nested(cmd);
 	l_queue_push_tail(cmds, cmd);
 }
 
+struct scan_freq_slice_data {
+	struct l_queue *slices;
+	struct scan_freq_set *current;
+	unsigned int count;
+};
+
+static void scan_freq_slice_add(uint32_t freq, void *user_data)
+{
+	struct scan_freq_slice_data *data = user_data;
+
+	if (!data->current || data->count == slice_max_channels) {
+		data->current = scan_freq_set_new();
+		data->count = 0;
+		l_queue_push_tail(data->slices, data->current);
+	}
+
+	scan_freq_set_add(data->current, freq);
+	data->count++;
+}
+
+/*
+ * Split the requested frequencies into slices of at most slice_max_channels
+ * channels, each scanned by a separate trigger.  Only the first trigger may
+ * flush the kernel BSS table so that GET_SCAN after the last slice returns
+ * the merged view of all slices.  Between the slices the radio returns to
+ * the operating channel for slice_interval_ms, see scan_notify.
+ */
+static bool scan_cmds_add_sliced(struct l_queue *cmds, struct scan_context *sc,
+					bool passive,
+					const struct scan_parameters *params)
+{
+	const struct scan_freq_set *freqs = params->freqs;
+	struct scan_freq_slice_data data = { .slices = l_queue_new() };
+	const struct l_queue_entry *entry;
+	bool first = true;
+
+	if (!freqs)
+		freqs = wiphy_get_supported_freqs(sc->wiphy);
+
+	scan_freq_set_foreach(freqs, scan_freq_slice_add, &data);
+
+	if (l_queue_length(data.slices) < 2) {
+		l_queue_destroy(data.slices,
+				(l_queue_destroy_func_t) scan_freq_set_free);
+		return false;
+	}
+
+	for (entry = l_queue_get_entries(data.slices); entry;
+			entry = entry->next) {
+		struct scan_parameters slice_params = *params;
+
+		slice_params.freqs = entry->data;
+		scan_cmds_add(cmds, sc, passive, !first, &slice_params);
+		first = false;
+	}
+
+	l_debug("Scan split into %u slices",
+			l_queue_length(data.slices));
+
+	l_queue_destroy(data.slices,
+				(l_queue_destroy_func_t) scan_freq_set_free);
+
+	return true;
+}
+
 static int scan_request_send_trigger(struct scan_context *sc,
 					struct scan_request *sr)
 {
@@ -517,6 +725,42 @@ static int scan_request_send_trigger(struct scan_context *sc,
 	return -EIO;
 }
 
+/*
+ * A full scan on a tri-band radio only covers the 6 GHz Preferred Scanning
+ * Channels, where standalone 6 GHz APs are required to be discoverable.
+ * APs on the other 6 GHz channels are then found by probing just the
+ * channels advertised in the Reduced Neighbor Report elements of the
+ * 2.4 / 5 GHz BSSes, see scan_rnr_6ghz_follow_up.
+ */
+static bool scan_use_rnr_6ghz(struct scan_context *sc,
+				const struct scan_parameters *params)
+{
+	uint32_t bands = wiphy_get_supported_bands(sc->wiphy);
+
+	if (params->freqs || params->ssid)
+		return false;
+
+	return (bands & SCAN_BAND_6_GHZ) && (bands & ~SCAN_BAND_6_GHZ);
+}
+
+static void scan_hidden_setup(struct scan_context *sc,
+				struct scan_request *sr,
+				const struct scan_parameters *params)
+{
+	struct l_queue *ssids = scan_get_hidden_ssids();
+	unsigned int max_ssids = wiphy_get_max_num_ssids_per_scan(sc->wiphy);
+
+	sr->hidden_follow_up = true;
+	sr->hidden_freqs = scan_freq_set_new();
+
+	/* Every hidden SSID fits next to the wildcard, see scan_cmds_add */
+	if (l_queue_length(ssids) < max_ssids)
+		scan_freq_set_merge(sr->hidden_freqs, params->freqs ?:
+					wiphy_get_supported_freqs(sc->wiphy));
+
+	l_queue_destroy(ssids, NULL);
+}
+
 static uint32_t scan_common(uint64_t wdev_id, bool passive,
 				const struct scan_parameters *params,
 				scan_trigger_func_t trigger,
@@ -525,6 +769,8 @@ static uint32_t scan_common(uint64_t wdev_id, bool passive,
 {
 	struct scan_context *sc;
 	struct scan_request *sr;
+	struct scan_parameters psc_params;
+	struct scan_freq_set *psc_freqs = NULL;
 
 	sc = l_queue_find(scan_contexts, scan_context_match, &wdev_id);
 
@@ -540,7 +786,33 @@ static uint32_t scan_common(uint64_t wdev_id, bool passive,
 	sr->id = ++next_scan_request_id;
 	sr->cmds = l_queue_new();
 
-	scan_cmds_add(sr->cmds, sc, passive, params);
+	if (scan_use_rnr_6ghz(sc, params)) {
+		psc_freqs = scan_freq_set_new();
+		scan_freq_set_merge(psc_freqs,
+					wiphy_get_supported_freqs(sc->wiphy));
+		scan_freq_set_constrain_6ghz(psc_freqs, true);
+
+		psc_params = *params;
+		psc_params.freqs = psc_freqs;
+		params = &psc_params;
+
+		sr->rnr_6ghz = true;
+	}
+
+	sr->randomize_mac_addr_hint = params->randomize_mac_addr_hint;
+
+	if (!passive && !params->ssid && known_networks_has_hidden())
+		scan_hidden_setup(sc, sr, params);
+
+	if (params->sliced && slice_max_channels)
+		sr->sliced = scan_cmds_add_sliced(sr->cmds, sc, passive,
+							params);
+
+	if (!sr->sliced)
+		scan_cmds_add(sr->cmds, sc, passive, false, params);
+
+	if (psc_freqs)
+		scan_freq_set_free(psc_freqs);
 
 	/* Queue empty implies !sc->triggered && !sc->start_cmd_id */
 	if (!l_queue_isempty(sc->requests))
@@ -643,6 +915,9 @@ bool scan_cancel(uint64_t wdev_id, uint32_t id)
 		if (sc->get_scan_cmd_id)
 			l_genl_family_cancel(nl80211, sc->get_scan_cmd_id);
 
+		l_timeout_remove(sc->slice_timeout);
+		sc->slice_timeout = NULL;
+
 		sc->start_cmd_id = 0;
 		l_queue_remove(sc->requests, sr);
 		sc->started = false;
@@ -665,172 +940,659 @@ static void scan_periodic_triggered(int err, void *user_data)
 
 	l_debug("Periodic scan triggered for wdev %" PRIx64, sc->wdev_id);
 
+	sc->sp.trigger_time = l_time_now();
+
 	if (sc->sp.trigger)
 		sc->sp.trigger(0, sc->sp.userdata);
 }
 
-static bool scan_periodic_notify(int err, struct l_queue *bss_list,
-					void *user_data)
+static unsigned int scan_periodic_churn(struct scan_context *sc,
+						const uint8_t *addrs,
+						unsigned int count)
 {
-	struct scan_context *sc = user_data;
+	const uint8_t *last = sc->sp.last_addrs;
+	unsigned int last_count = sc->sp.last_addrs_count;
+	unsigned int common = 0;
+	unsigned int rank_changes = 0;
+	unsigned int set_churn;
+	unsigned int rank_churn;
+	unsigned int i, j;
 
-	scan_periodic_rearm(sc);
+	if (!count && !last_count)
+		return 0;
 
-	if (sc->sp.callback)
-		return sc->sp.callback(err, bss_list, sc->sp.userdata);
+	for (i = 0; i < count; i++)
+		for (j = 0; j < last_count; j++)
+			if (!memcmp(addrs + i * 6, last + j * 6, 6)) {
+				common++;
+				break;
+			}
 
-	return false;
-}
+	for (i = 0; i < SCAN_CHURN_RANK_DEPTH; i++) {
+		if (i >= count && i >= last_count)
+			break;
 
-static bool scan_periodic_queue(struct scan_context *sc)
-{
-	if (!l_queue_isempty(sc->requests)) {
-		sc->sp.retry = true;
-		return false;
+		if (i >= count || i >= last_count ||
+				memcmp(addrs + i * 6, last + i * 6, 6))
+			rank_changes++;
 	}
 
-	if (sc->sp.needs_active_scan && known_networks_has_hidden()) {
-		struct scan_parameters params = {
-			.randomize_mac_addr_hint = true
-		};
-
-		sc->sp.needs_active_scan = false;
-
-		sc->sp.id = scan_active_full(sc->wdev_id, &params,
-						scan_periodic_triggered,
-						scan_periodic_notify, sc, NULL);
-	} else
-		sc->sp.id = scan_passive(sc->wdev_id, NULL,
-						scan_periodic_triggered,
-						scan_periodic_notify, sc, NULL);
+	/* BSSes that appeared or disappeared relative to both scans */
+	set_churn = 100 * (count + last_count - 2 * common) /
+						(count + last_count);
+	rank_churn = 100 * rank_changes / SCAN_CHURN_RANK_DEPTH;
 
-	return sc->sp.id != 0;
+	return set_churn > rank_churn ? set_churn : rank_churn;
 }
 
-static bool scan_periodic_is_disabled(void)
+/*
+ * Don't spend more than the allowed share of airtime scanning once the
+ * environment has proven static enough to back off, so that the first few
+ * scans still find networks quickly.
+ */
+static unsigned int scan_periodic_budget_interval(unsigned int interval,
+							uint64_t airtime_ms)
 {
-	const struct l_settings *config = iwd_get_config();
-	bool disabled;
+	unsigned int min_interval;
 
-	if (!l_settings_get_bool(config, "Scan", "DisablePeriodicScan",
-								&disabled))
-		return false;
+	if (!periodic_max_airtime || !airtime_ms ||
+			interval <= SCAN_INIT_INTERVAL)
+		return interval;
 
-	return disabled;
+	min_interval = (airtime_ms * 100) / (periodic_max_airtime * 1000) + 1;
+
+	if (interval >= min_interval)
+		return interval;
+
+	return minsize(min_interval, SCAN_MAX_INTERVAL);
 }
 
-void scan_periodic_start(uint64_t wdev_id, scan_trigger_func_t trigger,
-				scan_notify_func_t func, void *userdata)
-{
-	struct scan_context *sc;
+/*
+ * Pick the next periodic scan interval based on how much the set of BSSes,
+ * and the order of the best ranked ones, changed since the previous
+ * periodic scan.  The result is bounded by SCAN_INIT_INTERVAL and
+ * SCAN_MAX_INTERVAL and by the [Scan].PeriodicScanMaxAirtime budget.
+ */
+static void scan_periodic_adapt(struct scan_context *sc,
+					struct l_queue *bss_list)
+{
+	struct scan_periodic_stats *stats = &sc->sp.stats;
+	unsigned int count = l_queue_length(bss_list);
+	const struct l_queue_entry *entry;
+	uint8_t *addrs = NULL;
+	unsigned int interval = sc->sp.interval;
+	unsigned int churn;
+	uint64_t airtime_ms = 0;
+	unsigned int i = 0;
+
+	if (count)
+		addrs = l_malloc(count * 6);
+
+	for (entry = l_queue_get_entries(bss_list); entry;
+			entry = entry->next) {
+		const struct scan_bss *bss = entry->data;
+
+		memcpy(addrs + i++ * 6, bss->addr, 6);
+	}
 
-	if (scan_periodic_is_disabled())
-		return;
+	if (sc->sp.trigger_time)
+		airtime_ms = l_time_to_msecs(l_time_diff(sc->sp.trigger_time,
+								l_time_now()));
+
+	stats->scans += 1;
+	stats->airtime_ms += airtime_ms;
+	sc->sp.last_airtime_ms = airtime_ms;
+
+	if (sc->sp.have_last_addrs) {
+		churn = scan_periodic_churn(sc, addrs, count);
+		stats->last_churn = churn;
+
+		if (churn >= SCAN_CHURN_HIGH && interval > SCAN_INIT_INTERVAL) {
+			interval /= 2;
+			stats->shortened += 1;
+		} else if (churn <= SCAN_CHURN_LOW &&
+				interval < SCAN_MAX_INTERVAL) {
+			interval *= 2;
+			stats->lengthened += 1;
+		}
+	}
 
-	sc = l_queue_find(scan_contexts, scan_context_match, &wdev_id);
+	l_free(sc->sp.last_addrs);
+	sc->sp.last_addrs = addrs;
+	sc->sp.last_addrs_count = count;
+	sc->sp.have_last_addrs = true;
 
-	if (!sc) {
-		l_error("scan_periodic_start called without scan_wdev_add");
-		return;
+	if (interval < SCAN_INIT_INTERVAL)
+		interval = SCAN_INIT_INTERVAL;
+	else if (interval > SCAN_MAX_INTERVAL)
+		interval = SCAN_MAX_INTERVAL;
+
+	if (scan_periodic_budget_interval(interval, airtime_ms) != interval) {
+		interval = scan_periodic_budget_interval(interval, airtime_ms);
+		stats->budget_limited += 1;
 	}
 
-	if (sc->sp.interval)
-		return;
+	l_debug("Periodic scan: %u BSSes, churn %u%%, airtime %" PRIu64
+			"ms, interval %u -> %u", count, stats->last_churn,
+			airtime_ms, sc->sp.interval, interval);
 
-	l_debug("Starting periodic scan for wdev %" PRIx64, wdev_id);
+	sc->sp.interval = interval;
+	stats->interval = interval;
+}
 
-	sc->sp.interval = SCAN_INIT_INTERVAL;
-	sc->sp.trigger = trigger;
-	sc->sp.callback = func;
-	sc->sp.userdata = userdata;
+struct scan_sched_data {
+	struct l_queue *networks;
+	unsigned int max_match_sets;
+	struct scan_freq_set *freqs;
+	bool all_freqs_known;
+};
 
-	/* If nothing queued, start the first periodic scan */
-	scan_periodic_queue(sc);
+static bool scan_sched_match_ssid(const void *a, const void *b)
+{
+	const struct network_info *info = a;
+
+	return !strcmp(info->ssid, b);
 }
 
-bool scan_periodic_stop(uint64_t wdev_id)
+static bool scan_sched_add_network(const struct network_info *info,
+					void *user_data)
 {
-	struct scan_context *sc;
+	struct scan_sched_data *data = user_data;
+	const struct l_queue_entry *entry;
 
-	sc = l_queue_find(scan_contexts, scan_context_match, &wdev_id);
+	/* Hotspot networks are matched on ANQP data, not on the SSID */
+	if (info->is_hotspot || !info->is_autoconnectable)
+		return true;
 
-	if (!sc)
-		return false;
+	if (l_queue_find(data->networks, scan_sched_match_ssid, info->ssid))
+		return true;
 
-	if (!sc->sp.interval)
+	/* Known networks are sorted by the last connection time */
+	if (l_queue_length(data->networks) >= data->max_match_sets)
 		return false;
 
-	l_debug("Stopping periodic scan for wdev %" PRIx64, wdev_id);
+	l_queue_push_tail(data->networks, (void *) info);
 
-	if (sc->sp.timeout)
-		l_timeout_remove(sc->sp.timeout);
+	if (l_queue_isempty(info->known_frequencies))
+		data->all_freqs_known = false;
 
-	if (sc->sp.id) {
-		scan_cancel(wdev_id, sc->sp.id);
-		sc->sp.id = 0;
-	}
+	for (entry = l_queue_get_entries(info->known_frequencies); entry;
+			entry = entry->next) {
+		const struct known_frequency *known_freq = entry->data;
 
-	sc->sp.interval = 0;
-	sc->sp.trigger = NULL;
-	sc->sp.callback = NULL;
-	sc->sp.userdata = NULL;
-	sc->sp.retry = false;
-	sc->sp.needs_active_scan = false;
+		scan_freq_set_add(data->freqs, known_freq->frequency);
+	}
 
 	return true;
 }
 
-uint64_t scan_get_triggered_time(uint64_t wdev_id, uint32_t id)
-{
-	struct scan_context *sc;
-	struct scan_request *sr;
+/*
+ * Carry the periodic scan backoff over to the firmware: one scan plan per
+ * doubling of the interval, up to SCAN_MAX_INTERVAL or the driver's limit,
+ * each subject to the airtime budget.  Drivers with a single plan get the
+ * interval the backoff would settle on.
+ */
+static void scan_sched_build_attr_plans(struct l_genl_msg *msg,
+						struct scan_context *sc)
+{
+	unsigned int max_plans = wiphy_get_max_num_sched_scan_plans(sc->wiphy);
+	unsigned int max_interval =
+			wiphy_get_max_sched_scan_plan_interval(sc->wiphy);
+	unsigned int interval = sc->sp.interval;
+	uint32_t plan_interval;
+	uint32_t iterations = 1;
+	unsigned int i;
 
-	sc = l_queue_find(scan_contexts, scan_context_match, &wdev_id);
-	if (!sc)
-		return 0;
+	if (!max_interval || max_interval > SCAN_MAX_INTERVAL)
+		max_interval = SCAN_MAX_INTERVAL;
 
-	if (!sc->triggered)
-		return 0;
+	if (max_plans <= 1) {
+		plan_interval = minsize(scan_periodic_budget_interval(
+						max_interval,
+						sc->sp.last_airtime_ms),
+					max_interval) * 1000;
+		l_genl_msg_append_attr(msg, NL80211_ATTR_SCHED_SCAN_INTERVAL,
+					4, &plan_interval);
+		return;
+	}
 
-	sr = l_queue_find(sc->requests, scan_request_match, L_UINT_TO_PTR(id));
-	if (!sr)
-		return 0;
+	l_genl_msg_enter_nested(msg, NL80211_ATTR_SCHED_SCAN_PLANS);
 
-	return sr->start_time_tsf;
-}
+	for (i = 1;; i++, interval *= 2) {
+		plan_interval = minsize(scan_periodic_budget_interval(
+						minsize(interval, max_interval),
+						sc->sp.last_airtime_ms),
+					max_interval);
 
-static void scan_periodic_timeout(struct l_timeout *timeout, void *user_data)
-{
-	struct scan_context *sc = user_data;
+		l_genl_msg_enter_nested(msg, i);
+		l_genl_msg_append_attr(msg, NL80211_SCHED_SCAN_PLAN_INTERVAL,
+					4, &plan_interval);
 
-	l_debug("scan_periodic_timeout: %" PRIx64, sc->wdev_id);
+		/* The last plan has no iteration count and runs forever */
+		if (i == max_plans || plan_interval >= max_interval) {
+			l_genl_msg_leave_nested(msg);
+			break;
+		}
 
-	sc->sp.interval *= 2;
+		l_genl_msg_append_attr(msg, NL80211_SCHED_SCAN_PLAN_ITERATIONS,
+					4, &iterations);
+		l_genl_msg_leave_nested(msg);
+	}
 
-	scan_periodic_queue(sc);
+	l_genl_msg_leave_nested(msg);
 }
 
-static void scan_periodic_timeout_destroy(void *user_data)
+static struct l_genl_msg *scan_sched_build_cmd(struct scan_context *sc,
+						struct l_queue *networks,
+						struct scan_freq_set *freqs)
 {
-	struct scan_context *sc = user_data;
+	struct scan_parameters params = {};
+	const struct l_queue_entry *entry;
+	unsigned int max_ssids =
+			wiphy_get_max_num_sched_scan_ssids(sc->wiphy);
+	struct l_genl_msg *msg;
+	uint32_t flags = 0;
+	unsigned int num_ssids = 0;
+	unsigned int i = 0;
 
-	sc->sp.timeout = NULL;
-}
+	msg = l_genl_msg_new(NL80211_CMD_START_SCHED_SCAN);
 
-static void scan_periodic_rearm(struct scan_context *sc)
-{
-	l_debug("Arming periodic scan timer: %u", sc->sp.interval);
+	l_genl_msg_append_attr(msg, NL80211_ATTR_WDEV, 8, &sc->wdev_id);
+	scan_sched_build_attr_plans(msg, sc);
+	/* Have the kernel stop the scan if we go away */
+	l_genl_msg_append_attr(msg, NL80211_ATTR_SOCKET_OWNER, 0, NULL);
 
-	if (sc->sp.timeout)
-		l_timeout_modify(sc->sp.timeout, sc->sp.interval);
-	else
-		sc->sp.timeout = l_timeout_create(sc->sp.interval,
-						scan_periodic_timeout, sc,
-						scan_periodic_timeout_destroy);
-}
+	if (freqs)
+		scan_build_attr_scan_frequencies(msg, freqs);
 
-static bool start_next_scan_request(struct scan_context *sc)
-{
+	/* Hidden networks only show up if probed for by name */
+	for (entry = l_queue_get_entries(networks); entry;
+			entry = entry->next) {
+		const struct network_info *info = entry->data;
+
+		if (!info->is_hidden || num_ssids >= max_ssids)
+			continue;
+
+		if (!num_ssids)
+			l_genl_msg_enter_nested(msg, NL80211_ATTR_SCAN_SSIDS);
+
+		l_genl_msg_append_attr(msg, num_ssids++, strlen(info->ssid),
+					info->ssid);
+	}
+
+	if (num_ssids) {
+		l_genl_msg_leave_nested(msg);
+
+		if (wiphy_get_max_scan_ie_len(sc->wiphy))
+			scan_build_attr_ie(msg, sc, &params);
+
+		if (wiphy_has_feature(sc->wiphy,
+				NL80211_FEATURE_SCHED_SCAN_RANDOM_MAC_ADDR) &&
+				!scan_mac_address_randomization_is_disabled())
+			flags |= NL80211_SCAN_FLAG_RANDOM_ADDR;
+
+		if (wiphy_has_ext_feature(sc->wiphy,
+					NL80211_EXT_FEATURE_SCAN_RANDOM_SN))
+			flags |= NL80211_SCAN_FLAG_RANDOM_SN;
+	}
+
+	if (flags)
+		l_genl_msg_append_attr(msg, NL80211_ATTR_SCAN_FLAGS, 4, &flags);
+
+	l_genl_msg_enter_nested(msg, NL80211_ATTR_SCHED_SCAN_MATCH);
+
+	for (entry = l_queue_get_entries(networks); entry;
+			entry = entry->next) {
+		const struct network_info *info = entry->data;
+
+		l_genl_msg_enter_nested(msg, ++i);
+		l_genl_msg_append_attr(msg, NL80211_SCHED_SCAN_MATCH_ATTR_SSID,
+					strlen(info->ssid), info->ssid);
+		l_genl_msg_append_attr(msg, NL80211_SCHED_SCAN_MATCH_ATTR_RSSI,
+					4, &sched_scan_rssi_threshold);
+		l_genl_msg_leave_nested(msg);
+	}
+
+	l_genl_msg_leave_nested(msg);
+
+	return msg;
+}
+
+static void scan_sched_start_done(struct scan_context *sc, int err)
+{
+	sc->sp.sched_cmd_id = 0;
+
+	if (err < 0) {
+		l_debug("Scheduled scan failed to start: %s (%d), falling "
+			"back to periodic scans", strerror(-err), -err);
+
+		sc->sp.sched_scan_failed = true;
+		sc->sp.stats.sched_scan_fallbacks += 1;
+		scan_periodic_rearm(sc);
+		return;
+	}
+
+	l_debug("Scheduled scan started for wdev %" PRIx64
+		", initial interval %us", sc->wdev_id, sc->sp.interval);
+
+	sc->sp.sched_scan = true;
+}
+
+static void scan_sched_started(struct l_genl_msg *msg, void *user_data)
+{
+	scan_sched_start_done(user_data, l_genl_msg_get_error(msg));
+}
+
+/*
+ * Hand the periodic scan over to the firmware.  A scheduled scan with one
+ * match set per known network wakes us up only when one of them is seen
+ * above sched_scan_rssi_threshold, instead of every sp.interval seconds.
+ * Returns false if the periodic scan timer should be used instead.
+ */
+static bool scan_sched_start(struct scan_context *sc)
+{
+	struct scan_sched_data data;
+	struct l_genl_msg *msg;
+
+	if (sched_scan_disabled || sc->sp.sched_scan_failed ||
+			!wiphy_supports_sched_scan(sc->wiphy))
+		return false;
+
+	data.networks = l_queue_new();
+	data.max_match_sets = wiphy_get_max_match_sets(sc->wiphy);
+	data.freqs = scan_freq_set_new();
+	data.all_freqs_known = true;
+
+	known_networks_foreach(scan_sched_add_network, &data);
+
+	if (l_queue_isempty(data.networks)) {
+		msg = NULL;
+		goto done;
+	}
+
+	/*
+	 * Only narrow the scan down to the known frequencies if we have
+	 * them for every network, otherwise some might never be matched.
+	 */
+	scan_freq_set_constrain(data.freqs,
+				wiphy_get_supported_freqs(sc->wiphy));
+
+	msg = scan_sched_build_cmd(sc, data.networks,
+				data.all_freqs_known &&
+				!scan_freq_set_isempty(data.freqs) ?
+				data.freqs : NULL);
+
+	sc->sp.sched_cmd_id = l_genl_family_send(nl80211, msg,
+							scan_sched_started,
+							sc, NULL);
+	if (!sc->sp.sched_cmd_id)
+		l_genl_msg_unref(msg);
+
+done:
+	l_queue_destroy(data.networks, NULL);
+	scan_freq_set_free(data.freqs);
+
+	return msg && sc->sp.sched_cmd_id;
+}
+
+static void scan_sched_stop(struct scan_context *sc)
+{
+	struct l_genl_msg *msg;
+
+	if (!sc->sp.sched_cmd_id && !sc->sp.sched_scan)
+		return;
+
+	l_debug("Stopping scheduled scan for wdev %" PRIx64, sc->wdev_id);
+
+	/*
+	 * If START_SCHED_SCAN has already been sent, the STOP is still
+	 * processed after it.  Otherwise the kernel returns -ENOENT.
+	 */
+	if (sc->sp.sched_cmd_id) {
+		l_genl_family_cancel(nl80211, sc->sp.sched_cmd_id);
+		sc->sp.sched_cmd_id = 0;
+	}
+
+	sc->sp.sched_scan = false;
+
+	msg = l_genl_msg_new_sized(NL80211_CMD_STOP_SCHED_SCAN, 16);
+	l_genl_msg_append_attr(msg, NL80211_ATTR_WDEV, 8, &sc->wdev_id);
+
+	if (!l_genl_family_send(nl80211, msg, NULL, NULL, NULL))
+		l_genl_msg_unref(msg);
+}
+
+static void scan_sched_known_networks_changed(void *data, void *user_data)
+{
+	struct scan_context *sc = data;
+
+	if (!sc->sp.sched_scan && !sc->sp.sched_cmd_id)
+		return;
+
+	/*
+	 * The match sets no longer reflect the known networks.  Scan right
+	 * away, which also picks up a network that has just been added, and
+	 * hand over to the firmware again with the new set afterwards.
+	 */
+	l_debug("Known networks changed, restarting scheduled scan");
+
+	scan_sched_stop(sc);
+
+	if (!scan_periodic_queue(sc) && !sc->sp.retry)
+		scan_periodic_rearm(sc);
+}
+
+static void scan_known_networks_changed(enum known_networks_event event,
+					const struct network_info *info,
+					void *user_data)
+{
+	l_queue_foreach(scan_contexts, scan_sched_known_networks_changed,
+				NULL);
+}
+
+static bool scan_periodic_notify(int err, struct l_queue *bss_list,
+					void *user_data)
+{
+	struct scan_context *sc = user_data;
+
+	if (!err && bss_list)
+		scan_periodic_adapt(sc, bss_list);
+	else if (sc->sp.interval < SCAN_MAX_INTERVAL)
+		sc->sp.interval *= 2;
+
+	sc->sp.trigger_time = 0;
+
+	if (err || !scan_sched_start(sc))
+		scan_periodic_rearm(sc);
+
+	if (sc->sp.callback)
+		return sc->sp.callback(err, bss_list, sc->sp.userdata);
+
+	return false;
+}
+
+static bool scan_periodic_queue(struct scan_context *sc)
+{
+	if (!l_queue_isempty(sc->requests)) {
+		sc->sp.retry = true;
+		return false;
+	}
+
+	if (sc->sp.needs_active_scan && known_networks_has_hidden()) {
+		struct scan_parameters params = {
+			.randomize_mac_addr_hint = true
+		};
+
+		sc->sp.needs_active_scan = false;
+
+		sc->sp.id = scan_active_full(sc->wdev_id, &params,
+						scan_periodic_triggered,
+						scan_periodic_notify, sc, NULL);
+	} else
+		sc->sp.id = scan_passive(sc->wdev_id, NULL,
+						scan_periodic_triggered,
+						scan_periodic_notify, sc, NULL);
+
+	return sc->sp.id != 0;
+}
+
+static bool scan_periodic_is_disabled(void)
+{
+	const struct l_settings *config = iwd_get_config();
+	bool disabled;
+
+	if (!l_settings_get_bool(config, "Scan", "DisablePeriodicScan",
+								&disabled))
+		return false;
+
+	return disabled;
+}
+
+void scan_periodic_start(uint64_t wdev_id, scan_trigger_func_t trigger,
+				scan_notify_func_t func, void *userdata)
+{
+	struct scan_context *sc;
+
+	if (scan_periodic_is_disabled())
+		return;
+
+	sc = l_queue_find(scan_contexts, scan_context_match, &wdev_id);
+
+	if (!sc) {
+		l_error("scan_periodic_start called without scan_wdev_add");
+		return;
+	}
+
+	if (sc->sp.interval)
+		return;
+
+	l_debug("Starting periodic scan for wdev %" PRIx64, wdev_id);
+
+	sc->sp.interval = SCAN_INIT_INTERVAL;
+	sc->sp.stats.interval = SCAN_INIT_INTERVAL;
+	sc->sp.trigger = trigger;
+	sc->sp.callback = func;
+	sc->sp.userdata = userdata;
+
+	/* If nothing queued, start the first periodic scan */
+	scan_periodic_queue(sc);
+}
+
+bool scan_periodic_stop(uint64_t wdev_id)
+{
+	struct scan_context *sc;
+
+	sc = l_queue_find(scan_contexts, scan_context_match, &wdev_id);
+
+	if (!sc)
+		return false;
+
+	if (!sc->sp.interval)
+		return false;
+
+	l_debug("Stopping periodic scan for wdev %" PRIx64, wdev_id);
+
+	if (sc->sp.timeout)
+		l_timeout_remove(sc->sp.timeout);
+
+	if (sc->sp.id) {
+		scan_cancel(wdev_id, sc->sp.id);
+		sc->sp.id = 0;
+	}
+
+	scan_sched_stop(sc);
+	sc->sp.sched_scan_failed = false;
+
+	sc->sp.interval = 0;
+	sc->sp.trigger = NULL;
+	sc->sp.callback = NULL;
+	sc->sp.userdata = NULL;
+	sc->sp.retry = false;
+	sc->sp.needs_active_scan = false;
+	sc->sp.trigger_time = 0;
+
+	l_free(sc->sp.last_addrs);
+	sc->sp.last_addrs = NULL;
+	sc->sp.last_addrs_count = 0;
+	sc->sp.have_last_addrs = false;
+
+	return true;
+}
+
+bool scan_periodic_get_stats(uint64_t wdev_id,
+				struct scan_periodic_stats *out_stats)
+{
+	struct scan_context *sc;
+
+	sc = l_queue_find(scan_contexts, scan_context_match, &wdev_id);
+	if (!sc)
+		return false;
+
+	memcpy(out_stats, &sc->sp.stats, sizeof(*out_stats));
+
+	return true;
+}
+
+bool scan_hidden_bss_pending(uint64_t wdev_id)
+{
+	struct scan_context *sc;
+
+	sc = l_queue_find(scan_contexts, scan_context_match, &wdev_id);
+	if (!sc)
+		return false;
+
+	return sc->hidden_pending;
+}
+
+uint64_t scan_get_triggered_time(uint64_t wdev_id, uint32_t id)
+{
+	struct scan_context *sc;
+	struct scan_request *sr;
+
+	sc = l_queue_find(scan_contexts, scan_context_match, &wdev_id);
+	if (!sc)
+		return 0;
+
+	if (!sc->triggered)
+		return 0;
+
+	sr = l_queue_find(sc->requests, scan_request_match, L_UINT_TO_PTR(id));
+	if (!sr)
+		return 0;
+
+	return sr->start_time_tsf;
+}
+
+static void scan_periodic_timeout(struct l_timeout *timeout, void *user_data)
+{
+	struct scan_context *sc = user_data;
+
+	l_debug("scan_periodic_timeout: %" PRIx64, sc->wdev_id);
+
+	scan_periodic_queue(sc);
+}
+
+static void scan_periodic_timeout_destroy(void *user_data)
+{
+	struct scan_context *sc = user_data;
+
+	sc->sp.timeout = NULL;
+}
+
+static void scan_periodic_rearm(struct scan_context *sc)
+{
+	l_debug("Arming periodic scan timer: %u", sc->sp.interval);
+
+	if (sc->sp.timeout)
+		l_timeout_modify(sc->sp.timeout, sc->sp.interval);
+	else
+		sc->sp.timeout = l_timeout_create(sc->sp.interval,
+						scan_periodic_timeout, sc,
+						scan_periodic_timeout_destroy);
+}
+
+static bool start_next_scan_request(struct scan_context *sc)
+{
 	struct scan_request *sr = l_queue_peek_head(sc->requests);
 
 	if (sc->suspended)
@@ -839,6 +1601,9 @@ static bool start_next_scan_request(struct scan_context *sc)
 	if (sc->state != SCAN_STATE_NOT_RUNNING)
 		return true;
 
+	if (sc->slice_timeout)
+		return true;
+
 	while (sr) {
 		if (!scan_request_send_trigger(sc, sr))
 			return true;
@@ -924,6 +1689,24 @@ static bool scan_parse_advertisement_protocol(struct scan_bss *bss,
 	return true;
 }
 
+static void scan_bss_add_rnr_info(const struct ie_rnr_info *info,
+					void *user_data)
+{
+	struct scan_bss *bss = user_data;
+
+	if (scan_oper_class_to_band(NULL, info->oper_class) !=
+			SCAN_BAND_6_GHZ)
+		return;
+
+	if (!scan_channel_to_freq(info->channel_num, SCAN_BAND_6_GHZ))
+		return;
+
+	if (!bss->rnr_6ghz)
+		bss->rnr_6ghz = l_queue_new();
+
+	l_queue_push_tail(bss->rnr_6ghz, l_memdup(info, sizeof(*info)));
+}
+
 static bool scan_parse_bss_information_elements(struct scan_bss *bss,
 					const void *data, uint16_t len)
 {
@@ -1041,6 +1824,11 @@ static bool scan_parse_bss_information_elements(struct scan_bss *bss,
 			bss->rc_ie = l_memdup(iter.data - 2, iter.len + 2);
 
 			break;
+		case IE_TYPE_REDUCED_NEIGHBOR_REPORT:
+			/* Only the 6 GHz entries are of use, for now */
+			ie_parse_reduced_neighbor_report(&iter,
+						scan_bss_add_rnr_info, bss);
+			break;
 		}
 	}
 
@@ -1321,6 +2109,7 @@ static void scan_bss_compute_rank(struct scan_bss *bss)
 			factor = factor * data_rate / 2340000000U +
 						RANK_MIN_SUPPORTED_RATE_FACTOR;
 			rank *= factor;
+			bss->data_rate = data_rate;
 		} else
 			rank *= RANK_MIN_SUPPORTED_RATE_FACTOR;
 	}
@@ -1367,6 +2156,7 @@ void scan_bss_free(struct scan_bss *bss)
 	l_free(bss->wsc);
 	l_free(bss->osen);
 	l_free(bss->rc_ie);
+	l_queue_destroy(bss->rnr_6ghz, l_free);
 
 	switch (bss->source_frame) {
 	case SCAN_BSS_PROBE_RESP:
@@ -1431,6 +2221,21 @@ int scan_bss_get_rsn_info(const struct scan_bss *bss, struct ie_rsn_info *info)
 	return 0;
 }
 
+/*
+ * Rough estimate, in kbit/s, of the throughput a station could get from
+ * @bss: the best data rate usable at the observed signal strength scaled
+ * down by typical MAC efficiency and by the share of the channel that the
+ * BSS reports as busy.  Returns 0 if the data rate could not be determined.
+ */
+uint32_t scan_bss_get_expected_throughput(const struct scan_bss *bss)
+{
+	uint64_t throughput = bss->data_rate / 1000;
+
+	throughput = throughput * 6 / 10;
+
+	return throughput * (256 - bss->utilization) / 256;
+}
+
 int scan_bss_rank_compare(const void *a, const void *b, void *user_data)
 {
 	const struct scan_bss *new_bss = a, *bss = b;
@@ -1466,20 +2271,116 @@ static void get_scan_callback(struct l_genl_msg *msg, void *user_data)
 	l_queue_insert(results->bss_list, bss, scan_bss_rank_compare, NULL);
 }
 
-static void discover_hidden_network_bsses(struct scan_context *sc,
-						struct l_queue *bss_list)
+static bool scan_hidden_bss_match(const void *a, const void *b)
 {
-	const struct l_queue_entry *bss_entry;
+	const struct scan_hidden_bss *hb = a;
 
-	for (bss_entry = l_queue_get_entries(bss_list); bss_entry;
-						bss_entry = bss_entry->next) {
-		struct scan_bss *bss = bss_entry->data;
+	return !memcmp(hb->addr, b, 6);
+}
+
+static bool scan_hidden_bss_is_stale(const struct scan_hidden_bss *hb,
+					uint64_t now)
+{
+	unsigned int timeout = hb->ssid[0] ? SCAN_HIDDEN_RESOLVED_TIMEOUT :
+					SCAN_HIDDEN_UNRESOLVED_TIMEOUT;
+
+	if (!hb->last_probed)
+		return true;
+
+	return l_time_after(now, l_time_offset(hb->last_probed,
+						timeout * L_USEC_PER_SEC));
+}
+
+static bool scan_hidden_bss_expired(void *data, void *user_data)
+{
+	struct scan_hidden_bss *hb = data;
+	const uint64_t *now = user_data;
+
+	if (l_time_after(l_time_offset(hb->last_seen,
+				SCAN_HIDDEN_UNRESOLVED_TIMEOUT *
+				L_USEC_PER_SEC), *now))
+		return false;
+
+	l_free(hb);
+	return true;
+}
+
+/* The probe response of a hidden BSS, if it answered to one of our SSIDs */
+static const struct scan_bss *scan_hidden_bss_resolve(struct l_queue *bss_list,
+							const uint8_t *addr)
+{
+	const struct l_queue_entry *entry;
+
+	for (entry = l_queue_get_entries(bss_list); entry;
+						entry = entry->next) {
+		const struct scan_bss *bss = entry->data;
+
+		if (!memcmp(bss->addr, addr, 6) &&
+				!util_ssid_is_hidden(bss->ssid_len, bss->ssid))
+			return bss;
+	}
+
+	return NULL;
+}
+
+/*
+ * Remember which SSID each hidden BSS answered to, or that it answered to
+ * none of our hidden SSIDs, so that following scans don't need to probe
+ * for them again until the entry goes stale.
+ */
+static void scan_hidden_update(struct scan_context *sc,
+				struct l_queue *bss_list,
+				struct scan_request *sr)
+{
+	const struct l_queue_entry *entry;
+	uint64_t now = l_time_now();
+	bool pending = false;
+
+	for (entry = l_queue_get_entries(bss_list); entry;
+						entry = entry->next) {
+		const struct scan_bss *bss = entry->data;
+		const struct scan_bss *named;
+		struct scan_hidden_bss *hb;
 
 		if (!util_ssid_is_hidden(bss->ssid_len, bss->ssid))
 			continue;
 
+		hb = l_queue_find(sc->hidden_bsses, scan_hidden_bss_match,
+					bss->addr);
+		if (!hb) {
+			hb = l_new(struct scan_hidden_bss, 1);
+			memcpy(hb->addr, bss->addr, 6);
+			l_queue_push_tail(sc->hidden_bsses, hb);
+		}
+
+		hb->last_seen = now;
+		named = scan_hidden_bss_resolve(bss_list, bss->addr);
+
+		if (named) {
+			memcpy(hb->ssid, named->ssid, named->ssid_len);
+			hb->ssid[named->ssid_len] = '\0';
+			hb->last_probed = now;
+		} else if (sr && sr->hidden_freqs &&
+				scan_freq_set_contains(sr->hidden_freqs,
+							bss->frequency)) {
+			/* Probed for all our hidden SSIDs, answered none */
+			hb->ssid[0] = '\0';
+			hb->last_probed = now;
+		} else if (scan_hidden_bss_is_stale(hb, now)) {
+			/* No longer answers to the SSID it used to */
+			hb->ssid[0] = '\0';
+			hb->last_probed = 0;
+			pending = true;
+		}
+	}
+
+	l_queue_foreach_remove(sc->hidden_bsses, scan_hidden_bss_expired,
+				&now);
+
+	sc->hidden_pending = pending;
+
+	if (pending)
 		sc->sp.needs_active_scan = true;
-	}
 }
 
 static void scan_finished(struct scan_context *sc,
@@ -1489,12 +2390,15 @@ static void scan_finished(struct scan_context *sc,
 	bool new_owner = false;
 
 	if (bss_list)
-		discover_hidden_network_bsses(sc, bss_list);
+		scan_hidden_update(sc, bss_list, sr);
 
 	if  (sr) {
 		l_queue_remove(sc->requests, sr);
 		sc->started = false;
 
+		l_timeout_remove(sc->slice_timeout);
+		sc->slice_timeout = NULL;
+
 		if (sr->callback)
 			new_owner = sr->callback(err, bss_list, sr->userdata);
 
@@ -1516,6 +2420,175 @@ static void scan_finished(struct scan_context *sc,
 				(l_queue_destroy_func_t) scan_bss_free);
 }
 
+struct scan_rnr_6ghz_data {
+	struct scan_freq_set *freqs;
+	uint8_t bssid[6];
+	unsigned int num_bssids;
+};
+
+static void scan_rnr_6ghz_collect(void *data, void *user_data)
+{
+	const struct ie_rnr_info *info = data;
+	struct scan_rnr_6ghz_data *rnr = user_data;
+
+	scan_freq_set_add(rnr->freqs, scan_channel_to_freq(info->channel_num,
+							SCAN_BAND_6_GHZ));
+
+	if (!info->addr_present) {
+		/* Unknown BSSID, can't narrow the probe down to one BSS */
+		rnr->num_bssids = 2;
+		return;
+	}
+
+	if (rnr->num_bssids && !memcmp(rnr->bssid, info->addr, 6))
+		return;
+
+	memcpy(rnr->bssid, info->addr, 6);
+	rnr->num_bssids++;
+}
+
+/*
+ * Queue a second pass over the 6 GHz non-PSC channels advertised by the
+ * BSSes found in the first pass.  The follow-up trigger doesn't flush so
+ * the GET_SCAN after it returns the results of both passes.  Returns false
+ * if there is nothing to probe and the request can complete.
+ */
+static bool scan_rnr_6ghz_follow_up(struct scan_context *sc,
+					struct scan_request *sr,
+					struct l_queue *bss_list)
+{
+	struct scan_rnr_6ghz_data rnr = {};
+	struct scan_parameters params = {};
+	const struct l_queue_entry *entry;
+
+	if (!sr->rnr_6ghz)
+		return false;
+
+	sr->rnr_6ghz = false;
+	rnr.freqs = scan_freq_set_new();
+
+	for (entry = l_queue_get_entries(bss_list); entry;
+						entry = entry->next) {
+		const struct scan_bss *bss = entry->data;
+
+		l_queue_foreach(bss->rnr_6ghz, scan_rnr_6ghz_collect, &rnr);
+	}
+
+	scan_freq_set_constrain(rnr.freqs,
+				wiphy_get_supported_freqs(sc->wiphy));
+	scan_freq_set_constrain_6ghz(rnr.freqs, false);
+
+	if (scan_freq_set_isempty(rnr.freqs)) {
+		scan_freq_set_free(rnr.freqs);
+		return false;
+	}
+
+	params.freqs = rnr.freqs;
+	params.randomize_mac_addr_hint = sr->randomize_mac_addr_hint;
+
+	if (rnr.num_bssids == 1)
+		params.bssid = rnr.bssid;
+
+	scan_cmds_add(sr->cmds, sc, sr->passive, true, &params);
+	scan_freq_set_free(rnr.freqs);
+
+	l_debug("Probing 6 GHz channels from RNR, %s",
+		rnr.num_bssids == 1 ? "single BSS" : "wildcard BSSID");
+
+	start_next_scan_request(sc);
+	return true;
+}
+
+static bool scan_hidden_ssid_match(const void *a, const void *b)
+{
+	return !strcmp(a, b);
+}
+
+/*
+ * Queue directed probes on just the channels of the hidden BSSes from the
+ * first pass that aren't resolved yet.  If each of them has already
+ * answered to one of our SSIDs before, only those SSIDs are probed for,
+ * otherwise all hidden known networks are.  Like the RNR follow-up this
+ * doesn't flush so the results of both passes are returned together.
+ */
+static bool scan_hidden_follow_up(struct scan_context *sc,
+					struct scan_request *sr,
+					struct l_queue *bss_list)
+{
+	struct scan_parameters params = {};
+	const struct l_queue_entry *entry;
+	struct scan_freq_set *freqs;
+	struct l_queue *ssids;
+	uint64_t now = l_time_now();
+	bool all_resolved = true;
+	bool queued = false;
+
+	if (!sr->hidden_follow_up)
+		return false;
+
+	sr->hidden_follow_up = false;
+
+	if (!wiphy_get_max_num_ssids_per_scan(sc->wiphy))
+		return false;
+
+	freqs = scan_freq_set_new();
+	ssids = l_queue_new();
+
+	for (entry = l_queue_get_entries(bss_list); entry;
+						entry = entry->next) {
+		const struct scan_bss *bss = entry->data;
+		struct scan_hidden_bss *hb;
+
+		if (!util_ssid_is_hidden(bss->ssid_len, bss->ssid))
+			continue;
+
+		if (scan_freq_set_contains(sr->hidden_freqs, bss->frequency))
+			continue;
+
+		if (scan_hidden_bss_resolve(bss_list, bss->addr))
+			continue;
+
+		hb = l_queue_find(sc->hidden_bsses, scan_hidden_bss_match,
+					bss->addr);
+		if (hb && !scan_hidden_bss_is_stale(hb, now))
+			continue;
+
+		scan_freq_set_add(freqs, bss->frequency);
+
+		if (!hb || !hb->ssid[0])
+			all_resolved = false;
+		else if (!l_queue_find(ssids, scan_hidden_ssid_match,
+						hb->ssid))
+			l_queue_push_tail(ssids, hb->ssid);
+	}
+
+	if (scan_freq_set_isempty(freqs))
+		goto done;
+
+	if (!all_resolved) {
+		l_queue_destroy(ssids, NULL);
+		ssids = scan_get_hidden_ssids();
+		scan_freq_set_merge(sr->hidden_freqs, freqs);
+	}
+
+	params.freqs = freqs;
+	params.randomize_mac_addr_hint = sr->randomize_mac_addr_hint;
+
+	scan_cmds_add_ssids(sr->cmds, sc, &params, ssids);
+
+	l_debug("Probing for %u hidden SSIDs on hidden BSS channels",
+		l_queue_length(ssids));
+
+	start_next_scan_request(sc);
+	queued = true;
+
+done:
+	l_queue_destroy(ssids, NULL);
+	scan_freq_set_free(freqs);
+
+	return queued;
+}
+
 static void get_scan_done(void *user)
 {
 	struct scan_results *results = user;
@@ -1525,11 +2598,16 @@ static void get_scan_done(void *user)
 
 	sc->get_scan_cmd_id = 0;
 
-	if (l_queue_peek_head(sc->requests) == results->sr)
-		scan_finished(sc, 0, results->bss_list, results->sr);
-	else
+	if (l_queue_peek_head(sc->requests) != results->sr ||
+			(results->sr && (scan_rnr_6ghz_follow_up(sc,
+							results->sr,
+							results->bss_list) ||
+					scan_hidden_follow_up(sc, results->sr,
+							results->bss_list))))
 		l_queue_destroy(results->bss_list,
 				(l_queue_destroy_func_t) scan_bss_free);
+	else
+		scan_finished(sc, 0, results->bss_list, results->sr);
 
 	if (results->freqs)
 		scan_freq_set_free(results->freqs);
@@ -1578,6 +2656,98 @@ static void scan_parse_new_scan_results(struct l_genl_msg *msg,
 	}
 }
 
+static void scan_slice_timeout(struct l_timeout *timeout, void *user_data)
+{
+	struct scan_context *sc = user_data;
+
+	l_timeout_remove(sc->slice_timeout);
+	sc->slice_timeout = NULL;
+
+	start_next_scan_request(sc);
+}
+
+static void scan_get_results(struct scan_context *sc, struct scan_request *sr,
+				struct l_genl_msg *msg)
+{
+	struct l_genl_msg *scan_msg;
+	struct scan_results *results;
+
+	results = l_new(struct scan_results, 1);
+	results->sc = sc;
+	results->time_stamp = l_time_now();
+	results->sr = sr;
+
+	scan_parse_new_scan_results(msg, results);
+
+	scan_msg = l_genl_msg_new_sized(NL80211_CMD_GET_SCAN, 8);
+	l_genl_msg_append_attr(scan_msg, NL80211_ATTR_WDEV, 8, &sc->wdev_id);
+	sc->get_scan_cmd_id = l_genl_family_dump(nl80211, scan_msg,
+							get_scan_callback,
+							results, get_scan_done);
+	if (sc->get_scan_cmd_id)
+		return;
+
+	l_genl_msg_unref(scan_msg);
+
+	if (results->freqs)
+		scan_freq_set_free(results->freqs);
+
+	l_free(results);
+}
+
+/*
+ * Unlike the other scan events, SCHED_SCAN_RESULTS and SCHED_SCAN_STOPPED
+ * only carry WIPHY, IFINDEX and COOKIE so the scan context is looked up
+ * through the netdev.
+ */
+static void scan_sched_notify(struct l_genl_msg *msg, uint8_t cmd)
+{
+	uint32_t ifindex;
+	struct netdev *netdev;
+	uint64_t wdev_id;
+	struct scan_context *sc;
+
+	if (nl80211_parse_attrs(msg, NL80211_ATTR_IFINDEX, &ifindex,
+					NL80211_ATTR_UNSPEC) < 0)
+		return;
+
+	netdev = netdev_find(ifindex);
+	if (!netdev)
+		return;
+
+	wdev_id = netdev_get_wdev_id(netdev);
+
+	sc = l_queue_find(scan_contexts, scan_context_match, &wdev_id);
+	if (!sc)
+		return;
+
+	switch (cmd) {
+	case NL80211_CMD_SCHED_SCAN_RESULTS:
+		if (!sc->sp.sched_scan || sc->get_scan_cmd_id)
+			break;
+
+		l_debug("Scheduled scan matched for wdev %" PRIx64,
+			sc->wdev_id);
+
+		sc->sp.stats.sched_scan_results += 1;
+		scan_get_results(sc, NULL, msg);
+		break;
+
+	case NL80211_CMD_SCHED_SCAN_STOPPED:
+		if (!sc->sp.sched_scan)
+			break;
+
+		/* Stopped by the kernel or driver rather than by us */
+		l_debug("Scheduled scan stopped, resuming periodic scans");
+
+		sc->sp.sched_scan = false;
+		sc->sp.sched_scan_failed = true;
+		sc->sp.stats.sched_scan_fallbacks += 1;
+		scan_periodic_rearm(sc);
+		break;
+	}
+}
+
 static void scan_notify(struct l_genl_msg *msg, void *user_data)
 {
 	struct l_genl_attr attr;
@@ -1595,6 +2765,13 @@ static void scan_notify(struct l_genl_msg *msg, void *user_data)
 
 	l_debug("Scan notification %s(%u)", nl80211cmd_to_string(cmd), cmd);
 
+	switch (cmd) {
+	case NL80211_CMD_SCHED_SCAN_RESULTS:
+	case NL80211_CMD_SCHED_SCAN_STOPPED:
+		scan_sched_notify(msg, cmd);
+		return;
+	}
+
 	if (nl80211_parse_attrs(msg, NL80211_ATTR_WDEV, &wdev_id,
 					NL80211_ATTR_WIPHY, &wiphy_id,
 					NL80211_ATTR_UNSPEC) < 0)
@@ -1626,8 +2803,6 @@ static void scan_notify(struct l_genl_msg *msg, void *user_data)
 	switch (cmd) {
 	case NL80211_CMD_NEW_SCAN_RESULTS:
 	{
-		struct l_genl_msg *scan_msg;
-		struct scan_results *results;
 		bool send_next = false;
 		bool get_results = false;
 
@@ -1653,6 +2828,12 @@ static void scan_notify(struct l_genl_msg *msg, void *user_data)
 			 */
 			if (l_queue_isempty(sr->cmds))
 				get_results = true;
+			else if (sr->sliced && slice_interval_ms)
+				/* Give the operating channel some airtime */
+				sc->slice_timeout = l_timeout_create_ms(
+							slice_interval_ms,
+							scan_slice_timeout,
+							sc, NULL);
 			else
 				send_next = true;
 		} else {
@@ -1675,22 +2856,8 @@ static void scan_notify(struct l_genl_msg *msg, void *user_data)
 		if (send_next)
 			start_next_scan_request(sc);
 
-		if (!get_results)
-			break;
-
-		results = l_new(struct scan_results, 1);
-		results->sc = sc;
-		results->time_stamp = l_time_now();
-		results->sr = sr;
-
-		scan_parse_new_scan_results(msg, results);
-
-		scan_msg = l_genl_msg_new_sized(NL80211_CMD_GET_SCAN, 8);
-		l_genl_msg_append_attr(scan_msg, NL80211_ATTR_WDEV, 8,
-					&sc->wdev_id);
-		sc->get_scan_cmd_id = l_genl_family_dump(nl80211, scan_msg,
-							get_scan_callback,
-							results, get_scan_done);
+		if (get_results)
+			scan_get_results(sc, sr, msg);
 
 		break;
 	}
@@ -1731,6 +2898,20 @@ static void scan_notify(struct l_genl_msg *msg, void *user_data)
 	}
 }
 
+void __scan_notify(struct l_genl_msg *msg)
+{
+	scan_notify(msg, NULL);
+}
+
+void __scan_sched_started(uint64_t wdev_id, int err)
+{
+	struct scan_context *sc;
+
+	sc = l_queue_find(scan_contexts, scan_context_match, &wdev_id);
+	if (sc)
+		scan_sched_start_done(sc, err);
+}
+
 uint8_t scan_freq_to_channel(uint32_t freq, enum scan_band *out_band)
 {
 	uint32_t channel = 0;
@@ -1745,6 +2926,10 @@ uint8_t scan_freq_to_channel(uint32_t freq, enum scan_band *out_band)
 				return 0;
 
 			channel /= 5;
+
+			/* Channel 14 is 2484, nothing lies between */
+			if (channel > 13)
+				return 0;
 		}
 
 		if (out_band)
@@ -1777,6 +2962,30 @@ uint8_t scan_freq_to_channel(uint32_t freq, enum scan_band *out_band)
 		return channel;
 	}
 
+	/* 6 GHz channel 2 is the odd one out, sitting below channel 1 */
+	if (freq == 5935) {
+		if (out_band)
+			*out_band = SCAN_BAND_6_GHZ;
+
+		return 2;
+	}
+
+	if (freq >= 5955 && freq <= 7115) {
+		if (freq % 5)
+			return 0;
+
+		channel = (freq - 5950) / 5;
+
+		/* 5960 would alias channel 2, which is 5935 */
+		if (channel == 2)
+			return 0;
+
+		if (out_band)
+			*out_band = SCAN_BAND_6_GHZ;
+
+		return channel;
+	}
+
 	return 0;
 }
 
@@ -1798,6 +3007,14 @@ uint32_t scan_channel_to_freq(uint8_t channel, enum scan_band band)
 			return 4000 + 5 * channel;
 	}
 
+	if (band == SCAN_BAND_6_GHZ) {
+		if (channel == 2)
+			return 5935;
+
+		if (channel >= 1 && channel <= 233)
+			return 5950 + 5 * channel;
+	}
+
 	return 0;
 }
 
@@ -1853,10 +3070,11 @@ static const uint8_t oper_class_jp_to_global[] = {
 	/* 128 - 130 is a 1 to 1 mapping */
 };
 
-/* Annex E, table E-4 (only 2.4GHz and 4.9 / 5GHz bands) */
+/* Annex E, table E-4 (only 2.4GHz, 4.9 / 5GHz and 6GHz bands) */
 static const enum scan_band oper_class_to_band_global[] = {
 	[81 ... 84]   = SCAN_BAND_2_4_GHZ,
 	[104 ... 130] = SCAN_BAND_5_GHZ,
+	[131 ... 136] = SCAN_BAND_6_GHZ,
 };
 
 /* Annex E, table E-5 */
@@ -1924,164 +3142,203 @@ enum scan_band scan_oper_class_to_band(const uint8_t *country,
 		return 0;
 }
 
+/*
+ * Fixed-size per-band channel bitmaps: 2.4 GHz channels 1-14, 5 GHz
+ * channels 1-199 (including the 4.9 GHz range mapped to 181-199) and
+ * 6 GHz channels 1-233.  A set is a single flat allocation, and merge,
+ * intersection and emptiness checks are word-wise.
+ */
+#define SCAN_FREQ_SET_WORDS	4	/* 256 channels per band */
+
 struct scan_freq_set {
 	uint16_t channels_2ghz;
-	struct l_uintset *channels_5ghz;
+	uint64_t channels_5ghz[SCAN_FREQ_SET_WORDS];
+	uint64_t channels_6ghz[SCAN_FREQ_SET_WORDS];
 };
 
 struct scan_freq_set *scan_freq_set_new(void)
 {
-	struct scan_freq_set *ret = l_new(struct scan_freq_set, 1);
-
-	/* 802.11-2012, 8.4.2.10 hints that 200 is the largest channel number */
-	ret->channels_5ghz = l_uintset_new_from_range(1, 200);
-
-	return ret;
+	return l_new(struct scan_freq_set, 1);
 }
 
 void scan_freq_set_free(struct scan_freq_set *freqs)
 {
-	l_uintset_free(freqs->channels_5ghz);
 	l_free(freqs);
 }
 
+static uint64_t *scan_freq_set_band_words(const struct scan_freq_set *freqs,
+						enum scan_band band)
+{
+	switch (band) {
+	case SCAN_BAND_5_GHZ:
+		return (uint64_t *) freqs->channels_5ghz;
+	case SCAN_BAND_6_GHZ:
+		return (uint64_t *) freqs->channels_6ghz;
+	case SCAN_BAND_2_4_GHZ:
+		break;
+	}
+
+	return NULL;
+}
+
 bool scan_freq_set_add(struct scan_freq_set *freqs, uint32_t freq)
 {
 	enum scan_band band;
 	uint8_t channel;
+	uint64_t *words;
 
 	channel = scan_freq_to_channel(freq, &band);
 	if (!channel)
 		return false;
 
-	switch (band) {
-	case SCAN_BAND_2_4_GHZ:
+	if (band == SCAN_BAND_2_4_GHZ) {
 		freqs->channels_2ghz |= 1 << (channel - 1);
 		return true;
-	case SCAN_BAND_5_GHZ:
-		return l_uintset_put(freqs->channels_5ghz, channel);
 	}
 
-	return false;
+	words = scan_freq_set_band_words(freqs, band);
+	if (!words)
+		return false;
+
+	words[channel / 64] |= (uint64_t) 1 << (channel % 64);
+	return true;
 }
 
 bool scan_freq_set_contains(struct scan_freq_set *freqs, uint32_t freq)
 {
 	enum scan_band band;
 	uint8_t channel;
+	uint64_t *words;
 
 	channel = scan_freq_to_channel(freq, &band);
 	if (!channel)
 		return false;
 
-	switch (band) {
-	case SCAN_BAND_2_4_GHZ:
+	if (band == SCAN_BAND_2_4_GHZ)
 		return freqs->channels_2ghz & (1 << (channel - 1));
-	case SCAN_BAND_5_GHZ:
-		return l_uintset_contains(freqs->channels_5ghz, channel);
-	}
 
-	return false;
+	words = scan_freq_set_band_words(freqs, band);
+	if (!words)
+		return false;
+
+	return words[channel / 64] & ((uint64_t) 1 << (channel % 64));
+}
+
+static bool scan_channels_isempty(const uint64_t *words)
+{
+	unsigned int i;
+
+	for (i = 0; i < SCAN_FREQ_SET_WORDS; i++)
+		if (words[i])
+			return false;
+
+	return true;
 }
 
 uint32_t scan_freq_set_get_bands(struct scan_freq_set *freqs)
 {
 	uint32_t bands = 0;
-	uint32_t max;
 
 	if (freqs->channels_2ghz)
 		bands |= SCAN_BAND_2_4_GHZ;
 
-	max = l_uintset_get_max(freqs->channels_5ghz);
-
-	if (l_uintset_find_min(freqs->channels_5ghz) <= max)
+	if (!scan_channels_isempty(freqs->channels_5ghz))
 		bands |= SCAN_BAND_5_GHZ;
 
-	return bands;
-}
-
-static void scan_channels_5ghz_add(uint32_t channel, void *user_data)
-{
-	struct l_uintset *to = user_data;
+	if (!scan_channels_isempty(freqs->channels_6ghz))
+		bands |= SCAN_BAND_6_GHZ;
 
-	l_uintset_put(to, channel);
+	return bands;
 }
 
 void scan_freq_set_merge(struct scan_freq_set *to,
 					const struct scan_freq_set *from)
 {
+	unsigned int i;
+
 	to->channels_2ghz |= from->channels_2ghz;
 
-	l_uintset_foreach(from->channels_5ghz, scan_channels_5ghz_add,
-							to->channels_5ghz);
+	for (i = 0; i < SCAN_FREQ_SET_WORDS; i++) {
+		to->channels_5ghz[i] |= from->channels_5ghz[i];
+		to->channels_6ghz[i] |= from->channels_6ghz[i];
+	}
 }
 
 bool scan_freq_set_isempty(const struct scan_freq_set *set)
 {
-	if (set->channels_2ghz == 0 && l_uintset_isempty(set->channels_5ghz))
-		return true;
-
-	return false;
+	return set->channels_2ghz == 0 &&
+			scan_channels_isempty(set->channels_5ghz) &&
+			scan_channels_isempty(set->channels_6ghz);
 }
 
-struct channels_5ghz_foreach_data {
-	scan_freq_set_func_t func;
-	void *user_data;
-};
-
-static void scan_channels_5ghz_frequency(uint32_t channel, void *user_data)
+static void scan_channels_foreach(const uint64_t *words, enum scan_band band,
+				scan_freq_set_func_t func, void *user_data)
 {
-	const struct channels_5ghz_foreach_data *channels_5ghz_data = user_data;
-	uint32_t freq;
+	unsigned int i;
 
-	freq = scan_channel_to_freq(channel, SCAN_BAND_5_GHZ);
+	for (i = 0; i < SCAN_FREQ_SET_WORDS; i++) {
+		uint64_t word = words[i];
 
-	channels_5ghz_data->func(freq, channels_5ghz_data->user_data);
+		while (word) {
+			uint8_t channel = i * 64 + __builtin_ctzll(word);
+
+			func(scan_channel_to_freq(channel, band), user_data);
+			word &= word - 1;
+		}
+	}
 }
 
 void scan_freq_set_foreach(const struct scan_freq_set *freqs,
 				scan_freq_set_func_t func, void *user_data)
 {
-	struct channels_5ghz_foreach_data data = { };
-	uint8_t channel;
-	uint32_t freq;
+	uint16_t channels_2ghz;
 
 	if (unlikely(!freqs || !func))
 		return;
 
-	data.func = func;
-	data.user_data = user_data;
-
-	l_uintset_foreach(freqs->channels_5ghz, scan_channels_5ghz_frequency,
-									&data);
-
-	if (!freqs->channels_2ghz)
-		return;
+	scan_channels_foreach(freqs->channels_5ghz, SCAN_BAND_5_GHZ,
+				func, user_data);
+	scan_channels_foreach(freqs->channels_6ghz, SCAN_BAND_6_GHZ,
+				func, user_data);
 
-	for (channel = 1; channel <= 14; channel++) {
-		if (freqs->channels_2ghz & (1 << (channel - 1))) {
-			freq = scan_channel_to_freq(channel, SCAN_BAND_2_4_GHZ);
+	for (channels_2ghz = freqs->channels_2ghz; channels_2ghz;
+			channels_2ghz &= channels_2ghz - 1) {
+		uint8_t channel = __builtin_ctz(channels_2ghz) + 1;
 
-			func(freq, user_data);
-		}
+		func(scan_channel_to_freq(channel, SCAN_BAND_2_4_GHZ),
+			user_data);
 	}
 }
 
 void scan_freq_set_constrain(struct scan_freq_set *set,
 					const struct scan_freq_set *constraint)
 {
-	struct l_uintset *intersection;
+	unsigned int i;
 
-	intersection = l_uintset_intersect(constraint->channels_5ghz,
-							set->channels_5ghz);
-	if (!intersection)
-		/* This shouldn't ever be the case. */
-		return;
+	set->channels_2ghz &= constraint->channels_2ghz;
 
-	l_uintset_free(set->channels_5ghz);
-	set->channels_5ghz = intersection;
+	for (i = 0; i < SCAN_FREQ_SET_WORDS; i++) {
+		set->channels_5ghz[i] &= constraint->channels_5ghz[i];
+		set->channels_6ghz[i] &= constraint->channels_6ghz[i];
+	}
+}
 
-	set->channels_2ghz &= constraint->channels_2ghz;
+/*
+ * Keep only the 6 GHz Preferred Scanning Channels (5, 21, ..., 229) if
+ * @psc is true, or only the non-PSC channels otherwise.  Other bands are
+ * left alone.
+ */
+static void scan_freq_set_constrain_6ghz(struct scan_freq_set *set, bool psc)
+{
+	uint64_t psc_mask[SCAN_FREQ_SET_WORDS] = {};
+	unsigned int channel;
+	unsigned int i;
+
+	for (channel = 5; channel <= 229; channel += 16)
+		psc_mask[channel / 64] |= (uint64_t) 1 << (channel % 64);
+
+	for (i = 0; i < SCAN_FREQ_SET_WORDS; i++)
+		set->channels_6ghz[i] &= psc ? psc_mask[i] : ~psc_mask[i];
 }
 
 bool scan_wdev_add(uint64_t wdev_id)
@@ -2159,15 +3416,45 @@ static int scan_init(void)
 
 	scan_contexts = l_queue_new();
 
+	known_networks_watch = known_networks_watch_add(
+					scan_known_networks_changed,
+					NULL, NULL);
+
 	if (!l_settings_get_double(config, "Rank", "BandModifier5Ghz",
 					&RANK_5G_FACTOR))
 		RANK_5G_FACTOR = 1.0;
 
+	if (!l_settings_get_uint(config, "Scan", "SliceMaxChannels",
+					&slice_max_channels))
+		slice_max_channels = 3;
+
+	if (!l_settings_get_uint(config, "Scan", "SliceInterval",
+					&slice_interval_ms))
+		slice_interval_ms = 150;
+
+	if (!l_settings_get_uint(config, "Scan", "PeriodicScanMaxAirtime",
+					&periodic_max_airtime) ||
+			periodic_max_airtime > 100)
+		periodic_max_airtime = 5;
+
+	if (!l_settings_get_bool(config, "Scan", "DisableScheduledScan",
+					&sched_scan_disabled))
+		sched_scan_disabled = false;
+
+	if (!l_settings_get_int(config, "Scan", "ScheduledScanRSSIThreshold",
+					&sched_scan_rssi_threshold) ||
+			sched_scan_rssi_threshold > 0 ||
+			sched_scan_rssi_threshold < -100)
+		sched_scan_rssi_threshold = -80;
+
 	return 0;
 }
 
 static void scan_exit()
 {
+	known_networks_watch_remove(known_networks_watch);
+	known_networks_watch = 0;
+
 	l_queue_destroy(scan_contexts,
 				(l_queue_destroy_func_t) scan_context_free);
 	scan_contexts = NULL;
@@ -2176,3 +3463,4 @@ static void scan_exit()
 }
 
 IWD_MODULE(scan, scan_init, scan_exit)
+IWD_MODULE_DEPENDS(scan, known_networks)
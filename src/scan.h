@@ -23,6 +23,7 @@
 enum scan_band {
 	SCAN_BAND_2_4_GHZ =	0x1,
 	SCAN_BAND_5_GHZ =	0x2,
+	SCAN_BAND_6_GHZ =	0x4,
 };
 
 enum scan_state {
@@ -75,6 +76,7 @@ struct scan_bss {
 	uint8_t utilization;
 	uint8_t cc[3];
 	uint16_t rank;
+	uint64_t data_rate;	/* Estimated max data rate in bit/s, 0 if unknown */
 	uint8_t ht_ie[28];
 	uint8_t vht_ie[14];
 	uint64_t time_stamp;
@@ -82,6 +84,7 @@ struct scan_bss {
 	uint8_t *rc_ie;		/* Roaming consortium IE */
 	uint8_t hs20_version;
 	uint64_t parent_tsf;
+	struct l_queue *rnr_6ghz;	/* 6 GHz APs from the RNR element */
 	bool mde_present : 1;
 	bool cc_present : 1;
 	bool cap_rm_neighbor_report : 1;
@@ -101,7 +104,10 @@ struct scan_parameters {
 	bool randomize_mac_addr_hint : 1;
 	bool no_cck_rates : 1;
 	bool duration_mandatory : 1;
+	/* Split into short slices, e.g. to limit off-channel time */
+	bool sliced : 1;
 	const char *ssid;	/* Used for direct probe request */
+	const uint8_t *bssid;	/* Used for probe requests to a single BSS */
 };
 
 static inline int scan_bss_addr_cmp(const struct scan_bss *a1,
@@ -134,14 +140,33 @@ uint32_t scan_active_full(uint64_t wdev_id,
 			void *userdata, scan_destroy_func_t destroy);
 bool scan_cancel(uint64_t wdev_id, uint32_t id);
 
+struct scan_periodic_stats {
+	uint32_t scans;
+	uint32_t interval;		/* Current interval in seconds */
+	uint32_t last_churn;		/* Percent, 0 - 100 */
+	uint32_t shortened;		/* Interval halved due to churn */
+	uint32_t lengthened;		/* Interval doubled, static environment */
+	uint32_t budget_limited;	/* Interval raised to meet airtime budget */
+	uint32_t sched_scan_results;	/* Matches reported by scheduled scan */
+	uint32_t sched_scan_fallbacks;	/* Periodic timer resumed instead */
+	uint64_t airtime_ms;		/* Total time spent in periodic scans */
+};
+
 void scan_periodic_start(uint64_t wdev_id, scan_trigger_func_t trigger,
 				scan_notify_func_t func, void *userdata);
 bool scan_periodic_stop(uint64_t wdev_id);
+bool scan_periodic_get_stats(uint64_t wdev_id,
+				struct scan_periodic_stats *out_stats);
 
 uint64_t scan_get_triggered_time(uint64_t wdev_id, uint32_t id);
+bool scan_hidden_bss_pending(uint64_t wdev_id);
+
+void __scan_notify(struct l_genl_msg *msg);
+void __scan_sched_started(uint64_t wdev_id, int err);
 
 void scan_bss_free(struct scan_bss *bss);
 int scan_bss_rank_compare(const void *a, const void *b, void *user);
+uint32_t scan_bss_get_expected_throughput(const struct scan_bss *bss);
 
 int scan_bss_get_rsn_info(const struct scan_bss *bss, struct ie_rsn_info *info);
 
@@ -28,6 +28,7 @@
 #include <stdio.h>
 #include <errno.h>
 #include <time.h>
+#include <inttypes.h>
 #include <sys/time.h>
 #include <linux/if_ether.h>
 
@@ -61,6 +62,17 @@ static uint32_t netdev_watch;
 static uint32_t mfp_setting;
 static bool anqp_disabled;
 static bool netconfig_enabled;
+static uint32_t roam_candidate_scan_interval;
+static int roam_candidate_min_rssi;
+static uint32_t roam_throughput_threshold;
+
+/* Link statistics samples with less traffic than this are not used */
+#define STATION_LINK_MIN_TX_PACKETS 20
+/* Throughput below this share of the peak is considered a collapse */
+#define STATION_THROUGHPUT_COLLAPSE_PCT 30
+#define STATION_THROUGHPUT_LOW_SAMPLES 3
+/* Required gain of a roam target when roaming due to low throughput */
+#define STATION_ROAM_THROUGHPUT_GAIN_PCT 120
 
 struct station {
 	enum station_state state;
@@ -88,6 +100,17 @@ struct station {
 	uint32_t roam_scan_id;
 	uint8_t preauth_bssid[6];
 
+	/* Background roam candidate table for the connected ESS */
+	struct l_queue *roam_candidates;
+	struct l_timeout *roam_candidate_timeout;
+	uint32_t roam_candidate_scan_id;
+	struct scan_freq_set *roam_candidate_freqs;
+
+	/* Link quality model built from netdev link statistics, in kbit/s */
+	uint32_t link_throughput;
+	uint32_t link_throughput_peak;
+	uint8_t link_throughput_low_count;
+
 	struct wiphy *wiphy;
 	struct netdev *netdev;
 
@@ -101,6 +124,15 @@ struct station {
 	bool ap_directed_roaming : 1;
 	bool scanning : 1;
 	bool autoconnect : 1;
+	bool roam_candidate_nr_pending : 1;
+	bool roam_candidate_nr_skip : 1;
+	bool throughput_low : 1;
+};
+
+struct roam_candidate {
+	struct scan_bss *bss;
+	uint64_t last_seen;
+	double rank;
 };
 
 struct anqp_entry {
@@ -600,6 +632,8 @@ void station_set_scan_results(struct station *station,
 	struct network *network;
 	bool wait_for_anqp = false;
 
+	iwd_startup_phase_done(IWD_STARTUP_PHASE_FIRST_SCAN);
+
 	while ((network = l_queue_pop_head(station->networks_sorted)))
 		network_bss_list_clear(network);
 
@@ -707,6 +741,7 @@ static void station_handshake_event(struct handshake_state *hs,
 		break;
 	case HANDSHAKE_EVENT_COMPLETE:
 	case HANDSHAKE_EVENT_SETTING_KEYS_FAILED:
+	case HANDSHAKE_EVENT_REKEY_COMPLETE:
 	case HANDSHAKE_EVENT_EAP_NOTIFY:
 		/*
 		 * currently we don't care about any other events. The
@@ -1041,16 +1076,28 @@ static void periodic_scan_trigger(int err, void *user_data)
 static void periodic_scan_stop(struct station *station)
 {
 	uint64_t id = netdev_get_wdev_id(station->netdev);
-
-	scan_periodic_stop(id);
+	struct scan_periodic_stats stats;
+
+	if (scan_periodic_stop(id) && scan_periodic_get_stats(id, &stats))
+		l_debug("Periodic scan stats: %u scans, %" PRIu64 "ms airtime,"
+			" interval %us, churn %u%%, shortened %u,"
+			" lengthened %u, budget limited %u,"
+			" scheduled scan matches %u, fallbacks %u",
+			stats.scans, stats.airtime_ms, stats.interval,
+			stats.last_churn, stats.shortened, stats.lengthened,
+			stats.budget_limited, stats.sched_scan_results,
+			stats.sched_scan_fallbacks);
 
 	station_property_set_scanning(station, false);
 }
 
 static bool station_needs_hidden_network_scan(struct station *station)
 {
+	uint64_t id = netdev_get_wdev_id(station->netdev);
+
 	return !l_queue_isempty(station->hidden_bss_list_sorted) &&
-						known_networks_has_hidden();
+					known_networks_has_hidden() &&
+					scan_hidden_bss_pending(id);
 }
 
 static uint32_t station_scan_trigger(struct station *station,
@@ -1181,6 +1228,10 @@ static const char *station_state_to_string(enum station_state state)
 	return "invalid";
 }
 
+static void station_roam_candidate_scan_start(struct station *station);
+static void station_roam_candidate_scan_stop(struct station *station);
+static void station_roam_candidates_clear(struct station *station);
+
 static void station_enter_state(struct station *station,
 						enum station_state state)
 {
@@ -1221,12 +1272,19 @@ static void station_enter_state(struct station *station,
 #endif
 		/* fall through */
 	case STATION_STATE_DISCONNECTED:
+		periodic_scan_stop(station);
+		station_roam_candidate_scan_stop(station);
+
+		break;
 	case STATION_STATE_CONNECTED:
+		iwd_startup_phase_done(IWD_STARTUP_PHASE_CONNECTED);
 		periodic_scan_stop(station);
+		station_roam_candidate_scan_start(station);
 
 		break;
 	case STATION_STATE_DISCONNECTING:
 	case STATION_STATE_ROAMING:
+		station_roam_candidate_scan_stop(station);
 		break;
 	}
 
@@ -1270,6 +1328,14 @@ bool station_set_autoconnect(struct station *station, bool autoconnect)
 	return true;
 }
 
+static void station_link_model_reset(struct station *station)
+{
+	station->link_throughput = 0;
+	station->link_throughput_peak = 0;
+	station->link_throughput_low_count = 0;
+	station->throughput_low = false;
+}
+
 static void station_roam_state_clear(struct station *station)
 {
 	l_timeout_remove(station->roam_trigger_timeout);
@@ -1277,6 +1343,7 @@ static void station_roam_state_clear(struct station *station)
 	station->preparing_roam = false;
 	station->signal_low = false;
 	station->roam_min_time.tv_sec = 0;
+	station_link_model_reset(station);
 
 	if (station->roam_scan_id)
 		scan_cancel(netdev_get_wdev_id(station->netdev),
@@ -1299,6 +1366,8 @@ static void station_reset_connection_state(struct station *station)
 		network_disconnected(network);
 
 	station_roam_state_clear(station);
+	station_roam_candidate_scan_stop(station);
+	station_roam_candidates_clear(station);
 
 	station->connected_bss = NULL;
 	station->connected_network = NULL;
@@ -1352,9 +1421,16 @@ static void station_roamed(struct station *station)
 	station->signal_low = false;
 	station->roam_min_time.tv_sec = 0;
 	station->roam_no_orig_ap = false;
+	station_link_model_reset(station);
 
-	if (station->netconfig)
+	/* The candidates were ranked against the BSS we just left */
+	station_roam_candidates_clear(station);
+
+	if (station->netconfig) {
+		netconfig_set_lease_bssid(station->netconfig,
+						station->connected_bss->addr);
 		netconfig_reconfigure(station->netconfig);
+	}
 
 	station_enter_state(station, STATION_STATE_CONNECTED);
 }
@@ -1377,7 +1453,7 @@ static void station_roam_failed(struct station *station)
 
 	if (station->state == STATION_STATE_ROAMING)
 		station_disassociated(station);
-	else if (station->signal_low)
+	else if (station->signal_low || station->throughput_low)
 		station_roam_timeout_rearm(station, 60);
 }
 
@@ -1635,18 +1711,131 @@ static void station_roam_scan_triggered(int err, void *user_data)
 	 */
 }
 
+/*
+ * Returns the roaming preference of @bss within the currently connected ESS,
+ * or a negative value if @bss cannot be used as a transition target.  @seen
+ * is set if @bss belongs to the ESS, whether or not it is usable.
+ */
+static double station_roam_bss_rank(struct station *station,
+					struct scan_bss *bss, bool *seen)
+{
+	struct handshake_state *hs = netdev_get_handshake(station->netdev);
+	static const double RANK_FT_FACTOR = 1.3;
+	enum security security;
+	struct ie_rsn_info info;
+	uint16_t mdid;
+	double rank;
+	int r;
+
+	/* Skip result if it is not part of the ESS */
+	if (bss->ssid_len != hs->ssid_len ||
+			memcmp(bss->ssid, hs->ssid, hs->ssid_len))
+		return -1.0;
+
+	memset(&info, 0, sizeof(info));
+	r = scan_bss_get_rsn_info(bss, &info);
+	if (r < 0) {
+		if (r != -ENOENT)
+			return -1.0;
+
+		security = security_determine(bss->capability, NULL);
+	} else
+		security = security_determine(bss->capability, &info);
+
+	if (security != network_get_security(station->connected_network))
+		return -1.0;
+
+	if (seen)
+		*seen = true;
+
+	if (!wiphy_can_connect(station->wiphy, bss))
+		return -1.0;
+
+	if (blacklist_contains_bss(bss->addr))
+		return -1.0;
+
+	/*
+	 * BSSes come already ranked with their initial association preference
+	 * rank value.  We only need to add preference for BSSes that are
+	 * within the FT Mobility Domain so as to favor Fast Roaming, if it is
+	 * supported.
+	 */
+	rank = bss->rank;
+
+	if (hs->mde) {
+		ie_parse_mobility_domain_from_data(hs->mde, hs->mde[1] + 2,
+							&mdid, NULL, NULL);
+
+		if (bss->mde_present && l_get_le16(bss->mde) == mdid)
+			rank *= RANK_FT_FACTOR;
+	}
+
+	return rank;
+}
+
+/*
+ * True if the pending roam is due to the link delivering much less than it
+ * used to while the signal level itself is still fine.
+ */
+static bool station_roam_by_throughput(struct station *station)
+{
+	return station->throughput_low && !station->signal_low &&
+			!station->roam_no_orig_ap &&
+			!station->ap_directed_roaming;
+}
+
+/*
+ * Returns the throughput @bss is expected to deliver, or a negative value
+ * if that would not be a clear improvement over the current link.  The scan
+ * based estimates are theoretical and well above what a link measurably
+ * delivers, so the candidate is compared against the same estimate for the
+ * current BSS and scaled by the share of it the current link achieves.
+ */
+static double station_roam_bss_throughput(struct station *station,
+						struct scan_bss *bss)
+{
+	uint64_t throughput = scan_bss_get_expected_throughput(bss);
+	uint64_t current =
+		scan_bss_get_expected_throughput(station->connected_bss);
+
+	if (current && throughput * 100 <=
+				current * STATION_ROAM_THROUGHPUT_GAIN_PCT)
+		return -1.0;
+
+	if (!current || !station->link_throughput)
+		return throughput;
+
+	return (double) throughput * station->link_throughput / current;
+}
+
+/*
+ * Start a transition to @bss which is not necessarily part of the
+ * station's BSS list yet.  Takes ownership of @bss.
+ */
+static void station_roam_to_bss(struct station *station, struct scan_bss *bss)
+{
+	struct network *network = station->connected_network;
+	struct scan_bss *existing;
+
+	existing = network_bss_find_by_addr(network, bss->addr);
+	if (existing) {
+		scan_bss_free(bss);
+		bss = existing;
+	} else {
+		network_bss_add(network, bss);
+		l_queue_push_tail(station->bss_list, bss);
+	}
+
+	station_transition_start(station, bss);
+}
+
 static bool station_roam_scan_notify(int err, struct l_queue *bss_list,
 					void *userdata)
 {
 	struct station *station = userdata;
-	struct network *network = station->connected_network;
-	struct handshake_state *hs = netdev_get_handshake(station->netdev);
 	struct scan_bss *bss;
 	struct scan_bss *best_bss = NULL;
 	double best_bss_rank = 0.0;
-	static const double RANK_FT_FACTOR = 1.3;
-	uint16_t mdid;
-	enum security orig_security, security;
 	bool seen = false;
 
 	if (err) {
@@ -1660,60 +1849,23 @@ static bool station_roam_scan_notify(int err, struct l_queue *bss_list,
 	 * list in its station->networks entry.
 	 */
 
-	orig_security = network_get_security(network);
-
-	if (hs->mde)
-		ie_parse_mobility_domain_from_data(hs->mde, hs->mde[1] + 2,
-							&mdid, NULL, NULL);
-
-	/*
-	 * BSSes in the bss_list come already ranked with their initial
-	 * association preference rank value.  We only need to add preference
-	 * for BSSes that are within the FT Mobility Domain so as to favor
-	 * Fast Roaming, if it is supported.
-	 */
-
 	while ((bss = l_queue_pop_head(bss_list))) {
 		double rank;
-		struct ie_rsn_info info;
-		int r;
 
 		/* Skip the BSS we are connected to if doing an AP roam */
 		if (station->ap_directed_roaming && !memcmp(bss->addr,
 				station->connected_bss->addr, 6))
 			goto next;
 
-		/* Skip result if it is not part of the ESS */
-
-		if (bss->ssid_len != hs->ssid_len ||
-				memcmp(bss->ssid, hs->ssid, hs->ssid_len))
-			goto next;
-
-		memset(&info, 0, sizeof(info));
-		r = scan_bss_get_rsn_info(bss, &info);
-		if (r < 0) {
-			if (r != -ENOENT)
-				goto next;
-
-			security = security_determine(bss->capability, NULL);
-		} else
-			security = security_determine(bss->capability, &info);
-
-		if (security != orig_security)
-			goto next;
-
-		seen = true;
-
-		if (!wiphy_can_connect(station->wiphy, bss))
-			goto next;
-
-		if (blacklist_contains_bss(bss->addr))
-			goto next;
-
-		rank = bss->rank;
+		rank = station_roam_bss_rank(station, bss, &seen);
 
-		if (hs->mde && bss->mde_present && l_get_le16(bss->mde) == mdid)
-			rank *= RANK_FT_FACTOR;
+		/*
+		 * When roaming because of poor throughput, compare the
+		 * candidates by the throughput they can be expected to
+		 * deliver rather than by their signal based rank.
+		 */
+		if (rank > 0 && station_roam_by_throughput(station))
+			rank = station_roam_bss_throughput(station, bss);
 
 		if (rank > best_bss_rank) {
 			if (best_bss)
@@ -1738,16 +1890,7 @@ next:
 	if (!best_bss || scan_bss_addr_eq(best_bss, station->connected_bss))
 		goto fail_free_bss;
 
-	bss = network_bss_find_by_addr(network, best_bss->addr);
-	if (bss) {
-		scan_bss_free(best_bss);
-		best_bss = bss;
-	} else {
-		network_bss_add(network, best_bss);
-		l_queue_push_tail(station->bss_list, best_bss);
-	}
-
-	station_transition_start(station, best_bss);
+	station_roam_to_bss(station, best_bss);
 
 	return true;
 
@@ -1774,6 +1917,14 @@ static void station_roam_scan(struct station *station,
 
 	l_debug("ifindex: %u", netdev_get_ifindex(station->netdev));
 
+	/*
+	 * A roam due to poor throughput is not urgent as the signal is still
+	 * fine, so keep the time spent off-channel short.  Otherwise the link
+	 * is about to be lost and the scan has to finish as fast as possible.
+	 */
+	if (station_roam_by_throughput(station))
+		params.sliced = true;
+
 	if (station->connected_network)
 		/* Use direct probe request */
 		params.ssid = network_get_ssid(station->connected_network);
@@ -1982,6 +2133,306 @@ static void station_neighbor_report_cb(struct netdev *netdev, int err,
 	scan_freq_set_free(freq_set_no_md);
 }
 
+static void roam_candidate_free(void *data)
+{
+	struct roam_candidate *candidate = data;
+
+	scan_bss_free(candidate->bss);
+	l_free(candidate);
+}
+
+static int roam_candidate_rank_compare(const void *a, const void *b,
+					void *user)
+{
+	const struct roam_candidate *new_candidate = a;
+	const struct roam_candidate *candidate = b;
+
+	return (candidate->rank > new_candidate->rank) ? 1 : -1;
+}
+
+static bool roam_candidate_match_addr(const void *a, const void *b)
+{
+	const struct roam_candidate *candidate = a;
+
+	return !memcmp(candidate->bss->addr, b, ETH_ALEN);
+}
+
+static bool roam_candidate_remove_if_stale(void *data, void *user_data)
+{
+	struct roam_candidate *candidate = data;
+	uint64_t *now = user_data;
+	uint64_t max_age = roam_candidate_scan_interval * L_USEC_PER_SEC;
+
+	if (l_time_diff(candidate->last_seen, *now) <= max_age)
+		return false;
+
+	roam_candidate_free(candidate);
+	return true;
+}
+
+static void station_roam_candidates_clear(struct station *station)
+{
+	l_queue_clear(station->roam_candidates, roam_candidate_free);
+
+	if (station->roam_candidate_freqs) {
+		scan_freq_set_free(station->roam_candidate_freqs);
+		station->roam_candidate_freqs = NULL;
+	}
+
+	station->roam_candidate_nr_skip = false;
+}
+
+/*
+ * Takes ownership of @bss if it is a usable roam target within the connected
+ * ESS, returns false otherwise.
+ */
+static bool station_roam_candidate_add(struct station *station,
+					struct scan_bss *bss)
+{
+	struct roam_candidate *candidate;
+	double rank;
+
+	if (scan_bss_addr_eq(bss, station->connected_bss))
+		return false;
+
+	rank = station_roam_bss_rank(station, bss, NULL);
+	if (rank < 0)
+		return false;
+
+	candidate = l_queue_remove_if(station->roam_candidates,
+					roam_candidate_match_addr, bss->addr);
+	if (candidate)
+		scan_bss_free(candidate->bss);
+	else
+		candidate = l_new(struct roam_candidate, 1);
+
+	candidate->bss = bss;
+	candidate->rank = rank;
+	candidate->last_seen = l_time_now();
+
+	l_queue_insert(station->roam_candidates, candidate,
+				roam_candidate_rank_compare, NULL);
+
+	return true;
+}
+
+void station_roam_candidates_update(struct station *station,
+					struct l_queue *bss_list)
+{
+	const struct l_queue_entry *entry;
+	uint64_t now = l_time_now();
+
+	if (!station->connected_bss || station->state != STATION_STATE_CONNECTED)
+		return;
+
+	for (entry = l_queue_get_entries(bss_list); entry;) {
+		struct scan_bss *bss = entry->data;
+
+		entry = entry->next;
+
+		if (station_roam_candidate_add(station, bss))
+			l_queue_remove(bss_list, bss);
+	}
+
+	l_queue_foreach_remove(station->roam_candidates,
+				roam_candidate_remove_if_stale, &now);
+
+	l_debug("%u roam candidates", l_queue_length(station->roam_candidates));
+}
+
+/*
+ * Pick the best candidate that is still fresh and whose last observed
+ * signal is above the roam threshold.  On success the candidate BSS is
+ * removed from the table and returned to the caller.
+ */
+static struct scan_bss *station_roam_candidate_take(struct station *station)
+{
+	const struct l_queue_entry *entry;
+	uint64_t now = l_time_now();
+
+	l_queue_foreach_remove(station->roam_candidates,
+				roam_candidate_remove_if_stale, &now);
+
+	for (entry = l_queue_get_entries(station->roam_candidates); entry;
+			entry = entry->next) {
+		struct roam_candidate *candidate = entry->data;
+		struct scan_bss *bss = candidate->bss;
+
+		if (scan_bss_addr_eq(bss, station->connected_bss))
+			continue;
+
+		if (bss->signal_strength / 100 <= roam_candidate_min_rssi)
+			continue;
+
+		if (blacklist_contains_bss(bss->addr))
+			continue;
+
+		if (station_roam_by_throughput(station) &&
+				station_roam_bss_throughput(station, bss) < 0)
+			continue;
+
+		l_queue_remove(station->roam_candidates, candidate);
+		l_free(candidate);
+
+		return bss;
+	}
+
+	return NULL;
+}
+
+static bool station_roam_candidate_scan_notify(int err,
+						struct l_queue *bss_list,
+						void *userdata)
+{
+	struct station *station = userdata;
+
+	if (err)
+		return false;
+
+	station_roam_candidates_update(station, bss_list);
+
+	/* Anything left over is freed by the scan module */
+	return false;
+}
+
+static void station_roam_candidate_scan_destroy(void *userdata)
+{
+	struct station *station = userdata;
+
+	station->roam_candidate_scan_id = 0;
+}
+
+static void station_roam_candidate_neighbor_report_cb(struct netdev *netdev,
+						int err,
+						const uint8_t *reports,
+						size_t reports_len,
+						void *user_data)
+{
+	struct station *station = user_data;
+	struct ie_tlv_iter iter;
+	const uint8_t *cc = NULL;
+
+	station->roam_candidate_nr_pending = false;
+
+	/* A roam got triggered while this was pending, it uses the report */
+	if (station->preparing_roam)
+		station_neighbor_report_cb(netdev, err, reports, reports_len,
+						station);
+
+	if (err || !reports || !station->connected_bss)
+		return;
+
+	if (station->connected_bss->cc_present)
+		cc = station->connected_bss->cc;
+
+	/* Neighbors may have gone away since the previous report */
+	if (station->roam_candidate_freqs)
+		scan_freq_set_free(station->roam_candidate_freqs);
+
+	station->roam_candidate_freqs = scan_freq_set_new();
+
+	ie_tlv_iter_init(&iter, reports, reports_len);
+
+	while (ie_tlv_iter_next(&iter)) {
+		struct ie_neighbor_report_info info;
+		enum scan_band band;
+		uint32_t freq;
+
+		if (ie_tlv_iter_get_tag(&iter) != IE_TYPE_NEIGHBOR_REPORT)
+			continue;
+
+		if (ie_parse_neighbor_report(&iter, &info) < 0)
+			continue;
+
+		freq = station_freq_from_neighbor_report(cc, &info, &band);
+		if (!freq)
+			continue;
+
+		if (!(band & wiphy_get_supported_bands(station->wiphy)))
+			continue;
+
+		scan_freq_set_add(station->roam_candidate_freqs, freq);
+	}
+}
+
+static void station_roam_candidate_timeout(struct l_timeout *timeout,
+						void *user_data)
+{
+	struct station *station = user_data;
+	const struct network_info *info;
+	struct scan_parameters params = { .sliced = true };
+	struct scan_freq_set *freqs;
+
+	l_timeout_modify(timeout, roam_candidate_scan_interval);
+
+	if (station->state != STATION_STATE_CONNECTED ||
+			station->preparing_roam ||
+			station->roam_candidate_scan_id)
+		return;
+
+	/*
+	 * Refresh the neighbor list on every other iteration at most.  Until
+	 * the first report arrives only the known frequencies are scanned.
+	 */
+	station->roam_candidate_nr_skip = !station->roam_candidate_nr_skip;
+
+	if (station->connected_bss->cap_rm_neighbor_report &&
+			station->roam_candidate_nr_skip &&
+			!station->roam_candidate_nr_pending &&
+			!netdev_neighbor_report_req(station->netdev,
+				station_roam_candidate_neighbor_report_cb))
+		station->roam_candidate_nr_pending = true;
+
+	info = network_get_info(station->connected_network);
+	freqs = info ? network_info_get_roam_frequencies(info,
+					station->connected_bss->frequency, 5) :
+			NULL;
+
+	if (station->roam_candidate_freqs) {
+		if (!freqs)
+			freqs = scan_freq_set_new();
+
+		scan_freq_set_merge(freqs, station->roam_candidate_freqs);
+	}
+
+	if (!freqs)
+		return;
+
+	/*
+	 * Keep this scan short and passive, only the channels the ESS is
+	 * known to use are visited so the off-channel time stays small.
+	 */
+	params.freqs = freqs;
+
+	station->roam_candidate_scan_id =
+		scan_passive_full(netdev_get_wdev_id(station->netdev), &params,
+				NULL, station_roam_candidate_scan_notify,
+				station, station_roam_candidate_scan_destroy);
+
+	scan_freq_set_free(freqs);
+}
+
+static void station_roam_candidate_scan_start(struct station *station)
+{
+	if (!roam_candidate_scan_interval || station->roam_candidate_timeout)
+		return;
+
+	station->roam_candidate_timeout =
+		l_timeout_create(roam_candidate_scan_interval,
+					station_roam_candidate_timeout,
+					station, NULL);
+}
+
+static void station_roam_candidate_scan_stop(struct station *station)
+{
+	l_timeout_remove(station->roam_candidate_timeout);
+	station->roam_candidate_timeout = NULL;
+
+	if (station->roam_candidate_scan_id)
+		scan_cancel(netdev_get_wdev_id(station->netdev),
+				station->roam_candidate_scan_id);
+}
+
 static void station_roam_trigger_cb(struct l_timeout *timeout, void *user_data)
 {
 	struct station *station = user_data;
@@ -1992,6 +2443,21 @@ static void station_roam_trigger_cb(struct l_timeout *timeout, void *user_data)
 	station->roam_trigger_timeout = NULL;
 	station->preparing_roam = true;
 
+	/*
+	 * If the background scans have already found a good enough target
+	 * in the ESS, go there right away instead of scanning first.
+	 */
+	if (!station->ap_directed_roaming) {
+		struct scan_bss *bss = station_roam_candidate_take(station);
+
+		if (bss) {
+			l_debug("Using roam candidate "MAC,
+					MAC_STR(bss->addr));
+			station_roam_to_bss(station, bss);
+			return;
+		}
+	}
+
 	/*
 	 * If current BSS supports Neighbor Reports, narrow the scan down
 	 * to channels occupied by known neighbors in the ESS.  This isn't
@@ -2002,10 +2468,18 @@ static void station_roam_trigger_cb(struct l_timeout *timeout, void *user_data)
 	 * APs not known to the AP."
 	 */
 	if (station->connected_bss->cap_rm_neighbor_report &&
-			!station->roam_no_orig_ap)
+			!station->roam_no_orig_ap) {
+		/*
+		 * A background request holds the only slot, its report is
+		 * handed over once it arrives.
+		 */
+		if (station->roam_candidate_nr_pending)
+			return;
+
 		if (!netdev_neighbor_report_req(station->netdev,
 						station_neighbor_report_cb))
 			return;
+	}
 
 	if (!station_roam_scan_known_freqs(station)) {
 		l_debug("No neighbor report or known frequencies, roam failed");
@@ -2023,6 +2497,9 @@ static void station_roam_timeout_rearm(struct station *station, int seconds)
 	min_timeout = now;
 	min_timeout.tv_sec += seconds;
 
+	/* Both low signal and low throughput may ask for a roam */
+	l_timeout_remove(station->roam_trigger_timeout);
+
 	if (station->roam_min_time.tv_sec < min_timeout.tv_sec ||
 			(station->roam_min_time.tv_sec == min_timeout.tv_sec &&
 			 station->roam_min_time.tv_nsec < min_timeout.tv_nsec))
@@ -2178,10 +2655,110 @@ static void station_low_rssi(struct station *station)
 
 static void station_ok_rssi(struct station *station)
 {
+	station->signal_low = false;
+
+	if (station->throughput_low)
+		return;
+
 	l_timeout_remove(station->roam_trigger_timeout);
 	station->roam_trigger_timeout = NULL;
+}
 
-	station->signal_low = false;
+static void station_low_throughput(struct station *station)
+{
+	if (station->throughput_low)
+		return;
+
+	station->throughput_low = true;
+
+	if (station_cannot_roam(station) || station->roam_trigger_timeout)
+		return;
+
+	station_roam_timeout_rearm(station, 5);
+}
+
+static void station_ok_throughput(struct station *station)
+{
+	station->throughput_low = false;
+
+	if (station->signal_low)
+		return;
+
+	l_timeout_remove(station->roam_trigger_timeout);
+	station->roam_trigger_timeout = NULL;
+}
+
+/*
+ * Estimate the throughput, in kbit/s, the link delivered since the previous
+ * sample.  Prefer the driver's own estimate, otherwise derive it from the
+ * TX bitrate and the share of transmissions that needed no retry.
+ */
+static uint32_t station_link_sample_throughput(
+					const struct netdev_link_stats *stats)
+{
+	uint32_t attempts = stats->tx_packets_delta + stats->tx_retries_delta;
+	uint32_t delivered = 0;
+	uint64_t throughput;
+
+	if (stats->expected_throughput)
+		return stats->expected_throughput;
+
+	/* Assume the same MAC efficiency as for scan result estimates */
+	throughput = (uint64_t) stats->tx_bitrate * 100 * 6 / 10;
+
+	if (stats->tx_packets_delta > stats->tx_failed_delta)
+		delivered = stats->tx_packets_delta - stats->tx_failed_delta;
+
+	return throughput * delivered / attempts;
+}
+
+static void station_link_stats(struct station *station,
+				const struct netdev_link_stats *stats)
+{
+	uint32_t sample;
+
+	if (station->state != STATION_STATE_CONNECTED)
+		return;
+
+	/* Rate control statistics are meaningless on an idle link */
+	if (stats->tx_packets_delta < STATION_LINK_MIN_TX_PACKETS)
+		return;
+
+	sample = station_link_sample_throughput(stats);
+
+	if (!station->link_throughput)
+		station->link_throughput = sample;
+	else
+		station->link_throughput =
+			(3 * station->link_throughput + sample) / 4;
+
+	if (station->link_throughput > station->link_throughput_peak)
+		station->link_throughput_peak = station->link_throughput;
+
+	l_debug("rssi: %d, tx: %u, rx: %u, retries: %u, failed: %u, "
+			"throughput: %u kbit/s (peak %u)", stats->rssi,
+			stats->tx_bitrate, stats->rx_bitrate,
+			stats->tx_retries_delta, stats->tx_failed_delta,
+			station->link_throughput,
+			station->link_throughput_peak);
+
+	if (station->link_throughput >= roam_throughput_threshold ||
+			station->link_throughput * 100 >=
+				station->link_throughput_peak *
+					STATION_THROUGHPUT_COLLAPSE_PCT) {
+		station->link_throughput_low_count = 0;
+
+		if (station->throughput_low)
+			station_ok_throughput(station);
+
+		return;
+	}
+
+	if (++station->link_throughput_low_count <
+					STATION_THROUGHPUT_LOW_SAMPLES)
+		return;
+
+	station_low_throughput(station);
 }
 
 static void station_rssi_level_changed(struct station *station,
@@ -2215,6 +2792,9 @@ static void station_netdev_event(struct netdev *netdev, enum netdev_event event,
 	case NETDEV_EVENT_RSSI_LEVEL_NOTIFY:
 		station_rssi_level_changed(station, l_get_u8(event_data));
 		break;
+	case NETDEV_EVENT_LINK_STATS:
+		station_link_stats(station, event_data);
+		break;
 	}
 }
 
@@ -2353,14 +2933,18 @@ static void station_connect_cb(struct netdev *netdev, enum netdev_result result,
 
 	network_connected(station->connected_network);
 
-	if (station->netconfig)
+	if (station->netconfig) {
+		netconfig_set_lease_key(station->netconfig,
+				network_get_security(station->connected_network),
+				network_get_ssid(station->connected_network),
+				station->connected_bss->addr);
 		netconfig_configure(station->netconfig,
 					network_get_settings(
 						station->connected_network),
 					netdev_get_address(station->netdev),
 					station_netconfig_event_handler,
 					station);
-	else
+	} else
 		station_enter_state(station, STATION_STATE_CONNECTED);
 }
 
@@ -3170,6 +3754,13 @@ static struct station *station_create(struct netdev *netdev)
 
 	station->anqp_pending = l_queue_new();
 
+	station->roam_candidates = l_queue_new();
+
+	if (roam_throughput_threshold)
+		netdev_set_link_stats_reporting(netdev, true);
+
+	iwd_startup_phase_done(IWD_STARTUP_PHASE_STATION_CREATED);
+
 	return station;
 }
 
@@ -3191,6 +3782,8 @@ static void station_free(struct station *station)
 
 	periodic_scan_stop(station);
 
+	netdev_set_link_stats_reporting(station->netdev, false);
+
 	if (station->signal_agent) {
 		station_signal_agent_release(station->signal_agent,
 					netdev_get_path(station->netdev));
@@ -3222,6 +3815,9 @@ static void station_free(struct station *station)
 				station->hidden_network_scan_id);
 
 	station_roam_state_clear(station);
+	station_roam_candidate_scan_stop(station);
+	station_roam_candidates_clear(station);
+	l_queue_destroy(station->roam_candidates, NULL);
 
 	l_queue_destroy(station->networks_sorted, NULL);
 	l_hashmap_destroy(station->networks, network_free);
@@ -3339,6 +3935,20 @@ static int station_init(void)
 	if (!netconfig_enabled)
 		l_info("station: Network configuration is disabled.");
 
+	if (!l_settings_get_uint(iwd_get_config(), "Scan",
+					"RoamCandidateScanInterval",
+					&roam_candidate_scan_interval))
+		roam_candidate_scan_interval = 60;
+
+	if (!l_settings_get_int(iwd_get_config(), "General", "RoamThreshold",
+					&roam_candidate_min_rssi))
+		roam_candidate_min_rssi = -70;
+
+	if (!l_settings_get_uint(iwd_get_config(), "General",
+					"RoamThroughputThreshold",
+					&roam_throughput_threshold))
+		roam_throughput_threshold = 0;
+
 	return 0;
 }
 
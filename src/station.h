@@ -85,4 +85,6 @@ void station_network_foreach(struct station *station,
 				station_network_foreach_func_t func,
 				void *user_data);
 struct l_queue *station_get_bss_list(struct station *station);
+void station_roam_candidates_update(struct station *station,
+					struct l_queue *bss_list);
 struct scan_bss *station_get_connected_bss(struct station *station);
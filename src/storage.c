@@ -40,6 +40,7 @@
 
 #include <ell/ell.h>
 
+#include "src/missing.h"
 #include "src/common.h"
 #include "src/storage.h"
 
@@ -47,6 +48,10 @@
 #define STORAGE_FILE_MODE (S_IRUSR | S_IWUSR)
 
 #define KNOWN_FREQ_FILENAME ".known_network.freq"
+#define ERP_CACHE_FILENAME ".erp_cache"
+#define ERP_CACHE_KEY_FILENAME ".erp_cache.key"
+#define DHCP_LEASE_CACHE_FILENAME ".dhcp_leases"
+#define WIPHY_SNAPSHOT_FILENAME ".wiphy_capabilities"
 
 static char *storage_path = NULL;
 static char *storage_hotspot_path = NULL;
@@ -459,3 +464,152 @@ void storage_known_frequencies_sync(struct l_settings *known_freqs)
 
 	l_free(known_freq_file_path);
 }
+
+struct l_settings *storage_erp_cache_load(void)
+{
+	struct l_settings *erp_cache;
+	char *erp_cache_file_path;
+
+	erp_cache = l_settings_new();
+
+	erp_cache_file_path = storage_get_path("/%s", ERP_CACHE_FILENAME);
+
+	if (!l_settings_load_from_file(erp_cache, erp_cache_file_path)) {
+		l_settings_free(erp_cache);
+		erp_cache = NULL;
+	}
+
+	l_free(erp_cache_file_path);
+
+	return erp_cache;
+}
+
+void storage_erp_cache_sync(struct l_settings *erp_cache)
+{
+	char *erp_cache_file_path;
+	char *data;
+	size_t len;
+
+	if (!erp_cache)
+		return;
+
+	erp_cache_file_path = storage_get_path("/%s", ERP_CACHE_FILENAME);
+
+	data = l_settings_to_data(erp_cache, &len);
+	write_file(data, len, false, "%s", erp_cache_file_path);
+	explicit_bzero(data, len);
+	l_free(data);
+
+	l_free(erp_cache_file_path);
+}
+
+struct l_settings *storage_dhcp_lease_cache_load(void)
+{
+	struct l_settings *lease_cache;
+	char *lease_cache_file_path;
+
+	lease_cache = l_settings_new();
+
+	lease_cache_file_path = storage_get_path("/%s",
+						DHCP_LEASE_CACHE_FILENAME);
+
+	if (!l_settings_load_from_file(lease_cache, lease_cache_file_path)) {
+		l_settings_free(lease_cache);
+		lease_cache = NULL;
+	}
+
+	l_free(lease_cache_file_path);
+
+	return lease_cache;
+}
+
+void storage_dhcp_lease_cache_sync(struct l_settings *lease_cache)
+{
+	char *lease_cache_file_path;
+	char *data;
+	size_t len;
+
+	if (!lease_cache)
+		return;
+
+	lease_cache_file_path = storage_get_path("/%s",
+						DHCP_LEASE_CACHE_FILENAME);
+
+	data = l_settings_to_data(lease_cache, &len);
+	write_file(data, len, false, "%s", lease_cache_file_path);
+	l_free(data);
+
+	l_free(lease_cache_file_path);
+}
+
+struct l_settings *storage_wiphy_snapshot_load(void)
+{
+	struct l_settings *snapshots;
+	char *snapshot_file_path;
+
+	snapshots = l_settings_new();
+
+	snapshot_file_path = storage_get_path("/%s", WIPHY_SNAPSHOT_FILENAME);
+
+	if (!l_settings_load_from_file(snapshots, snapshot_file_path)) {
+		l_settings_free(snapshots);
+		snapshots = NULL;
+	}
+
+	l_free(snapshot_file_path);
+
+	return snapshots;
+}
+
+void storage_wiphy_snapshot_sync(struct l_settings *snapshots)
+{
+	char *snapshot_file_path;
+	char *data;
+	size_t len;
+
+	if (!snapshots)
+		return;
+
+	snapshot_file_path = storage_get_path("/%s", WIPHY_SNAPSHOT_FILENAME);
+
+	data = l_settings_to_data(snapshots, &len);
+	write_file(data, len, false, "%s", snapshot_file_path);
+	l_free(data);
+
+	l_free(snapshot_file_path);
+}
+
+/*
+ * Returns the secret used to authenticate the persisted ERP cache entries.
+ * The key is generated on first use and kept in its own file so that a
+ * corrupted or hand-edited cache file is rejected on load.  Both files are
+ * created with STORAGE_FILE_MODE permissions by write_file.
+ */
+bool storage_erp_cache_get_key(void *key, size_t len)
+{
+	char *key_file_path;
+	ssize_t r;
+
+	key_file_path = storage_get_path("/%s", ERP_CACHE_KEY_FILENAME);
+
+	r = read_file(key, len, "%s", key_file_path);
+	if (r == (ssize_t) len)
+		goto done;
+
+	if (!l_getrandom(key, len)) {
+		r = -1;
+		goto done;
+	}
+
+	r = write_file(key, len, false, "%s", key_file_path);
+
+done:
+	l_free(key_file_path);
+
+	if (r != (ssize_t) len) {
+		explicit_bzero(key, len);
+		return false;
+	}
+
+	return true;
+}
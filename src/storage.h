@@ -49,3 +49,13 @@ int storage_network_remove(enum security type, const char *ssid);
 
 struct l_settings *storage_known_frequencies_load(void);
 void storage_known_frequencies_sync(struct l_settings *known_freqs);
+
+struct l_settings *storage_erp_cache_load(void);
+void storage_erp_cache_sync(struct l_settings *erp_cache);
+bool storage_erp_cache_get_key(void *key, size_t len);
+
+struct l_settings *storage_dhcp_lease_cache_load(void);
+void storage_dhcp_lease_cache_sync(struct l_settings *lease_cache);
+
+struct l_settings *storage_wiphy_snapshot_load(void);
+void storage_wiphy_snapshot_sync(struct l_settings *snapshots);
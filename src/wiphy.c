@@ -91,6 +91,7 @@ static char **whitelist_filter;
 static char **blacklist_filter;
 static int mac_randomize_bytes = 6;
 static char regdom_country[2];
+static struct l_settings *snapshots;
 
 struct wiphy {
 	uint32_t id;
@@ -99,6 +100,10 @@ struct wiphy {
 	uint32_t feature_flags;
 	uint8_t ext_features[(NUM_NL80211_EXT_FEATURES + 7) / 8];
 	uint8_t max_num_ssids_per_scan;
+	uint8_t max_num_sched_scan_ssids;
+	uint8_t max_match_sets;
+	uint32_t max_num_sched_scan_plans;
+	uint32_t max_sched_scan_plan_interval;
 	uint32_t max_roc_duration;
 	uint16_t max_scan_ie_len;
 	uint16_t supported_iftypes;
@@ -115,6 +120,14 @@ struct wiphy {
 	struct l_genl_family *nl80211;
 	char regdom_country[2];
 
+	/*
+	 * Set while the capabilities come from the on-disk snapshot and
+	 * have not yet been checked against the kernel.  The live dump is
+	 * parsed into @live and compared with @snapshot_data once complete.
+	 */
+	char *snapshot_data;
+	struct wiphy *live;
+
 	bool support_scheduled_scan:1;
 	bool support_rekey_offload:1;
 	bool support_adhoc_rsn:1;
@@ -263,6 +276,11 @@ static void wiphy_free(void *data)
 	l_free(wiphy->model_str);
 	l_free(wiphy->vendor_str);
 	l_free(wiphy->driver_str);
+	l_free(wiphy->snapshot_data);
+
+	if (wiphy->live)
+		wiphy_free(wiphy->live);
+
 	l_genl_family_free(wiphy->nl80211);
 	l_free(wiphy);
 }
@@ -432,6 +450,31 @@ uint8_t wiphy_get_max_num_ssids_per_scan(struct wiphy *wiphy)
 	return wiphy->max_num_ssids_per_scan;
 }
 
+uint8_t wiphy_get_max_num_sched_scan_ssids(struct wiphy *wiphy)
+{
+	return wiphy->max_num_sched_scan_ssids;
+}
+
+uint8_t wiphy_get_max_match_sets(struct wiphy *wiphy)
+{
+	return wiphy->max_match_sets;
+}
+
+uint32_t wiphy_get_max_num_sched_scan_plans(struct wiphy *wiphy)
+{
+	return wiphy->max_num_sched_scan_plans;
+}
+
+uint32_t wiphy_get_max_sched_scan_plan_interval(struct wiphy *wiphy)
+{
+	return wiphy->max_sched_scan_plan_interval;
+}
+
+bool wiphy_supports_sched_scan(struct wiphy *wiphy)
+{
+	return wiphy->support_scheduled_scan && wiphy->max_match_sets;
+}
+
 uint16_t wiphy_get_max_scan_ie_len(struct wiphy *wiphy)
 {
 	return wiphy->max_scan_ie_len;
@@ -666,6 +709,9 @@ static void wiphy_print_basic_info(struct wiphy *wiphy)
 		if (bands & SCAN_BAND_5_GHZ)
 			len += sprintf(buf + len, " 5 GHz");
 
+		if (bands & SCAN_BAND_6_GHZ)
+			len += sprintf(buf + len, " 6 GHz");
+
 		l_info("%s", buf);
 	}
 
@@ -841,7 +887,8 @@ static void parse_supported_bands(struct wiphy *wiphy,
 	while (l_genl_attr_next(bands, &type, NULL, NULL)) {
 		enum nl80211_band band = type;
 
-		if (band != NL80211_BAND_2GHZ && band != NL80211_BAND_5GHZ)
+		if (band != NL80211_BAND_2GHZ && band != NL80211_BAND_5GHZ &&
+				band != NL80211_BAND_6GHZ)
 			continue;
 
 		if (!l_genl_attr_recurse(bands, &attr))
@@ -975,6 +1022,36 @@ static void wiphy_parse_attributes(struct wiphy *wiphy,
 				wiphy->max_num_ssids_per_scan =
 							*((uint8_t *) data);
 			break;
+		case NL80211_ATTR_MAX_NUM_SCHED_SCAN_SSIDS:
+			if (len != sizeof(uint8_t))
+				l_warn("Invalid MAX_NUM_SCHED_SCAN_SSIDS "
+					"attribute");
+			else
+				wiphy->max_num_sched_scan_ssids =
+							*((uint8_t *) data);
+			break;
+		case NL80211_ATTR_MAX_MATCH_SETS:
+			if (len != sizeof(uint8_t))
+				l_warn("Invalid MAX_MATCH_SETS attribute");
+			else
+				wiphy->max_match_sets = *((uint8_t *) data);
+			break;
+		case NL80211_ATTR_MAX_NUM_SCHED_SCAN_PLANS:
+			if (len != sizeof(uint32_t))
+				l_warn("Invalid MAX_NUM_SCHED_SCAN_PLANS "
+					"attribute");
+			else
+				wiphy->max_num_sched_scan_plans =
+							*((uint32_t *) data);
+			break;
+		case NL80211_ATTR_MAX_SCAN_PLAN_INTERVAL:
+			if (len != sizeof(uint32_t))
+				l_warn("Invalid MAX_SCAN_PLAN_INTERVAL "
+					"attribute");
+			else
+				wiphy->max_sched_scan_plan_interval =
+							*((uint32_t *) data);
+			break;
 		case NL80211_ATTR_MAX_SCAN_IE_LEN:
 			if (len != sizeof(uint16_t))
 				l_warn("Invalid MAX_SCAN_IE_LEN attribute");
@@ -1096,7 +1173,8 @@ static void wiphy_register(struct wiphy *wiphy)
 		l_hwdb_lookup_free(entries);
 	}
 
-	wiphy_get_driver_name(wiphy);
+	if (!wiphy->driver_str)
+		wiphy_get_driver_name(wiphy);
 
 #ifdef HAVE_DBUS
 	if (!l_dbus_object_add_interface(dbus, wiphy_get_path(wiphy),
@@ -1135,9 +1213,392 @@ void wiphy_update_from_genl(struct wiphy *wiphy, struct l_genl_msg *msg)
 	if (wiphy->blacklisted)
 		return;
 
+	/* Capabilities in use come from the snapshot, only validate */
+	if (wiphy->snapshot_data) {
+		if (!wiphy->live)
+			wiphy->live = wiphy_new(wiphy->id);
+
+		wiphy_parse_attributes(wiphy->live, msg);
+		return;
+	}
+
 	wiphy_parse_attributes(wiphy, msg);
 }
 
+static char *wiphy_snapshot_group(struct wiphy *wiphy)
+{
+	return l_strdup_printf("%02x%02x%02x%02x%02x%02x-%s",
+				MAC_STR(wiphy->permanent_addr),
+				wiphy->driver_str);
+}
+
+static void wiphy_snapshot_set_hex(struct l_settings *settings,
+					const char *group, const char *key,
+					const uint8_t *data, size_t len)
+{
+	char *hex = l_util_hexstring(data, len);
+
+	l_settings_set_value(settings, group, key, hex);
+	l_free(hex);
+}
+
+static uint8_t *wiphy_snapshot_get_hex(struct l_settings *settings,
+					const char *group, const char *key,
+					size_t *out_len)
+{
+	const char *value = l_settings_get_value(settings, group, key);
+
+	if (!value)
+		return NULL;
+
+	return l_util_from_hexstring(value, out_len);
+}
+
+static void wiphy_snapshot_freq_to_string(uint32_t freq, void *user_data)
+{
+	struct l_string *str = user_data;
+
+	l_string_append_printf(str, " %u", freq);
+}
+
+/*
+ * Only the raw capabilities reported by the kernel are saved, the bits we
+ * derive from them and from our configuration in wiphy_create_complete are
+ * recomputed on every start.
+ */
+static void wiphy_snapshot_save(struct wiphy *wiphy,
+					struct l_settings *settings,
+					const char *group)
+{
+	struct l_string *str;
+	char *freqs;
+	char key[32];
+	unsigned int i;
+
+	l_settings_set_uint(settings, group, "FeatureFlags",
+				wiphy->feature_flags);
+	wiphy_snapshot_set_hex(settings, group, "ExtFeatures",
+				wiphy->ext_features,
+				sizeof(wiphy->ext_features));
+	l_settings_set_uint(settings, group, "MaxScanSSIDs",
+				wiphy->max_num_ssids_per_scan);
+	l_settings_set_uint(settings, group, "MaxSchedScanSSIDs",
+				wiphy->max_num_sched_scan_ssids);
+	l_settings_set_uint(settings, group, "MaxMatchSets",
+				wiphy->max_match_sets);
+	l_settings_set_uint(settings, group, "MaxSchedScanPlans",
+				wiphy->max_num_sched_scan_plans);
+	l_settings_set_uint(settings, group, "MaxSchedScanPlanInterval",
+				wiphy->max_sched_scan_plan_interval);
+	l_settings_set_uint(settings, group, "MaxScanIELen",
+				wiphy->max_scan_ie_len);
+	l_settings_set_uint(settings, group, "MaxROCDuration",
+				wiphy->max_roc_duration);
+	l_settings_set_uint(settings, group, "Iftypes",
+				wiphy->supported_iftypes);
+	l_settings_set_uint(settings, group, "Ciphers",
+				wiphy->supported_ciphers);
+
+	str = l_string_new(256);
+	scan_freq_set_foreach(wiphy->supported_freqs,
+				wiphy_snapshot_freq_to_string, str);
+	freqs = l_string_unwrap(str);
+	l_settings_set_value(settings, group, "Frequencies", freqs);
+	l_free(freqs);
+
+	wiphy_snapshot_set_hex(settings, group, "ExtendedCapabilities",
+				wiphy->extended_capabilities + 2, EXT_CAP_LEN);
+
+	for (i = 0; i < NUM_NL80211_IFTYPES; i++) {
+		if (!wiphy->iftype_extended_capabilities[i])
+			continue;
+
+		snprintf(key, sizeof(key), "ExtendedCapabilities%u", i);
+		wiphy_snapshot_set_hex(settings, group, key,
+				wiphy->iftype_extended_capabilities[i] + 2,
+				EXT_CAP_LEN);
+	}
+
+	for (i = 0; i < NUM_NL80211_BANDS; i++) {
+		if (!wiphy->supported_rates[i] || !wiphy->supported_rates[i][0])
+			continue;
+
+		snprintf(key, sizeof(key), "Rates%u", i);
+		wiphy_snapshot_set_hex(settings, group, key,
+					wiphy->supported_rates[i],
+					strlen((char *) wiphy->supported_rates[i]));
+	}
+
+	l_settings_set_bool(settings, group, "ScheduledScan",
+				wiphy->support_scheduled_scan);
+	l_settings_set_bool(settings, group, "RekeyOffload",
+				wiphy->support_rekey_offload);
+	l_settings_set_bool(settings, group, "AdhocRSN",
+				wiphy->support_adhoc_rsn);
+	l_settings_set_bool(settings, group, "QosSetMap",
+				wiphy->support_qos_set_map);
+	l_settings_set_bool(settings, group, "AuthAssoc",
+				wiphy->support_cmds_auth_assoc);
+	l_settings_set_bool(settings, group, "OffchannelTx",
+				wiphy->offchannel_tx_ok);
+}
+
+static char *wiphy_snapshot_to_data(struct wiphy *wiphy)
+{
+	struct l_settings *settings = l_settings_new();
+	char *data;
+	size_t len;
+
+	wiphy_snapshot_save(wiphy, settings, "Capabilities");
+	data = l_settings_to_data(settings, &len);
+	l_settings_free(settings);
+
+	return data;
+}
+
+static bool wiphy_snapshot_load_freqs(struct wiphy *wiphy, const char *str)
+{
+	char *end;
+	unsigned long freq;
+
+	while (*str != '\0') {
+		errno = 0;
+		freq = strtoul(str, &end, 10);
+
+		if (errno == ERANGE || end == str || !freq || freq > 7125)
+			return false;
+
+		scan_freq_set_add(wiphy->supported_freqs, freq);
+		str = end;
+	}
+
+	return !scan_freq_set_isempty(wiphy->supported_freqs);
+}
+
+static bool wiphy_snapshot_load(struct wiphy *wiphy)
+{
+	L_AUTO_FREE_VAR(char *, group) = wiphy_snapshot_group(wiphy);
+	const char *freqs;
+	uint8_t *data;
+	size_t len;
+	char key[32];
+	unsigned int i;
+	unsigned int u;
+	bool b;
+
+	if (!snapshots || !l_settings_has_group(snapshots, group))
+		return false;
+
+	if (!l_settings_get_uint(snapshots, group, "FeatureFlags",
+					&wiphy->feature_flags))
+		return false;
+
+	data = wiphy_snapshot_get_hex(snapshots, group, "ExtFeatures", &len);
+	if (!data)
+		return false;
+
+	memcpy(wiphy->ext_features, data,
+		minsize(len, sizeof(wiphy->ext_features)));
+	l_free(data);
+
+	if (!l_settings_get_uint(snapshots, group, "MaxScanSSIDs", &u))
+		return false;
+
+	wiphy->max_num_ssids_per_scan = u;
+
+	if (l_settings_get_uint(snapshots, group, "MaxSchedScanSSIDs", &u))
+		wiphy->max_num_sched_scan_ssids = u;
+
+	if (l_settings_get_uint(snapshots, group, "MaxMatchSets", &u))
+		wiphy->max_match_sets = u;
+
+	if (l_settings_get_uint(snapshots, group, "MaxSchedScanPlans", &u))
+		wiphy->max_num_sched_scan_plans = u;
+
+	if (l_settings_get_uint(snapshots, group, "MaxSchedScanPlanInterval",
+					&u))
+		wiphy->max_sched_scan_plan_interval = u;
+
+	if (!l_settings_get_uint(snapshots, group, "MaxScanIELen", &u))
+		return false;
+
+	wiphy->max_scan_ie_len = u;
+
+	if (!l_settings_get_uint(snapshots, group, "MaxROCDuration",
+					&wiphy->max_roc_duration))
+		return false;
+
+	if (!l_settings_get_uint(snapshots, group, "Iftypes", &u))
+		return false;
+
+	wiphy->supported_iftypes = u;
+
+	if (!l_settings_get_uint(snapshots, group, "Ciphers", &u))
+		return false;
+
+	wiphy->supported_ciphers = u;
+
+	freqs = l_settings_get_value(snapshots, group, "Frequencies");
+	if (!freqs || !wiphy_snapshot_load_freqs(wiphy, freqs))
+		return false;
+
+	data = wiphy_snapshot_get_hex(snapshots, group,
+					"ExtendedCapabilities", &len);
+	if (!data)
+		return false;
+
+	memcpy(wiphy->extended_capabilities + 2, data,
+		minsize(len, EXT_CAP_LEN));
+	l_free(data);
+
+	for (i = 0; i < NUM_NL80211_IFTYPES; i++) {
+		snprintf(key, sizeof(key), "ExtendedCapabilities%u", i);
+		data = wiphy_snapshot_get_hex(snapshots, group, key, &len);
+		if (!data)
+			continue;
+
+		wiphy->iftype_extended_capabilities[i] =
+					l_new(uint8_t, EXT_CAP_LEN + 2);
+		wiphy->iftype_extended_capabilities[i][0] =
+					IE_TYPE_EXTENDED_CAPABILITIES;
+		wiphy->iftype_extended_capabilities[i][1] = EXT_CAP_LEN;
+		memcpy(wiphy->iftype_extended_capabilities[i] + 2, data,
+			minsize(len, EXT_CAP_LEN));
+		l_free(data);
+	}
+
+	for (i = 0; i < NUM_NL80211_BANDS; i++) {
+		snprintf(key, sizeof(key), "Rates%u", i);
+		data = wiphy_snapshot_get_hex(snapshots, group, key, &len);
+		if (!data)
+			continue;
+
+		wiphy->supported_rates[i] = l_malloc(len + 1);
+		memcpy(wiphy->supported_rates[i], data, len);
+		wiphy->supported_rates[i][len] = 0;
+		l_free(data);
+	}
+
+	if (l_settings_get_bool(snapshots, group, "ScheduledScan", &b))
+		wiphy->support_scheduled_scan = b;
+
+	if (l_settings_get_bool(snapshots, group, "RekeyOffload", &b))
+		wiphy->support_rekey_offload = b;
+
+	if (l_settings_get_bool(snapshots, group, "AdhocRSN", &b))
+		wiphy->support_adhoc_rsn = b;
+
+	if (l_settings_get_bool(snapshots, group, "QosSetMap", &b))
+		wiphy->support_qos_set_map = b;
+
+	if (l_settings_get_bool(snapshots, group, "AuthAssoc", &b))
+		wiphy->support_cmds_auth_assoc = b;
+
+	if (l_settings_get_bool(snapshots, group, "OffchannelTx", &b))
+		wiphy->offchannel_tx_ok = b;
+
+	/* Re-serialize so formatting differences don't count as changes */
+	wiphy->snapshot_data = wiphy_snapshot_to_data(wiphy);
+
+	return true;
+}
+
+static void wiphy_snapshot_store(struct wiphy *wiphy)
+{
+	L_AUTO_FREE_VAR(char *, group) = NULL;
+
+	if (!wiphy->driver_str || util_mem_is_zero(wiphy->permanent_addr, 6))
+		return;
+
+	if (!snapshots)
+		snapshots = l_settings_new();
+
+	group = wiphy_snapshot_group(wiphy);
+	l_settings_remove_group(snapshots, group);
+	wiphy_snapshot_save(wiphy, snapshots, group);
+
+	storage_wiphy_snapshot_sync(snapshots);
+}
+
+/*
+ * Bring up a wiphy purely from its saved capability snapshot, keyed by
+ * permanent address and driver, without waiting for the GET_WIPHY dump.
+ * The dump is still expected to follow and is checked against the
+ * snapshot in wiphy_validate_snapshots.
+ */
+struct wiphy *wiphy_create_from_snapshot(uint32_t wiphy_id, const char *name)
+{
+	struct wiphy *wiphy;
+
+	if (!snapshots || wiphy_find(wiphy_id))
+		return NULL;
+
+	wiphy = wiphy_create(wiphy_id, name);
+	if (!wiphy)
+		return NULL;
+
+	if (wiphy->blacklisted ||
+			wiphy_get_permanent_addr_from_sysfs(wiphy) < 0 ||
+			!wiphy_get_driver_name(wiphy) ||
+			!wiphy_snapshot_load(wiphy)) {
+		wiphy_destroy(wiphy);
+		return NULL;
+	}
+
+	l_debug("Using capability snapshot for %s", wiphy->name);
+
+	return wiphy;
+}
+
+/* Replace @to's kernel-reported capabilities with those from @from */
+static void wiphy_capabilities_move(struct wiphy *to, struct wiphy *from)
+{
+	struct scan_freq_set *freqs;
+	unsigned int i;
+
+	to->feature_flags = from->feature_flags;
+	memcpy(to->ext_features, from->ext_features, sizeof(to->ext_features));
+	to->max_num_ssids_per_scan = from->max_num_ssids_per_scan;
+	to->max_num_sched_scan_ssids = from->max_num_sched_scan_ssids;
+	to->max_match_sets = from->max_match_sets;
+	to->max_num_sched_scan_plans = from->max_num_sched_scan_plans;
+	to->max_sched_scan_plan_interval = from->max_sched_scan_plan_interval;
+	to->max_roc_duration = from->max_roc_duration;
+	to->max_scan_ie_len = from->max_scan_ie_len;
+	to->supported_iftypes = from->supported_iftypes;
+	to->supported_ciphers = from->supported_ciphers;
+
+	freqs = to->supported_freqs;
+	to->supported_freqs = from->supported_freqs;
+	from->supported_freqs = freqs;
+
+	memcpy(to->extended_capabilities, from->extended_capabilities,
+		sizeof(to->extended_capabilities));
+
+	for (i = 0; i < NUM_NL80211_IFTYPES; i++) {
+		l_free(to->iftype_extended_capabilities[i]);
+		to->iftype_extended_capabilities[i] =
+					from->iftype_extended_capabilities[i];
+		from->iftype_extended_capabilities[i] = NULL;
+	}
+
+	for (i = 0; i < NUM_NL80211_BANDS; i++) {
+		l_free(to->supported_rates[i]);
+		to->supported_rates[i] = from->supported_rates[i];
+		from->supported_rates[i] = NULL;
+	}
+
+	memset(to->rm_enabled_capabilities, 0,
+		sizeof(to->rm_enabled_capabilities));
+
+	to->support_scheduled_scan = from->support_scheduled_scan;
+	to->support_rekey_offload = from->support_rekey_offload;
+	to->support_adhoc_rsn = from->support_adhoc_rsn;
+	to->support_qos_set_map = from->support_qos_set_map;
+	to->support_cmds_auth_assoc = from->support_cmds_auth_assoc;
+	to->offchannel_tx_ok = from->offchannel_tx_ok;
+}
+
 void wiphy_update_name(struct wiphy *wiphy, const char *name)
 {
 #ifdef HAVE_DBUS
@@ -1287,6 +1748,9 @@ void wiphy_create_complete(struct wiphy *wiphy)
 					wiphy->name, strerror(-err));
 	}
 
+	if (!wiphy->snapshot_data)
+		wiphy_snapshot_store(wiphy);
+
 	wiphy_set_station_capability_bits(wiphy);
 	wiphy_setup_rm_enabled_capabilities(wiphy);
 	wiphy_get_reg_domain(wiphy);
@@ -1294,6 +1758,41 @@ void wiphy_create_complete(struct wiphy *wiphy)
 	wiphy_print_basic_info(wiphy);
 }
 
+static void wiphy_validate_snapshot(void *data, void *user_data)
+{
+	struct wiphy *wiphy = data;
+	char *live_data;
+
+	/* Not from a snapshot or the dump has not reached this wiphy yet */
+	if (!wiphy->snapshot_data || !wiphy->live)
+		return;
+
+	live_data = wiphy_snapshot_to_data(wiphy->live);
+
+	if (strcmp(live_data, wiphy->snapshot_data)) {
+		l_warn("Capability snapshot for %s is out of date, updating",
+			wiphy->name);
+
+		wiphy_capabilities_move(wiphy, wiphy->live);
+		wiphy_snapshot_store(wiphy);
+
+		wiphy_set_station_capability_bits(wiphy);
+		wiphy_setup_rm_enabled_capabilities(wiphy);
+	}
+
+	l_free(live_data);
+	l_free(wiphy->snapshot_data);
+	wiphy->snapshot_data = NULL;
+	wiphy_free(wiphy->live);
+	wiphy->live = NULL;
+}
+
+/* Called once a GET_WIPHY dump completes */
+void wiphy_validate_snapshots(void)
+{
+	l_queue_foreach(wiphy_list, wiphy_validate_snapshot, NULL);
+}
+
 bool wiphy_destroy(struct wiphy *wiphy)
 {
 	l_debug("");
@@ -1534,6 +2033,7 @@ static int wiphy_init(void)
 	}
 
 	wiphy_list = l_queue_new();
+	snapshots = storage_wiphy_snapshot_load();
 
 	rfkill_watch_add(wiphy_rfkill_cb, NULL);
 
@@ -1581,6 +2081,9 @@ static void wiphy_exit(void)
 	l_queue_destroy(wiphy_list, wiphy_free);
 	wiphy_list = NULL;
 
+	l_settings_free(snapshots);
+	snapshots = NULL;
+
 	l_genl_family_free(nl80211);
 	nl80211 = NULL;
 	mac_randomize_bytes = 6;
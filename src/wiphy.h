@@ -47,10 +47,12 @@ struct wiphy *wiphy_find(int wiphy_id);
 bool wiphy_is_blacklisted(const struct wiphy *wiphy);
 
 struct wiphy *wiphy_create(uint32_t wiphy_id, const char *name);
+struct wiphy *wiphy_create_from_snapshot(uint32_t wiphy_id, const char *name);
 void wiphy_update_name(struct wiphy *wiphy, const char *name);
 void wiphy_create_complete(struct wiphy *wiphy);
 bool wiphy_destroy(struct wiphy *wiphy);
 void wiphy_update_from_genl(struct wiphy *wiphy, struct l_genl_msg *msg);
+void wiphy_validate_snapshots(void);
 
 bool wiphy_constrain_freq_set(const struct wiphy *wiphy,
 						struct scan_freq_set *set);
@@ -66,6 +68,11 @@ bool wiphy_rrm_capable(struct wiphy *wiphy);
 bool wiphy_has_feature(struct wiphy *wiphy, uint32_t feature);
 bool wiphy_has_ext_feature(struct wiphy *wiphy, uint32_t feature);
 uint8_t wiphy_get_max_num_ssids_per_scan(struct wiphy *wiphy);
+uint8_t wiphy_get_max_num_sched_scan_ssids(struct wiphy *wiphy);
+uint8_t wiphy_get_max_match_sets(struct wiphy *wiphy);
+uint32_t wiphy_get_max_num_sched_scan_plans(struct wiphy *wiphy);
+uint32_t wiphy_get_max_sched_scan_plan_interval(struct wiphy *wiphy);
+bool wiphy_supports_sched_scan(struct wiphy *wiphy);
 uint16_t wiphy_get_max_scan_ie_len(struct wiphy *wiphy);
 uint32_t wiphy_get_max_roc_duration(struct wiphy *wiphy);
 bool wiphy_supports_iftype(struct wiphy *wiphy, uint32_t iftype);
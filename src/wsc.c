@@ -262,6 +262,7 @@ static void wsc_enrollee_netdev_event(struct netdev *netdev,
 		break;
 	case NETDEV_EVENT_RSSI_THRESHOLD_LOW:
 	case NETDEV_EVENT_RSSI_THRESHOLD_HIGH:
+	case NETDEV_EVENT_LINK_STATS:
 		break;
 	default:
 		l_debug("Unexpected event: %d", event);
@@ -315,6 +316,9 @@ static inline enum wsc_rf_band freq_to_rf_band(uint32_t freq)
 		return WSC_RF_BAND_2_4_GHZ;
 	case SCAN_BAND_5_GHZ:
 		return WSC_RF_BAND_5_0_GHZ;
+	case SCAN_BAND_6_GHZ:
+		/* WSC defines no 6 GHz RF band value */
+		break;
 	}
 
 	return WSC_RF_BAND_2_4_GHZ;
@@ -1063,6 +1067,9 @@ static void wsc_station_dbus_connect(struct wsc_dbus *super,
 		return;
 	}
 
+	/* Precompute our DH keypair while the scan is in progress */
+	eap_wsc_dh_pool_prepare();
+
 	if (pin) {
 		wsc->walk_timer = l_timeout_create(60, pin_timeout, wsc, NULL);
 	} else {
@@ -29,6 +29,7 @@
 #include <getopt.h>
 #include <signal.h>
 #include <time.h>
+#include <math.h>
 #include <sys/time.h>
 #include <linux/if_ether.h>
 #include <linux/rtnetlink.h>
@@ -125,6 +126,13 @@ struct hwsim_rule {
 	uint32_t frequency;
 	int priority;
 	int signal;
+	bool path_loss : 1;
+	bool airtime : 1;
+	/* Addresses resolved to radios by rules_compile() */
+	const struct radio_info_rec *source_radio;
+	const struct radio_info_rec *destination_radio;
+	bool source_broadcast : 1;
+	bool destination_broadcast : 1;
 };
 
 struct hwsim_support {
@@ -152,6 +160,7 @@ static bool p2p_attr;
 static const char *radio_name_attr;
 static struct l_dbus *dbus;
 static struct l_queue *rules;
+static bool rules_compiled;
 static unsigned int next_rule_id;
 
 static uint32_t hwsim_iftypes = HWSIM_DEFAULT_IFTYPES;
@@ -334,6 +343,11 @@ static void list_callback(struct l_genl_msg *msg, void *user_data)
 		l_free(hwname);
 }
 
+struct medium_waypoint {
+	double x, y;
+	uint64_t arrival;	/* In medium_now_ms() time */
+};
+
 struct radio_info_rec {
 	uint32_t id;
 	uint32_t wiphy_id;
@@ -344,6 +358,15 @@ struct radio_info_rec {
 	int channels;
 	uint8_t addrs[2][ETH_ALEN];
 	char *name;
+	/*
+	 * Position in meters.  The radio starts moving from 'start' at
+	 * start_time and then travels through each waypoint in turn.
+	 */
+	bool positioned;
+	double start_x, start_y;
+	uint64_t start_time;
+	struct medium_waypoint *waypoints;
+	unsigned int num_waypoints;
 };
 
 struct interface_info_rec {
@@ -356,6 +379,14 @@ struct interface_info_rec {
 static struct l_queue *radio_info;
 static struct l_queue *interface_info;
 
+/*
+ * Address to radio and address to interface lookups done for every frame
+ * on the medium.  Each entry is a queue since nothing stops two radios or
+ * interfaces from using the same address.
+ */
+static struct l_hashmap *radio_addr_index;
+static struct l_hashmap *interface_addr_index;
+
 static struct l_dbus_message *pending_create_msg;
 static uint32_t pending_create_radio_id;
 
@@ -364,6 +395,7 @@ static void radio_free(void *user_data)
 	struct radio_info_rec *rec = user_data;
 
 	l_free(rec->name);
+	l_free(rec->waypoints);
 	l_free(rec);
 }
 
@@ -375,8 +407,101 @@ static void interface_free(void *user_data)
 	l_free(rec);
 }
 
+static unsigned int addr_hash(const void *p)
+{
+	const uint8_t *addr = p;
+
+	/* The first octets are usually the same for all hwsim radios */
+	return l_get_u32(addr + 2) ^ addr[0];
+}
+
+static int addr_compare(const void *a, const void *b)
+{
+	return memcmp(a, b, ETH_ALEN);
+}
+
+static void *addr_copy(const void *p)
+{
+	return l_memdup(p, ETH_ALEN);
+}
+
+static void addr_index_entry_free(void *data)
+{
+	l_queue_destroy(data, NULL);
+}
+
+static void addr_index_add(struct l_hashmap **index, const uint8_t *addr,
+				void *data)
+{
+	struct l_queue *entry;
+
+	if (!*index) {
+		*index = l_hashmap_new();
+		l_hashmap_set_hash_function(*index, addr_hash);
+		l_hashmap_set_compare_function(*index, addr_compare);
+		l_hashmap_set_key_copy_function(*index, addr_copy);
+		l_hashmap_set_key_free_function(*index, l_free);
+	}
+
+	entry = l_hashmap_lookup(*index, addr);
+	if (!entry) {
+		entry = l_queue_new();
+		l_hashmap_insert(*index, addr, entry);
+	}
+
+	l_queue_push_tail(entry, data);
+}
+
+static void addr_index_remove(struct l_hashmap *index, const uint8_t *addr,
+				void *data)
+{
+	struct l_queue *entry = l_hashmap_lookup(index, addr);
+
+	if (!entry || !l_queue_remove(entry, data))
+		return;
+
+	if (l_queue_isempty(entry)) {
+		l_hashmap_remove(index, addr);
+		l_queue_destroy(entry, NULL);
+	}
+}
+
+static const struct l_queue_entry *addr_index_lookup(struct l_hashmap *index,
+							const uint8_t *addr)
+{
+	return l_queue_get_entries(l_hashmap_lookup(index, addr));
+}
+
+static void radio_index_add(struct radio_info_rec *rec)
+{
+	addr_index_add(&radio_addr_index, rec->addrs[0], rec);
+	addr_index_add(&radio_addr_index, rec->addrs[1], rec);
+	rules_compiled = false;
+}
+
+static void radio_index_remove(struct radio_info_rec *rec,
+				uint8_t addrs[][ETH_ALEN])
+{
+	addr_index_remove(radio_addr_index, addrs[0], rec);
+	addr_index_remove(radio_addr_index, addrs[1], rec);
+	rules_compiled = false;
+}
+
+static struct radio_info_rec *radio_lookup_addr(const uint8_t *addr)
+{
+	const struct l_queue_entry *entry =
+		addr_index_lookup(radio_addr_index, addr);
+
+	return entry ? entry->data : NULL;
+}
+
 static void hwsim_radio_cache_cleanup(void)
 {
+	l_hashmap_destroy(radio_addr_index, addr_index_entry_free);
+	l_hashmap_destroy(interface_addr_index, addr_index_entry_free);
+	radio_addr_index = NULL;
+	interface_addr_index = NULL;
+
 	l_queue_destroy(radio_info, radio_free);
 	l_queue_destroy(interface_info, interface_free);
 	radio_info = NULL;
@@ -399,22 +524,6 @@ static bool radio_info_match_wiphy_id(const void *a, const void *b)
 	return rec->wiphy_id == id;
 }
 
-static bool radio_info_match_addr0(const void *a, const void *b)
-{
-	const struct radio_info_rec *rec = a;
-	const uint8_t *addr0 = b;
-
-	return !memcmp(rec->addrs[0], addr0, ETH_ALEN);
-}
-
-static bool radio_info_match_addr1(const void *a, const void *b)
-{
-	const struct radio_info_rec *rec = a;
-	const uint8_t *addr1 = b;
-
-	return !memcmp(rec->addrs[1], addr1, ETH_ALEN);
-}
-
 static bool interface_info_match_id(const void *a, const void *b)
 {
 	const struct interface_info_rec *rec = a;
@@ -569,6 +678,7 @@ static void get_radio_callback(struct l_genl_msg *msg, void *user_data)
 	if (rec) {
 		old = true;
 		memcpy(&prev_rec, rec, sizeof(prev_rec));
+		radio_index_remove(rec, prev_rec.addrs);
 
 		if (strlen(rec->name) != name_len ||
 				memcmp(rec->name, name, name_len))
@@ -657,6 +767,8 @@ static void get_radio_callback(struct l_genl_msg *msg, void *user_data)
 	if (!old)
 		l_queue_push_tail(radio_info, rec);
 
+	radio_index_add(rec);
+
 	path = radio_get_path(rec);
 
 	if (!old) {
@@ -699,6 +811,8 @@ static void get_radio_callback(struct l_genl_msg *msg, void *user_data)
 err_free_radio:
 	if (!old)
 		radio_free(rec);
+	else
+		radio_index_add(rec);
 
 	if (pending_create_msg && pending_create_radio_id == *id)
 		dbus_pending_reply(&pending_create_msg,
@@ -819,6 +933,7 @@ static void get_interface_callback(struct l_genl_msg *msg, void *user_data)
 			name_change = true;
 
 		l_free(rec->name);
+		addr_index_remove(interface_addr_index, rec->addr, rec);
 	} else {
 		old = false;
 
@@ -830,6 +945,7 @@ static void get_interface_callback(struct l_genl_msg *msg, void *user_data)
 
 	memcpy(rec->addr, addr, ETH_ALEN);
 	rec->name = l_strndup(ifname, ifname_len);
+	addr_index_add(&interface_addr_index, rec->addr, rec);
 
 	if (!interface_info)
 		interface_info = l_queue_new();
@@ -876,6 +992,7 @@ static bool interface_info_destroy_by_radio(void *data, void *user_data)
 		return false;
 
 	l_dbus_unregister_object(dbus, interface_get_path(rec));
+	addr_index_remove(interface_addr_index, rec->addr, rec);
 	interface_free(rec);
 
 	return true;
@@ -915,6 +1032,7 @@ static void del_radio_event(struct l_genl_msg *msg)
 	l_queue_foreach_remove(interface_info, interface_info_destroy_by_radio,
 				radio);
 	l_dbus_unregister_object(dbus, radio_get_path(radio));
+	radio_index_remove(radio, radio->addrs);
 	l_queue_remove(radio_info, radio);
 	radio_free(radio);
 }
@@ -950,6 +1068,7 @@ static void del_interface_event(struct l_genl_msg *msg)
 		return;
 
 	l_dbus_unregister_object(dbus, interface_get_path(interface));
+	addr_index_remove(interface_addr_index, interface->addr, interface);
 	l_queue_remove(interface_info, interface);
 	interface_free(interface);
 }
@@ -1033,7 +1152,9 @@ static void rtnl_newlink_notify(const struct ifinfomsg *ifi, int bytes)
 				continue;
 
 			addr_change = true;
+			addr_index_remove(interface_addr_index, rec->addr, rec);
 			memcpy(rec->addr, RTA_DATA(attr), ETH_ALEN);
+			addr_index_add(&interface_addr_index, rec->addr, rec);
 			break;
 		}
 	}
@@ -1090,42 +1211,278 @@ struct hwsim_frame {
 	uint16_t payload_len;
 	const uint8_t *payload;
 	bool acked;
+	bool airtime_accounted;
+	unsigned int airtime_delay;
 	struct l_genl_msg *msg;
 	int pending_callback_count;
 };
 
-static bool radio_match_addr(const struct radio_info_rec *radio,
-				const uint8_t *addr)
+/*
+ * Resolve the rule addresses to radios once so that matching a frame only
+ * needs pointer comparisons.  Needs redoing whenever the rules or the
+ * radio addresses change.
+ */
+static void rules_compile(void)
+{
+	const struct l_queue_entry *rule_entry;
+
+	for (rule_entry = l_queue_get_entries(rules); rule_entry;
+			rule_entry = rule_entry->next) {
+		struct hwsim_rule *rule = rule_entry->data;
+
+		rule->source_broadcast =
+			util_is_broadcast_address(rule->source);
+		rule->source_radio = rule->source_broadcast ? NULL :
+					radio_lookup_addr(rule->source);
+
+		rule->destination_broadcast =
+			util_is_broadcast_address(rule->destination);
+		rule->destination_radio = rule->destination_broadcast ? NULL :
+					radio_lookup_addr(rule->destination);
+	}
+
+	rules_compiled = true;
+}
+
+/*
+ * Simple medium model used by rules with the PathLoss or Airtime property
+ * set.  Signal is derived from the distance between the two radios using
+ * a log-distance path loss model and every frame occupies its channel for
+ * the time it takes to transmit at the rate the transmitter picked.
+ */
+#define MEDIUM_TX_POWER			20	/* dBm */
+#define MEDIUM_PATH_LOSS_EXPONENT	3.0
+#define MEDIUM_MIN_SIGNAL		-100	/* dBm */
+
+struct medium_channel {
+	uint64_t busy_until;
+};
+
+static struct l_hashmap *medium_channels;
+
+static uint64_t medium_now_ms(void)
+{
+	return l_time_now() / 1000;
+}
+
+static void medium_radio_position(const struct radio_info_rec *radio,
+					uint64_t now, double *x, double *y)
+{
+	double from_x = radio->start_x;
+	double from_y = radio->start_y;
+	uint64_t from_time = radio->start_time;
+	unsigned int i;
+
+	for (i = 0; i < radio->num_waypoints; i++) {
+		const struct medium_waypoint *wp = &radio->waypoints[i];
+		double progress;
+
+		if (now < wp->arrival) {
+			progress = (double) (now - from_time) /
+					(wp->arrival - from_time);
+
+			*x = from_x + (wp->x - from_x) * progress;
+			*y = from_y + (wp->y - from_y) * progress;
+			return;
+		}
+
+		from_x = wp->x;
+		from_y = wp->y;
+		from_time = wp->arrival;
+	}
+
+	*x = from_x;
+	*y = from_y;
+}
+
+/*
+ * Replace any movement in progress with a path through @num points, each
+ * reached @durations[i] milliseconds after the previous one.  A radio that
+ * had no position yet starts at the first point.
+ */
+static void medium_radio_set_path(struct radio_info_rec *radio,
+					const double *xs, const double *ys,
+					const uint32_t *durations,
+					unsigned int num)
+{
+	uint64_t now = medium_now_ms();
+	uint64_t arrival = now;
+	unsigned int i;
+
+	if (radio->positioned)
+		medium_radio_position(radio, now, &radio->start_x,
+					&radio->start_y);
+	else {
+		radio->start_x = xs[0];
+		radio->start_y = ys[0];
+	}
+
+	radio->start_time = now;
+	radio->positioned = true;
+
+	l_free(radio->waypoints);
+	radio->waypoints = l_new(struct medium_waypoint, num);
+	radio->num_waypoints = num;
+
+	for (i = 0; i < num; i++) {
+		arrival += durations[i];
+
+		radio->waypoints[i].x = xs[i];
+		radio->waypoints[i].y = ys[i];
+		radio->waypoints[i].arrival = arrival;
+	}
+}
+
+static bool medium_path_loss_signal(const struct radio_info_rec *src_radio,
+					const struct radio_info_rec *dst_radio,
+					uint32_t frequency, int32_t *signal)
 {
-	if (!radio || util_is_broadcast_address(addr))
-		return !radio && util_is_broadcast_address(addr);
+	uint64_t now = medium_now_ms();
+	double src_x, src_y, dst_x, dst_y;
+	double distance, loss;
+
+	if (!src_radio || !dst_radio || !frequency ||
+			!src_radio->positioned || !dst_radio->positioned)
+		return false;
+
+	medium_radio_position(src_radio, now, &src_x, &src_y);
+	medium_radio_position(dst_radio, now, &dst_x, &dst_y);
+
+	distance = hypot(dst_x - src_x, dst_y - src_y);
+	if (distance < 1.0)
+		distance = 1.0;
+
+	/* Free space loss at 1m, frequency in MHz, then log-distance */
+	loss = 20.0 * log10(frequency) - 27.55 +
+		10.0 * MEDIUM_PATH_LOSS_EXPONENT * log10(distance);
 
-	return !memcmp(addr, radio->addrs[0], ETH_ALEN) ||
-		!memcmp(addr, radio->addrs[1], ETH_ALEN);
+	*signal = lround(MEDIUM_TX_POWER - loss);
+	if (*signal < MEDIUM_MIN_SIGNAL)
+		*signal = MEDIUM_MIN_SIGNAL;
+
+	return true;
+}
+
+/* Time on air in microseconds, assuming legacy rates only */
+static unsigned int medium_frame_airtime(const struct hwsim_frame *frame)
+{
+	/* Band bitrate tables of mac80211_hwsim, in 100 kbps units */
+	static const uint16_t rates_2ghz[] = {
+		10, 20, 55, 110, 60, 90, 120, 180, 240, 360, 480, 540
+	};
+	static const uint16_t rates_5ghz[] = {
+		60, 90, 120, 180, 240, 360, 480, 540
+	};
+	const uint16_t *rates = rates_5ghz;
+	unsigned int n_rates = L_ARRAY_SIZE(rates_5ghz);
+	int idx = frame->tx_info_len ? frame->tx_info[0].idx : 0;
+	unsigned int airtime;
+	bool dsss = false;
+
+	if (frame->frequency < 3000) {
+		rates = rates_2ghz;
+		n_rates = L_ARRAY_SIZE(rates_2ghz);
+	}
+
+	if (idx < 0 || (unsigned int) idx >= n_rates)
+		idx = 0;
+
+	if (rates == rates_2ghz && idx < 4)
+		dsss = true;
+
+	airtime = (dsss ? 192 : 20) +
+			frame->payload_len * 8 * 10 / rates[idx];
+
+	/* SIFS and the ACK coming back */
+	if (!(frame->flags & HWSIM_TX_CTL_NO_ACK) &&
+			!util_is_broadcast_address(frame->dst_ether_addr))
+		airtime += 16 + 44;
+
+	return airtime;
+}
+
+/*
+ * Account for the frame's time on air once per transmission and return the
+ * delivery delay in ms, including the time spent waiting for earlier frames
+ * on the same channel.
+ */
+static unsigned int medium_airtime_delay(struct hwsim_frame *frame)
+{
+	struct medium_channel *channel;
+	uint64_t now;
+	uint64_t start;
+
+	if (frame->airtime_accounted)
+		return frame->airtime_delay;
+
+	if (!medium_channels)
+		medium_channels = l_hashmap_new();
+
+	channel = l_hashmap_lookup(medium_channels,
+					L_UINT_TO_PTR(frame->frequency));
+	if (!channel) {
+		channel = l_new(struct medium_channel, 1);
+		l_hashmap_insert(medium_channels,
+					L_UINT_TO_PTR(frame->frequency),
+					channel);
+	}
+
+	now = l_time_now();
+	start = channel->busy_until > now ? channel->busy_until : now;
+	channel->busy_until = start + medium_frame_airtime(frame);
+
+	frame->airtime_accounted = true;
+	frame->airtime_delay = (channel->busy_until - now + 999) / 1000;
+
+	return frame->airtime_delay;
+}
+
+static bool rule_match_radio(const struct radio_info_rec *radio,
+				const struct radio_info_rec *rule_radio,
+				bool broadcast)
+{
+	if (broadcast)
+		return !radio;
+
+	return radio && radio == rule_radio;
 }
 
 static void process_rules(const struct radio_info_rec *src_radio,
 				const struct radio_info_rec *dst_radio,
-				struct hwsim_frame *frame, bool *drop)
+				struct hwsim_frame *frame, int32_t *signal,
+				bool *drop, bool *airtime)
 {
 	const struct l_queue_entry *rule_entry;
 
+	if (!rules_compiled)
+		rules_compile();
+
 	for (rule_entry = l_queue_get_entries(rules); rule_entry;
 			rule_entry = rule_entry->next) {
 		struct hwsim_rule *rule = rule_entry->data;
+		const struct radio_info_rec *source = rule->source_radio;
+		const struct radio_info_rec *destination =
+						rule->destination_radio;
+		bool source_bcast = rule->source_broadcast;
+		bool destination_bcast = rule->destination_broadcast;
+
+		if (rule->frequency && rule->frequency != frame->frequency)
+			continue;
 
 		if (!rule->source_any &&
-				!radio_match_addr(src_radio, rule->source) &&
+				!rule_match_radio(src_radio, source,
+							source_bcast) &&
 				(!rule->bidirectional ||
-				 !radio_match_addr(dst_radio, rule->source)))
+				 !rule_match_radio(dst_radio, source,
+							source_bcast)))
 			continue;
 
 		if (!rule->destination_any &&
-				!radio_match_addr(dst_radio,
-							rule->destination) &&
+				!rule_match_radio(dst_radio, destination,
+							destination_bcast) &&
 				(!rule->bidirectional ||
-				 !radio_match_addr(src_radio,
-							rule->destination)))
+				 !rule_match_radio(src_radio, destination,
+							destination_bcast)))
 			continue;
 
 		/*
@@ -1134,19 +1491,25 @@ static void process_rules(const struct radio_info_rec *src_radio,
 		 * radio's address.
 		 */
 		if (!rule->source_any && rule->bidirectional &&
-				radio_match_addr(dst_radio, rule->source))
+				rule_match_radio(dst_radio, source,
+							source_bcast))
 			if (!rule->destination_any &&
-					!radio_match_addr(dst_radio,
-							rule->destination))
+					!rule_match_radio(dst_radio,
+							destination,
+							destination_bcast))
 				continue;
 
-		if (rule->frequency && rule->frequency != frame->frequency)
-			continue;
-
 		/* Rule deemed to match frame, apply any changes */
 
+		if (rule->path_loss)
+			medium_path_loss_signal(src_radio, dst_radio,
+						frame->frequency, signal);
+
 		if (rule->signal)
-			frame->signal = rule->signal / 100;
+			*signal = rule->signal / 100;
+
+		if (rule->airtime)
+			*airtime = true;
 
 		*drop = rule->drop;
 	}
@@ -1156,6 +1519,8 @@ struct send_frame_info {
 	struct hwsim_frame *frame;
 	struct radio_info_rec *radio;
 	void *user_data;
+	int32_t signal;
+	uint64_t due;
 };
 
 static bool send_frame_tx_info(struct hwsim_frame *frame)
@@ -1197,7 +1562,7 @@ static bool send_frame(struct send_frame_info *info,
 	l_genl_msg_append_attr(msg, HWSIM_ATTR_RX_RATE, 4,
 				&rx_rate);
 	l_genl_msg_append_attr(msg, HWSIM_ATTR_SIGNAL, 4,
-				&info->frame->signal);
+				&info->signal);
 	l_genl_msg_append_attr(msg, HWSIM_ATTR_FREQ, 4,
 				&info->frame->frequency);
 
@@ -1230,9 +1595,11 @@ static void hwsim_frame_unref(struct hwsim_frame *frame)
 
 		if (!(frame->flags & HWSIM_TX_CTL_NO_ACK) && frame->acked) {
 			bool drop = false;
+			bool airtime = false;
 
 			process_rules(frame->ack_radio, frame->src_radio,
-					frame, &drop);
+					frame, &frame->signal, &drop,
+					&airtime);
 
 			if (!drop)
 				frame->flags |= HWSIM_TX_STAT_ACK;
@@ -1317,9 +1684,9 @@ static bool send_custom_frame(const uint8_t *addr, uint32_t freq,
 
 	info->frame = frame;
 	info->user_data = user_data;
+	info->signal = signal;
 
-	info->radio = l_queue_find(radio_info, radio_info_match_addr0, addr) ?:
-		l_queue_find(radio_info, radio_info_match_addr1, addr);
+	info->radio = radio_lookup_addr(addr);
 	if (!info->radio)
 		goto error;
 
@@ -1336,31 +1703,149 @@ error:
 	return false;
 }
 
-struct interface_match_data {
-	struct radio_info_rec *radio;
-	const uint8_t *addr;
-};
-
-static bool interface_info_match_dst(const void *a, const void *b)
-{
-	const struct interface_info_rec *rec = a;
-	const struct interface_match_data *dst = b;
+/*
+ * Frames are delivered after a delay like with the kernel medium.  Rather
+ * than a timer per delivered frame, all pending deliveries are kept in a
+ * wheel of 1ms slots driven by a single timeout.  Deliveries due further
+ * out than the wheel size stay in their slot until a later round.
+ */
+#define DELIVERY_WHEEL_SLOTS	64
 
-	return rec->radio_rec == dst->radio &&
-		!memcmp(rec->addr, dst->addr, ETH_ALEN);
-}
+static struct l_queue *delivery_wheel[DELIVERY_WHEEL_SLOTS];
+static uint64_t delivery_wheel_tick;
+static unsigned int delivery_pending;
+static struct l_timeout *delivery_timeout;
 
-static void frame_delay_callback(struct l_timeout *timeout, void *user_data)
+static void medium_deliver(struct send_frame_info *send_info)
 {
-	struct send_frame_info *send_info = user_data;
-
 	if (send_frame(send_info, send_frame_callback,
 					send_frame_destroy))
 		send_info->frame->pending_callback_count++;
 	else
 		send_frame_destroy(send_info);
+}
 
-	l_timeout_remove(timeout);
+static void delivery_wheel_run_slot(unsigned int slot, uint64_t now)
+{
+	struct l_queue *queue = delivery_wheel[slot];
+	struct l_queue *later = NULL;
+	struct send_frame_info *send_info;
+
+	if (!queue)
+		return;
+
+	delivery_wheel[slot] = NULL;
+
+	while ((send_info = l_queue_pop_head(queue))) {
+		if (send_info->due > now) {
+			if (!later)
+				later = l_queue_new();
+
+			l_queue_push_tail(later, send_info);
+			continue;
+		}
+
+		delivery_pending--;
+		medium_deliver(send_info);
+	}
+
+	l_queue_destroy(queue, NULL);
+	delivery_wheel[slot] = later;
+}
+
+static void delivery_timeout_callback(struct l_timeout *timeout,
+					void *user_data)
+{
+	uint64_t now = medium_now_ms();
+	uint64_t steps = now - delivery_wheel_tick;
+	uint64_t i;
+
+	if (steps > DELIVERY_WHEEL_SLOTS)
+		steps = DELIVERY_WHEEL_SLOTS;
+
+	for (i = 1; i <= steps; i++)
+		delivery_wheel_run_slot((delivery_wheel_tick + i) %
+					DELIVERY_WHEEL_SLOTS, now);
+
+	delivery_wheel_tick = now;
+
+	if (delivery_pending)
+		l_timeout_modify_ms(timeout, 1);
+}
+
+static bool medium_schedule(struct send_frame_info *send_info,
+				unsigned int delay_ms)
+{
+	uint64_t now = medium_now_ms();
+	unsigned int slot;
+
+	if (!delay_ms)
+		delay_ms = 1;
+
+	if (!delivery_timeout) {
+		delivery_timeout = l_timeout_create_ms(1,
+						delivery_timeout_callback,
+						NULL, NULL);
+		if (!delivery_timeout)
+			return false;
+	} else if (!delivery_pending)
+		l_timeout_modify_ms(delivery_timeout, 1);
+
+	if (!delivery_pending)
+		delivery_wheel_tick = now;
+
+	send_info->due = now + delay_ms;
+	slot = send_info->due % DELIVERY_WHEEL_SLOTS;
+
+	if (!delivery_wheel[slot])
+		delivery_wheel[slot] = l_queue_new();
+
+	l_queue_push_tail(delivery_wheel[slot], send_info);
+	delivery_pending++;
+
+	return true;
+}
+
+static void delivery_wheel_cleanup(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < DELIVERY_WHEEL_SLOTS; i++) {
+		l_queue_destroy(delivery_wheel[i], send_frame_destroy);
+		delivery_wheel[i] = NULL;
+	}
+
+	delivery_pending = 0;
+	l_timeout_remove(delivery_timeout);
+	delivery_timeout = NULL;
+}
+
+static void process_frame_to_radio(struct hwsim_frame *frame,
+					struct radio_info_rec *radio,
+					int32_t signal, bool drop,
+					bool airtime)
+{
+	struct send_frame_info *send_info;
+	unsigned int delay = 1;
+
+	process_rules(frame->src_radio, radio, frame, &signal, &drop,
+			&airtime);
+
+	if (drop)
+		return;
+
+	if (airtime)
+		delay = medium_airtime_delay(frame);
+
+	send_info = l_new(struct send_frame_info, 1);
+	send_info->radio = radio;
+	send_info->frame = hwsim_frame_ref(frame);
+	send_info->signal = signal;
+
+	if (!medium_schedule(send_info, delay)) {
+		l_error("Error delaying frame, frame will be dropped");
+		send_frame_destroy(send_info);
+	}
 }
 
 /*
@@ -1371,64 +1856,70 @@ static void frame_delay_callback(struct l_timeout *timeout, void *user_data)
 static void process_frame(struct hwsim_frame *frame)
 {
 	const struct l_queue_entry *entry;
+	int32_t signal_mcast = frame->signal;
 	bool drop_mcast = false;
+	bool airtime_mcast = false;
 
-	if (util_is_broadcast_address(frame->dst_ether_addr))
-		process_rules(frame->src_radio, NULL, frame, &drop_mcast);
-
-	for (entry = l_queue_get_entries(radio_info); entry;
-			entry = entry->next) {
-		struct radio_info_rec *radio = entry->data;
-		struct send_frame_info *send_info;
-		bool drop = drop_mcast;
+	/*
+	 * The kernel hwsim medium passes multicast frames to all
+	 * radios that are on the same frequency as this frame but
+	 * the netlink medium API only lets userspace pass frames to
+	 * radios by known hardware address.  It does check that the
+	 * receiving radio is on the same frequency though so we can
+	 * send to all known addresses.
+	 *
+	 * If the frame's Receiver Address (RA) is a multicast
+	 * address, then send the frame to every radio that is
+	 * registered.  If it's a unicast address then optimize
+	 * by only forwarding the frame to the radios that have
+	 * at least one interface with this specific address.
+	 */
+	if (util_is_broadcast_address(frame->dst_ether_addr)) {
+		process_rules(frame->src_radio, NULL, frame, &signal_mcast,
+				&drop_mcast, &airtime_mcast);
 
-		if (radio == frame->src_radio)
-			continue;
+		for (entry = l_queue_get_entries(radio_info); entry;
+				entry = entry->next) {
+			struct radio_info_rec *radio = entry->data;
 
-		/*
-		 * The kernel hwsim medium passes multicast frames to all
-		 * radios that are on the same frequency as this frame but
-		 * the netlink medium API only lets userspace pass frames to
-		 * radios by known hardware address.  It does check that the
-		 * receiving radio is on the same frequency though so we can
-		 * send to all known addresses.
-		 *
-		 * If the frame's Receiver Address (RA) is a multicast
-		 * address, then send the frame to every radio that is
-		 * registered.  If it's a unicast address then optimize
-		 * by only forwarding the frame to the radios that have
-		 * at least one interface with this specific address.
-		 */
-		if (!util_is_broadcast_address(frame->dst_ether_addr)) {
-			struct interface_match_data match_data = {
-				radio,
-				frame->dst_ether_addr,
-			};
-			struct interface_info_rec *interface =
-				l_queue_find(interface_info,
-						interface_info_match_dst,
-						&match_data);
-
-			if (!interface)
+			if (radio == frame->src_radio)
 				continue;
+
+			process_frame_to_radio(frame, radio, signal_mcast,
+						drop_mcast, airtime_mcast);
 		}
 
-		process_rules(frame->src_radio, radio, frame, &drop);
+		goto done;
+	}
 
-		if (drop)
+	for (entry = addr_index_lookup(interface_addr_index,
+						frame->dst_ether_addr);
+			entry; entry = entry->next) {
+		struct interface_info_rec *interface = entry->data;
+		struct radio_info_rec *radio = interface->radio_rec;
+		const struct l_queue_entry *prev;
+
+		if (radio == frame->src_radio)
 			continue;
 
-		send_info = l_new(struct send_frame_info, 1);
-		send_info->radio = radio;
-		send_info->frame = hwsim_frame_ref(frame);
+		/* Send once per radio even with multiple matching interfaces */
+		for (prev = addr_index_lookup(interface_addr_index,
+						frame->dst_ether_addr);
+				prev != entry; prev = prev->next) {
+			const struct interface_info_rec *other = prev->data;
 
-		if (!l_timeout_create_ms(1, frame_delay_callback,
-						send_info, NULL)) {
-			l_error("Error delaying frame, frame will be dropped");
-			send_frame_destroy(send_info);
+			if (other->radio_rec == radio)
+				break;
 		}
+
+		if (prev != entry)
+			continue;
+
+		process_frame_to_radio(frame, radio, frame->signal, false,
+					false);
 	}
 
+done:
 	hwsim_frame_unref(frame);
 }
 
@@ -1522,8 +2013,7 @@ static void unicast_handler(struct l_genl_msg *msg, void *user_data)
 	frame->msg = l_genl_msg_ref(msg);
 	frame->refcount = 1;
 
-	frame->src_radio = l_queue_find(radio_info, radio_info_match_addr1,
-					transmitter);
+	frame->src_radio = radio_lookup_addr(transmitter);
 	if (!frame->src_radio) {
 		l_error("Unknown transmitter address %s, probably need to "
 			"update radio dump code for this kernel",
@@ -1762,9 +2252,90 @@ static bool radio_property_get_regdom(struct l_dbus *dbus,
 	return true;
 }
 
+static bool radio_property_get_position(struct l_dbus *dbus,
+					struct l_dbus_message *message,
+					struct l_dbus_message_builder *builder,
+					void *user_data)
+{
+	const struct radio_info_rec *rec = user_data;
+	double x, y;
+
+	if (!rec->positioned)
+		return false;
+
+	medium_radio_position(rec, medium_now_ms(), &x, &y);
+
+	l_dbus_message_builder_enter_struct(builder, "dd");
+	l_dbus_message_builder_append_basic(builder, 'd', &x);
+	l_dbus_message_builder_append_basic(builder, 'd', &y);
+	l_dbus_message_builder_leave_struct(builder);
+
+	return true;
+}
+
+static struct l_dbus_message *radio_set_position(struct l_dbus *dbus,
+					struct l_dbus_message *message,
+					void *user_data)
+{
+	struct radio_info_rec *radio = user_data;
+	double x, y;
+	uint32_t duration;
+
+	if (!l_dbus_message_get_arguments(message, "ddu", &x, &y, &duration))
+		return dbus_error_invalid_args(message);
+
+	if (!isfinite(x) || !isfinite(y))
+		return dbus_error_invalid_args(message);
+
+	medium_radio_set_path(radio, &x, &y, &duration, 1);
+
+	return l_dbus_message_new_method_return(message);
+}
+
+#define MEDIUM_MAX_WAYPOINTS	256
+
+static struct l_dbus_message *radio_set_path(struct l_dbus *dbus,
+					struct l_dbus_message *message,
+					void *user_data)
+{
+	struct radio_info_rec *radio = user_data;
+	struct l_dbus_message_iter waypoints;
+	double xs[MEDIUM_MAX_WAYPOINTS];
+	double ys[MEDIUM_MAX_WAYPOINTS];
+	uint32_t durations[MEDIUM_MAX_WAYPOINTS];
+	unsigned int num = 0;
+	double x, y;
+	uint32_t duration;
+
+	if (!l_dbus_message_get_arguments(message, "a(ddu)", &waypoints))
+		return dbus_error_invalid_args(message);
+
+	while (l_dbus_message_iter_next_entry(&waypoints, &x, &y, &duration)) {
+		if (num == MEDIUM_MAX_WAYPOINTS || !isfinite(x) || !isfinite(y))
+			return dbus_error_invalid_args(message);
+
+		xs[num] = x;
+		ys[num] = y;
+		durations[num] = duration;
+		num++;
+	}
+
+	if (!num)
+		return dbus_error_invalid_args(message);
+
+	medium_radio_set_path(radio, xs, ys, durations, num);
+
+	return l_dbus_message_new_method_return(message);
+}
+
 static void setup_radio_interface(struct l_dbus_interface *interface)
 {
 	l_dbus_interface_method(interface, "Destroy", 0, radio_destroy, "", "");
+	l_dbus_interface_method(interface, "SetPosition", 0,
+				radio_set_position, "", "ddu",
+				"x", "y", "duration");
+	l_dbus_interface_method(interface, "SetPath", 0,
+				radio_set_path, "", "a(ddu)", "waypoints");
 
 	l_dbus_interface_property(interface, "Name", 0, "s",
 					radio_property_get_name, NULL);
@@ -1778,6 +2349,8 @@ static void setup_radio_interface(struct l_dbus_interface *interface)
 					radio_property_get_p2p, NULL);
 	l_dbus_interface_property(interface, "RegulatoryDomainIndex", 0, "u",
 					radio_property_get_regdom, NULL);
+	l_dbus_interface_property(interface, "Position", 0, "(dd)",
+					radio_property_get_position, NULL);
 }
 
 static struct l_dbus_message *interface_send_frame(struct l_dbus *dbus,
@@ -1880,6 +2453,7 @@ static struct l_dbus_message *rule_add(struct l_dbus *dbus,
 		rules = l_queue_new();
 
 	l_queue_insert(rules, rule, rule_compare_priority, NULL);
+	rules_compiled = false;
 	path = rule_get_path(rule);
 
 	if (!l_dbus_object_add_interface(dbus, path,
@@ -1914,6 +2488,7 @@ static struct l_dbus_message *rule_remove(struct l_dbus *dbus,
 	path = rule_get_path(rule);
 	l_queue_remove(rules, rule);
 	l_free(rule);
+	rules_compiled = false;
 	l_dbus_unregister_object(dbus, path);
 
 	return l_dbus_message_new_method_return(message);
@@ -1958,6 +2533,8 @@ static struct l_dbus_message *rule_property_set_source(struct l_dbus *dbus,
 		rule->source_any = false;
 	}
 
+	rules_compiled = false;
+
 	return l_dbus_message_new_method_return(message);
 }
 
@@ -2006,6 +2583,8 @@ static struct l_dbus_message *rule_property_set_destination(
 		rule->destination_any = false;
 	}
 
+	rules_compiled = false;
+
 	return l_dbus_message_new_method_return(message);
 }
 
@@ -2160,6 +2739,68 @@ static struct l_dbus_message *rule_property_set_drop(
 	return l_dbus_message_new_method_return(message);
 }
 
+static bool rule_property_get_path_loss(struct l_dbus *dbus,
+					struct l_dbus_message *message,
+					struct l_dbus_message_builder *builder,
+					void *user_data)
+{
+	struct hwsim_rule *rule = user_data;
+	bool bval = rule->path_loss;
+
+	l_dbus_message_builder_append_basic(builder, 'b', &bval);
+
+	return true;
+}
+
+static struct l_dbus_message *rule_property_set_path_loss(
+					struct l_dbus *dbus,
+					struct l_dbus_message *message,
+					struct l_dbus_message_iter *new_value,
+					l_dbus_property_complete_cb_t complete,
+					void *user_data)
+{
+	struct hwsim_rule *rule = user_data;
+	bool bval;
+
+	if (!l_dbus_message_iter_get_variant(new_value, "b", &bval))
+		return dbus_error_invalid_args(message);
+
+	rule->path_loss = bval;
+
+	return l_dbus_message_new_method_return(message);
+}
+
+static bool rule_property_get_airtime(struct l_dbus *dbus,
+					struct l_dbus_message *message,
+					struct l_dbus_message_builder *builder,
+					void *user_data)
+{
+	struct hwsim_rule *rule = user_data;
+	bool bval = rule->airtime;
+
+	l_dbus_message_builder_append_basic(builder, 'b', &bval);
+
+	return true;
+}
+
+static struct l_dbus_message *rule_property_set_airtime(
+					struct l_dbus *dbus,
+					struct l_dbus_message *message,
+					struct l_dbus_message_iter *new_value,
+					l_dbus_property_complete_cb_t complete,
+					void *user_data)
+{
+	struct hwsim_rule *rule = user_data;
+	bool bval;
+
+	if (!l_dbus_message_iter_get_variant(new_value, "b", &bval))
+		return dbus_error_invalid_args(message);
+
+	rule->airtime = bval;
+
+	return l_dbus_message_new_method_return(message);
+}
+
 static void setup_rule_interface(struct l_dbus_interface *interface)
 {
 	l_dbus_interface_method(interface, "Remove", 0, rule_remove, "", "");
@@ -2192,6 +2833,14 @@ static void setup_rule_interface(struct l_dbus_interface *interface)
 					L_DBUS_PROPERTY_FLAG_AUTO_EMIT, "b",
 					rule_property_get_drop,
 					rule_property_set_drop);
+	l_dbus_interface_property(interface, "PathLoss",
+					L_DBUS_PROPERTY_FLAG_AUTO_EMIT, "b",
+					rule_property_get_path_loss,
+					rule_property_set_path_loss);
+	l_dbus_interface_property(interface, "Airtime",
+					L_DBUS_PROPERTY_FLAG_AUTO_EMIT, "b",
+					rule_property_get_airtime,
+					rule_property_set_airtime);
 }
 
 static void request_name_callback(struct l_dbus *dbus, bool success,
@@ -2688,6 +3337,7 @@ int main(int argc, char *argv[])
 
 	exit_status = l_main_run_with_signal(signal_handler, NULL);
 
+	delivery_wheel_cleanup();
 	l_genl_family_free(hwsim);
 	l_genl_family_free(nl80211);
 	l_genl_unref(genl);
@@ -2698,6 +3348,7 @@ int main(int argc, char *argv[])
 	l_dbus_destroy(dbus);
 	hwsim_radio_cache_cleanup();
 	l_queue_destroy(rules, l_free);
+	l_hashmap_destroy(medium_channels, l_free);
 
 	l_netlink_destroy(rtnl);
 
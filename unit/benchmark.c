@@ -0,0 +1,543 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2021  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <ell/ell.h>
+
+#include "src/util.h"
+#include "src/storage.h"
+#include "src/ie.h"
+#include "src/crypto.h"
+#include "src/eapol.h"
+#include "src/handshake.h"
+#include "src/mpdu.h"
+#include "src/sae.h"
+#include "src/auth-proto.h"
+
+static uint64_t alloc_count;
+
+#ifdef HAVE___LIBC_MALLOC
+/*
+ * Count heap allocations by wrapping the glibc allocator.  ell allocates
+ * through malloc/realloc so this covers l_new, l_malloc and friends too.
+ * Other C libraries have no such entry points, there allocations are not
+ * counted.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static const bool alloc_counting = true;
+
+void *malloc(size_t size)
+{
+	alloc_count++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	alloc_count++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	alloc_count++;
+	return __libc_realloc(ptr, size);
+}
+#else
+static const bool alloc_counting = false;
+#endif
+
+struct benchmark {
+	const char *name;
+	void *(*setup)(void);
+	bool (*run)(void *data);
+	void (*teardown)(void *data);
+};
+
+struct benchmark_result {
+	double ns_per_op;
+	double allocs_per_op;	/* Negative if allocations aren't counted */
+};
+
+static const uint8_t rsne_data[] = {
+	0x30, 0x14, 0x01, 0x00, 0x00, 0x0f, 0xac, 0x04, 0x01, 0x00,
+	0x00, 0x0f, 0xac, 0x04, 0x01, 0x00, 0x00, 0x0f, 0xac, 0x02,
+	0x0c, 0x00,
+};
+
+static bool bench_ie_parse_rsne(void *data)
+{
+	struct ie_rsn_info info;
+
+	return !ie_parse_rsne_from_data(rsne_data, sizeof(rsne_data), &info);
+}
+
+static const uint8_t supp_rates_ie[] = {
+	0x01, 0x08, 0x82, 0x84, 0x8b, 0x96, 0x0c, 0x12, 0x18, 0x24,
+};
+
+static const uint8_t ext_supp_rates_ie[] = {
+	0x32, 0x04, 0x30, 0x48, 0x60, 0x6c,
+};
+
+static const uint8_t ht_ie[] = {
+	0x2d, 0x1a, 0x6f, 0x08, 0x17, 0xff, 0xff, 0xff, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+static const uint8_t vht_ie[] = {
+	0xbf, 0x0c, 0x32, 0x58, 0x82, 0x0f, 0xea, 0xff, 0x00, 0x00,
+	0xea, 0xff, 0x00, 0x00,
+};
+
+/*
+ * scan_bss_compute_rank() is internal to scan.c, which can't be linked
+ * on its own.  Estimating the data rate is most of its cost.
+ */
+static bool bench_ie_parse_data_rates(void *data)
+{
+	uint64_t rate;
+
+	return !ie_parse_data_rates(supp_rates_ie, ext_supp_rates_ie,
+					ht_ie, vht_ie, -50, &rate);
+}
+
+static bool bench_ie_parse_data_rates_legacy(void *data)
+{
+	uint64_t rate;
+
+	return !ie_parse_data_rates(supp_rates_ie, ext_supp_rates_ie,
+					NULL, NULL, -50, &rate);
+}
+
+/* WPA2 frame, 3 of 4, with the MIC recomputed in eapol_setup */
+static const uint8_t eapol_key_data_3_of_4[] = {
+	0x02, 0x03, 0x00, 0x97, 0x02, 0x13, 0xca, 0x00, 0x10, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x01, 0xc2, 0xbb, 0x57, 0xab, 0x58, 0x8f, 0x92,
+	0xeb, 0xbd, 0x44, 0xe8, 0x11, 0x09, 0x4f, 0x60, 0x1c, 0x08, 0x79, 0x86,
+	0x03, 0x0c, 0x3a, 0xc7, 0x49, 0xcc, 0x61, 0xd6, 0x3e, 0x33, 0x83, 0x2e,
+	0x50, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xf5, 0x35, 0xd9,
+	0x18, 0x09, 0x73, 0x1a, 0x1d, 0x29, 0x08, 0x94, 0x70, 0x5e, 0x91, 0x9c,
+	0x8e, 0x00, 0x38, 0x19, 0x18, 0xdf, 0x1e, 0xf0, 0xe7, 0x69, 0x66, 0x52,
+	0xe2, 0x57, 0x93, 0x80, 0x34, 0xe1, 0x70, 0x38, 0xb9, 0x8b, 0x4c, 0x45,
+	0xa9, 0x23, 0xb7, 0xb6, 0xfa, 0x8c, 0x33, 0xe3, 0x7b, 0xdc, 0xd4, 0x7f,
+	0xea, 0xb1, 0x1c, 0x22, 0x6a, 0x2c, 0x5e, 0x38, 0xd5, 0xad, 0x79, 0x94,
+	0x05, 0xd6, 0x10, 0xa6, 0x95, 0x51, 0xd6, 0x0b, 0xe6, 0x0a, 0x5b,
+};
+
+static const uint8_t eapol_kck[16] = {
+	0x9a, 0x75, 0xef, 0x0b, 0xde, 0x7c, 0x20, 0x9c,
+	0xca, 0xe1, 0x3f, 0x54, 0xb1, 0xb3, 0x3e, 0xa3,
+};
+
+static void *eapol_setup(void)
+{
+	uint8_t *frame = l_memdup(eapol_key_data_3_of_4,
+					sizeof(eapol_key_data_3_of_4));
+	struct eapol_key *ek = (struct eapol_key *) frame;
+	uint8_t mic[16];
+
+	memset(EAPOL_KEY_MIC(ek), 0, sizeof(mic));
+
+	if (!eapol_calculate_mic(IE_RSN_AKM_SUITE_PSK, eapol_kck, ek,
+					mic, sizeof(mic))) {
+		l_free(frame);
+		return NULL;
+	}
+
+	memcpy(EAPOL_KEY_MIC(ek), mic, sizeof(mic));
+
+	return frame;
+}
+
+static bool bench_eapol_verify_3_of_4(void *data)
+{
+	const struct eapol_key *ek;
+
+	ek = eapol_key_validate(data, sizeof(eapol_key_data_3_of_4), 16);
+	if (!ek)
+		return false;
+
+	return eapol_verify_ptk_3_of_4(ek, false, 16) &&
+		eapol_verify_mic(IE_RSN_AKM_SUITE_PSK, eapol_kck, ek, 16);
+}
+
+static const uint8_t aa[] = { 0x24, 0xa2, 0xe1, 0xec, 0x17, 0x04 };
+static const uint8_t spa[] = { 0xa0, 0xa8, 0xcd, 0x1c, 0x7e, 0xc9 };
+static const uint8_t pmk[32] = { 0xbf, 0x9a, 0xa3, 0x15, 0x53, 0x00 };
+static const uint8_t anonce[32] = { 0xc2, 0xbb, 0x57, 0xab, 0x58, 0x8f };
+static const uint8_t snonce[32] = { 0x32, 0x89, 0xe9, 0x15, 0x65, 0x09 };
+
+static bool bench_prf_sha1_ptk(void *data)
+{
+	uint8_t ptk[48];
+
+	return crypto_derive_pairwise_ptk(pmk, sizeof(pmk), aa, spa,
+						anonce, snonce, ptk,
+						sizeof(ptk), L_CHECKSUM_SHA1);
+}
+
+static bool bench_kdf_sha256_ptk(void *data)
+{
+	uint8_t ptk[48];
+
+	return crypto_derive_pairwise_ptk(pmk, sizeof(pmk), aa, spa,
+						anonce, snonce, ptk,
+						sizeof(ptk), L_CHECKSUM_SHA256);
+}
+
+static bool bench_psk_from_passphrase(void *data)
+{
+	static const char *ssid = "TestWPA";
+	uint8_t psk[32];
+
+	return !crypto_psk_from_passphrase("EasilyGuessedPassword",
+						(const uint8_t *) ssid,
+						strlen(ssid), psk);
+}
+
+struct bench_handshake_state {
+	struct handshake_state super;
+};
+
+static void bench_handshake_state_free(struct handshake_state *hs)
+{
+	struct bench_handshake_state *bhs =
+			l_container_of(hs, struct bench_handshake_state, super);
+
+	l_free(bhs);
+}
+
+static void bench_sae_tx_auth(const uint8_t *frame, size_t len,
+				void *user_data)
+{
+	bool *committed = user_data;
+
+	*committed = true;
+}
+
+static void bench_sae_tx_assoc(void *user_data)
+{
+}
+
+static bool bench_sae_commit(void *data)
+{
+	struct bench_handshake_state *bhs;
+	struct auth_proto *ap;
+	bool committed = false;
+
+	bhs = l_new(struct bench_handshake_state, 1);
+	bhs->super.ifindex = 1;
+	bhs->super.free = bench_handshake_state_free;
+
+	handshake_state_set_supplicant_address(&bhs->super, spa);
+	handshake_state_set_authenticator_address(&bhs->super, aa);
+	handshake_state_set_passphrase(&bhs->super, "secret123");
+
+	ap = sae_sm_new(&bhs->super, bench_sae_tx_auth, bench_sae_tx_assoc,
+				&committed);
+	auth_proto_start(ap);
+
+	auth_proto_free(ap);
+	handshake_state_free(&bhs->super);
+
+	return committed;
+}
+
+static const struct benchmark benchmarks[] = {
+	{ "ie_parse_rsne", NULL, bench_ie_parse_rsne, NULL },
+	{ "ie_parse_data_rates/vht", NULL, bench_ie_parse_data_rates, NULL },
+	{ "ie_parse_data_rates/legacy", NULL,
+				bench_ie_parse_data_rates_legacy, NULL },
+	{ "eapol_verify/ptk_3_of_4", eapol_setup, bench_eapol_verify_3_of_4,
+				l_free },
+	{ "prf_sha1/ptk", NULL, bench_prf_sha1_ptk, NULL },
+	{ "kdf_sha256/ptk", NULL, bench_kdf_sha256_ptk, NULL },
+	{ "pbkdf2/psk", NULL, bench_psk_from_passphrase, NULL },
+	{ "sae/commit", NULL, bench_sae_commit, NULL },
+	{ }
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Run the benchmark in batches, doubling the batch size until a batch
+ * takes at least min_ns so that timer overhead stays negligible.  Returns
+ * false if the setup or any run failed, in which case the numbers measure
+ * an error path and are meaningless.
+ */
+static bool benchmark_run(const struct benchmark *bench, uint64_t min_ns,
+				struct benchmark_result *result)
+{
+	void *data = NULL;
+	uint64_t iterations = 1;
+	uint64_t start, elapsed, allocs;
+	uint64_t i;
+	bool ok;
+
+	if (bench->setup) {
+		data = bench->setup();
+		if (!data)
+			return false;
+	}
+
+	/* Warm up caches and any lazily initialized state */
+	ok = bench->run(data);
+
+	while (ok) {
+		allocs = alloc_count;
+		start = now_ns();
+
+		for (i = 0; i < iterations; i++)
+			ok &= bench->run(data);
+
+		elapsed = now_ns() - start;
+		allocs = alloc_count - allocs;
+
+		if (elapsed >= min_ns || iterations >= (1ULL << 40))
+			break;
+
+		iterations *= 2;
+	}
+
+	if (bench->teardown)
+		bench->teardown(data);
+
+	if (!ok)
+		return false;
+
+	result->ns_per_op = (double) elapsed / iterations;
+	result->allocs_per_op = alloc_counting ?
+				(double) allocs / iterations : -1;
+
+	return true;
+}
+
+static bool baseline_lookup(struct l_settings *baseline, const char *name,
+				struct benchmark_result *out)
+{
+	const char *value;
+
+	if (!baseline || !l_settings_has_group(baseline, name))
+		return false;
+
+	value = l_settings_get_value(baseline, name, "NsPerOp");
+	if (!value)
+		return false;
+
+	out->ns_per_op = strtod(value, NULL);
+
+	value = l_settings_get_value(baseline, name, "AllocsPerOp");
+	out->allocs_per_op = value ? strtod(value, NULL) : -1;
+
+	return true;
+}
+
+static void baseline_store(struct l_settings *baseline, const char *name,
+				const struct benchmark_result *result)
+{
+	char buf[32];
+
+	snprintf(buf, sizeof(buf), "%.1f", result->ns_per_op);
+	l_settings_set_value(baseline, name, "NsPerOp", buf);
+
+	if (result->allocs_per_op < 0)
+		return;
+
+	snprintf(buf, sizeof(buf), "%.2f", result->allocs_per_op);
+	l_settings_set_value(baseline, name, "AllocsPerOp", buf);
+}
+
+static void usage(void)
+{
+	printf("benchmark - iwd hot path microbenchmarks\n"
+		"Usage:\n");
+	printf("\tbenchmark [options] [filter]\n");
+	printf("Options:\n"
+		"\t-b, --baseline <file>   Compare with a saved baseline\n"
+		"\t-s, --save <file>       Save the results as a baseline\n"
+		"\t-t, --time <ms>         Minimum run time per benchmark\n"
+		"\t-r, --regression <pct>  Fail if slower than the baseline "
+						"by this much\n"
+		"\t-h, --help              Show help options\n");
+}
+
+static const struct option main_options[] = {
+	{ "baseline",	required_argument, NULL, 'b' },
+	{ "save",	required_argument, NULL, 's' },
+	{ "time",	required_argument, NULL, 't' },
+	{ "regression",	required_argument, NULL, 'r' },
+	{ "help",	no_argument,	   NULL, 'h' },
+	{ }
+};
+
+int main(int argc, char *argv[])
+{
+	const char *baseline_path = NULL;
+	const char *save_path = NULL;
+	const char *filter = NULL;
+	unsigned long min_ms = 500;
+	double max_regression = 25.0;
+	struct l_settings *baseline = NULL;
+	struct l_settings *save = NULL;
+	const struct benchmark *bench;
+	int exit_status = EXIT_SUCCESS;
+
+	for (;;) {
+		int opt;
+
+		opt = getopt_long(argc, argv, "b:s:t:r:h", main_options, NULL);
+		if (opt < 0)
+			break;
+
+		switch (opt) {
+		case 'b':
+			baseline_path = optarg;
+			break;
+		case 's':
+			save_path = optarg;
+			break;
+		case 't':
+			min_ms = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			max_regression = strtod(optarg, NULL);
+			break;
+		case 'h':
+			usage();
+			return EXIT_SUCCESS;
+		default:
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (argc - optind > 1) {
+		fprintf(stderr, "Invalid command line parameters\n");
+		return EXIT_FAILURE;
+	}
+
+	if (argc - optind == 1)
+		filter = argv[optind];
+
+	if (baseline_path) {
+		baseline = l_settings_new();
+
+		if (!l_settings_load_from_file(baseline, baseline_path)) {
+			fprintf(stderr, "Unable to load baseline %s\n",
+					baseline_path);
+			l_settings_free(baseline);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (save_path)
+		save = l_settings_new();
+
+	printf("%-28s %14s %12s %10s\n", "Benchmark", "ns/op", "allocs/op",
+			"vs base");
+
+	for (bench = benchmarks; bench->name; bench++) {
+		struct benchmark_result result;
+		struct benchmark_result base;
+		char delta[16] = "";
+		char allocs[16];
+
+		if (filter && !strstr(bench->name, filter))
+			continue;
+
+		if (!benchmark_run(bench, min_ms * 1000000, &result)) {
+			printf("%-28s %14s\n", bench->name, "FAILED");
+			exit_status = EXIT_FAILURE;
+			continue;
+		}
+
+		if (baseline_lookup(baseline, bench->name, &base) &&
+				base.ns_per_op > 0) {
+			double change = (result.ns_per_op - base.ns_per_op) *
+						100.0 / base.ns_per_op;
+
+			snprintf(delta, sizeof(delta), "%+.1f%%", change);
+
+			if (change > max_regression)
+				exit_status = EXIT_FAILURE;
+
+			/* Allocation counts are deterministic, timing isn't */
+			if (result.allocs_per_op >= 0 &&
+					base.allocs_per_op >= 0 &&
+					result.allocs_per_op >
+						base.allocs_per_op + 0.5)
+				exit_status = EXIT_FAILURE;
+		}
+
+		if (result.allocs_per_op >= 0)
+			snprintf(allocs, sizeof(allocs), "%.2f",
+						result.allocs_per_op);
+		else
+			strcpy(allocs, "-");
+
+		printf("%-28s %14.1f %12s %10s\n", bench->name,
+				result.ns_per_op, allocs, delta);
+
+		if (save)
+			baseline_store(save, bench->name, &result);
+	}
+
+	if (save) {
+		size_t len;
+		char *data = l_settings_to_data(save, &len);
+
+		if (!data || write_file(data, len, false, "%s",
+						save_path) < 0) {
+			fprintf(stderr, "Unable to save baseline to %s\n",
+					save_path);
+			exit_status = EXIT_FAILURE;
+		}
+
+		l_free(data);
+		l_settings_free(save);
+	}
+
+	l_settings_free(baseline);
+
+	return exit_status;
+}
@@ -692,6 +692,85 @@ static void ie_test_encapsulate_wsc(const void *data)
 	l_free(packed);
 }
 
+static const uint8_t rnr_ie[] = {
+	IE_TYPE_REDUCED_NEIGHBOR_REPORT, 40,
+	/* 6 GHz co-located AP: BSSID, Short-SSID, BSS Parameters and PSD */
+	0x00, 0x0d, 131, 37,
+	0xff, 0x02, 0x00, 0x00, 0x00, 0x01, 0x00, 0x78, 0x56, 0x34, 0x12,
+	0x42, 0x00,
+	/* Two 5 GHz neighbors with a BSSID only */
+	0x10, 0x07, 115, 36,
+	0x10, 0x02, 0x00, 0x00, 0x00, 0x02, 0x00,
+	0x20, 0x02, 0x00, 0x00, 0x00, 0x03, 0x00,
+	/* Reserved TBTT Information Field Type, must be skipped */
+	0x01, 0x01, 81, 6,
+	0x00,
+};
+
+static const uint8_t rnr_ie_truncated[] = {
+	IE_TYPE_REDUCED_NEIGHBOR_REPORT, 10,
+	0x10, 0x07, 115, 36,
+	0x10, 0x02, 0x00, 0x00, 0x00, 0x02,
+};
+
+static void ie_test_rnr_collect(const struct ie_rnr_info *info,
+				void *user_data)
+{
+	struct l_queue *infos = user_data;
+
+	l_queue_push_tail(infos, l_memdup(info, sizeof(*info)));
+}
+
+static void ie_test_rnr(const void *data)
+{
+	static const uint8_t addr1[6] = { 0x02, 0x00, 0x00, 0x00, 0x01, 0x00 };
+	static const uint8_t addr3[6] = { 0x02, 0x00, 0x00, 0x00, 0x03, 0x00 };
+	struct l_queue *infos = l_queue_new();
+	struct ie_tlv_iter iter;
+	const struct ie_rnr_info *info;
+
+	ie_tlv_iter_init(&iter, rnr_ie, sizeof(rnr_ie));
+	assert(ie_tlv_iter_next(&iter));
+	assert(ie_parse_reduced_neighbor_report(&iter, ie_test_rnr_collect,
+						infos) == 0);
+	assert(l_queue_length(infos) == 3);
+
+	info = l_queue_pop_head(infos);
+	assert(info->oper_class == 131);
+	assert(info->channel_num == 37);
+	assert(info->addr_present);
+	assert(!memcmp(info->addr, addr1, 6));
+	assert(info->short_ssid_present);
+	assert(info->short_ssid == 0x12345678);
+	assert(info->bss_params_present);
+	assert(info->bss_params & IE_RNR_BSS_PARAM_SAME_SSID);
+	assert(info->bss_params & IE_RNR_BSS_PARAM_COLOCATED_AP);
+	l_free((void *) info);
+
+	l_free(l_queue_pop_head(infos));
+
+	info = l_queue_pop_head(infos);
+	assert(info->oper_class == 115);
+	assert(info->channel_num == 36);
+	assert(info->addr_present);
+	assert(!memcmp(info->addr, addr3, 6));
+	assert(!info->short_ssid_present);
+	assert(!info->bss_params_present);
+	l_free((void *) info);
+
+	l_queue_destroy(infos, l_free);
+
+	infos = l_queue_new();
+
+	ie_tlv_iter_init(&iter, rnr_ie_truncated, sizeof(rnr_ie_truncated));
+	assert(ie_tlv_iter_next(&iter));
+	assert(ie_parse_reduced_neighbor_report(&iter, ie_test_rnr_collect,
+						infos) == -EINVAL);
+	assert(l_queue_isempty(infos));
+
+	l_queue_destroy(infos, l_free);
+}
+
 int main(int argc, char *argv[])
 {
 	l_test_init(&argc, &argv);
@@ -753,5 +832,8 @@ int main(int argc, char *argv[])
 				ie_test_encapsulate_wsc,
 				&ie_tlv_concat_test_data_1);
 
+	l_test_add("/ie/Reduced Neighbor Report/Test Case 1",
+				ie_test_rnr, NULL);
+
 	return l_test_run();
 }
@@ -0,0 +1,515 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2014-2019  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <ell/ell.h>
+
+#include "linux/nl80211.h"
+#include "src/iwd.h"
+#include "src/module.h"
+#include "src/wiphy.h"
+#include "src/netdev.h"
+#include "src/common.h"
+#include "src/knownnetworks.h"
+#include "src/scan.h"
+
+#define TEST_WIPHY_ID	1
+#define TEST_WDEV_ID	(((uint64_t) TEST_WIPHY_ID << 32) | 1)
+#define TEST_IFINDEX	3
+
+struct wiphy {
+	uint32_t id;
+	struct scan_freq_set *supported_freqs;
+};
+
+struct netdev {
+	uint32_t ifindex;
+	uint64_t wdev_id;
+};
+
+static struct wiphy test_wiphy = { .id = TEST_WIPHY_ID };
+static struct netdev test_netdev = {
+	.ifindex = TEST_IFINDEX,
+	.wdev_id = TEST_WDEV_ID,
+};
+static struct l_settings *test_config;
+static unsigned int netdev_lookups;
+static known_networks_watch_func_t known_networks_watch;
+
+const struct l_settings *iwd_get_config(void)
+{
+	return test_config;
+}
+
+struct l_genl *iwd_get_genl(void)
+{
+	return NULL;
+}
+
+bool known_networks_foreach(known_networks_foreach_func_t function,
+				void *user_data)
+{
+	return true;
+}
+
+bool known_networks_has_hidden(void)
+{
+	return false;
+}
+
+uint32_t known_networks_watch_add(known_networks_watch_func_t func,
+					void *user_data,
+					known_networks_destroy_func_t destroy)
+{
+	known_networks_watch = func;
+
+	return 1;
+}
+
+void known_networks_watch_remove(uint32_t id)
+{
+	known_networks_watch = NULL;
+}
+
+struct netdev *netdev_find(int ifindex)
+{
+	netdev_lookups++;
+
+	return ifindex == (int) test_netdev.ifindex ? &test_netdev : NULL;
+}
+
+uint64_t netdev_get_wdev_id(struct netdev *netdev)
+{
+	return netdev->wdev_id;
+}
+
+struct wiphy *wiphy_find(int wiphy_id)
+{
+	return wiphy_id == TEST_WIPHY_ID ? &test_wiphy : NULL;
+}
+
+bool wiphy_can_randomize_mac_addr(struct wiphy *wiphy)
+{
+	return false;
+}
+
+const uint8_t *wiphy_get_extended_capabilities(struct wiphy *wiphy,
+							uint32_t iftype)
+{
+	return NULL;
+}
+
+uint8_t wiphy_get_max_match_sets(struct wiphy *wiphy)
+{
+	return 8;
+}
+
+uint8_t wiphy_get_max_num_sched_scan_ssids(struct wiphy *wiphy)
+{
+	return 4;
+}
+
+uint32_t wiphy_get_max_num_sched_scan_plans(struct wiphy *wiphy)
+{
+	return 2;
+}
+
+uint32_t wiphy_get_max_sched_scan_plan_interval(struct wiphy *wiphy)
+{
+	return 3600;
+}
+
+uint8_t wiphy_get_max_num_ssids_per_scan(struct wiphy *wiphy)
+{
+	return 4;
+}
+
+uint16_t wiphy_get_max_scan_ie_len(struct wiphy *wiphy)
+{
+	return 0;
+}
+
+uint32_t wiphy_get_supported_bands(struct wiphy *wiphy)
+{
+	return SCAN_BAND_2_4_GHZ | SCAN_BAND_5_GHZ;
+}
+
+const struct scan_freq_set *wiphy_get_supported_freqs(
+						const struct wiphy *wiphy)
+{
+	return wiphy->supported_freqs;
+}
+
+const uint8_t *wiphy_get_supported_rates(struct wiphy *wiphy, unsigned int band,
+						unsigned int *out_num)
+{
+	return NULL;
+}
+
+bool wiphy_has_ext_feature(struct wiphy *wiphy, uint32_t feature)
+{
+	return false;
+}
+
+bool wiphy_has_feature(struct wiphy *wiphy, uint32_t feature)
+{
+	return false;
+}
+
+bool wiphy_supports_sched_scan(struct wiphy *wiphy)
+{
+	return true;
+}
+
+extern struct iwd_module_desc __start___iwd_module[];
+extern struct iwd_module_desc __stop___iwd_module[];
+
+static void scan_module_init(void)
+{
+	struct iwd_module_desc *desc;
+
+	test_config = l_settings_new();
+
+	for (desc = __start___iwd_module; desc < __stop___iwd_module; desc++)
+		assert(desc->init() == 0);
+}
+
+static void scan_module_exit(void)
+{
+	struct iwd_module_desc *desc;
+
+	for (desc = __start___iwd_module; desc < __stop___iwd_module; desc++)
+		desc->exit();
+
+	l_settings_free(test_config);
+	test_config = NULL;
+}
+
+static struct l_genl_msg *build_sched_scan_event(uint8_t cmd,
+							uint32_t ifindex)
+{
+	struct l_genl_msg *msg = l_genl_msg_new(cmd);
+	uint32_t wiphy_id = TEST_WIPHY_ID;
+	uint64_t cookie = 0;
+
+	/* As sent by nl80211_send_sched_scan(), there is no WDEV */
+	l_genl_msg_append_attr(msg, NL80211_ATTR_WIPHY, 4, &wiphy_id);
+	l_genl_msg_append_attr(msg, NL80211_ATTR_IFINDEX, 4, &ifindex);
+	l_genl_msg_append_attr(msg, NL80211_ATTR_COOKIE, 8, &cookie);
+
+	return msg;
+}
+
+static void send_sched_scan_event(uint8_t cmd, uint32_t ifindex)
+{
+	struct l_genl_msg *msg = build_sched_scan_event(cmd, ifindex);
+
+	__scan_notify(msg);
+	l_genl_msg_unref(msg);
+}
+
+static void test_sched_scan_event(const void *data)
+{
+	struct l_genl_msg *msg;
+	struct scan_periodic_stats stats;
+	uint64_t wdev_id = TEST_WDEV_ID;
+	uint32_t wiphy_id = TEST_WIPHY_ID;
+
+	scan_module_init();
+	assert(scan_wdev_add(TEST_WDEV_ID));
+	assert(known_networks_watch);
+
+	scan_periodic_start(TEST_WDEV_ID, NULL, NULL, NULL);
+
+	/* No scheduled scan running yet, the results are not ours */
+	send_sched_scan_event(NL80211_CMD_SCHED_SCAN_RESULTS, TEST_IFINDEX);
+	assert(scan_periodic_get_stats(TEST_WDEV_ID, &stats));
+	assert(stats.sched_scan_results == 0);
+
+	__scan_sched_started(TEST_WDEV_ID, 0);
+
+	/* Resolved through the netdev and followed by a GET_SCAN */
+	netdev_lookups = 0;
+	send_sched_scan_event(NL80211_CMD_SCHED_SCAN_RESULTS, TEST_IFINDEX);
+	assert(netdev_lookups == 1);
+	assert(scan_periodic_get_stats(TEST_WDEV_ID, &stats));
+	assert(stats.sched_scan_results == 1);
+
+	send_sched_scan_event(NL80211_CMD_SCHED_SCAN_RESULTS, TEST_IFINDEX + 1);
+	send_sched_scan_event(NL80211_CMD_SCHED_SCAN_STOPPED, TEST_IFINDEX + 1);
+	assert(netdev_lookups == 3);
+	assert(scan_periodic_get_stats(TEST_WDEV_ID, &stats));
+	assert(stats.sched_scan_results == 1);
+	assert(stats.sched_scan_fallbacks == 0);
+
+	/* Stopped by the driver, the periodic timer takes over again */
+	send_sched_scan_event(NL80211_CMD_SCHED_SCAN_STOPPED, TEST_IFINDEX);
+	send_sched_scan_event(NL80211_CMD_SCHED_SCAN_RESULTS, TEST_IFINDEX);
+	assert(scan_periodic_get_stats(TEST_WDEV_ID, &stats));
+	assert(stats.sched_scan_fallbacks == 1);
+	assert(stats.sched_scan_results == 1);
+
+	/* A STOPPED after our own STOP_SCHED_SCAN is not a fallback */
+	assert(scan_periodic_stop(TEST_WDEV_ID));
+	scan_periodic_start(TEST_WDEV_ID, NULL, NULL, NULL);
+	__scan_sched_started(TEST_WDEV_ID, 0);
+
+	known_networks_watch(KNOWN_NETWORKS_EVENT_ADDED, NULL, NULL);
+	send_sched_scan_event(NL80211_CMD_SCHED_SCAN_STOPPED, TEST_IFINDEX);
+	send_sched_scan_event(NL80211_CMD_SCHED_SCAN_RESULTS, TEST_IFINDEX);
+	assert(scan_periodic_get_stats(TEST_WDEV_ID, &stats));
+	assert(stats.sched_scan_fallbacks == 1);
+	assert(stats.sched_scan_results == 1);
+
+	/* Failing to start falls back to the periodic timer too */
+	__scan_sched_started(TEST_WDEV_ID, -EOPNOTSUPP);
+	assert(scan_periodic_get_stats(TEST_WDEV_ID, &stats));
+	assert(stats.sched_scan_fallbacks == 2);
+
+	/* The other scan events are still matched on WDEV */
+	netdev_lookups = 0;
+	msg = l_genl_msg_new(NL80211_CMD_SCAN_ABORTED);
+	l_genl_msg_append_attr(msg, NL80211_ATTR_WIPHY, 4, &wiphy_id);
+	l_genl_msg_append_attr(msg, NL80211_ATTR_WDEV, 8, &wdev_id);
+	__scan_notify(msg);
+	l_genl_msg_unref(msg);
+
+	assert(netdev_lookups == 0);
+
+	assert(scan_periodic_stop(TEST_WDEV_ID));
+	assert(scan_wdev_remove(TEST_WDEV_ID));
+	scan_module_exit();
+}
+
+static const struct {
+	uint32_t freq;
+	uint8_t channel;
+	enum scan_band band;
+} freq_channel_tests[] = {
+	{ 2412, 1, SCAN_BAND_2_4_GHZ },
+	{ 2472, 13, SCAN_BAND_2_4_GHZ },
+	{ 2484, 14, SCAN_BAND_2_4_GHZ },
+	{ 4915, 183, SCAN_BAND_5_GHZ },
+	{ 5180, 36, SCAN_BAND_5_GHZ },
+	{ 5825, 165, SCAN_BAND_5_GHZ },
+	{ 5935, 2, SCAN_BAND_6_GHZ },
+	{ 5955, 1, SCAN_BAND_6_GHZ },
+	{ 5975, 5, SCAN_BAND_6_GHZ },
+	{ 7115, 233, SCAN_BAND_6_GHZ },
+};
+
+static void test_freq_to_channel(const void *data)
+{
+	static const uint32_t invalid[] = {
+		2411, 2413, 2477, 2482, 2485, 5182, 5940, 5950, 5957, 5960,
+		7120,
+	};
+	enum scan_band band;
+	unsigned int i;
+
+	for (i = 0; i < L_ARRAY_SIZE(freq_channel_tests); i++) {
+		assert(scan_freq_to_channel(freq_channel_tests[i].freq,
+						&band) ==
+				freq_channel_tests[i].channel);
+		assert(band == freq_channel_tests[i].band);
+	}
+
+	for (i = 0; i < L_ARRAY_SIZE(invalid); i++)
+		assert(scan_freq_to_channel(invalid[i], NULL) == 0);
+}
+
+static void test_channel_to_freq(const void *data)
+{
+	unsigned int i;
+
+	for (i = 0; i < L_ARRAY_SIZE(freq_channel_tests); i++)
+		assert(scan_channel_to_freq(freq_channel_tests[i].channel,
+						freq_channel_tests[i].band) ==
+				freq_channel_tests[i].freq);
+
+	assert(scan_channel_to_freq(0, SCAN_BAND_2_4_GHZ) == 0);
+	assert(scan_channel_to_freq(15, SCAN_BAND_2_4_GHZ) == 0);
+	assert(scan_channel_to_freq(0, SCAN_BAND_6_GHZ) == 0);
+	assert(scan_channel_to_freq(234, SCAN_BAND_6_GHZ) == 0);
+}
+
+static void test_freq_set_add(const void *data)
+{
+	struct scan_freq_set *set = scan_freq_set_new();
+	unsigned int i;
+
+	assert(scan_freq_set_isempty(set));
+	assert(scan_freq_set_get_bands(set) == 0);
+
+	for (i = 0; i < L_ARRAY_SIZE(freq_channel_tests); i++)
+		assert(!scan_freq_set_contains(set,
+						freq_channel_tests[i].freq));
+
+	for (i = 0; i < L_ARRAY_SIZE(freq_channel_tests); i++)
+		assert(scan_freq_set_add(set, freq_channel_tests[i].freq));
+
+	for (i = 0; i < L_ARRAY_SIZE(freq_channel_tests); i++)
+		assert(scan_freq_set_contains(set,
+						freq_channel_tests[i].freq));
+
+	/* Channel 2 must not alias 6 GHz channel 1, nor the other way */
+	assert(!scan_freq_set_contains(set, 5965));
+	assert(!scan_freq_set_contains(set, 2417));
+
+	assert(!scan_freq_set_add(set, 5940));
+	assert(!scan_freq_set_contains(set, 5940));
+
+	assert(!scan_freq_set_isempty(set));
+	assert(scan_freq_set_get_bands(set) == (SCAN_BAND_2_4_GHZ |
+						SCAN_BAND_5_GHZ |
+						SCAN_BAND_6_GHZ));
+
+	scan_freq_set_free(set);
+}
+
+static void test_freq_set_5960(const void *data)
+{
+	struct scan_freq_set *set = scan_freq_set_new();
+	enum scan_band band;
+
+	/* Above the 5 GHz band, and not where 6 GHz channel 2 is either */
+	assert(scan_freq_to_channel(5960, &band) == 0);
+	assert(!scan_freq_set_add(set, 5960));
+	assert(!scan_freq_set_contains(set, 5935));
+	assert(scan_freq_set_isempty(set));
+
+	assert(scan_freq_set_add(set, 5935));
+	assert(!scan_freq_set_contains(set, 5960));
+	assert(scan_freq_set_get_bands(set) == SCAN_BAND_6_GHZ);
+
+	scan_freq_set_free(set);
+}
+
+static void test_freq_set_merge_constrain(const void *data)
+{
+	struct scan_freq_set *a = scan_freq_set_new();
+	struct scan_freq_set *b = scan_freq_set_new();
+
+	scan_freq_set_add(a, 2412);
+	scan_freq_set_add(a, 5180);
+	scan_freq_set_add(a, 5935);
+
+	scan_freq_set_add(b, 2437);
+	scan_freq_set_add(b, 5180);
+	scan_freq_set_add(b, 7115);
+
+	scan_freq_set_merge(a, b);
+
+	assert(scan_freq_set_contains(a, 2412));
+	assert(scan_freq_set_contains(a, 2437));
+	assert(scan_freq_set_contains(a, 5180));
+	assert(scan_freq_set_contains(a, 5935));
+	assert(scan_freq_set_contains(a, 7115));
+
+	/* The source is left untouched */
+	assert(!scan_freq_set_contains(b, 2412));
+	assert(!scan_freq_set_contains(b, 5935));
+
+	scan_freq_set_free(b);
+	b = scan_freq_set_new();
+
+	scan_freq_set_add(b, 2437);
+	scan_freq_set_add(b, 5935);
+	scan_freq_set_add(b, 5955);
+
+	scan_freq_set_constrain(a, b);
+
+	assert(!scan_freq_set_contains(a, 2412));
+	assert(scan_freq_set_contains(a, 2437));
+	assert(!scan_freq_set_contains(a, 5180));
+	assert(scan_freq_set_contains(a, 5935));
+	assert(!scan_freq_set_contains(a, 5955));
+	assert(!scan_freq_set_contains(a, 7115));
+	assert(scan_freq_set_get_bands(a) == (SCAN_BAND_2_4_GHZ |
+						SCAN_BAND_6_GHZ));
+
+	scan_freq_set_free(b);
+	b = scan_freq_set_new();
+
+	scan_freq_set_constrain(a, b);
+	assert(scan_freq_set_isempty(a));
+
+	scan_freq_set_free(a);
+	scan_freq_set_free(b);
+}
+
+struct freq_list {
+	uint32_t freqs[16];
+	unsigned int n_freqs;
+};
+
+static void freq_list_append(uint32_t freq, void *user_data)
+{
+	struct freq_list *list = user_data;
+
+	assert(list->n_freqs < L_ARRAY_SIZE(list->freqs));
+	list->freqs[list->n_freqs++] = freq;
+}
+
+static void test_freq_set_foreach(const void *data)
+{
+	/* 5 GHz, then 6 GHz, then 2.4 GHz, each in channel order */
+	static const uint32_t expected[] = {
+		5180, 5825, 4915, 5955, 5935, 7115, 2412, 2484,
+	};
+	struct scan_freq_set *set = scan_freq_set_new();
+	struct freq_list list = {};
+	unsigned int i;
+
+	for (i = L_ARRAY_SIZE(expected); i; i--)
+		scan_freq_set_add(set, expected[i - 1]);
+
+	scan_freq_set_foreach(set, freq_list_append, &list);
+
+	assert(list.n_freqs == L_ARRAY_SIZE(expected));
+	assert(!memcmp(list.freqs, expected, sizeof(expected)));
+
+	scan_freq_set_free(set);
+}
+
+int main(int argc, char *argv[])
+{
+	l_test_init(&argc, &argv);
+
+	l_test_add("/scan/freq_to_channel", test_freq_to_channel, NULL);
+	l_test_add("/scan/channel_to_freq", test_channel_to_freq, NULL);
+	l_test_add("/scan/freq_set/add", test_freq_set_add, NULL);
+	l_test_add("/scan/freq_set/5960", test_freq_set_5960, NULL);
+	l_test_add("/scan/freq_set/merge_constrain",
+					test_freq_set_merge_constrain, NULL);
+	l_test_add("/scan/freq_set/foreach", test_freq_set_foreach, NULL);
+	l_test_add("/scan/sched_scan/event", test_sched_scan_event, NULL);
+
+	return l_test_run();
+}